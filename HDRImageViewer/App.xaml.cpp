@@ -11,6 +11,7 @@
 
 #include "pch.h"
 #include "App.xaml.h"
+#include "ImageProbe.h"
 
 using namespace HDRImageViewer;
 
@@ -21,6 +22,7 @@ using namespace Windows::ApplicationModel::Activation;
 using namespace Windows::Foundation;
 using namespace Windows::Foundation::Collections;
 using namespace Windows::Storage;
+using namespace Windows::Storage::Search;
 using namespace Windows::UI::Xaml;
 using namespace Windows::UI::Xaml::Controls;
 using namespace Windows::UI::Xaml::Controls::Primitives;
@@ -80,6 +82,7 @@ void App::OnActivated(Windows::ApplicationModel::Activation::IActivatedEventArgs
         bool useFullscreen = false;
         bool hideUI = false;
         String^ fullFilename;
+        String^ probePath;
 
         std::wstring arg;
         std::getline(argsStream, arg, L' '); // First argument is the executable name.
@@ -119,13 +122,24 @@ void App::OnActivated(Windows::ApplicationModel::Activation::IActivatedEventArgs
                 continue;
             }
 
+            const WCHAR probeArg[] = L"-probe:";
+            const UINT countProbeArg = ARRAYSIZE(probeArg) - 1;
+            if (!wcsncmp(probeArg, arg.c_str(), countProbeArg) && wcslen(arg.c_str()) > countProbeArg)
+            {
+                probePath = ref new String(arg.substr(countProbeArg).c_str());
+                continue;
+            }
+
             std::wstringstream help;
             help
                 << L"-f\n\tStart in fullscreen mode\n\n"
                 << L"-h\n\tStart with UI hidden\n\n"
                 << L"-input:[filename]\n\tLoad [filename]\n"
                 << L"\tNOTE: Filename must be relative to the current working directory,\n"
-                << L"\tas HDRImageViewer only has access to this directory.";
+                << L"\tas HDRImageViewer only has access to this directory.\n\n"
+                << L"-probe:[path]\n\tWrite the metadata of [path], or of every image under it if it is\n"
+                << L"\ta folder, to probe.jsonl in the current working directory and exit.\n"
+                << L"\tNo pixels are decoded. [path] is relative as for -input.";
 
             Platform::String^ helpString = ref new String(help.str().c_str());
 
@@ -151,7 +165,11 @@ void App::OnActivated(Windows::ApplicationModel::Activation::IActivatedEventArgs
         Window::Current->Content = m_directXPage;
         Window::Current->Activate();
 
-        if (fullFilename != nullptr)
+        if (probePath != nullptr)
+        {
+            RunProbe(cmd->Operation->CurrentDirectoryPath, probePath);
+        }
+        else if (fullFilename != nullptr)
         {
             create_task(StorageFile::GetFileFromPathAsync(fullFilename)).then([=](StorageFile^ file) {
 
@@ -179,6 +197,71 @@ void App::OnActivated(Windows::ApplicationModel::Activation::IActivatedEventArgs
     }
 }
 
+// Probes relativePath (a file, or a folder searched recursively) within folderPath, writes one
+// JSON line per image to probe.jsonl in folderPath and exits.
+void App::RunProbe(String^ folderPath, String^ relativePath)
+{
+    create_task(StorageFolder::GetFolderFromPathAsync(folderPath)).then([=](StorageFolder^ outputFolder) {
+
+        return create_task(outputFolder->GetItemAsync(relativePath)).then([=](IStorageItem^ item) {
+
+            if (item->IsOfType(StorageItemTypes::Folder))
+            {
+                auto options = ref new QueryOptions();
+                options->FolderDepth = FolderDepth::Deep;
+                ImageProbe::AppendSupportedFileTypes(options->FileTypeFilter);
+
+                auto query = static_cast<StorageFolder^>(item)->CreateFileQueryWithOptions(options);
+                return create_task(query->GetFilesAsync());
+            }
+
+            auto single = ref new Platform::Collections::Vector<StorageFile^>();
+            single->Append(static_cast<StorageFile^>(item));
+            return task_from_result(single->GetView());
+
+        }).then([=](IVectorView<StorageFile^>^ files) {
+
+            std::vector<StorageFile^> inputs;
+            for (unsigned int i = 0; i < files->Size; i++)
+            {
+                inputs.push_back(files->GetAt(i));
+            }
+
+            return ImageProbe::ProbeFilesAsync(inputs, ImageLoaderOptions());
+
+        }).then([=](std::vector<std::wstring> lines) {
+
+            std::wstringstream output;
+            for (const auto& line : lines)
+            {
+                output << line << L"\n";
+            }
+
+            auto text = ref new String(output.str().c_str());
+
+            return create_task(outputFolder->CreateFileAsync(L"probe.jsonl", CreationCollisionOption::ReplaceExisting)).then([=](StorageFile^ file) {
+                return FileIO::WriteTextAsync(file, text);
+            });
+        });
+
+    }).then([=](task<void> t) {
+
+        try
+        {
+            t.get();
+            Application::Current->Exit();
+        }
+        catch (Platform::Exception^ e)
+        {
+            auto probeCtrl = ref new Windows::UI::Xaml::Controls::ContentDialog();
+            probeCtrl->Title = L"Error";
+            probeCtrl->Content = e->Message;
+            probeCtrl->CloseButtonText = L"OK";
+            probeCtrl->ShowAsync();
+        }
+    }, task_continuation_context::use_current());
+}
+
 // Invoked when the app is launched via the file type association for which the app has registered.
 void App::OnFileActivated(Windows::ApplicationModel::Activation::FileActivatedEventArgs ^ e)
 {
@@ -199,6 +282,8 @@ void App::OnFileActivated(Windows::ApplicationModel::Activation::FileActivatedEv
         IStorageItem^ storageItem = e->Files->GetAt(0);
         StorageFile^ storageFile = (StorageFile^)storageItem;
 
+        // Lets Left/Right step through the other images in the folder the file was opened from.
+        m_directXPage->SetNeighboringFiles(e->NeighboringFilesQuery);
         m_directXPage->LoadImage(storageFile);
     }
     else
@@ -30,6 +30,7 @@ namespace HDRImageViewer
     private:
         void OnSuspending(Platform::Object^ sender, Windows::ApplicationModel::SuspendingEventArgs^ e);
         void OnResuming(Platform::Object ^sender, Platform::Object ^args);
+        void RunProbe(_In_ Platform::String^ folderPath, _In_ Platform::String^ relativePath);
         DirectXPage^ m_directXPage;
     };
 }
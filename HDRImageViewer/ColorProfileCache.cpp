@@ -0,0 +1,256 @@
+#include "pch.h"
+#include "ColorProfileCache.h"
+
+#include <atomic>
+#include <list>
+
+using namespace HDRImageViewer;
+
+using namespace Microsoft::WRL;
+
+static const size_t sc_MaxProfiles = 32; // Profiles kept by ColorProfileCache.
+
+namespace
+{
+    std::mutex s_cacheLock;
+    std::list<std::shared_ptr<ColorProfile>> s_profiles; // Most recently used first.
+
+    uint64_t s_hits = 0;
+    uint64_t s_misses = 0;
+    uint64_t s_evictions = 0;
+
+    // Atomic, as they are updated under each profile's own lock rather than the cache's.
+    std::atomic<uint64_t> s_colorContextHits(0);
+    std::atomic<uint64_t> s_colorContextMisses(0);
+
+    /// <summary>
+    /// FNV-1a.
+    /// </summary>
+    uint64_t HashBytes(_In_reads_bytes_(size) const uint8_t* data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ data[i]) * 1099511628211ull;
+        }
+
+        return hash;
+    }
+}
+
+ColorProfile::ColorProfile(std::vector<uint8_t>&& bytes, uint64_t hash) :
+    m_bytes(std::move(bytes)),
+    m_hash(hash)
+{
+}
+
+HRESULT ColorProfile::GetColorContext(ID2D1DeviceContext* context, ID2D1ColorContext** colorContext)
+{
+    *colorContext = nullptr;
+
+    ComPtr<ID2D1Device> device;
+    context->GetDevice(&device);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (m_colorContext == nullptr || m_device != device)
+    {
+        s_colorContextMisses++;
+
+        m_colorContext.Reset();
+        m_device.Reset();
+
+        HRESULT hr = context->CreateColorContext(
+            D2D1_COLOR_SPACE_CUSTOM,
+            m_bytes.data(),
+            static_cast<UINT32>(m_bytes.size()),
+            &m_colorContext);
+        if (FAILED(hr))
+            return hr;
+
+        m_device = device;
+    }
+    else
+    {
+        s_colorContextHits++;
+    }
+
+    return m_colorContext.CopyTo(colorContext);
+}
+
+HRESULT ColorProfile::GetIccTransform(std::shared_ptr<const IccTransform>& transform)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (!m_isTransformParsed)
+    {
+        auto parsed = std::make_shared<IccTransform>();
+        m_transformResult = IccTransform::CreateFromProfile(m_bytes.data(), m_bytes.size(), *parsed);
+        if (SUCCEEDED(m_transformResult))
+        {
+            m_transform = parsed;
+        }
+
+        m_isTransformParsed = true;
+    }
+
+    transform = m_transform;
+    return m_transformResult;
+}
+
+HRESULT ColorProfile::GetColorManagementLut(ID2D1DeviceContext2* context, UINT size, std::shared_ptr<const Lut3D>& lut)
+{
+    lut.reset();
+
+    // Held while baking, so each size is only baked once.
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    for (const auto& baked : m_luts)
+    {
+        if (baked->GetSize() == size)
+        {
+            lut = baked;
+            return S_OK;
+        }
+    }
+
+    ComPtr<ID2D1ColorContext> source;
+    HRESULT hr = context->CreateColorContext(
+        D2D1_COLOR_SPACE_CUSTOM,
+        m_bytes.data(),
+        static_cast<UINT32>(m_bytes.size()),
+        &source);
+    if (FAILED(hr))
+        return hr;
+
+    auto baked = std::make_shared<Lut3D>();
+    hr = Lut3D::BakeColorManagement(context, source.Get(), size, *baked);
+    if (FAILED(hr))
+        return hr;
+
+    m_luts.push_back(baked);
+    lut = baked;
+    return S_OK;
+}
+
+void ColorProfile::ReleaseDeviceResources()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    m_colorContext.Reset();
+    m_device.Reset();
+}
+
+HRESULT ColorProfileCache::GetProfile(const uint8_t* bytes, size_t size, std::shared_ptr<ColorProfile>& profile)
+{
+    profile.reset();
+
+    if (size == 0)
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+    uint64_t hash = HashBytes(bytes, size);
+
+    std::lock_guard<std::mutex> lock(s_cacheLock);
+
+    for (auto i = s_profiles.begin(); i != s_profiles.end(); i++)
+    {
+        const auto& existing = (*i)->GetBytes();
+        if ((*i)->GetHash() == hash && existing.size() == size && memcmp(existing.data(), bytes, size) == 0)
+        {
+            s_hits++;
+            s_profiles.splice(s_profiles.begin(), s_profiles, i);
+            profile = *i;
+            return S_OK;
+        }
+    }
+
+    try
+    {
+        profile = std::make_shared<ColorProfile>(std::vector<uint8_t>(bytes, bytes + size), hash);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    s_misses++;
+    s_profiles.push_front(profile);
+
+    if (s_profiles.size() > sc_MaxProfiles)
+    {
+        s_profiles.pop_back();
+        s_evictions++;
+    }
+
+    return S_OK;
+}
+
+HRESULT ColorProfileCache::GetProfile(IWICColorContext* colorContext, std::shared_ptr<ColorProfile>& profile)
+{
+    profile.reset();
+
+    WICColorContextType type = WICColorContextUninitialized;
+    HRESULT hr = colorContext->GetType(&type);
+    if (FAILED(hr))
+        return hr;
+
+    if (type != WICColorContextProfile)
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+    UINT size = 0;
+    hr = colorContext->GetProfileBytes(0, nullptr, &size);
+    if (FAILED(hr))
+        return hr;
+
+    std::vector<uint8_t> bytes(size);
+    hr = colorContext->GetProfileBytes(size, bytes.data(), &size);
+    if (FAILED(hr))
+        return hr;
+
+    return GetProfile(bytes.data(), bytes.size(), profile);
+}
+
+HRESULT ColorProfileCache::GetProfile(ID2D1ColorContext* colorContext, std::shared_ptr<ColorProfile>& profile)
+{
+    profile.reset();
+
+    UINT32 size = colorContext->GetProfileSize();
+    if (size == 0)
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+    std::vector<uint8_t> bytes(size);
+    HRESULT hr = colorContext->GetProfile(bytes.data(), size);
+    if (FAILED(hr))
+        return hr;
+
+    return GetProfile(bytes.data(), bytes.size(), profile);
+}
+
+ColorProfileCacheStats ColorProfileCache::GetStats()
+{
+    std::lock_guard<std::mutex> lock(s_cacheLock);
+
+    return { s_hits, s_misses, s_evictions, s_colorContextHits, s_colorContextMisses, s_profiles.size() };
+}
+
+void ColorProfileCache::ReleaseDeviceResources()
+{
+    std::lock_guard<std::mutex> lock(s_cacheLock);
+
+    for (auto& profile : s_profiles)
+    {
+        profile->ReleaseDeviceResources();
+    }
+}
+
+void ColorProfileCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(s_cacheLock);
+
+    s_profiles.clear();
+    s_hits = 0;
+    s_misses = 0;
+    s_evictions = 0;
+    s_colorContextHits = 0;
+    s_colorContextMisses = 0;
+}
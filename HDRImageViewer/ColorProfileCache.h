@@ -0,0 +1,125 @@
+//*********************************************************
+//
+// ColorProfileCache
+//
+// A process wide cache of the ICC profiles embedded in images,
+// keyed by a hash of their contents. The images in a folder
+// usually share one or two profiles, so each profile's
+// Direct2D color context and CPU transforms (IccTransform, and
+// baked color management LUTs) are prepared once and shared by
+// every loader: the viewer, prefetched neighbours and exports.
+//
+// The least recently used profiles are evicted beyond a fixed
+// count. Profiles are shared_ptr owned, so evicted ones stay
+// valid for the loaders still using them. Both classes are
+// thread safe.
+//
+//*********************************************************
+
+#pragma once
+
+#include "IccTransform.h"
+#include "Lut3D.h"
+
+#include <mutex>
+
+namespace HDRImageViewer
+{
+    /// <summary>
+    /// Counters for judging how well profiles are shared.
+    /// </summary>
+    struct ColorProfileCacheStats
+    {
+        uint64_t    hits;               // Lookups which found the profile.
+        uint64_t    misses;             // Lookups which added the profile.
+        uint64_t    evictions;
+        uint64_t    colorContextHits;   // Direct2D color contexts reused.
+        uint64_t    colorContextMisses; // Direct2D color contexts created.
+        size_t      entryCount;
+    };
+
+    /// <summary>
+    /// One ICC profile and the resources prepared from it, each created on first use.
+    /// </summary>
+    class ColorProfile
+    {
+    public:
+        ColorProfile(std::vector<uint8_t>&& bytes, uint64_t hash);
+
+        uint64_t GetHash() const { return m_hash; }
+        const std::vector<uint8_t>& GetBytes() const { return m_bytes; }
+
+        /// <summary>
+        /// Returns a Direct2D color context for the profile. It is created once per Direct2D device.
+        /// </summary>
+        HRESULT GetColorContext(_In_ ID2D1DeviceContext* context, _COM_Outptr_ ID2D1ColorContext** colorContext);
+
+        /// <summary>
+        /// Returns the profile parsed as an IccTransform; see IccTransform::CreateFromProfile for errors,
+        /// which are also remembered.
+        /// </summary>
+        HRESULT GetIccTransform(_Out_ std::shared_ptr<const IccTransform>& transform);
+
+        /// <summary>
+        /// Returns the Direct2D color management transform to scRGB baked at size points per axis;
+        /// see Lut3D::BakeColorManagement.
+        /// </summary>
+        HRESULT GetColorManagementLut(
+            _In_ ID2D1DeviceContext2* context,
+            UINT size,
+            _Out_ std::shared_ptr<const Lut3D>& lut);
+
+        /// <summary>
+        /// Releases the Direct2D color context, after the device is lost.
+        /// </summary>
+        void ReleaseDeviceResources();
+
+    private:
+        std::mutex                                      m_lock;
+        const std::vector<uint8_t>                      m_bytes;
+        const uint64_t                                  m_hash;
+
+        Microsoft::WRL::ComPtr<ID2D1Device>             m_device;           // Owner of m_colorContext.
+        Microsoft::WRL::ComPtr<ID2D1ColorContext>       m_colorContext;
+        bool                                            m_isTransformParsed = false;
+        HRESULT                                         m_transformResult = S_OK;
+        std::shared_ptr<const IccTransform>             m_transform;
+        std::vector<std::shared_ptr<const Lut3D>>       m_luts;             // One per size.
+    };
+
+    class ColorProfileCache
+    {
+    public:
+        /// <summary>
+        /// Returns the shared profile with these contents, adding it on a miss.
+        /// </summary>
+        static HRESULT GetProfile(
+            _In_reads_bytes_(size) const uint8_t* bytes,
+            size_t size,
+            _Out_ std::shared_ptr<ColorProfile>& profile);
+
+        /// <summary>
+        /// As GetProfile, for the profile of a WICColorContextProfile color context. EXIF color space
+        /// contexts return WINCODEC_ERR_UNSUPPORTEDOPERATION.
+        /// </summary>
+        static HRESULT GetProfile(_In_ IWICColorContext* colorContext, _Out_ std::shared_ptr<ColorProfile>& profile);
+
+        /// <summary>
+        /// As GetProfile, for the profile of a Direct2D color context. Contexts without an ICC profile,
+        /// such as those created from DXGI color spaces, return WINCODEC_ERR_UNSUPPORTEDOPERATION.
+        /// </summary>
+        static HRESULT GetProfile(_In_ ID2D1ColorContext* colorContext, _Out_ std::shared_ptr<ColorProfile>& profile);
+
+        static ColorProfileCacheStats GetStats();
+
+        /// <summary>
+        /// Releases every profile's Direct2D resources; call when the device is lost.
+        /// </summary>
+        static void ReleaseDeviceResources();
+
+        /// <summary>
+        /// Removes all profiles and resets the counters.
+        /// </summary>
+        static void Clear();
+    };
+}
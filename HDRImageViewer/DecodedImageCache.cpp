@@ -0,0 +1,470 @@
+#include "pch.h"
+#include "DecodedImageCache.h"
+
+using namespace HDRImageViewer;
+
+using namespace Microsoft::WRL;
+using namespace Microsoft::WRL::Wrappers;
+using namespace Windows::Graphics::Display;
+
+static const uint32_t sc_EntryMagic = 0x43444948;   // "HIDC"
+static const uint32_t sc_EntryVersion = 1;
+static const uint64_t sc_PixelAlignment = 4096;     // Page aligned pixel data in the mapped view.
+static const UINT     sc_StoreBandRows = 64;        // Rows copied out of the source per write.
+static const wchar_t  sc_EntryExtension[] = L".decoded";
+
+namespace
+{
+    struct EntryHeader
+    {
+        uint32_t            magic;
+        uint32_t            version;
+        uint32_t            keyLength;      // In characters; the key immediately follows the header.
+        uint32_t            width;
+        uint32_t            height;
+        uint32_t            stride;
+        uint32_t            pixelBits;      // Of format, not of the source image.
+        WICPixelFormatGUID  format;
+        uint64_t            pixelOffset;
+
+        // ImageInfo and ImageCLL.
+        uint32_t            bitsPerPixel;
+        uint32_t            bitsPerChannel;
+        uint32_t            isFloat;
+        uint32_t            imageKind;
+        uint32_t            forceBT2100ColorSpace;
+        uint32_t            isHeif;
+        float               maxNits;
+        float               medNits;
+    };
+
+    /// <summary>
+    /// Serves the pixels of a cache entry from a read only view of the file.
+    /// </summary>
+    class MappedBitmapSource : public RuntimeClass<RuntimeClassFlags<ClassicCom>, IWICBitmapSource>
+    {
+    public:
+        MappedBitmapSource() : m_view(nullptr), m_pixels(nullptr), m_header{} {}
+
+        ~MappedBitmapSource()
+        {
+            if (m_view)
+            {
+                UnmapViewOfFile(m_view);
+            }
+        }
+
+        // Takes ownership of view.
+        HRESULT RuntimeClassInitialize(_In_ void* view, const EntryHeader& header)
+        {
+            m_view = view;
+            m_header = header;
+            m_pixels = static_cast<const BYTE*>(view) + header.pixelOffset;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP GetSize(_Out_ UINT* width, _Out_ UINT* height) override
+        {
+            if (!width || !height) return E_INVALIDARG;
+
+            *width = m_header.width;
+            *height = m_header.height;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP GetPixelFormat(_Out_ WICPixelFormatGUID* format) override
+        {
+            if (!format) return E_INVALIDARG;
+
+            *format = m_header.format;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP GetResolution(_Out_ double* dpiX, _Out_ double* dpiY) override
+        {
+            if (!dpiX || !dpiY) return E_INVALIDARG;
+
+            *dpiX = *dpiY = 96.0;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP CopyPalette(_In_ IWICPalette*) override
+        {
+            return WINCODEC_ERR_PALETTEUNAVAILABLE;
+        }
+
+        IFACEMETHODIMP CopyPixels(_In_opt_ const WICRect* rect, UINT stride, UINT bufferSize, _Out_writes_(bufferSize) BYTE* buffer) override
+        {
+            if (!buffer) return E_INVALIDARG;
+
+            const UINT width = m_header.width;
+            const UINT height = m_header.height;
+
+            WICRect rc = { 0, 0, static_cast<INT>(width), static_cast<INT>(height) };
+            if (rect)
+            {
+                rc = *rect;
+            }
+
+            if (rc.X < 0 || rc.Y < 0 || rc.Width < 0 || rc.Height < 0 ||
+                static_cast<UINT>(rc.X) + static_cast<UINT>(rc.Width) > width ||
+                static_cast<UINT>(rc.Y) + static_cast<UINT>(rc.Height) > height)
+            {
+                return E_INVALIDARG;
+            }
+
+            if (rc.Width == 0 || rc.Height == 0) return S_OK;
+
+            const UINT bytesPerPixel = m_header.pixelBits / 8;
+            const UINT rowBytes = static_cast<UINT>(rc.Width) * bytesPerPixel;
+            const UINT rows = static_cast<UINT>(rc.Height);
+            if (stride < rowBytes) return E_INVALIDARG;
+
+            if (bufferSize / stride < rows - 1 ||
+                bufferSize - (rows - 1) * stride < rowBytes)
+            {
+                return WINCODEC_ERR_INSUFFICIENTBUFFER;
+            }
+
+            for (UINT y = 0; y < rows; y++)
+            {
+                auto src = m_pixels + static_cast<size_t>(rc.Y + y) * m_header.stride + static_cast<size_t>(rc.X) * bytesPerPixel;
+                memcpy(buffer + static_cast<size_t>(y) * stride, src, rowBytes);
+            }
+
+            return S_OK;
+        }
+
+    private:
+        void*           m_view;
+        const BYTE*     m_pixels;
+        EntryHeader     m_header;
+    };
+
+    HRESULT WriteAll(HANDLE file, _In_reads_bytes_(size) const void* data, size_t size)
+    {
+        auto bytes = static_cast<const BYTE*>(data);
+        while (size > 0)
+        {
+            DWORD chunk = static_cast<DWORD>((std::min)(size, static_cast<size_t>(1u << 30)));
+            DWORD written = 0;
+            if (!WriteFile(file, bytes, chunk, &written, nullptr))
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            bytes += written;
+            size -= written;
+        }
+
+        return S_OK;
+    }
+}
+
+DecodedImageCache::DecodedImageCache(
+    _In_ Platform::String^ folder,
+    _In_ IWICImagingFactory* wicFactory,
+    uint64_t byteLimit,
+    uint32_t entryLimit) :
+    m_folder(folder->Data()),
+    m_wicFactory(wicFactory),
+    m_byteLimit(byteLimit),
+    m_entryLimit(entryLimit)
+{
+}
+
+std::wstring DecodedImageCache::MakeKey(_In_ Platform::String^ path, uint64_t size, int64_t modifiedTime)
+{
+    std::wstringstream key;
+    key << path->Data() << L'|' << size << L'|' << modifiedTime;
+    return key.str();
+}
+
+HRESULT DecodedImageCache::Lookup(const std::wstring& key, _Out_ DecodedImage& image)
+{
+    image = {};
+
+    auto path = GetEntryPath(key);
+
+    // Entries may be deleted by Trim while they are mapped.
+    FileHandle file(CreateFile2(
+        path.c_str(),
+        GENERIC_READ | FILE_WRITE_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_DELETE,
+        OPEN_EXISTING,
+        nullptr));
+
+    if (!file.IsValid())
+    {
+        DWORD error = GetLastError();
+        return (error == ERROR_FILE_NOT_FOUND) ? S_FALSE : HRESULT_FROM_WIN32(error);
+    }
+
+    FILE_STANDARD_INFO fileInfo = {};
+    if (!GetFileInformationByHandleEx(file.Get(), FileStandardInfo, &fileInfo, sizeof(fileInfo)))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    const uint64_t fileSize = fileInfo.EndOfFile.QuadPart;
+    if (fileSize < sizeof(EntryHeader))
+    {
+        DeleteFileW(path.c_str());
+        return S_FALSE;
+    }
+
+    HandleT<HandleTraits::HANDLENullTraits> mapping(CreateFileMappingFromApp(file.Get(), nullptr, PAGE_READONLY, 0, nullptr));
+    if (!mapping.IsValid())
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    void* view = MapViewOfFileFromApp(mapping.Get(), FILE_MAP_READ, 0, 0);
+    if (!view)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    EntryHeader header = {};
+    memcpy(&header, view, sizeof(header));
+
+    const wchar_t* storedKey = reinterpret_cast<const wchar_t*>(static_cast<const BYTE*>(view) + sizeof(header));
+    uint64_t keyEnd = sizeof(header) + static_cast<uint64_t>(header.keyLength) * sizeof(wchar_t);
+
+    bool isValid =
+        header.magic == sc_EntryMagic &&
+        header.version == sc_EntryVersion &&
+        header.keyLength == key.size() &&
+        keyEnd <= header.pixelOffset &&
+        header.pixelBits % 8 == 0 &&
+        header.stride >= static_cast<uint64_t>(header.width) * (header.pixelBits / 8) &&
+        header.pixelOffset + static_cast<uint64_t>(header.stride) * header.height <= fileSize &&
+        key.compare(0, key.size(), storedKey, header.keyLength) == 0;
+
+    if (!isValid)
+    {
+        // A hash collision, or an entry written by a different version.
+        UnmapViewOfFile(view);
+        return S_FALSE;
+    }
+
+    ComPtr<MappedBitmapSource> source;
+    HRESULT hr = MakeAndInitialize<MappedBitmapSource>(&source, view, header);
+    if (FAILED(hr))
+    {
+        UnmapViewOfFile(view);
+        return hr;
+    }
+
+    // The modification time of an entry is its last use, for Trim.
+    FILE_BASIC_INFO basicInfo = {};
+    GetSystemTimeAsFileTime(reinterpret_cast<FILETIME*>(&basicInfo.LastWriteTime));
+    SetFileInformationByHandle(file.Get(), FileBasicInfo, &basicInfo, sizeof(basicInfo));
+
+    // Only single image files are stored, so the subresource fields stay zero.
+    image.info = {};
+    image.info.bitsPerPixel = header.bitsPerPixel;
+    image.info.bitsPerChannel = header.bitsPerChannel;
+    image.info.isFloat = header.isFloat != 0;
+    image.info.size = Windows::Foundation::Size(static_cast<float>(header.width), static_cast<float>(header.height));
+    image.info.numProfiles = 0;
+    image.info.imageKind = static_cast<AdvancedColorKind>(header.imageKind);
+    image.info.forceBT2100ColorSpace = header.forceBT2100ColorSpace != 0;
+    image.info.isHeif = header.isHeif != 0;
+    image.info.isValid = true;
+    image.cll = { header.maxNits, header.medNits };
+
+    return source.As(&image.pixels);
+}
+
+HRESULT DecodedImageCache::Store(const std::wstring& key, const ImageInfo& info, const ImageCLL& cll, _In_ IWICBitmapSource* pixels)
+{
+    if (info.numProfiles > 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    UINT width = 0, height = 0;
+    HRESULT hr = pixels->GetSize(&width, &height);
+    if (FAILED(hr))
+        return hr;
+
+    WICPixelFormatGUID format = {};
+    hr = pixels->GetPixelFormat(&format);
+    if (FAILED(hr))
+        return hr;
+
+    UINT pixelBits = 0;
+    hr = GetBitsPerPixel(format, &pixelBits);
+    if (FAILED(hr))
+        return hr;
+
+    if (pixelBits % 8 != 0)
+    {
+        return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+    }
+
+    EntryHeader header = {};
+    header.magic = sc_EntryMagic;
+    header.version = sc_EntryVersion;
+    header.keyLength = static_cast<uint32_t>(key.size());
+    header.width = width;
+    header.height = height;
+    header.stride = width * (pixelBits / 8);
+    header.pixelBits = pixelBits;
+    header.format = format;
+    header.pixelOffset = (sizeof(header) + key.size() * sizeof(wchar_t) + sc_PixelAlignment - 1) & ~(sc_PixelAlignment - 1);
+    header.bitsPerPixel = info.bitsPerPixel;
+    header.bitsPerChannel = info.bitsPerChannel;
+    header.isFloat = info.isFloat;
+    header.imageKind = static_cast<uint32_t>(info.imageKind);
+    header.forceBT2100ColorSpace = info.forceBT2100ColorSpace;
+    header.isHeif = info.isHeif;
+    header.maxNits = cll.maxNits;
+    header.medNits = cll.medNits;
+
+    std::vector<BYTE> buffer;
+    try
+    {
+        buffer.resize(static_cast<size_t>(header.stride) * sc_StoreBandRows);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // Written under a temporary name so a concurrent Lookup never maps a partial entry.
+    auto path = GetEntryPath(key);
+    auto tempPath = path + L".tmp";
+
+    {
+        FileHandle file(CreateFile2(tempPath.c_str(), GENERIC_WRITE, 0, CREATE_ALWAYS, nullptr));
+        if (!file.IsValid())
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        std::vector<BYTE> prefix(static_cast<size_t>(header.pixelOffset));
+        memcpy(prefix.data(), &header, sizeof(header));
+        memcpy(prefix.data() + sizeof(header), key.data(), key.size() * sizeof(wchar_t));
+
+        hr = WriteAll(file.Get(), prefix.data(), prefix.size());
+
+        for (UINT y = 0; SUCCEEDED(hr) && y < height; y += sc_StoreBandRows)
+        {
+            UINT rows = (std::min)(sc_StoreBandRows, height - y);
+            WICRect band = { 0, static_cast<INT>(y), static_cast<INT>(width), static_cast<INT>(rows) };
+
+            hr = pixels->CopyPixels(&band, header.stride, header.stride * rows, buffer.data());
+            if (SUCCEEDED(hr))
+            {
+                hr = WriteAll(file.Get(), buffer.data(), static_cast<size_t>(header.stride) * rows);
+            }
+        }
+    }
+
+    if (SUCCEEDED(hr) && !MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (FAILED(hr))
+    {
+        DeleteFileW(tempPath.c_str());
+        return hr;
+    }
+
+    Trim();
+
+    return S_OK;
+}
+
+/// <summary>
+/// Entry file names are a 64-bit FNV-1a hash of the key; the key itself is stored in the entry.
+/// </summary>
+std::wstring DecodedImageCache::GetEntryPath(const std::wstring& key) const
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (wchar_t c : key)
+    {
+        hash = (hash ^ static_cast<uint64_t>(c)) * 1099511628211ull;
+    }
+
+    wchar_t name[17] = {};
+    swprintf_s(name, L"%016llx", hash);
+
+    return m_folder + L"\\" + name + sc_EntryExtension;
+}
+
+HRESULT DecodedImageCache::GetBitsPerPixel(WICPixelFormatGUID format, _Out_ UINT* bitsPerPixel) const
+{
+    // This format doesn't support IWICComponentInfo.
+    if (format == GUID_WICPixelFormat32bppR10G10B10A2HDR10)
+    {
+        *bitsPerPixel = 32;
+        return S_OK;
+    }
+
+    *bitsPerPixel = 0;
+
+    ComPtr<IWICComponentInfo> componentInfo;
+    HRESULT hr = m_wicFactory->CreateComponentInfo(format, &componentInfo);
+    if (FAILED(hr))
+        return hr;
+
+    ComPtr<IWICPixelFormatInfo> pixelFormatInfo;
+    hr = componentInfo.As(&pixelFormatInfo);
+    if (FAILED(hr))
+        return hr;
+
+    return pixelFormatInfo->GetBitsPerPixel(bitsPerPixel);
+}
+
+/// <summary>
+/// Deletes the least recently used entries until the folder is within both limits.
+/// </summary>
+void DecodedImageCache::Trim()
+{
+    std::lock_guard<std::mutex> lock(m_trimLock);
+
+    struct EntryFile
+    {
+        std::wstring    name;
+        uint64_t        size;
+        uint64_t        lastUse;
+    };
+
+    std::vector<EntryFile> entries;
+
+    WIN32_FIND_DATAW findData = {};
+    auto pattern = m_folder + L"\\*" + sc_EntryExtension;
+    HANDLE find = FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, 0);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    do
+    {
+        entries.push_back({
+            findData.cFileName,
+            (static_cast<uint64_t>(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow,
+            (static_cast<uint64_t>(findData.ftLastWriteTime.dwHighDateTime) << 32) | findData.ftLastWriteTime.dwLowDateTime });
+    } while (FindNextFileW(find, &findData));
+
+    FindClose(find);
+
+    std::sort(entries.begin(), entries.end(), [](const EntryFile& a, const EntryFile& b) {
+        return a.lastUse > b.lastUse;
+    });
+
+    uint64_t totalSize = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        totalSize += entries[i].size;
+        if (totalSize > m_byteLimit || i >= m_entryLimit)
+        {
+            DeleteFileW((m_folder + L"\\" + entries[i].name).c_str());
+        }
+    }
+}
@@ -0,0 +1,74 @@
+//*********************************************************
+//
+// DecodedImageCache
+//
+// Persists fully decoded images in the app's local cache
+// folder, so reopening an unchanged file maps the pixels
+// back in instead of decoding them again.
+//
+// Each entry is one file: a header with the ImageInfo and
+// the computed ImageCLL, followed by the pixels in the
+// pixel format ImageLoader keeps resident. The pixel data
+// starts on a page boundary, with unpadded rows, and is
+// served to Direct2D straight from a read only mapping of
+// the file.
+//
+// Entries are keyed by path, size and modification time, so
+// an edited file is a miss. Least recently used entries are
+// deleted once the folder exceeds its byte or entry limit.
+//
+//*********************************************************
+
+#pragma once
+
+#include "ImageInfo.h"
+
+#include <mutex>
+
+namespace HDRImageViewer
+{
+    struct DecodedImage
+    {
+        ImageInfo                                   info;
+        ImageCLL                                    cll;
+        Microsoft::WRL::ComPtr<IWICBitmapSource>    pixels; // Backed by the mapped entry.
+    };
+
+    class DecodedImageCache
+    {
+    public:
+        DecodedImageCache(
+            _In_ Platform::String^ folder,
+            _In_ IWICImagingFactory* wicFactory,
+            uint64_t byteLimit,
+            uint32_t entryLimit);
+
+        /// <summary>
+        /// Identifies one version of a source file.
+        /// </summary>
+        static std::wstring MakeKey(_In_ Platform::String^ path, uint64_t size, int64_t modifiedTime);
+
+        /// <summary>
+        /// Maps the entry for key. Returns S_FALSE if there is no valid entry.
+        /// </summary>
+        HRESULT Lookup(const std::wstring& key, _Out_ DecodedImage& image);
+
+        /// <summary>
+        /// Writes a new entry. pixels must be in one of ImageLoader's resident formats and must
+        /// not be in use elsewhere; this is intended to run on a worker thread.
+        /// Images with embedded color profiles are not supported.
+        /// </summary>
+        HRESULT Store(const std::wstring& key, const ImageInfo& info, const ImageCLL& cll, _In_ IWICBitmapSource* pixels);
+
+    private:
+        std::wstring GetEntryPath(const std::wstring& key) const;
+        HRESULT GetBitsPerPixel(WICPixelFormatGUID format, _Out_ UINT* bitsPerPixel) const;
+        void Trim();
+
+        std::wstring                                    m_folder;
+        Microsoft::WRL::ComPtr<IWICImagingFactory>      m_wicFactory;
+        uint64_t                                        m_byteLimit;
+        uint32_t                                        m_entryLimit;
+        std::mutex                                      m_trimLock;
+    };
+}
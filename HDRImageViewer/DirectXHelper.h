@@ -12,6 +12,7 @@
 #pragma once
 
 #include <ppltasks.h>
+#include <WindowsStorageCOM.h>
 
 namespace DX
 {
@@ -78,6 +79,114 @@ namespace DX
         });
     }
 
+    // Reads the remainder of a COM stream, from its current position, into memory.
+    inline HRESULT ReadStreamToEnd(_In_ IStream* stream, _Out_ std::vector<byte>& data)
+    {
+        data.clear();
+
+        STATSTG stat = {};
+        HRESULT hr = stream->Stat(&stat, STATFLAG_NONAME);
+        if (FAILED(hr)) return hr;
+
+        LARGE_INTEGER zero = {};
+        ULARGE_INTEGER pos = {};
+        hr = stream->Seek(zero, STREAM_SEEK_CUR, &pos);
+        if (FAILED(hr)) return hr;
+
+        ULONGLONG remaining = stat.cbSize.QuadPart > pos.QuadPart ? stat.cbSize.QuadPart - pos.QuadPart : 0;
+        if (remaining > SIZE_MAX || remaining > ULONG_MAX)
+        {
+            return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+        }
+
+        try
+        {
+            data.resize(static_cast<size_t>(remaining));
+        }
+        catch (const std::bad_alloc&)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        ULONG bytesRead = 0;
+        hr = stream->Read(data.data(), static_cast<ULONG>(data.size()), &bytesRead);
+        if (FAILED(hr)) return hr;
+
+        if (bytesRead != data.size())
+        {
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        }
+
+        return S_OK;
+    }
+
+    // Opens a read-only Win32 handle to a storage file. Access to files outside the app's sandbox,
+    // e.g. from a FileOpenPicker, is brokered. Fails if the file's provider doesn't support handles.
+    inline HRESULT OpenStorageFileHandle(_In_ Windows::Storage::IStorageFile^ file, _Out_ HANDLE* handle)
+    {
+        *handle = INVALID_HANDLE_VALUE;
+
+        Microsoft::WRL::ComPtr<IStorageItemHandleAccess> handleAccess;
+        HRESULT hr = reinterpret_cast<IUnknown*>(file)->QueryInterface(IID_PPV_ARGS(&handleAccess));
+        if (FAILED(hr)) return hr;
+
+        return handleAccess->Create(HAO_READ, HSO_SHARE_READ, HO_NONE, nullptr, handle);
+    }
+
+    // A read-only view of a whole file. The view stays valid after the file handle is closed.
+    class FileView
+    {
+    public:
+        FileView() : m_data(nullptr), m_size(0) {}
+        ~FileView() { if (m_data) UnmapViewOfFile(m_data); }
+
+        FileView(const FileView&) = delete;
+        FileView& operator=(const FileView&) = delete;
+
+        HRESULT Map(_In_ HANDLE file)
+        {
+            FILE_STANDARD_INFO info = {};
+            if (!GetFileInformationByHandleEx(file, FileStandardInfo, &info, sizeof(info)))
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            // Empty files can't be mapped.
+            if (info.EndOfFile.QuadPart <= 0)
+            {
+                return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            }
+
+            if (static_cast<ULONGLONG>(info.EndOfFile.QuadPart) > SIZE_MAX)
+            {
+                return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+            }
+
+            Microsoft::WRL::Wrappers::HandleT<Microsoft::WRL::Wrappers::HandleTraits::HANDLENullTraits> mapping(
+                CreateFileMappingFromApp(file, nullptr, PAGE_READONLY, 0, nullptr));
+            if (!mapping.IsValid())
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            m_data = static_cast<const byte*>(MapViewOfFileFromApp(mapping.Get(), FILE_MAP_READ, 0, 0));
+            if (!m_data)
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            m_size = static_cast<size_t>(info.EndOfFile.QuadPart);
+            return S_OK;
+        }
+
+        const byte* Data() const { return m_data; }
+        size_t Size() const { return m_size; }
+
+    private:
+        const byte* m_data;
+        size_t      m_size;
+    };
+
     // Converts a length in device-independent pixels (DIPs) to a length in physical pixels.
     inline float ConvertDipsToPixels(float dips, float dpi)
     {
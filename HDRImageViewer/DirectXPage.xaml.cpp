@@ -12,6 +12,8 @@
 #include "pch.h"
 #include "DirectXPage.xaml.h"
 #include "DirectXHelper.h"
+#include "ImageProbe.h"
+#include "MagicConstants.h"
 
 using namespace HDRImageViewer;
 
@@ -23,6 +25,7 @@ using namespace Windows::Foundation::Collections;
 using namespace Windows::Graphics::Display;
 using namespace Windows::Storage;
 using namespace Windows::Storage::Pickers;
+using namespace Windows::Storage::Search;
 using namespace Windows::Storage::Streams;
 using namespace Windows::System;
 using namespace Windows::System::Threading;
@@ -39,8 +42,10 @@ using namespace Windows::UI::Xaml::Navigation;
 
 DirectXPage::DirectXPage() :
     m_isWindowVisible(true),
+    m_folderIndex(0),
     m_imageInfo{},
     m_isImageValid(false),
+    m_hasViewingLut(false),
     m_imageCLL{ -1.0f, -1.0f }
 {
     InitializeComponent();
@@ -137,122 +142,155 @@ void DirectXPage::LoadDefaultImage()
 
 void DirectXPage::LoadImage(_In_ StorageFile^ imageFile)
 {
-    task<StorageFile^> createFileTask;
     m_isImageValid = false;
     BrightnessAdjustSlider->IsEnabled = false;
     RenderEffectCombo->IsEnabled = false;
 
-    bool useDirectXTex = false;
+    // A newer image supersedes any load still in progress. Loading continuations run on the UI
+    // thread, so a superseded load is dropped before its next stage (e.g. the full decode after
+    // a preview); the decoders themselves also check the token between strips and tiles.
+    m_loadCancellation.cancel();
+    m_loadCancellation = cancellation_token_source();
+    auto cancel = m_loadCancellation.get_token();
 
-    auto type = imageFile->FileType;
-    if (type == L".HDR" || type == L".hdr" ||
-        type == L".EXR" || type == L".exr" ||
-        type == L".DDS" || type == L".dds")
-    {
-        useDirectXTex = true;
-    }
+    // The requested image takes priority over prefetching its neighbours.
+    m_prefetchCancellation.cancel();
 
-    if (useDirectXTex)
+    // Stepping to a prefetched neighbour needs no decoding at all.
+    std::wstring key = imageFile->Path->Data();
+    if (!key.empty())
     {
-        // For formats that are loaded by DirectXTex, we must use a file path
-        // from the temporary folder.
-        createFileTask = create_task([=] {
-            return imageFile->CopyAsync(
-                ApplicationData::Current->TemporaryFolder,
-                imageFile->Name,
-                NameCollisionOption::ReplaceExisting);
-            });
-    }
-    else
-    {
-        // For formats that are loaded by WIC, we can directly load from the file.
-        createFileTask = create_task([=] { return imageFile; });
+        ImageInfo cached = m_renderer->LoadImageFromCache(key);
+        if (cached.isValid)
+        {
+            ShowLoadedImage(imageFile, cached);
+            UpdateFolderNavigation(imageFile, cancel);
+            return;
+        }
     }
 
-    createFileTask.then([=](StorageFile^ imageFile) {
-        if (useDirectXTex)
+    // Next best is an image decoded in an earlier session, provided the file hasn't changed since.
+    create_task(imageFile->GetBasicPropertiesAsync(), cancel).then([=](task<FileProperties::BasicProperties^> propertiesTask) {
+        std::wstring diskKey;
+        try
+        {
+            auto properties = propertiesTask.get();
+            if (!imageFile->Path->IsEmpty())
+            {
+                diskKey = DecodedImageCache::MakeKey(imageFile->Path, properties->Size, properties->DateModified.UniversalTime);
+            }
+        }
+        catch (const task_canceled&)
         {
-            return create_task([=] { return m_renderer->LoadImageFromDirectXTex(imageFile->Path, type); });
+            return;
         }
-        else
+        catch (...)
         {
-            return create_task(imageFile->OpenAsync(FileAccessMode::Read)
-        ).then([=](IRandomAccessStream^ ras) {
-            // If file opening fails, fall through to error handler at the end of task chain.
-
-            ComPtr<IStream> iStream;
-            DX::ThrowIfFailed(CreateStreamOverRandomAccessStream(ras, IID_PPV_ARGS(&iStream)));
-            return m_renderer->LoadImageFromWic(iStream.Get());
-            });
+            // The disk cache is optional.
         }
-    }).then([=](ImageInfo info) {
-        // Temporarily store image decode result for the error handler.
-        m_tempInfo = info;
 
-        if (info.isValid == false)
+        if (!diskKey.empty())
         {
-            // Exit before any of the current image state is modified.
-            throw ref new FailureException();
+            ImageInfo restored = m_renderer->LoadImageFromDiskCache(diskKey);
+            if (restored.isValid)
+            {
+                ShowLoadedImage(imageFile, restored);
+                UpdateFolderNavigation(imageFile, cancel);
+                return;
+            }
         }
 
-        m_imageInfo = info;
+        DecodeImage(imageFile, diskKey, cancel);
+    }, task_continuation_context::use_current());
+}
+
+// Decodes an image which is in neither the prefetch nor the disk cache.
+void DirectXPage::DecodeImage(_In_ StorageFile^ imageFile, const std::wstring& diskKey, cancellation_token cancel)
+{
+    bool useDirectXTex = false;
+
+    auto type = imageFile->FileType;
+    if (type == L".HDR" || type == L".hdr" ||
+        type == L".EXR" || type == L".exr" ||
+        type == L".DDS" || type == L".dds")
+    {
+        useDirectXTex = true;
+    }
 
-        m_renderer->CreateImageDependentResources();
-        m_imageCLL = m_renderer->FitImageToWindow(true); // On first load of image, need to generate HDR metadata.
+    // No format needs to be copied to the temporary folder first. WIC decodes from the file
+    // stream; DirectXTex formats are mapped through a brokered file handle where the file
+    // supports one, and otherwise read from the stream.
+    create_task(imageFile->OpenAsync(FileAccessMode::Read), cancel
+    ).then([=](IRandomAccessStream^ ras) {
+        // If file opening fails, fall through to error handler at the end of task chain.
 
-        ApplicationView::GetForCurrentView()->Title = imageFile->Name;
-        ImageACKind->Text = L"Kind: " + ConvertACKindToString(m_imageInfo.imageKind);
-        ImageHasColorProfile->Text = L"Color profile: " + (m_imageInfo.numProfiles > 0 ? L"Yes" : L"No");
-        ImageBitDepth->Text = L"Bit depth: " + ref new String(std::to_wstring(m_imageInfo.bitsPerChannel).c_str());
-        ImageIsFloat->Text = L"Floating point: " + (m_imageInfo.isFloat ? L"Yes" : L"No");
+        ComPtr<IStream> iStream;
+        DX::ThrowIfFailed(CreateStreamOverRandomAccessStream(ras, IID_PPV_ARGS(&iStream)));
 
-        std::wstringstream cllStr;
-        cllStr << L"Estimated MaxCLL: ";
-        if (m_imageCLL.maxNits < 0.0f)
-        {
-            cllStr << L"N/A";
-        }
-        else
+        // Progressive loading: if the image can be cheaply decoded at a reduced resolution,
+        // show that first. The controls stay disabled until the full image replaces it. The
+        // preview is still decoded here on the UI thread, so only cheap decode paths produce one.
+        ImageInfo preview = useDirectXTex ?
+            m_renderer->LoadPreviewFromDirectXTex(iStream.Get(), type, cancel) :
+            m_renderer->LoadPreviewFromWic(iStream.Get(), cancel);
+
+        if (preview.isValid)
         {
-            cllStr << std::to_wstring(static_cast<int>(m_imageCLL.maxNits)) << L" nits";
-        }
+            m_imageInfo = preview;
 
-        ImageMaxCLL->Text = ref new String(cllStr.str().c_str());
+            m_renderer->CreateImageDependentResources();
+            m_imageCLL = m_renderer->FitImageToWindow(true);
 
-        std::wstringstream avgStr;
-        avgStr << L"Estimated MedCLL: ";
-        if (m_imageCLL.medNits < 0.0f)
-        {
-            avgStr << L"N/A";
+            ApplicationView::GetForCurrentView()->Title = imageFile->Name;
+            ApplyDefaultRenderOptions(); // Draws the preview.
         }
-        else
+
+        return iStream;
+    }, cancel, task_continuation_context::use_current()).then([=](ComPtr<IStream> iStream) {
+        // A separate continuation lets the preview be presented before the full decode starts. The
+        // decode, including the mip pyramid, runs on the thread pool while the preview is shown.
+        HANDLE handle = INVALID_HANDLE_VALUE;
+        if (useDirectXTex)
         {
-            avgStr << std::to_wstring(static_cast<int>(m_imageCLL.medNits)) << L" nits";
+            // Leave the handle invalid if it can't be opened; the stream is used instead.
+            DX::OpenStorageFileHandle(imageFile, &handle);
         }
 
-        ImageAvgCLL->Text = ref new String(avgStr.str().c_str());
+        return m_renderer->LoadImageAsync(handle, iStream.Get(), type, cancel);
+    }, cancel, task_continuation_context::use_current()).then([=](ImageInfo info) {
+        if (cancel.is_canceled())
+        {
+            // Superseded; the newer load owns the UI.
+            cancel_current_task();
+        }
 
-        // Image loading is done at this point.
-        m_isImageValid = true;
-        BrightnessAdjustSlider->IsEnabled = true;
-        RenderEffectCombo->IsEnabled = true;
+        // Temporarily store image decode result for the error handler.
+        m_tempInfo = info;
 
-        if (m_imageInfo.imageKind == AdvancedColorKind::HighDynamicRange)
+        if (info.isValid == false)
         {
-            ExportImageButton->IsEnabled = true;
+            // Exit before any of the current image state is modified.
+            throw ref new FailureException();
         }
-        else
+
+        ShowLoadedImage(imageFile, info);
+        UpdateFolderNavigation(imageFile, cancel);
+
+        if (!diskKey.empty())
         {
-            ExportImageButton->IsEnabled = false;
+            m_renderer->StoreImageInDiskCache(diskKey);
         }
 
-        UpdateDefaultRenderOptions();
-
-    }, task_continuation_context::use_current()).then([=](task<void> previousTask) {
+    }, cancel, task_continuation_context::use_current()).then([=](task<void> previousTask) {
         try
         {
             previousTask.get();
         }
+        catch (const task_canceled&)
+        {
+            // Not an error; a newer image was requested.
+            return;
+        }
         catch (...)
         {
             auto dialog = ref new ErrorContentDialog();
@@ -278,6 +316,296 @@ void DirectXPage::LoadImage(_In_ StorageFile^ imageFile)
     }, task_continuation_context::use_current());
 }
 
+// Updates the UI for a newly loaded image, which the renderer has already made current.
+void DirectXPage::ShowLoadedImage(_In_ StorageFile^ imageFile, const ImageInfo& info)
+{
+    ApplicationView::GetForCurrentView()->Title = imageFile->Name;
+
+    ShowImage(info);
+}
+
+// Updates the UI for the image or subresource the renderer has made current.
+void DirectXPage::ShowImage(const ImageInfo& info)
+{
+    m_imageInfo = info;
+
+    m_renderer->CreateImageDependentResources();
+    m_imageCLL = m_renderer->FitImageToWindow(true); // On first load of image, need to generate HDR metadata.
+
+    ImageACKind->Text = L"Kind: " + ConvertACKindToString(m_imageInfo.imageKind);
+    ImageHasColorProfile->Text = L"Color profile: " + (m_imageInfo.numProfiles > 0 ? L"Yes" : L"No");
+    ImageBitDepth->Text = L"Bit depth: " + ref new String(std::to_wstring(m_imageInfo.bitsPerChannel).c_str());
+    ImageIsFloat->Text = L"Floating point: " + (m_imageInfo.isFloat ? L"Yes" : L"No");
+
+    // Only containers of more than one image (see StepSubresource) show which one is current.
+    if (m_imageInfo.frameCount > 1 || m_imageInfo.mipCount > 1)
+    {
+        std::wstringstream subresourceStr;
+        subresourceStr << L"Frame: " << m_imageInfo.frameIndex + 1 << L" of " << max(m_imageInfo.frameCount, 1u)
+                       << L", mip: " << m_imageInfo.mipIndex + 1 << L" of " << max(m_imageInfo.mipCount, 1u);
+
+        ImageSubresource->Text = ref new String(subresourceStr.str().c_str());
+        ImageSubresource->Visibility = Windows::UI::Xaml::Visibility::Visible;
+    }
+    else
+    {
+        ImageSubresource->Visibility = Windows::UI::Xaml::Visibility::Collapsed;
+    }
+
+    std::wstringstream cllStr;
+    cllStr << L"Estimated MaxCLL: ";
+    if (m_imageCLL.maxNits < 0.0f)
+    {
+        cllStr << L"N/A";
+    }
+    else
+    {
+        cllStr << std::to_wstring(static_cast<int>(m_imageCLL.maxNits)) << L" nits";
+    }
+
+    ImageMaxCLL->Text = ref new String(cllStr.str().c_str());
+
+    std::wstringstream avgStr;
+    avgStr << L"Estimated MedCLL: ";
+    if (m_imageCLL.medNits < 0.0f)
+    {
+        avgStr << L"N/A";
+    }
+    else
+    {
+        avgStr << std::to_wstring(static_cast<int>(m_imageCLL.medNits)) << L" nits";
+    }
+
+    ImageAvgCLL->Text = ref new String(avgStr.str().c_str());
+
+    // Image loading is done at this point.
+    m_isImageValid = true;
+    BrightnessAdjustSlider->IsEnabled = true;
+    RenderEffectCombo->IsEnabled = true;
+
+    if (m_imageInfo.imageKind == AdvancedColorKind::HighDynamicRange)
+    {
+        ExportImageButton->IsEnabled = true;
+    }
+    else
+    {
+        ExportImageButton->IsEnabled = false;
+    }
+
+    UpdateDefaultRenderOptions();
+}
+
+// Steps to another frame (page, array item, cube face, volume slice or EXR part) or mip level
+// of the current image. Only the selected subresource is decoded.
+void DirectXPage::StepSubresource(int frameOffset, int mipOffset)
+{
+    if (!m_isImageValid)
+    {
+        return;
+    }
+
+    int frame = static_cast<int>(m_imageInfo.frameIndex) + frameOffset;
+    int mip = static_cast<int>(m_imageInfo.mipIndex) + mipOffset;
+    if (frame < 0 || frame >= static_cast<int>(max(m_imageInfo.frameCount, 1u)) ||
+        mip < 0 || mip >= static_cast<int>(max(m_imageInfo.mipCount, 1u)))
+    {
+        return;
+    }
+
+    ImageInfo info = m_renderer->SelectImageSubresource(static_cast<unsigned int>(frame), static_cast<unsigned int>(mip));
+    if (info.isValid == false)
+    {
+        m_isImageValid = false;
+        BrightnessAdjustSlider->IsEnabled = false;
+        RenderEffectCombo->IsEnabled = false;
+
+        auto dialog = ref new ErrorContentDialog();
+        dialog->ShowAsync();
+        return;
+    }
+
+    ShowImage(info);
+}
+
+void DirectXPage::SetNeighboringFiles(_In_opt_ StorageFileQueryResult^ query)
+{
+    m_neighboringFiles = query;
+}
+
+// Finds the image's position in its folder and starts prefetching its neighbours. The folder
+// comes from the neighbouring files query the app was activated with, if any, or else from the
+// parent folder, which is only accessible when the app was granted the whole folder (e.g. the
+// working directory on the command line). Without either there is no folder navigation.
+void DirectXPage::UpdateFolderNavigation(_In_ StorageFile^ imageFile, cancellation_token cancel)
+{
+    if (imageFile->Path->IsEmpty())
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < m_folderFiles.size(); i++)
+    {
+        if (m_folderFiles[i]->Path == imageFile->Path)
+        {
+            m_folderIndex = static_cast<int>(i);
+            StartPrefetch();
+            return;
+        }
+    }
+
+    // A different folder; nothing cached so far is a neighbour.
+    m_folderFiles.clear();
+    m_folderIndex = 0;
+    m_renderer->ClearPrefetchCache();
+
+    auto neighbors = m_neighboringFiles;
+    m_neighboringFiles = nullptr;
+
+    bool sortByName = false;
+    task<StorageFileQueryResult^> queryTask;
+    if (neighbors != nullptr)
+    {
+        // Already in the order the user sees in Explorer.
+        queryTask = task_from_result(neighbors);
+    }
+    else
+    {
+        sortByName = true;
+        queryTask = create_task(imageFile->GetParentAsync()).then([=](StorageFolder^ folder) -> StorageFileQueryResult^ {
+            if (folder == nullptr)
+            {
+                return nullptr;
+            }
+
+            auto options = ref new QueryOptions();
+            options->FolderDepth = FolderDepth::Shallow;
+            ImageProbe::AppendSupportedFileTypes(options->FileTypeFilter);
+
+            return folder->CreateFileQueryWithOptions(options);
+        });
+    }
+
+    queryTask.then([](StorageFileQueryResult^ query) {
+        return query != nullptr ?
+            create_task(query->GetFilesAsync()) :
+            task_from_result<IVectorView<StorageFile^>^>(nullptr);
+    }).then([=](IVectorView<StorageFile^>^ files) {
+        if (files == nullptr || cancel.is_canceled())
+        {
+            return;
+        }
+
+        std::vector<StorageFile^> folderFiles(begin(files), end(files));
+        if (sortByName)
+        {
+            // Natural order ("2.exr" before "10.exr"), as Explorer sorts by name.
+            std::sort(folderFiles.begin(), folderFiles.end(), [](StorageFile^ a, StorageFile^ b) {
+                return CompareStringEx(
+                    LOCALE_NAME_USER_DEFAULT, NORM_IGNORECASE | SORT_DIGITSASNUMBERS,
+                    a->Name->Data(), -1, b->Name->Data(), -1,
+                    nullptr, nullptr, 0) == CSTR_LESS_THAN;
+            });
+        }
+
+        for (size_t i = 0; i < folderFiles.size(); i++)
+        {
+            if (folderFiles[i]->Path == imageFile->Path)
+            {
+                m_folderFiles = std::move(folderFiles);
+                m_folderIndex = static_cast<int>(i);
+                StartPrefetch();
+                return;
+            }
+        }
+    }, task_continuation_context::use_current()).then([](task<void> previousTask) {
+        try
+        {
+            previousTask.get();
+        }
+        catch (...)
+        {
+            // Folder navigation is optional; the image itself is already shown.
+        }
+    });
+}
+
+// Shows the image offset positions away from the current one in its folder.
+void DirectXPage::NavigateFolder(int offset)
+{
+    int position = m_folderIndex + offset;
+    if (position < 0 || position >= static_cast<int>(m_folderFiles.size()))
+    {
+        return;
+    }
+
+    LoadImage(m_folderFiles[position]);
+}
+
+// Keeps the current image and decodes its nearest neighbours into the renderer's cache, one
+// at a time. Decoding runs on the thread pool; see HDRImageViewerRenderer::PrefetchImage.
+void DirectXPage::StartPrefetch()
+{
+    m_prefetchCancellation.cancel();
+    m_prefetchCancellation = cancellation_token_source();
+
+    m_renderer->SetPrefetchWindow(m_folderIndex, sc_prefetchRadius);
+    m_renderer->CacheCurrentImage(m_folderFiles[m_folderIndex]->Path->Data(), m_folderIndex);
+
+    // Nearest first, the next image before the previous one.
+    std::vector<int> positions;
+    for (int distance = 1; distance <= sc_prefetchRadius; distance++)
+    {
+        for (int position : { m_folderIndex + distance, m_folderIndex - distance })
+        {
+            if (position >= 0 && position < static_cast<int>(m_folderFiles.size()))
+            {
+                positions.push_back(position);
+            }
+        }
+    }
+
+    PrefetchNeighbors(positions, 0, m_prefetchCancellation.get_token());
+}
+
+void DirectXPage::PrefetchNeighbors(std::vector<int> positions, size_t next, cancellation_token cancel)
+{
+    while (next < positions.size() && m_renderer->IsImageCached(m_folderFiles[positions[next]]->Path->Data()))
+    {
+        next++;
+    }
+
+    if (next >= positions.size() || cancel.is_canceled())
+    {
+        return;
+    }
+
+    int position = positions[next];
+    StorageFile^ file = m_folderFiles[position];
+
+    create_task(file->OpenAsync(FileAccessMode::Read), cancel).then([=](IRandomAccessStream^ ras) {
+        ComPtr<IStream> iStream;
+        DX::ThrowIfFailed(CreateStreamOverRandomAccessStream(ras, IID_PPV_ARGS(&iStream)));
+
+        // Only DirectXTex formats use the handle; leave it invalid if it can't be opened.
+        HANDLE handle = INVALID_HANDLE_VALUE;
+        DX::OpenStorageFileHandle(file, &handle);
+
+        return m_renderer->PrefetchImage(handle, iStream.Get(), file->FileType, file->Path->Data(), position, cancel);
+    }, cancel, task_continuation_context::use_current()).then([=](task<void> previousTask) {
+        try
+        {
+            previousTask.get();
+        }
+        catch (...)
+        {
+            // Not cached; loading the image for real reports the error. Includes task_canceled;
+            // the check below stops the chain.
+        }
+
+        PrefetchNeighbors(positions, next + 1, cancel);
+    }, task_continuation_context::use_current());
+}
+
 void DirectXPage::SetUIHidden(bool value)
 {
     if (value == false)
@@ -307,7 +635,7 @@ void DirectXPage::SetUIFullscreen(bool value)
 void DirectXPage::ExportImageToSdr(_In_ Windows::Storage::StorageFile ^ file)
 {
     GUID wicFormat = {};
-    if (Platform::String::CompareOrdinal(file->FileType, L".jpg") == 0)
+    if (CompareStringOrdinal(file->FileType->Data(), -1, L".jpg", -1, TRUE) == CSTR_EQUAL)
     {
         wicFormat = GUID_ContainerFormatJpeg;
     }
@@ -320,7 +648,36 @@ void DirectXPage::ExportImageToSdr(_In_ Windows::Storage::StorageFile ^ file)
         ComPtr<IStream> iStream;
         DX::ThrowIfFailed(CreateStreamOverRandomAccessStream(ras, IID_PPV_ARGS(&iStream)));
         m_renderer->ExportImageToSdr(iStream.Get(), wicFormat);
-    });
+    }, task_continuation_context::use_current()).then([=](task<void> previousTask) {
+        try
+        {
+            previousTask.get();
+        }
+        catch (...)
+        {
+            auto dialog = ref new ErrorContentDialog();
+            dialog->ShowAsync();
+        }
+    }, task_continuation_context::use_current());
+}
+
+void DirectXPage::ExportImageToRgbe(_In_ Windows::Storage::StorageFile ^ file)
+{
+    create_task(file->OpenAsync(FileAccessMode::ReadWrite)).then([=](IRandomAccessStream^ ras) {
+        ComPtr<IStream> iStream;
+        DX::ThrowIfFailed(CreateStreamOverRandomAccessStream(ras, IID_PPV_ARGS(&iStream)));
+        m_renderer->ExportImageToRgbe(iStream.Get());
+    }, task_continuation_context::use_current()).then([=](task<void> previousTask) {
+        try
+        {
+            previousTask.get();
+        }
+        catch (...)
+        {
+            auto dialog = ref new ErrorContentDialog();
+            dialog->ShowAsync();
+        }
+    }, task_continuation_context::use_current());
 }
 
 void DirectXPage::UpdateDisplayACState(_In_opt_ AdvancedColorInfo^ info)
@@ -362,19 +719,7 @@ void DirectXPage::LoadImageButtonClick(_In_ Object^ sender, _In_ RoutedEventArgs
 {
     FileOpenPicker^ picker = ref new FileOpenPicker();
     picker->SuggestedStartLocation = PickerLocationId::Desktop;
-    picker->FileTypeFilter->Append(L".jxr");
-    picker->FileTypeFilter->Append(L".jpg");
-    picker->FileTypeFilter->Append(L".png");
-    picker->FileTypeFilter->Append(L".tif");
-    picker->FileTypeFilter->Append(L".hdr");
-    picker->FileTypeFilter->Append(L".exr");
-    picker->FileTypeFilter->Append(L".dds");
-
-    if (DX::CheckPlatformSupport(DX::OSVer::Win1903))
-    {
-        picker->FileTypeFilter->Append(L".heic");
-        picker->FileTypeFilter->Append(L".avif");
-    }
+    ImageProbe::AppendSupportedFileTypes(picker->FileTypeFilter);
 
     create_task(picker->PickSingleFileAsync()).then([=](StorageFile^ pickedFile) {
         if (pickedFile != nullptr)
@@ -388,24 +733,84 @@ void DirectXPage::ExportImageButtonClick(Platform::Object^ sender, Windows::UI::
 {
     FileSavePicker^ picker = ref new FileSavePicker();
     picker->SuggestedStartLocation = PickerLocationId::PicturesLibrary;
-    picker->CommitButtonText = L"Export image to SDR";
+    picker->CommitButtonText = L"Export image";
 
     auto jpgExtensions = ref new Platform::Collections::Vector<String^>(1, L".jpg");
     auto pngExtensions = ref new Platform::Collections::Vector<String^>(1, L".png");
+    auto hdrExtensions = ref new Platform::Collections::Vector<String^>(1, L".hdr");
 
     picker->FileTypeChoices->Insert(L"JPEG image", jpgExtensions);
     picker->FileTypeChoices->Insert(L"PNG image", pngExtensions);
+    picker->FileTypeChoices->Insert(L"Radiance HDR image", hdrExtensions);
 
     std::shared_ptr<GUID> wicFormatPtr = std::make_shared<GUID>();
 
     create_task(picker->PickSaveFileAsync()).then([=](StorageFile^ pickedFile) {
-        if (pickedFile != nullptr)
+        if (pickedFile == nullptr)
+        {
+            return;
+        }
+
+        // Radiance files keep the full dynamic range; everything else is tonemapped to SDR.
+        if (CompareStringOrdinal(pickedFile->FileType->Data(), -1, L".hdr", -1, TRUE) == CSTR_EQUAL)
+        {
+            ExportImageToRgbe(pickedFile);
+        }
+        else
         {
             ExportImageToSdr(pickedFile);
         }
     });
 }
 
+// Loads a .cube file as the viewing LUT, or removes the current one.
+void DirectXPage::ViewingLutButtonClick(Platform::Object^ sender, Windows::UI::Xaml::RoutedEventArgs^ e)
+{
+    if (m_hasViewingLut)
+    {
+        m_hasViewingLut = false;
+        ViewingLutButton->Content = ref new String(L"Load viewing LUT");
+        m_renderer->SetViewingLut(nullptr);
+        UpdateRenderOptions();
+        return;
+    }
+
+    FileOpenPicker^ picker = ref new FileOpenPicker();
+    picker->SuggestedStartLocation = PickerLocationId::Desktop;
+    picker->FileTypeFilter->Append(L".cube");
+
+    create_task(picker->PickSingleFileAsync()).then([=](StorageFile^ pickedFile) {
+        if (pickedFile == nullptr)
+        {
+            return task_from_result();
+        }
+
+        return create_task(FileIO::ReadBufferAsync(pickedFile)).then([=](IBuffer^ buffer) {
+            std::vector<char> text(buffer->Length);
+            DataReader::FromBuffer(buffer)->ReadBytes(
+                Platform::ArrayReference<byte>(reinterpret_cast<byte*>(text.data()), buffer->Length));
+
+            auto lut = std::make_shared<Lut3D>();
+            DX::ThrowIfFailed(Lut3D::ParseCube(text.data(), text.size(), *lut));
+
+            m_hasViewingLut = true;
+            ViewingLutButton->Content = ref new String(L"Remove viewing LUT");
+            m_renderer->SetViewingLut(lut);
+            UpdateRenderOptions();
+        }, task_continuation_context::use_current());
+    }).then([=](task<void> previousTask) {
+        try
+        {
+            previousTask.get();
+        }
+        catch (...)
+        {
+            auto dialog = ref new ErrorContentDialog();
+            dialog->ShowAsync();
+        }
+    });
+}
+
 
 // Saves the current state of the app for suspend and terminate events.
 void DirectXPage::SaveInternalState(_In_ IPropertySet^ state)
@@ -427,6 +832,12 @@ void DirectXPage::UpdateDefaultRenderOptions()
         return;
     }
 
+    ApplyDefaultRenderOptions();
+}
+
+// Selects the default render options for m_imageInfo, even if only a preview is loaded.
+void DirectXPage::ApplyDefaultRenderOptions()
+{
     switch (m_imageInfo.imageKind)
     {
     case AdvancedColorKind::StandardDynamicRange:
@@ -587,6 +998,30 @@ void DirectXPage::OnKeyUp(_In_ CoreWindow^ sender, _In_ KeyEventArgs^ args)
     {
         SetUIFullscreen(false);
     }
+    else if (VirtualKey::Left == args->VirtualKey)
+    {
+        NavigateFolder(-1);
+    }
+    else if (VirtualKey::Right == args->VirtualKey)
+    {
+        NavigateFolder(1);
+    }
+    else if (VirtualKey::PageUp == args->VirtualKey)
+    {
+        StepSubresource(-1, 0);
+    }
+    else if (VirtualKey::PageDown == args->VirtualKey)
+    {
+        StepSubresource(1, 0);
+    }
+    else if (VirtualKey::Up == args->VirtualKey)
+    {
+        StepSubresource(0, -1);
+    }
+    else if (VirtualKey::Down == args->VirtualKey)
+    {
+        StepSubresource(0, 1);
+    }
 }
 
 void DirectXPage::SliderChanged(_In_ Object^ sender, _In_ RangeBaseValueChangedEventArgs^ e)
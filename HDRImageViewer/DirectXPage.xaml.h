@@ -35,6 +35,7 @@ namespace HDRImageViewer
 
         void LoadDefaultImage();
         void LoadImage(_In_ Windows::Storage::StorageFile^ imageFile);
+        void SetNeighboringFiles(_In_opt_ Windows::Storage::Search::StorageFileQueryResult^ query);
 
         void SetUIFullscreen(bool value);
         void SetUIHidden(bool value);
@@ -52,10 +53,24 @@ namespace HDRImageViewer
         void SliderChanged(_In_ Platform::Object^ sender, _In_ Windows::UI::Xaml::Controls::Primitives::RangeBaseValueChangedEventArgs^ e);
         void ComboChanged(_In_ Platform::Object^ sender, _In_ Windows::UI::Xaml::Controls::SelectionChangedEventArgs^ e);
         void ExportImageButtonClick(_In_ Platform::Object^ sender, _In_ Windows::UI::Xaml::RoutedEventArgs^ e);
+        void ViewingLutButtonClick(_In_ Platform::Object^ sender, _In_ Windows::UI::Xaml::RoutedEventArgs^ e);
+
+        void DecodeImage(_In_ Windows::Storage::StorageFile^ imageFile, const std::wstring& diskKey, concurrency::cancellation_token cancel);
+        void ShowLoadedImage(_In_ Windows::Storage::StorageFile^ imageFile, const ImageInfo& info);
+        void ShowImage(const ImageInfo& info);
+        void StepSubresource(int frameOffset, int mipOffset);
+
+        // Folder navigation and neighbour prefetching.
+        void UpdateFolderNavigation(_In_ Windows::Storage::StorageFile^ imageFile, concurrency::cancellation_token cancel);
+        void NavigateFolder(int offset);
+        void StartPrefetch();
+        void PrefetchNeighbors(std::vector<int> positions, size_t next, concurrency::cancellation_token cancel);
 
         void ExportImageToSdr(_In_ Windows::Storage::StorageFile^ file);
+        void ExportImageToRgbe(_In_ Windows::Storage::StorageFile^ file);
         void UpdateDisplayACState(_In_opt_ Windows::Graphics::Display::AdvancedColorInfo^ info);
         void UpdateDefaultRenderOptions();
+        void ApplyDefaultRenderOptions();
         void UpdateRenderOptions();
 
         // XAML low-level rendering event handler.
@@ -93,11 +108,22 @@ namespace HDRImageViewer
         Windows::UI::Input::GestureRecognizer^          m_gestureRecognizer;
         bool                                            m_isWindowVisible;
 
+        // Canceled when a newer LoadImage call supersedes the load in progress.
+        concurrency::cancellation_token_source          m_loadCancellation;
+
+        // Images in the current image's folder, in display order. Neighbours of m_folderIndex are
+        // prefetched; m_prefetchCancellation stops that as soon as another image is requested.
+        std::vector<Windows::Storage::StorageFile^>     m_folderFiles;
+        int                                             m_folderIndex;
+        Windows::Storage::Search::StorageFileQueryResult^ m_neighboringFiles;
+        concurrency::cancellation_token_source          m_prefetchCancellation;
+
         // Cached information for UI.
         HDRImageViewer::ImageInfo                       m_imageInfo;
         HDRImageViewer::ImageInfo                       m_tempInfo;
         HDRImageViewer::ImageCLL                        m_imageCLL;
         bool                                            m_isImageValid;
+        bool                                            m_hasViewingLut;
         Windows::Graphics::Display::AdvancedColorInfo^  m_dispInfo;
         RenderOptionsViewModel^                         m_renderOptionsViewModel;
     };
@@ -18,6 +18,9 @@
 #include <assert.h>
 #include <exception>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 
 //
 // Requires the OpenEXR library <http://www.openexr.com/> and ZLIB <http://www.zlib.net>
@@ -25,8 +28,19 @@
 
 #pragma warning(push)
 #pragma warning(disable : 4244 4996)
+#include <Iex.h>
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfHeader.h>
+#include <ImfInputFile.h>
+#include <ImfInputPart.h>
+#include <ImfMultiPartInputFile.h>
+#include <ImfPreviewImage.h>
 #include <ImfRgbaFile.h>
+#include <ImfTiledInputFile.h>
 #include <ImfIO.h>
+#include <ImfThreading.h>
+#include <ImfVersion.h>
 #pragma warning(pop)
 
 static_assert(sizeof(Imf::Rgba) == 8, "Mismatch size");
@@ -92,7 +106,7 @@ namespace
     {
     public:
         InputStream(HANDLE hFile, const char fileName[]) :
-            IStream(fileName), m_hFile(hFile)
+            IStream(fileName), m_hFile(hFile), m_pos(0)
         {
             LARGE_INTEGER dist = {};
             LARGE_INTEGER result;
@@ -120,144 +134,945 @@ namespace
                 throw com_exception(HRESULT_FROM_WIN32(GetLastError()));
             }
 
+            if (bytesRead != static_cast<DWORD>(n))
+            {
+                throw com_exception(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF));
+            }
+
+            // Track the position ourselves rather than querying the file pointer after every read.
+            m_pos += n;
+
+            return m_pos < m_EOF;
+        }
+
+        virtual Imf::Int64 tellg() override
+        {
+            return m_pos;
+        }
+
+        virtual void seekg(Imf::Int64 pos) override
+        {
+            LARGE_INTEGER dist;
+            dist.QuadPart = pos;
+            if (!SetFilePointerEx(m_hFile, dist, nullptr, FILE_BEGIN))
+            {
+                throw com_exception(HRESULT_FROM_WIN32(GetLastError()));
+            }
+
+            m_pos = pos;
+        }
+
+        virtual void clear() override
+        {
+            SetLastError(0);
+        }
+
+    private:
+        HANDLE m_hFile;
+        LONGLONG m_EOF;
+        LONGLONG m_pos;
+    };
+
+    //---------------------------------------------------------------------------------
+    // Read-only view of an entire file.
+    class MappedFile
+    {
+    public:
+        MappedFile() : m_data(nullptr), m_size(0) {}
+        ~MappedFile() { Close(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        HRESULT Open(HANDLE hFile)
+        {
+            Close();
+
+            FILE_STANDARD_INFO fileInfo;
+            if (!GetFileInformationByHandleEx(hFile, FileStandardInfo, &fileInfo, sizeof(fileInfo)))
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            // Empty files cannot be mapped, and 32-bit processes may not have the address space.
+            if (fileInfo.EndOfFile.QuadPart <= 0)
+                return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+            if (static_cast<ULONGLONG>(fileInfo.EndOfFile.QuadPart) > SIZE_MAX)
+                return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN10)
+            ScopedHandle hMapping(CreateFileMappingFromApp(hFile, nullptr, PAGE_READONLY, 0, nullptr));
+#else
+            ScopedHandle hMapping(CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr));
+#endif
+            if (!hMapping)
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            // The view holds its own reference to the mapping object.
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN10)
+            void* view = MapViewOfFileFromApp(hMapping.get(), FILE_MAP_READ, 0, 0);
+#else
+            void* view = MapViewOfFile(hMapping.get(), FILE_MAP_READ, 0, 0, 0);
+#endif
+            if (!view)
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            m_data = static_cast<const char*>(view);
+            m_size = static_cast<size_t>(fileInfo.EndOfFile.QuadPart);
+
+            return S_OK;
+        }
+
+        void Close()
+        {
+            if (m_data)
+            {
+                UnmapViewOfFile(m_data);
+                m_data = nullptr;
+                m_size = 0;
+            }
+        }
+
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        const char* m_data;
+        size_t      m_size;
+    };
+
+    //---------------------------------------------------------------------------------
+    // Zero-copy stream over a memory mapped file. OpenEXR checks isMemoryMapped() and
+    // then decompresses chunks directly out of the mapping via readMemoryMapped(),
+    // so no read syscalls or intermediate buffers are needed.
+    class MappedInputStream : public Imf::IStream
+    {
+    public:
+        MappedInputStream(const char* data, size_t size, const char fileName[]) :
+            IStream(fileName), m_data(data), m_size(size), m_pos(0) {}
+
+        MappedInputStream(const MappedInputStream &) = delete;
+        MappedInputStream& operator = (const MappedInputStream &) = delete;
+
+        virtual bool isMemoryMapped() const override
+        {
+            return true;
+        }
+
+        virtual char* readMemoryMapped(int n) override
+        {
+            // Report errors with OpenEXR's own exception types, as Imf::StdIFStream does.
+            if (n < 0 || static_cast<size_t>(n) > m_size - m_pos)
+            {
+                throw Iex::InputExc("Unexpected end of file.");
+            }
+
+            auto result = const_cast<char*>(m_data + m_pos);
+            m_pos += static_cast<size_t>(n);
+
+            return result;
+        }
+
+        virtual bool read(char c[], int n) override
+        {
+            memcpy(c, readMemoryMapped(n), static_cast<size_t>(n));
+
+            return m_pos < m_size;
+        }
+
+        virtual Imf::Int64 tellg() override
+        {
+            return static_cast<Imf::Int64>(m_pos);
+        }
+
+        virtual void seekg(Imf::Int64 pos) override
+        {
+            // Seeking to the end is legal; reading from there is not.
+            if (pos < 0 || static_cast<Imf::Int64>(m_size) < pos)
+            {
+                throw Iex::InputExc("Seek outside of file.");
+            }
+
+            m_pos = static_cast<size_t>(pos);
+        }
+
+    private:
+        const char* m_data;
+        size_t      m_size;
+        size_t      m_pos;
+    };
+
+    // Reads from a COM stream, e.g. one opened over a brokered StorageFile, so that files
+    // the app can't open by path don't have to be copied somewhere it can.
+    class ComInputStream : public Imf::IStream
+    {
+    public:
+        ComInputStream(::IStream* stream, const char fileName[]) :
+            IStream(fileName), m_stream(stream), m_pos(0)
+        {
+            STATSTG stat = {};
+            HRESULT hr = m_stream->Stat(&stat, STATFLAG_NONAME);
+            if (FAILED(hr))
+            {
+                throw com_exception(hr);
+            }
+
+            m_EOF = static_cast<Imf::Int64>(stat.cbSize.QuadPart);
+
+            seekg(0);
+        }
+
+        ComInputStream(const ComInputStream &) = delete;
+        ComInputStream& operator = (const ComInputStream &) = delete;
+
+        virtual bool read(char c[], int n) override
+        {
+            ULONG bytesRead = 0;
+            HRESULT hr = m_stream->Read(c, static_cast<ULONG>(n), &bytesRead);
+            if (FAILED(hr))
+            {
+                throw com_exception(hr);
+            }
+
+            if (bytesRead != static_cast<ULONG>(n))
+            {
+                throw com_exception(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF));
+            }
+
+            m_pos += n;
+
+            return m_pos < m_EOF;
+        }
+
+        virtual Imf::Int64 tellg() override
+        {
+            return m_pos;
+        }
+
+        virtual void seekg(Imf::Int64 pos) override
+        {
+            LARGE_INTEGER dist;
+            dist.QuadPart = pos;
+            HRESULT hr = m_stream->Seek(dist, STREAM_SEEK_SET, nullptr);
+            if (FAILED(hr))
+            {
+                throw com_exception(hr);
+            }
+
+            m_pos = pos;
+        }
+
+        virtual void clear() override
+        {
+        }
+
+    private:
+        Microsoft::WRL::ComPtr<::IStream> m_stream;
+        Imf::Int64 m_pos;
+        Imf::Int64 m_EOF;
+    };
+
+    //---------------------------------------------------------------------------------
+    // OpenEXR sizes a file's line buffers from its per-file thread count, but runs the
+    // chunk decompression tasks on the process-wide pool. Grow the pool to cover the
+    // largest budget requested so far and return the resolved per-file count.
+    int PrepareThreadPool(int numThreads)
+    {
+        if (numThreads < 0)
+        {
+            numThreads = static_cast<int>(std::thread::hardware_concurrency());
+        }
+
+        static std::mutex s_poolLock;
+        std::lock_guard<std::mutex> lock(s_poolLock);
+
+        if (numThreads > Imf::globalThreadCount())
+        {
+            Imf::setGlobalThreadCount(numThreads);
+        }
+
+        return numThreads;
+    }
+
+    //---------------------------------------------------------------------------------
+    // Describes which file channels are decoded into which components of the output
+    // pixel. Components with an empty name are not read from the file; the alpha
+    // component is then filled with 1.0 after decoding.
+    struct ChannelLayout
+    {
+        std::string     names[4];
+        size_t          numComponents;
+        Imf::PixelType  pixelType;
+        bool            useRgbaInterface;   // luminance/chroma files need RgbaInputFile's YCA reconstruction
+        DXGI_FORMAT     format;
+
+        size_t ComponentSize() const { return (pixelType == Imf::HALF) ? 2 : 4; }
+        size_t PixelSize() const { return numComponents * ComponentSize(); }
+    };
+
+    HRESULT ChooseChannelLayout(
+        const Imf::ChannelList& channels,
+        EXR_FLAGS flags,
+        const char* layerName,
+        ChannelLayout& layout)
+    {
+        layout = ChannelLayout();
+        layout.pixelType = Imf::HALF;
+
+        const bool preserveFp32 = (flags & EXR_FLAGS_PRESERVE_FP32) != 0;
+        auto precisionOf = [&](const Imf::Channel* ch)
+        {
+            return (preserveFp32 && ch->type != Imf::HALF) ? Imf::FLOAT : Imf::HALF;
+        };
+
+        std::string prefix;
+        if (layerName && *layerName)
+        {
+            // An exact channel name selects just that channel.
+            if (auto ch = channels.findChannel(layerName))
+            {
+                layout.names[0] = layerName;
+                layout.numComponents = 1;
+                layout.pixelType = precisionOf(ch);
+                layout.format = (layout.pixelType == Imf::HALF) ? DXGI_FORMAT_R16_FLOAT : DXGI_FORMAT_R32_FLOAT;
+                return S_OK;
+            }
+
+            prefix = std::string(layerName) + '.';
+        }
+
+        auto find = [&](const char* suffix) { return channels.findChannel((prefix + suffix).c_str()); };
+
+        const Imf::Channel* rgb[3] = { find("R"), find("G"), find("B") };
+        const Imf::Channel* a = (flags & EXR_FLAGS_IGNORE_ALPHA) ? nullptr : find("A");
+
+        if (!rgb[0] && !rgb[1] && !rgb[2])
+        {
+            auto y = find("Y");
+            if (!y)
+                return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+            if (find("RY") || find("BY") || a)
+            {
+                // Subsampled chroma or luminance with alpha; let OpenEXR reconstruct RGBA.
+                layout.useRgbaInterface = true;
+                layout.names[0] = (layerName) ? layerName : "";
+                layout.numComponents = 4;
+                layout.format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+                return S_OK;
+            }
+
+            layout.names[0] = prefix + "Y";
+            layout.numComponents = 1;
+            layout.pixelType = precisionOf(y);
+            layout.format = (layout.pixelType == Imf::HALF) ? DXGI_FORMAT_R16_FLOAT : DXGI_FORMAT_R32_FLOAT;
+            return S_OK;
+        }
+
+        static const char* const s_suffixes[3] = { "R", "G", "B" };
+        for (size_t i = 0; i < 3; ++i)
+        {
+            // Missing color channels are still requested so OpenEXR fills them with zero.
+            layout.names[i] = prefix + s_suffixes[i];
+            if (rgb[i] && precisionOf(rgb[i]) == Imf::FLOAT)
+            {
+                layout.pixelType = Imf::FLOAT;
+            }
+        }
+
+        if (a)
+        {
+            layout.names[3] = prefix + "A";
+            if (precisionOf(a) == Imf::FLOAT)
+            {
+                layout.pixelType = Imf::FLOAT;
+            }
+        }
+
+        if (layout.pixelType == Imf::FLOAT)
+        {
+            layout.numComponents = a ? 4 : 3;
+            layout.format = a ? DXGI_FORMAT_R32G32B32A32_FLOAT : DXGI_FORMAT_R32G32B32_FLOAT;
+        }
+        else
+        {
+            // DXGI has no three component half format, so opaque half images keep an alpha of 1.
+            layout.numComponents = 4;
+            layout.format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+        }
+
+        return S_OK;
+    }
+
+    // Describes the caller's buffer to OpenEXR. base is the address of pixel (0, 0) in
+    // data window coordinates, which is usually outside of the buffer itself.
+    Imf::FrameBuffer MakeFrameBuffer(const ChannelLayout& layout, char* base, size_t rowPitch)
+    {
+        const size_t componentSize = layout.ComponentSize();
+        const size_t pixelSize = layout.PixelSize();
+
+        Imf::FrameBuffer frameBuffer;
+        for (size_t i = 0; i < layout.numComponents; ++i)
+        {
+            if (!layout.names[i].empty())
+            {
+                frameBuffer.insert(layout.names[i], Imf::Slice(layout.pixelType,
+                    base + i * componentSize, pixelSize, rowPitch, 1, 1, 0.0));
+            }
+        }
+
+        return frameBuffer;
+    }
+
+    // Alpha that was absent or ignored isn't written by OpenEXR; make those pixels opaque.
+    void FillOpaqueAlpha(const ChannelLayout& layout, uint8_t* pixels, size_t width, size_t height, size_t rowPitch)
+    {
+        if (layout.numComponents != 4 || !layout.names[3].empty())
+            return;
+
+        const size_t componentSize = layout.ComponentSize();
+        const size_t pixelSize = layout.PixelSize();
+
+        for (size_t y = 0; y < height; ++y)
+        {
+            uint8_t* pAlpha = pixels + y * rowPitch + 3 * componentSize;
+            for (size_t x = 0; x < width; ++x, pAlpha += pixelSize)
+            {
+                if (layout.pixelType == Imf::HALF)
+                {
+                    *reinterpret_cast<uint16_t*>(pAlpha) = 0x3C00;
+                }
+                else
+                {
+                    *reinterpret_cast<float*>(pAlpha) = 1.f;
+                }
+            }
+        }
+    }
+
+    class OutputStream : public Imf::OStream
+    {
+    public:
+        OutputStream(HANDLE hFile, const char fileName[]) :
+            OStream(fileName), m_hFile(hFile) {}
+
+        OutputStream(const OutputStream &) = delete;
+        OutputStream& operator = (const OutputStream &) = delete;
+
+        virtual void write(const char c[], int n) override
+        {
+            DWORD bytesWritten;
+            if (!WriteFile(m_hFile, c, static_cast<DWORD>(n), &bytesWritten, nullptr))
+            {
+                throw com_exception(HRESULT_FROM_WIN32(GetLastError()));
+            }
+        }
+
+        virtual Imf::Int64 tellp() override
+        {
             LARGE_INTEGER dist = {};
             LARGE_INTEGER result;
             if (!SetFilePointerEx(m_hFile, dist, &result, FILE_CURRENT))
             {
                 throw com_exception(HRESULT_FROM_WIN32(GetLastError()));
             }
+            return result.QuadPart;
+        }
+
+        virtual void seekp(Imf::Int64 pos) override
+        {
+            LARGE_INTEGER dist;
+            dist.QuadPart = pos;
+            if (!SetFilePointerEx(m_hFile, dist, nullptr, FILE_BEGIN))
+            {
+                throw com_exception(HRESULT_FROM_WIN32(GetLastError()));
+            }
+        }
+
+    private:
+        HANDLE m_hFile;
+    };
+}
+
+
+//=====================================================================================
+// Entry-points
+//=====================================================================================
+
+//-------------------------------------------------------------------------------------
+// Obtain metadata from EXR file on disk
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::GetMetadataFromEXRFile(const wchar_t* szFile, TexMetadata& metadata, EXR_FLAGS flags, const char* layerName)
+{
+    if (!szFile)
+        return E_INVALIDARG;
+
+    // Opening the reader only parses the header; no pixels are decoded.
+    EXRImageReader reader;
+    return reader.Open(szFile, &metadata, 0, flags, layerName);
+}
+
+
+//-------------------------------------------------------------------------------------
+// Load a EXR file from disk
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::LoadFromEXRFile(const wchar_t* szFile, TexMetadata* metadata, ScratchImage& image, int numThreads, EXR_FLAGS flags, const char* layerName)
+{
+    if (!szFile)
+        return E_INVALIDARG;
+
+    image.Release();
+
+    if (metadata)
+    {
+        memset(metadata, 0, sizeof(TexMetadata));
+    }
+
+    EXRImageReader reader;
+    HRESULT hr = reader.Open(szFile, metadata, numThreads, flags, layerName);
+    if (FAILED(hr))
+        return hr;
+
+    const TexMetadata& mdata = reader.GetMetadata();
+
+    hr = image.Initialize2D(mdata.format, mdata.width, mdata.height, 1, 1);
+    if (FAILED(hr))
+        return hr;
+
+    auto img = image.GetImage(0, 0, 0);
+    assert(img != nullptr);
+
+    hr = reader.ReadScanlines(0, mdata.height, img->pixels, img->rowPitch);
+    if (FAILED(hr))
+    {
+        image.Release();
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------------------------
+// Streaming EXR reader
+//-------------------------------------------------------------------------------------
+struct DirectX::EXRImageReader::Impl
+{
+    HRESULT Initialize(const char* fileName, int numThreads, EXR_FLAGS flags, const char* layerName, size_t part);
+
+    ScopedHandle                            hFile;
+    MappedFile                              mapping;
+    Microsoft::WRL::ComPtr<::IStream>       comStream;
+    std::unique_ptr<Imf::IStream>           stream;
+    std::unique_ptr<Imf::InputFile>         file;
+    std::unique_ptr<Imf::MultiPartInputFile> multiPartFile; // only for multi-part files
+    std::unique_ptr<Imf::InputPart>         inputPart;
+    std::unique_ptr<Imf::RgbaInputFile>     rgbaFile;
+    std::unique_ptr<Imf::IStream>           levelStream;
+    std::unique_ptr<Imf::TiledInputFile>    tiledFile;      // only for multi-resolution files
+    size_t                                  levelCount;
+    size_t                                  partCount;
+    ChannelLayout                           layout;
+    Imath::Box2i                            dataWindow;
+    TexMetadata                             metadata;
+};
+
+//-------------------------------------------------------------------------------------
+// Reads the header from stream and prepares the frame buffer layout
+//-------------------------------------------------------------------------------------
+HRESULT DirectX::EXRImageReader::Impl::Initialize(const char* fileName, int numThreads, EXR_FLAGS flags, const char* layerName, size_t part)
+{
+    HRESULT hr = S_OK;
+
+    try
+    {
+        numThreads = PrepareThreadPool(numThreads);
+
+        // The version field following the magic number flags multi-part files. Only those are
+        // opened with Imf::MultiPartInputFile, which reads the headers of every part.
+        char magicAndVersion[8];
+        stream->read(magicAndVersion, sizeof(magicAndVersion));
+        stream->seekg(0);
+
+        int version = static_cast<int>(
+            static_cast<uint32_t>(static_cast<uint8_t>(magicAndVersion[4])) |
+            static_cast<uint32_t>(static_cast<uint8_t>(magicAndVersion[5])) << 8 |
+            static_cast<uint32_t>(static_cast<uint8_t>(magicAndVersion[6])) << 16 |
+            static_cast<uint32_t>(static_cast<uint8_t>(magicAndVersion[7])) << 24);
+
+        partCount = 1;
+        if (Imf::isMultiPart(version))
+        {
+            multiPartFile.reset(new Imf::MultiPartInputFile(*stream, numThreads));
+            partCount = static_cast<size_t>(multiPartFile->parts());
+        }
+
+        if (part >= partCount)
+            return E_INVALIDARG;
+
+        if (part > 0)
+        {
+            inputPart.reset(new Imf::InputPart(*multiPartFile, static_cast<int>(part)));
+        }
+        else
+        {
+            // Imf::InputFile reads part 0 of a multi-part file.
+            multiPartFile.reset();
+            stream->seekg(0);
+            file.reset(new Imf::InputFile(*stream, numThreads));
+        }
+
+        const Imf::Header& header = inputPart ? inputPart->header() : file->header();
+
+        hr = ChooseChannelLayout(header.channels(), flags, layerName, layout);
+        if (FAILED(hr))
+            return hr;
+
+        dataWindow = header.dataWindow();
+
+        if (layout.useRgbaInterface)
+        {
+            // Imf::RgbaInputFile can only read part 0.
+            if (part > 0)
+                return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+            file.reset();
+            stream->seekg(0);
+            rgbaFile.reset(new Imf::RgbaInputFile(*stream, layout.names[0], numThreads));
+            dataWindow = rgbaFile->dataWindow();
+        }
+
+        // Multi-resolution tiled files get a second, independent view of the source so the
+        // coarser levels can be read with Imf::TiledInputFile without disturbing the stream
+        // position of the scanline reader: another stream over the mapping, or a clone of a
+        // COM stream. Levels are not offered for files that could not be mapped.
+        levelCount = 1;
+        if (file && file->header().hasTileDescription() &&
+            file->header().tileDescription().mode != Imf::ONE_LEVEL)
+        {
+            auto mode = file->header().tileDescription().mode;
+
+            Microsoft::WRL::ComPtr<::IStream> clone;
+            if (mapping.data())
+            {
+                levelStream.reset(new MappedInputStream(mapping.data(), mapping.size(), fileName));
+            }
+            else if (comStream && SUCCEEDED(comStream->Clone(&clone)))
+            {
+                levelStream.reset(new ComInputStream(clone.Get(), fileName));
+            }
+
+            if (levelStream)
+            {
+                tiledFile.reset(new Imf::TiledInputFile(*levelStream, numThreads));
+
+                levelCount = static_cast<size_t>((mode == Imf::MIPMAP_LEVELS)
+                    ? tiledFile->numLevels()
+                    : (std::min)(tiledFile->numXLevels(), tiledFile->numYLevels()));
+            }
+        }
+
+        int width = dataWindow.max.x - dataWindow.min.x + 1;
+        int height = dataWindow.max.y - dataWindow.min.y + 1;
+
+        if (width < 1 || height < 1)
+            return E_FAIL;
+
+        memset(&metadata, 0, sizeof(TexMetadata));
+        metadata.width = static_cast<size_t>(width);
+        metadata.height = static_cast<size_t>(height);
+        metadata.depth = metadata.arraySize = metadata.mipLevels = 1;
+        metadata.format = layout.format;
+        metadata.dimension = TEX_DIMENSION_TEXTURE2D;
+    }
+    catch (const com_exception& exc)
+    {
+#ifdef _DEBUG
+        OutputDebugStringA(exc.what());
+#endif
+        hr = exc.hr();
+    }
+    catch (const std::exception& exc)
+    {
+        exc;
+#ifdef _DEBUG
+        OutputDebugStringA(exc.what());
+#endif
+        hr = E_FAIL;
+    }
+    catch (...)
+    {
+        hr = E_UNEXPECTED;
+    }
+
+    return hr;
+}
+
+DirectX::EXRImageReader::EXRImageReader() noexcept
+{
+}
+
+DirectX::EXRImageReader::~EXRImageReader()
+{
+    Close();
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::EXRImageReader::Open(const wchar_t* szFile, TexMetadata* metadata, int numThreads, EXR_FLAGS flags, const char* layerName, size_t part)
+{
+    if (!szFile)
+        return E_INVALIDARG;
+
+    Close();
+
+    if (metadata)
+    {
+        memset(metadata, 0, sizeof(TexMetadata));
+    }
+
+    std::unique_ptr<Impl> impl(new (std::nothrow) Impl);
+    if (!impl)
+        return E_OUTOFMEMORY;
+
+    char fileName[MAX_PATH];
+    int result = WideCharToMultiByte(CP_ACP, 0, szFile, -1, fileName, MAX_PATH, nullptr, nullptr);
+    if (result <= 0)
+    {
+        *fileName = 0;
+    }
+
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    impl->hFile.reset(safe_handle(CreateFile2(szFile, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr)));
+#else
+    impl->hFile.reset(safe_handle(CreateFileW(szFile, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, nullptr)));
+#endif
+    if (!impl->hFile)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+
+    try
+    {
+        // The stream must outlive the file, and both are kept open so scanlines can be read on demand.
+        // Prefer a memory mapped stream; fall back to file reads if the mapping can't be created,
+        // e.g. when a 32-bit process lacks the address space for a very large file.
+        if (SUCCEEDED(impl->mapping.Open(impl->hFile.get())))
+        {
+            impl->stream.reset(new MappedInputStream(impl->mapping.data(), impl->mapping.size(), fileName));
+        }
+        else
+        {
+            impl->stream.reset(new InputStream(impl->hFile.get(), fileName));
+        }
+    }
+    catch (const com_exception& exc)
+    {
+        return exc.hr();
+    }
+    catch (...)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    hr = impl->Initialize(fileName, numThreads, flags, layerName, part);
+    if (FAILED(hr))
+        return hr;
+
+    if (metadata)
+    {
+        *metadata = impl->metadata;
+    }
+
+    m_impl = std::move(impl);
 
-            return result.QuadPart >= m_EOF;
-        }
+    return S_OK;
+}
 
-        virtual Imf::Int64 tellg() override
-        {
-            LARGE_INTEGER dist = {};
-            LARGE_INTEGER result;
-            if (!SetFilePointerEx(m_hFile, dist, &result, FILE_CURRENT))
-            {
-                throw com_exception(HRESULT_FROM_WIN32(GetLastError()));
-            }
-            return result.QuadPart;
-        }
+_Use_decl_annotations_
+HRESULT DirectX::EXRImageReader::Open(HANDLE hFile, TexMetadata* metadata, int numThreads, EXR_FLAGS flags, const char* layerName, size_t part)
+{
+    if (!hFile || hFile == INVALID_HANDLE_VALUE)
+        return E_INVALIDARG;
 
-        virtual void seekg(Imf::Int64 pos) override
-        {
-            LARGE_INTEGER dist;
-            dist.QuadPart = pos;
-            if (!SetFilePointerEx(m_hFile, dist, nullptr, FILE_BEGIN))
-            {
-                throw com_exception(HRESULT_FROM_WIN32(GetLastError()));
-            }
-        }
+    Close();
 
-        virtual void clear() override
-        {
-            SetLastError(0);
-        }
+    if (metadata)
+    {
+        memset(metadata, 0, sizeof(TexMetadata));
+    }
 
-    private:
-        HANDLE m_hFile;
-        LONGLONG m_EOF;
-    };
+    std::unique_ptr<Impl> impl(new (std::nothrow) Impl);
+    if (!impl)
+        return E_OUTOFMEMORY;
 
-    class OutputStream : public Imf::OStream
+    const char fileName[] = "";
+
+    // Keep a handle of our own so the caller may close theirs as soon as Open returns.
+    HANDLE hDuplicate = nullptr;
+    if (!DuplicateHandle(GetCurrentProcess(), hFile, GetCurrentProcess(), &hDuplicate, 0, FALSE, DUPLICATE_SAME_ACCESS))
     {
-    public:
-        OutputStream(HANDLE hFile, const char fileName[]) :
-            OStream(fileName), m_hFile(hFile) {}
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
 
-        OutputStream(const OutputStream &) = delete;
-        OutputStream& operator = (const OutputStream &) = delete;
+    impl->hFile.reset(hDuplicate);
 
-        virtual void write(const char c[], int n) override
+    try
+    {
+        if (SUCCEEDED(impl->mapping.Open(impl->hFile.get())))
         {
-            DWORD bytesWritten;
-            if (!WriteFile(m_hFile, c, static_cast<DWORD>(n), &bytesWritten, nullptr))
-            {
-                throw com_exception(HRESULT_FROM_WIN32(GetLastError()));
-            }
+            impl->stream.reset(new MappedInputStream(impl->mapping.data(), impl->mapping.size(), fileName));
         }
-
-        virtual Imf::Int64 tellp() override
+        else
         {
-            LARGE_INTEGER dist = {};
-            LARGE_INTEGER result;
-            if (!SetFilePointerEx(m_hFile, dist, &result, FILE_CURRENT))
-            {
-                throw com_exception(HRESULT_FROM_WIN32(GetLastError()));
-            }
-            return result.QuadPart;
+            impl->stream.reset(new InputStream(impl->hFile.get(), fileName));
         }
+    }
+    catch (const com_exception& exc)
+    {
+        return exc.hr();
+    }
+    catch (...)
+    {
+        return E_OUTOFMEMORY;
+    }
 
-        virtual void seekp(Imf::Int64 pos) override
-        {
-            LARGE_INTEGER dist;
-            dist.QuadPart = pos;
-            if (!SetFilePointerEx(m_hFile, dist, nullptr, FILE_BEGIN))
-            {
-                throw com_exception(HRESULT_FROM_WIN32(GetLastError()));
-            }
-        }
+    HRESULT hr = impl->Initialize(fileName, numThreads, flags, layerName, part);
+    if (FAILED(hr))
+        return hr;
 
-    private:
-        HANDLE m_hFile;
-    };
-}
+    if (metadata)
+    {
+        *metadata = impl->metadata;
+    }
 
+    m_impl = std::move(impl);
 
-//=====================================================================================
-// Entry-points
-//=====================================================================================
+    return S_OK;
+}
 
-//-------------------------------------------------------------------------------------
-// Obtain metadata from EXR file on disk
-//-------------------------------------------------------------------------------------
 _Use_decl_annotations_
-HRESULT DirectX::GetMetadataFromEXRFile(const wchar_t* szFile, TexMetadata& metadata)
+HRESULT DirectX::EXRImageReader::Open(IStream* stream, TexMetadata* metadata, int numThreads, EXR_FLAGS flags, const char* layerName, size_t part)
 {
-    if (!szFile)
+    if (!stream)
         return E_INVALIDARG;
 
-    char fileName[MAX_PATH];
-    int result = WideCharToMultiByte(CP_ACP, 0, szFile, -1, fileName, MAX_PATH, nullptr, nullptr);
-    if (result <= 0)
+    Close();
+
+    if (metadata)
     {
-        *fileName = 0;
+        memset(metadata, 0, sizeof(TexMetadata));
     }
 
-#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
-    ScopedHandle hFile(safe_handle(CreateFile2(szFile, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr)));
-#else
-    ScopedHandle hFile(safe_handle(CreateFileW(szFile, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
-        FILE_FLAG_SEQUENTIAL_SCAN, nullptr)));
-#endif
-    if (!hFile)
+    std::unique_ptr<Impl> impl(new (std::nothrow) Impl);
+    if (!impl)
+        return E_OUTOFMEMORY;
+
+    const char fileName[] = "";
+
+    try
     {
-        return HRESULT_FROM_WIN32(GetLastError());
+        impl->comStream = stream;
+        impl->stream.reset(new ComInputStream(stream, fileName));
+    }
+    catch (const com_exception& exc)
+    {
+        return exc.hr();
+    }
+    catch (...)
+    {
+        return E_OUTOFMEMORY;
     }
 
-    InputStream stream(hFile.get(), fileName);
+    HRESULT hr = impl->Initialize(fileName, numThreads, flags, layerName, part);
+    if (FAILED(hr))
+        return hr;
+
+    if (metadata)
+    {
+        *metadata = impl->metadata;
+    }
+
+    m_impl = std::move(impl);
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::EXRImageReader::ReadScanlines(size_t firstRow, size_t numRows, uint8_t* pixels, size_t rowPitch)
+{
+    if (!m_impl)
+        return E_UNEXPECTED;
+
+    if (!pixels)
+        return E_POINTER;
+
+    const TexMetadata& mdata = m_impl->metadata;
+
+    if (firstRow >= mdata.height || numRows > mdata.height - firstRow)
+        return E_INVALIDARG;
+
+    const ChannelLayout& layout = m_impl->layout;
+    const size_t componentSize = layout.ComponentSize();
+    const size_t pixelSize = layout.PixelSize();
+
+    if (rowPitch < mdata.width * pixelSize || (rowPitch % componentSize) > 0)
+        return E_INVALIDARG;
+
+    if (layout.useRgbaInterface && (rowPitch % sizeof(Imf::Rgba)) > 0)
+        return E_INVALIDARG;
+
+    if (!numRows)
+        return S_OK;
 
     HRESULT hr = S_OK;
 
     try
     {
-        Imf::RgbaInputFile file(stream);
+        auto& dw = m_impl->dataWindow;
 
-        auto dw = file.dataWindow();
+        int y0 = dw.min.y + static_cast<int>(firstRow);
+        int y1 = y0 + static_cast<int>(numRows) - 1;
 
-        int width = dw.max.x - dw.min.x + 1;
-        int height = dw.max.y - dw.min.y + 1;
+        // OpenEXR addresses the frame buffer in data window coordinates, so offset the base
+        // such that row y0 lands at the start of the caller's buffer.
+        if (m_impl->rgbaFile)
+        {
+            size_t yStride = rowPitch / sizeof(Imf::Rgba);
+            auto base = reinterpret_cast<Imf::Rgba*>(pixels)
+                - static_cast<ptrdiff_t>(dw.min.x)
+                - static_cast<ptrdiff_t>(y0) * static_cast<ptrdiff_t>(yStride);
 
-        if (width < 1 || height < 1)
-            return E_FAIL;
+            m_impl->rgbaFile->setFrameBuffer(base, 1, yStride);
+            m_impl->rgbaFile->readPixels(y0, y1);
+        }
+        else
+        {
+            auto base = reinterpret_cast<char*>(pixels)
+                - static_cast<ptrdiff_t>(dw.min.x) * static_cast<ptrdiff_t>(pixelSize)
+                - static_cast<ptrdiff_t>(y0) * static_cast<ptrdiff_t>(rowPitch);
 
-        metadata.width = static_cast<size_t>(width);
-        metadata.height = static_cast<size_t>(height);
-        metadata.depth = metadata.arraySize = metadata.mipLevels = 1;
-        metadata.format = DXGI_FORMAT_R16G16B16A16_FLOAT;
-        metadata.dimension = TEX_DIMENSION_TEXTURE2D;
+            if (m_impl->inputPart)
+            {
+                m_impl->inputPart->setFrameBuffer(MakeFrameBuffer(layout, base, rowPitch));
+                m_impl->inputPart->readPixels(y0, y1);
+            }
+            else
+            {
+                m_impl->file->setFrameBuffer(MakeFrameBuffer(layout, base, rowPitch));
+                m_impl->file->readPixels(y0, y1);
+            }
+
+            FillOpaqueAlpha(layout, pixels, mdata.width, numRows, rowPitch);
+        }
     }
     catch (const com_exception& exc)
     {
@@ -282,72 +1097,108 @@ HRESULT DirectX::GetMetadataFromEXRFile(const wchar_t* szFile, TexMetadata& meta
     return hr;
 }
 
+void DirectX::EXRImageReader::Close() noexcept
+{
+    if (m_impl)
+    {
+        // Destroy in dependency order: file, then stream, then mapping and handle.
+        m_impl->tiledFile.reset();
+        m_impl->levelStream.reset();
+        m_impl->file.reset();
+        m_impl->inputPart.reset();
+        m_impl->multiPartFile.reset();
+        m_impl->rgbaFile.reset();
+        m_impl->stream.reset();
+        m_impl->comStream.Reset();
+        m_impl->mapping.Close();
+        m_impl.reset();
+    }
+}
+
+size_t DirectX::EXRImageReader::GetPartCount() const noexcept
+{
+    return m_impl ? m_impl->partCount : 0;
+}
+
+size_t DirectX::EXRImageReader::GetLevelCount() const noexcept
+{
+    return m_impl ? m_impl->levelCount : 0;
+}
 
-//-------------------------------------------------------------------------------------
-// Load a EXR file from disk
-//-------------------------------------------------------------------------------------
 _Use_decl_annotations_
-HRESULT DirectX::LoadFromEXRFile(const wchar_t* szFile, TexMetadata* metadata, ScratchImage& image)
+HRESULT DirectX::EXRImageReader::GetLevelSize(size_t level, size_t* width, size_t* height) const noexcept
 {
-    if (!szFile)
-        return E_INVALIDARG;
+    if (!width || !height)
+        return E_POINTER;
 
-    image.Release();
+    *width = *height = 0;
 
-    if (metadata)
+    if (!m_impl)
+        return E_UNEXPECTED;
+
+    if (level >= m_impl->levelCount)
+        return E_INVALIDARG;
+
+    if (level == 0)
     {
-        memset(metadata, 0, sizeof(TexMetadata));
+        *width = m_impl->metadata.width;
+        *height = m_impl->metadata.height;
+        return S_OK;
     }
 
-    char fileName[MAX_PATH];
-    int result = WideCharToMultiByte(CP_ACP, 0, szFile, -1, fileName, MAX_PATH, nullptr, nullptr);
-    if (result <= 0)
+    try
     {
-        *fileName = 0;
+        int l = static_cast<int>(level);
+        *width = static_cast<size_t>(m_impl->tiledFile->levelWidth(l));
+        *height = static_cast<size_t>(m_impl->tiledFile->levelHeight(l));
     }
-
-#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
-    ScopedHandle hFile(safe_handle(CreateFile2(szFile, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr)));
-#else
-    ScopedHandle hFile(safe_handle(CreateFileW(szFile, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
-        FILE_FLAG_SEQUENTIAL_SCAN, nullptr)));
-#endif
-    if (!hFile)
+    catch (...)
     {
-        return HRESULT_FROM_WIN32(GetLastError());
+        return E_FAIL;
     }
 
-    InputStream stream(hFile.get(), fileName);
+    return S_OK;
+}
 
-    HRESULT hr = S_OK;
+_Use_decl_annotations_
+HRESULT DirectX::EXRImageReader::ReadLevel(size_t level, uint8_t* pixels, size_t rowPitch)
+{
+    if (!m_impl)
+        return E_UNEXPECTED;
 
-    try
-    {
-        Imf::RgbaInputFile file(stream);
+    if (!pixels)
+        return E_POINTER;
 
-        auto dw = file.dataWindow();
+    if (level >= m_impl->levelCount)
+        return E_INVALIDARG;
 
-        int width = dw.max.x - dw.min.x + 1;
-        int height = dw.max.y - dw.min.y + 1;
+    if (level == 0)
+        return ReadScanlines(0, m_impl->metadata.height, pixels, rowPitch);
 
-        if (width < 1 || height < 1)
-            return E_FAIL;
+    size_t width, height;
+    HRESULT hr = GetLevelSize(level, &width, &height);
+    if (FAILED(hr))
+        return hr;
 
-        if (metadata)
-        {
-            metadata->width = static_cast<size_t>(width);
-            metadata->height = static_cast<size_t>(height);
-            metadata->depth = metadata->arraySize = metadata->mipLevels = 1;
-            metadata->format = DXGI_FORMAT_R16G16B16A16_FLOAT;
-            metadata->dimension = TEX_DIMENSION_TEXTURE2D;
-        }
+    const ChannelLayout& layout = m_impl->layout;
 
-        hr = image.Initialize2D(DXGI_FORMAT_R16G16B16A16_FLOAT, width, height, 1, 1);
-        if (FAILED(hr))
-            return hr;
+    if (rowPitch < width * layout.PixelSize() || (rowPitch % layout.ComponentSize()) > 0)
+        return E_INVALIDARG;
+
+    try
+    {
+        auto tiledFile = m_impl->tiledFile.get();
+        int l = static_cast<int>(level);
+
+        auto dw = tiledFile->dataWindowForLevel(l, l);
+        auto base = reinterpret_cast<char*>(pixels)
+            - static_cast<ptrdiff_t>(dw.min.x) * static_cast<ptrdiff_t>(layout.PixelSize())
+            - static_cast<ptrdiff_t>(dw.min.y) * static_cast<ptrdiff_t>(rowPitch);
 
-        file.setFrameBuffer(reinterpret_cast<Imf::Rgba*>(image.GetPixels()) - dw.min.x - dw.min.y * width, 1, width);
-        file.readPixels(dw.min.y, dw.max.y);
+        tiledFile->setFrameBuffer(MakeFrameBuffer(layout, base, rowPitch));
+        tiledFile->readTiles(0, tiledFile->numXTiles(l) - 1, 0, tiledFile->numYTiles(l) - 1, l, l);
+
+        FillOpaqueAlpha(layout, pixels, width, height, rowPitch);
     }
     catch (const com_exception& exc)
     {
@@ -369,6 +1220,57 @@ HRESULT DirectX::LoadFromEXRFile(const wchar_t* szFile, TexMetadata* metadata, S
         hr = E_UNEXPECTED;
     }
 
+    return hr;
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::EXRImageReader::ReadPreview(ScratchImage& image)
+{
+    image.Release();
+
+    if (!m_impl)
+        return E_UNEXPECTED;
+
+    const Imf::Header& header = m_impl->rgbaFile ? m_impl->rgbaFile->header() :
+        m_impl->inputPart ? m_impl->inputPart->header() : m_impl->file->header();
+    if (!header.hasPreviewImage())
+        return S_FALSE;
+
+    HRESULT hr = S_OK;
+
+    try
+    {
+        const Imf::PreviewImage& preview = header.previewImage();
+        if (preview.width() < 1 || preview.height() < 1)
+            return S_FALSE;
+
+        hr = image.Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, preview.width(), preview.height(), 1, 1);
+        if (FAILED(hr))
+            return hr;
+
+        // Imf::PreviewRgba is tightly packed 8-bit RGBA.
+        static_assert(sizeof(Imf::PreviewRgba) == 4, "PreviewRgba size mismatch");
+
+        const Image* img = image.GetImage(0, 0, 0);
+        auto src = reinterpret_cast<const uint8_t*>(preview.pixels());
+        for (size_t y = 0; y < img->height; ++y)
+        {
+            memcpy(img->pixels + y * img->rowPitch, src + y * img->width * 4, img->width * 4);
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        exc;
+#ifdef _DEBUG
+        OutputDebugStringA(exc.what());
+#endif
+        hr = E_FAIL;
+    }
+    catch (...)
+    {
+        hr = E_UNEXPECTED;
+    }
+
     if (FAILED(hr))
     {
         image.Release();
@@ -377,6 +1279,12 @@ HRESULT DirectX::LoadFromEXRFile(const wchar_t* szFile, TexMetadata* metadata, S
     return hr;
 }
 
+const TexMetadata& DirectX::EXRImageReader::GetMetadata() const noexcept
+{
+    static const TexMetadata s_empty = {};
+    return m_impl ? m_impl->metadata : s_empty;
+}
+
 
 //-------------------------------------------------------------------------------------
 // Save a EXR file to disk
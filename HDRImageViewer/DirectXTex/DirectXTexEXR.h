@@ -6,19 +6,126 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 //--------------------------------------------------------------------------------------
 
+#pragma once
+
 #include "directxtex.h"
 
+#include <memory>
+
 #pragma comment(lib,"IlmImf-2_2.lib")
+#pragma comment(lib,"IlmThread-2_2.lib")
 
 namespace DirectX
 {
+    // Thread budget for EXR decompression. EXR_THREADS_AUTO sizes OpenEXR's worker pool to
+    // the number of hardware threads; 0 decodes entirely on the calling thread.
+    constexpr int EXR_THREADS_AUTO = -1;
+
+    enum EXR_FLAGS : unsigned long
+    {
+        EXR_FLAGS_NONE                  = 0x0,
+
+        EXR_FLAGS_PRESERVE_FP32         = 0x1,
+            // Keep 32-bit float channels at full precision instead of converting them to half
+
+        EXR_FLAGS_IGNORE_ALPHA          = 0x2,
+            // Treat the image as opaque even if it has an alpha channel
+    };
+
+    // The output format follows the selected channels:
+    //   RGB(A), half                          DXGI_FORMAT_R16G16B16A16_FLOAT (alpha filled with 1)
+    //   RGBA, float + PRESERVE_FP32           DXGI_FORMAT_R32G32B32A32_FLOAT
+    //   RGB, float + PRESERVE_FP32            DXGI_FORMAT_R32G32B32_FLOAT
+    //   single channel or luminance only      DXGI_FORMAT_R16_FLOAT / DXGI_FORMAT_R32_FLOAT
+    //   luminance/chroma (Y, RY, BY)          DXGI_FORMAT_R16G16B16A16_FLOAT
+    //
+    // layerName selects the channels "<layerName>.R", ".G", ".B", ".A" (or ".Y"); if it names a
+    // channel exactly, e.g. "Z" or "depth.Z", only that channel is loaded. nullptr selects the
+    // unprefixed RGBA channels.
     HRESULT __cdecl GetMetadataFromEXRFile(
         _In_z_ const wchar_t* szFile,
-        _Out_ TexMetadata& metadata);
+        _Out_ TexMetadata& metadata,
+        _In_ EXR_FLAGS flags = EXR_FLAGS_NONE, _In_opt_z_ const char* layerName = nullptr);
 
     HRESULT __cdecl LoadFromEXRFile(
         _In_z_ const wchar_t* szFile,
-        _Out_opt_ TexMetadata* metadata, _Out_ ScratchImage& image);
+        _Out_opt_ TexMetadata* metadata, _Out_ ScratchImage& image,
+        _In_ int numThreads = EXR_THREADS_AUTO,
+        _In_ EXR_FLAGS flags = EXR_FLAGS_NONE, _In_opt_z_ const char* layerName = nullptr);
 
     HRESULT __cdecl SaveToEXRFile(_In_ const Image& image, _In_z_ const wchar_t* szFile);
+
+    //---------------------------------------------------------------------------------
+    // Streaming EXR reader
+    //
+    // Decodes an arbitrary range of scanlines directly into caller-owned memory. Only
+    // OpenEXR's internal line buffers are held between calls, so a strip or viewport
+    // consumer never needs a second full-size copy of the image.
+    class EXRImageReader
+    {
+    public:
+        EXRImageReader() noexcept;
+        ~EXRImageReader();
+
+        EXRImageReader(const EXRImageReader&) = delete;
+        EXRImageReader& operator=(const EXRImageReader&) = delete;
+
+        // part selects one part of a multi-part file; single part files only have part 0.
+        HRESULT __cdecl Open(
+            _In_z_ const wchar_t* szFile, _Out_opt_ TexMetadata* metadata,
+            _In_ int numThreads = EXR_THREADS_AUTO,
+            _In_ EXR_FLAGS flags = EXR_FLAGS_NONE, _In_opt_z_ const char* layerName = nullptr,
+            _In_ size_t part = 0);
+
+        // Reads from a file handle opened for reading, e.g. one brokered by the storage APIs.
+        // The reader keeps its own duplicate of the handle.
+        HRESULT __cdecl Open(
+            _In_ HANDLE hFile, _Out_opt_ TexMetadata* metadata,
+            _In_ int numThreads = EXR_THREADS_AUTO,
+            _In_ EXR_FLAGS flags = EXR_FLAGS_NONE, _In_opt_z_ const char* layerName = nullptr,
+            _In_ size_t part = 0);
+
+        // Reads the image from the start of a stream; the reader holds a reference to it until
+        // Close. Streams that support Clone also expose the levels of tiled files.
+        HRESULT __cdecl Open(
+            _In_ IStream* stream, _Out_opt_ TexMetadata* metadata,
+            _In_ int numThreads = EXR_THREADS_AUTO,
+            _In_ EXR_FLAGS flags = EXR_FLAGS_NONE, _In_opt_z_ const char* layerName = nullptr,
+            _In_ size_t part = 0);
+
+        // Number of parts in the file. Parts other than 0 are read with the generic channel
+        // interface, so luminance/chroma images and multi-resolution levels are only offered
+        // for part 0.
+        size_t __cdecl GetPartCount() const noexcept;
+
+        // Decodes rows [firstRow, firstRow + numRows) of the data window. Pixels are written
+        // in metadata.format; rowPitch must be a multiple of the component size.
+        HRESULT __cdecl ReadScanlines(
+            size_t firstRow, size_t numRows,
+            _Out_writes_bytes_(rowPitch * numRows) uint8_t* pixels, size_t rowPitch);
+
+        // Tiled multi-resolution files expose their mip levels (the diagonal of a ripmap) so a
+        // viewer can decode only the resolution it displays. Level 0 is the full image; all
+        // other files report a single level.
+        size_t __cdecl GetLevelCount() const noexcept;
+
+        HRESULT __cdecl GetLevelSize(size_t level, _Out_ size_t* width, _Out_ size_t* height) const noexcept;
+
+        // Decodes a whole level in metadata.format.
+        HRESULT __cdecl ReadLevel(
+            size_t level,
+            _Out_writes_bytes_(rowPitch * levelHeight) uint8_t* pixels, size_t rowPitch);
+
+        // Reads the optional low resolution preview stored in the file header, as
+        // DXGI_FORMAT_R8G8B8A8_UNORM_SRGB. Returns S_FALSE if the file has no preview.
+        HRESULT __cdecl ReadPreview(_Out_ ScratchImage& image);
+
+        void __cdecl Close() noexcept;
+
+        const TexMetadata& __cdecl GetMetadata() const noexcept;
+
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> m_impl;
+    };
 };
@@ -0,0 +1,693 @@
+#include "pch.h"
+#include "FormatConverter.h"
+
+#include <DirectXPackedVector.h>
+#include <ppl.h>
+
+#if !defined(_M_ARM) && !defined(_M_ARM64)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+using namespace HDRImageViewer;
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+using namespace Microsoft::WRL;
+
+static const UINT sc_RowsPerTask = 16; // Rows per parallel work item.
+static const UINT sc_StripBytes = 4 * 1024 * 1024; // Source pixels copied per strip when the source is not a bitmap.
+
+namespace
+{
+    typedef void (*RowKernel)(_In_ const uint8_t* src, _Out_ uint8_t* dst, UINT width);
+
+    const XMVECTORF32 s_unorm8Scale = { { { 1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f } } };
+    const XMVECTORF32 s_unorm16Scale = { { { 1.0f / 65535.0f, 1.0f / 65535.0f, 1.0f / 65535.0f, 1.0f / 65535.0f } } };
+
+    // Half float loads and stores of four channels.
+
+    struct SoftwareHalf
+    {
+        static XMVECTOR Load4(_In_ const uint8_t* p)
+        {
+            return XMLoadHalf4(reinterpret_cast<const XMHALF4*>(p));
+        }
+
+        static void Store4(_Out_ uint8_t* p, FXMVECTOR v)
+        {
+            XMStoreHalf4(reinterpret_cast<XMHALF4*>(p), v);
+        }
+    };
+
+#if defined(_M_ARM) || defined(_M_ARM64)
+    typedef SoftwareHalf F16cHalf;
+#else
+    struct F16cHalf
+    {
+        static XMVECTOR Load4(_In_ const uint8_t* p)
+        {
+            return _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+        }
+
+        static void Store4(_Out_ uint8_t* p, FXMVECTOR v)
+        {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_cvtps_ph(v, 0 /* round to nearest even */));
+        }
+    };
+#endif
+
+    /// <summary>
+    /// F16C requires AVX state to be enabled by the OS as well as the CPUID feature bit.
+    /// </summary>
+    bool IsF16CSupported()
+    {
+#if defined(_M_ARM) || defined(_M_ARM64)
+        return false;
+#else
+        int info[4] = {};
+        __cpuid(info, 1);
+
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        bool f16c = (info[2] & (1 << 29)) != 0;
+
+        return osxsave && avx && f16c && (_xgetbv(0) & 6) == 6;
+#endif
+    }
+
+    // Pixel formats. Load returns RGBA, normalized to [0, 1] for integer formats; Store is its inverse.
+    // Formats without alpha load an alpha of 1.
+
+    template <UINT bytes, bool hasAlpha, bool isPremultiplied>
+    struct PixelTraits
+    {
+        static const UINT Bytes = bytes;
+        static const bool HasAlpha = hasAlpha;
+        static const bool IsPremultiplied = isPremultiplied;
+    };
+
+    struct Bgr24 : PixelTraits<3, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat24bppBGR; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorMultiply(XMVectorSet(p[2], p[1], p[0], 255.0f), s_unorm8Scale);
+        }
+    };
+
+    struct Rgb24 : PixelTraits<3, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat24bppRGB; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorMultiply(XMVectorSet(p[0], p[1], p[2], 255.0f), s_unorm8Scale);
+        }
+    };
+
+    struct Bgr32 : PixelTraits<4, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat32bppBGR; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            XMVECTOR v = XMLoadUByteN4(reinterpret_cast<const XMUBYTEN4*>(p));
+            return XMVectorSetW(XMVectorSwizzle<2, 1, 0, 3>(v), 1.0f);
+        }
+    };
+
+    struct Bgra32 : PixelTraits<4, true, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat32bppBGRA; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorSwizzle<2, 1, 0, 3>(XMLoadUByteN4(reinterpret_cast<const XMUBYTEN4*>(p)));
+        }
+    };
+
+    struct Rgba32 : PixelTraits<4, true, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat32bppRGBA; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMLoadUByteN4(reinterpret_cast<const XMUBYTEN4*>(p));
+        }
+    };
+
+    struct Prgba32 : PixelTraits<4, true, true>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat32bppPRGBA; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMLoadUByteN4(reinterpret_cast<const XMUBYTEN4*>(p));
+        }
+    };
+
+    struct Pbgra32 : PixelTraits<4, true, true>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat32bppPBGRA; }
+
+        template <class Half> static void Store(_Out_ uint8_t* p, FXMVECTOR v)
+        {
+            XMStoreUByteN4(reinterpret_cast<XMUBYTEN4*>(p), XMVectorSwizzle<2, 1, 0, 3>(v));
+        }
+    };
+
+    struct Gray8 : PixelTraits<1, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat8bppGray; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorSetW(XMVectorReplicate(p[0] / 255.0f), 1.0f);
+        }
+    };
+
+    struct Rgb48 : PixelTraits<6, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat48bppRGB; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            auto c = reinterpret_cast<const uint16_t*>(p);
+            return XMVectorMultiply(XMVectorSet(c[0], c[1], c[2], 65535.0f), s_unorm16Scale);
+        }
+    };
+
+    struct Bgr48 : PixelTraits<6, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat48bppBGR; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            auto c = reinterpret_cast<const uint16_t*>(p);
+            return XMVectorMultiply(XMVectorSet(c[2], c[1], c[0], 65535.0f), s_unorm16Scale);
+        }
+    };
+
+    struct Rgba64 : PixelTraits<8, true, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat64bppRGBA; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMLoadUShortN4(reinterpret_cast<const XMUSHORTN4*>(p));
+        }
+    };
+
+    struct Bgra64 : PixelTraits<8, true, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat64bppBGRA; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorSwizzle<2, 1, 0, 3>(XMLoadUShortN4(reinterpret_cast<const XMUSHORTN4*>(p)));
+        }
+    };
+
+    struct Prgba64 : PixelTraits<8, true, true>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat64bppPRGBA; }
+
+        template <class Half> static void Store(_Out_ uint8_t* p, FXMVECTOR v)
+        {
+            XMStoreUShortN4(reinterpret_cast<XMUSHORTN4*>(p), v);
+        }
+    };
+
+    struct Gray16 : PixelTraits<2, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat16bppGray; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorSetW(XMVectorReplicate(*reinterpret_cast<const uint16_t*>(p) / 65535.0f), 1.0f);
+        }
+    };
+
+    // Blue is in the least significant bits; the top two bits are unused.
+    struct Bgr101010 : PixelTraits<4, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat32bppBGR101010; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            XMVECTOR v = XMLoadUDecN4(reinterpret_cast<const XMUDECN4*>(p));
+            return XMVectorSetW(XMVectorSwizzle<2, 1, 0, 3>(v), 1.0f);
+        }
+    };
+
+    // Red is in the least significant bits, as DXGI_FORMAT_R10G10B10A2_UNORM.
+    struct Rgba1010102 : PixelTraits<4, true, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat32bppRGBA1010102; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMLoadUDecN4(reinterpret_cast<const XMUDECN4*>(p));
+        }
+
+        template <class Half> static void Store(_Out_ uint8_t* p, FXMVECTOR v)
+        {
+            XMStoreUDecN4(reinterpret_cast<XMUDECN4*>(p), v);
+        }
+    };
+
+    struct RgbaHalf64 : PixelTraits<8, true, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat64bppRGBAHalf; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return Half::Load4(p);
+        }
+    };
+
+    struct RgbHalf64 : PixelTraits<8, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat64bppRGBHalf; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorSetW(Half::Load4(p), 1.0f);
+        }
+    };
+
+    struct PrgbaHalf64 : PixelTraits<8, true, true>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat64bppPRGBAHalf; }
+
+        template <class Half> static void Store(_Out_ uint8_t* p, FXMVECTOR v)
+        {
+            Half::Store4(p, v);
+        }
+    };
+
+    // Four channel half loads would read past the end of the row, so three channel pixels are
+    // converted individually.
+    struct RgbHalf48 : PixelTraits<6, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat48bppRGBHalf; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            auto c = reinterpret_cast<const HALF*>(p);
+            return XMVectorSet(XMConvertHalfToFloat(c[0]), XMConvertHalfToFloat(c[1]), XMConvertHalfToFloat(c[2]), 1.0f);
+        }
+    };
+
+    struct GrayHalf16 : PixelTraits<2, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat16bppGrayHalf; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorSetW(XMVectorReplicate(XMConvertHalfToFloat(*reinterpret_cast<const HALF*>(p))), 1.0f);
+        }
+    };
+
+    struct RgbaFloat128 : PixelTraits<16, true, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat128bppRGBAFloat; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(p));
+        }
+    };
+
+    struct PrgbaFloat128 : PixelTraits<16, true, true>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat128bppPRGBAFloat; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(p));
+        }
+    };
+
+    struct RgbFloat128 : PixelTraits<16, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat128bppRGBFloat; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorSetW(XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(p)), 1.0f);
+        }
+    };
+
+    struct RgbFloat96 : PixelTraits<12, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat96bppRGBFloat; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorSetW(XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(p)), 1.0f);
+        }
+    };
+
+    struct GrayFloat32 : PixelTraits<4, false, false>
+    {
+        static REFWICPixelFormatGUID Format() { return GUID_WICPixelFormat32bppGrayFloat; }
+
+        template <class Half> static XMVECTOR Load(_In_ const uint8_t* p)
+        {
+            return XMVectorSetW(XMVectorReplicate(*reinterpret_cast<const float*>(p)), 1.0f);
+        }
+    };
+
+    /// <summary>
+    /// The kernel for one (source, destination) pair. Each pixel is loaded, premultiplied if only the
+    /// destination is premultiplied, and stored, without leaving registers.
+    /// </summary>
+    template <class Source, class Destination, class Half>
+    void ConvertRow(_In_ const uint8_t* src, _Out_ uint8_t* dst, UINT width)
+    {
+        const bool premultiply = Source::HasAlpha && !Source::IsPremultiplied && Destination::IsPremultiplied;
+
+        for (UINT x = 0; x < width; x++, src += Source::Bytes, dst += Destination::Bytes)
+        {
+            XMVECTOR v = Source::template Load<Half>(src);
+
+            if (premultiply)
+            {
+                v = XMVectorSelect(v, XMVectorMultiply(v, XMVectorSplatW(v)), g_XMSelect1110);
+            }
+
+            Destination::template Store<Half>(dst, v);
+        }
+    }
+
+    struct Kernel
+    {
+        const GUID* source;
+        const GUID* destination;
+        UINT        sourceBytes;
+        UINT        destinationBytes;
+        RowKernel   convert;        // DirectXMath only.
+        RowKernel   convertF16C;    // Half floats converted with F16C.
+    };
+
+    template <class Source, class Destination>
+    Kernel MakeKernel()
+    {
+        return
+        {
+            &Source::Format(),
+            &Destination::Format(),
+            Source::Bytes,
+            Destination::Bytes,
+            &ConvertRow<Source, Destination, SoftwareHalf>,
+            &ConvertRow<Source, Destination, F16cHalf>
+        };
+    }
+
+    /// <summary>
+    /// The pairs ImageLoader::CreateCachedWicSource requests for the formats our decoders produce.
+    /// </summary>
+    const std::vector<Kernel>& GetKernels()
+    {
+        static const std::vector<Kernel> s_kernels =
+        {
+            MakeKernel<Bgr24, Pbgra32>(),
+            MakeKernel<Rgb24, Pbgra32>(),
+            MakeKernel<Bgr32, Pbgra32>(),
+            MakeKernel<Bgra32, Pbgra32>(),
+            MakeKernel<Rgba32, Pbgra32>(),
+            MakeKernel<Prgba32, Pbgra32>(),
+            MakeKernel<Gray8, Pbgra32>(),
+
+            MakeKernel<Bgr24, Prgba64>(),
+            MakeKernel<Rgb24, Prgba64>(),
+            MakeKernel<Bgr32, Prgba64>(),
+            MakeKernel<Bgra32, Prgba64>(),
+            MakeKernel<Rgba32, Prgba64>(),
+            MakeKernel<Prgba32, Prgba64>(),
+            MakeKernel<Gray8, Prgba64>(),
+            MakeKernel<Rgb48, Prgba64>(),
+            MakeKernel<Bgr48, Prgba64>(),
+            MakeKernel<Rgba64, Prgba64>(),
+            MakeKernel<Bgra64, Prgba64>(),
+            MakeKernel<Gray16, Prgba64>(),
+            MakeKernel<Bgr101010, Prgba64>(),
+            MakeKernel<Rgba1010102, Prgba64>(),
+
+            MakeKernel<Bgr101010, Rgba1010102>(),
+
+            MakeKernel<RgbaHalf64, PrgbaHalf64>(),
+            MakeKernel<RgbHalf64, PrgbaHalf64>(),
+            MakeKernel<RgbHalf48, PrgbaHalf64>(),
+            MakeKernel<GrayHalf16, PrgbaHalf64>(),
+            MakeKernel<RgbaFloat128, PrgbaHalf64>(),
+            MakeKernel<PrgbaFloat128, PrgbaHalf64>(),
+            MakeKernel<RgbFloat128, PrgbaHalf64>(),
+            MakeKernel<RgbFloat96, PrgbaHalf64>(),
+            MakeKernel<GrayFloat32, PrgbaHalf64>(),
+        };
+
+        return s_kernels;
+    }
+
+    const Kernel* FindKernel(REFWICPixelFormatGUID source, REFWICPixelFormatGUID destination)
+    {
+        for (const auto& kernel : GetKernels())
+        {
+            if (*kernel.source == source && *kernel.destination == destination)
+            {
+                return &kernel;
+            }
+        }
+
+        return nullptr;
+    }
+
+    RowKernel SelectRowKernel(const Kernel& kernel)
+    {
+        static const bool s_f16c = IsF16CSupported();
+
+        return s_f16c ? kernel.convertF16C : kernel.convert;
+    }
+
+    void RunRowKernel(RowKernel convert, const uint8_t* src, UINT srcStride, uint8_t* dst, UINT dstStride, UINT width, UINT height)
+    {
+        auto convertRows = [&](UINT firstRow, UINT lastRow)
+        {
+            for (UINT y = firstRow; y < lastRow; y++)
+            {
+                convert(src + static_cast<size_t>(y) * srcStride, dst + static_cast<size_t>(y) * dstStride, width);
+            }
+        };
+
+        if (height <= sc_RowsPerTask)
+        {
+            convertRows(0, height);
+        }
+        else
+        {
+            concurrency::parallel_for(0u, (height + sc_RowsPerTask - 1) / sc_RowsPerTask, [&](UINT task)
+            {
+                convertRows(task * sc_RowsPerTask, (std::min)((task + 1) * sc_RowsPerTask, height));
+            });
+        }
+    }
+
+    /// <summary>
+    /// Converts on demand in CopyPixels, like IWICFormatConverter.
+    /// </summary>
+    class ConvertedBitmapSource : public RuntimeClass<RuntimeClassFlags<ClassicCom>, IWICBitmapSource>
+    {
+    public:
+        HRESULT RuntimeClassInitialize(_In_ IWICBitmapSource* source, const Kernel& kernel)
+        {
+            m_source = source;
+            m_kernel = &kernel;
+            m_convert = SelectRowKernel(kernel);
+
+            // Bitmaps are converted in place rather than copied first.
+            m_source.As(&m_bitmap);
+
+            return m_source->GetSize(&m_width, &m_height);
+        }
+
+        IFACEMETHODIMP GetSize(_Out_ UINT* width, _Out_ UINT* height) override
+        {
+            if (!width || !height) return E_INVALIDARG;
+
+            *width = m_width;
+            *height = m_height;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP GetPixelFormat(_Out_ WICPixelFormatGUID* format) override
+        {
+            if (!format) return E_INVALIDARG;
+
+            *format = *m_kernel->destination;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP GetResolution(_Out_ double* dpiX, _Out_ double* dpiY) override
+        {
+            return m_source->GetResolution(dpiX, dpiY);
+        }
+
+        IFACEMETHODIMP CopyPalette(_In_ IWICPalette*) override
+        {
+            return WINCODEC_ERR_PALETTEUNAVAILABLE;
+        }
+
+        IFACEMETHODIMP CopyPixels(_In_opt_ const WICRect* rect, UINT stride, UINT bufferSize, _Out_writes_(bufferSize) BYTE* buffer) override
+        {
+            if (!buffer) return E_INVALIDARG;
+
+            WICRect rc = { 0, 0, static_cast<INT>(m_width), static_cast<INT>(m_height) };
+            if (rect)
+            {
+                rc = *rect;
+            }
+
+            if (rc.X < 0 || rc.Y < 0 || rc.Width < 0 || rc.Height < 0 ||
+                static_cast<UINT>(rc.X) + static_cast<UINT>(rc.Width) > m_width ||
+                static_cast<UINT>(rc.Y) + static_cast<UINT>(rc.Height) > m_height)
+            {
+                return E_INVALIDARG;
+            }
+
+            if (rc.Width == 0 || rc.Height == 0) return S_OK;
+
+            const UINT width = static_cast<UINT>(rc.Width);
+            const UINT rows = static_cast<UINT>(rc.Height);
+            const UINT rowBytes = width * m_kernel->destinationBytes;
+            if (stride < rowBytes) return E_INVALIDARG;
+
+            if (bufferSize / stride < rows - 1 ||
+                bufferSize - (rows - 1) * stride < rowBytes)
+            {
+                return WINCODEC_ERR_INSUFFICIENTBUFFER;
+            }
+
+            if (m_bitmap)
+            {
+                // Falls back to copying if the bitmap is locked for writing elsewhere.
+                ComPtr<IWICBitmapLock> lock;
+                if (SUCCEEDED(m_bitmap->Lock(&rc, WICBitmapLockRead, &lock)))
+                {
+                    UINT srcStride = 0;
+                    HRESULT hr = lock->GetStride(&srcStride);
+                    if (FAILED(hr))
+                        return hr;
+
+                    UINT srcSize = 0;
+                    BYTE* src = nullptr;
+                    hr = lock->GetDataPointer(&srcSize, &src);
+                    if (FAILED(hr))
+                        return hr;
+
+                    RunRowKernel(m_convert, src, srcStride, buffer, stride, width, rows);
+                    return S_OK;
+                }
+            }
+
+            // Other sources, e.g. decoders, are read in strips, each converted while still in cache.
+            const UINT srcStride = width * m_kernel->sourceBytes;
+            const UINT stripRows = (std::max)(1u, (std::min)(rows, sc_StripBytes / srcStride));
+
+            std::vector<uint8_t> strip;
+            try
+            {
+                strip.resize(static_cast<size_t>(srcStride) * stripRows);
+            }
+            catch (const std::bad_alloc&)
+            {
+                return E_OUTOFMEMORY;
+            }
+
+            for (UINT y = 0; y < rows; y += stripRows)
+            {
+                UINT stripHeight = (std::min)(stripRows, rows - y);
+                WICRect stripRect = { rc.X, rc.Y + static_cast<INT>(y), rc.Width, static_cast<INT>(stripHeight) };
+
+                HRESULT hr = m_source->CopyPixels(&stripRect, srcStride, srcStride * stripHeight, strip.data());
+                if (FAILED(hr))
+                    return hr;
+
+                RunRowKernel(m_convert, strip.data(), srcStride, buffer + static_cast<size_t>(y) * stride, stride, width, stripHeight);
+            }
+
+            return S_OK;
+        }
+
+    private:
+        ComPtr<IWICBitmapSource>    m_source;
+        ComPtr<IWICBitmap>          m_bitmap;   // m_source, if it is a bitmap.
+        const Kernel*               m_kernel;
+        RowKernel                   m_convert;
+        UINT                        m_width;
+        UINT                        m_height;
+    };
+}
+
+bool FormatConverter::CanConvert(REFWICPixelFormatGUID source, REFWICPixelFormatGUID destination)
+{
+    return FindKernel(source, destination) != nullptr;
+}
+
+std::vector<std::pair<WICPixelFormatGUID, WICPixelFormatGUID>> FormatConverter::GetConversions()
+{
+    std::vector<std::pair<WICPixelFormatGUID, WICPixelFormatGUID>> conversions;
+    for (const auto& kernel : GetKernels())
+    {
+        conversions.emplace_back(*kernel.source, *kernel.destination);
+    }
+
+    return conversions;
+}
+
+HRESULT FormatConverter::CreateBitmapSource(IWICBitmapSource* source, REFWICPixelFormatGUID destination, IWICBitmapSource** converted)
+{
+    *converted = nullptr;
+
+    WICPixelFormatGUID sourceFormat = {};
+    HRESULT hr = source->GetPixelFormat(&sourceFormat);
+    if (FAILED(hr))
+        return hr;
+
+    const Kernel* kernel = FindKernel(sourceFormat, destination);
+    if (!kernel)
+    {
+        return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+    }
+
+    ComPtr<ConvertedBitmapSource> bitmapSource;
+    hr = MakeAndInitialize<ConvertedBitmapSource>(&bitmapSource, source, *kernel);
+    if (FAILED(hr))
+        return hr;
+
+    *converted = bitmapSource.Detach();
+    return S_OK;
+}
+
+HRESULT FormatConverter::ConvertRows(
+    REFWICPixelFormatGUID sourceFormat,
+    const uint8_t* src,
+    UINT srcStride,
+    REFWICPixelFormatGUID destinationFormat,
+    uint8_t* dst,
+    UINT dstStride,
+    UINT width,
+    UINT height)
+{
+    const Kernel* kernel = FindKernel(sourceFormat, destinationFormat);
+    if (!kernel)
+    {
+        return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+    }
+
+    RunRowKernel(SelectRowKernel(*kernel), src, srcStride, dst, dstStride, width, height);
+    return S_OK;
+}
@@ -0,0 +1,62 @@
+//*********************************************************
+//
+// FormatConverter
+//
+// Converts decoded pixels to the formats ImageLoader caches
+// (see ImageLoader::CreateCachedWicSource) in place of the
+// generic, single threaded IWICFormatConverter.
+//
+// Each supported (source, destination) pair is a kernel
+// instantiated at compile time from the two pixel formats,
+// fusing channel reordering, bit depth scaling, alpha
+// premultiplication and half conversion into one pass. Pixels
+// are processed with DirectXMath (SSE2 or NEON); half floats
+// use F16C instead when the CPU supports it. Rows are
+// converted in parallel.
+//
+// As with IWICFormatConverter, no gamma conversion occurs:
+// integer formats convert to integer formats and float
+// formats to float formats.
+//
+//*********************************************************
+
+#pragma once
+
+namespace HDRImageViewer
+{
+    class FormatConverter
+    {
+    public:
+        static bool CanConvert(REFWICPixelFormatGUID source, REFWICPixelFormatGUID destination);
+
+        /// <summary>
+        /// Lists the (source, destination) pairs which have a kernel.
+        /// </summary>
+        static std::vector<std::pair<WICPixelFormatGUID, WICPixelFormatGUID>> GetConversions();
+
+        /// <summary>
+        /// Wraps source as a bitmap source in the destination format, which converts the requested
+        /// rectangle inside CopyPixels like IWICFormatConverter does. Bitmaps are read in place;
+        /// other sources are copied in strips. Returns WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT if
+        /// CanConvert is false.
+        /// </summary>
+        static HRESULT CreateBitmapSource(
+            _In_ IWICBitmapSource* source,
+            REFWICPixelFormatGUID destination,
+            _COM_Outptr_ IWICBitmapSource** converted);
+
+        /// <summary>
+        /// Converts rows of width pixels in parallel. Returns WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT
+        /// if CanConvert is false.
+        /// </summary>
+        static HRESULT ConvertRows(
+            REFWICPixelFormatGUID sourceFormat,
+            _In_ const uint8_t* src,
+            UINT srcStride,
+            REFWICPixelFormatGUID destinationFormat,
+            _Out_ uint8_t* dst,
+            UINT dstStride,
+            UINT width,
+            UINT height);
+    };
+}
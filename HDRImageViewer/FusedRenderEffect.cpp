@@ -0,0 +1,426 @@
+#include "pch.h"
+#include <initguid.h>
+#include "FusedRenderEffect.h"
+#include "BasicReaderWriter.h"
+
+#define XML(X) TEXT(#X)
+
+namespace
+{
+    struct PixelShaderVariant
+    {
+        const GUID*     guid;
+        const wchar_t*  filename;
+    };
+
+    // One per kind and display mode that FusedRenderEffect::GetPixelShader selects.
+    const PixelShaderVariant sc_pixelShaders[] =
+    {
+        { &GUID_FusedRenderNonePixelShader,                 L"FusedRenderNone.cso" },
+        { &GUID_FusedRenderTonemapHdrDisplayPixelShader,    L"FusedRenderTonemapHdrDisplay.cso" },
+        { &GUID_FusedRenderTonemapSdrDisplayPixelShader,    L"FusedRenderTonemapSdrDisplay.cso" },
+        { &GUID_FusedRenderSdrOverlayPixelShader,           L"FusedRenderSdrOverlay.cso" },
+        { &GUID_FusedRenderHeatmapPixelShader,              L"FusedRenderHeatmap.cso" },
+    };
+}
+
+FusedRenderEffect::FusedRenderEffect() :
+    m_constants{ 1.0f, 4000.0f / 80.0f, 270.0f / 80.0f, 1.0f },
+    m_refCount(1),
+    m_inputRect{},
+    m_kind(FUSEDRENDER_KIND_NONE),
+    m_displayMode(D2D1_HDRTONEMAP_DISPLAY_MODE_SDR)
+{
+}
+
+HRESULT __stdcall FusedRenderEffect::CreateFusedRenderImpl(_Outptr_ IUnknown** ppEffectImpl)
+{
+    // Since the object's refcount is initialized to 1, we don't need to AddRef here.
+    *ppEffectImpl = static_cast<ID2D1EffectImpl*>(new (std::nothrow) FusedRenderEffect());
+
+    if (*ppEffectImpl == nullptr)
+    {
+        return E_OUTOFMEMORY;
+    }
+    else
+    {
+        return S_OK;
+    }
+}
+
+HRESULT FusedRenderEffect::SetKind(FUSEDRENDER_KIND kind)
+{
+    if (kind < FUSEDRENDER_KIND_NONE || kind > FUSEDRENDER_KIND_LUMINANCE_HEATMAP)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_kind = kind;
+
+    return S_OK;
+}
+
+FUSEDRENDER_KIND FusedRenderEffect::GetKind() const
+{
+    return m_kind;
+}
+
+HRESULT FusedRenderEffect::SetDisplayMode(D2D1_HDRTONEMAP_DISPLAY_MODE mode)
+{
+    m_displayMode = mode;
+
+    return S_OK;
+}
+
+D2D1_HDRTONEMAP_DISPLAY_MODE FusedRenderEffect::GetDisplayMode() const
+{
+    return m_displayMode;
+}
+
+HRESULT FusedRenderEffect::SetWhiteScale(float scale)
+{
+    m_constants.whiteScale = scale;
+
+    return S_OK;
+}
+
+float FusedRenderEffect::GetWhiteScale() const
+{
+    return m_constants.whiteScale;
+}
+
+HRESULT FusedRenderEffect::SetTonemapInputMaxLuminance(float nits)
+{
+    if (nits < 0.0f)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_constants.tonemapInputMax = nits / 80.0f; // scRGB 1.0 == 80 nits.
+
+    return S_OK;
+}
+
+float FusedRenderEffect::GetTonemapInputMaxLuminance() const
+{
+    return m_constants.tonemapInputMax * 80.0f;
+}
+
+HRESULT FusedRenderEffect::SetTonemapOutputMaxLuminance(float nits)
+{
+    if (nits < 0.0f || nits > 10000.0f)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_constants.tonemapOutputMax = nits / 80.0f; // scRGB 1.0 == 80 nits.
+
+    return S_OK;
+}
+
+float FusedRenderEffect::GetTonemapOutputMaxLuminance() const
+{
+    return m_constants.tonemapOutputMax * 80.0f;
+}
+
+HRESULT FusedRenderEffect::SetOutputScale(float scale)
+{
+    m_constants.outputScale = scale;
+
+    return S_OK;
+}
+
+float FusedRenderEffect::GetOutputScale() const
+{
+    return m_constants.outputScale;
+}
+
+HRESULT FusedRenderEffect::Register(_In_ ID2D1Factory1* pFactory)
+{
+    // The inspectable metadata of an effect is defined in XML. This can be passed in from an external source
+    // as well, however for simplicity we just inline the XML.
+    PCWSTR pszXml =
+        XML(
+            <?xml version='1.0'?>
+            <Effect>
+                <!-- System Properties -->
+                <Property name='DisplayName' type='string' value='Fused Render Pipeline' />
+                <Property name='Author' type='string' value='Microsoft Corporation' />
+                <Property name='Category' type='string' value='Stylize' />
+                <Property name='Description' type='string' value='White scale, render effect and SDR white level correction in one pass' />
+                <Inputs>
+                    <Input name='Source' />
+                </Inputs>
+                <!-- Custom Properties go here -->
+                <Property name='Kind' type='enum'>
+                    <Property name='DisplayName' type='string' value='Render effect'/>
+                    <Property name="Default" type="enum" value="0" />
+                    <Fields>
+                        <Field name='None' displayname='None' index="0" />
+                        <Field name='HdrTonemap' displayname='HDR tonemap' index="1" />
+                        <Field name='SdrOverlay' displayname='SDR overlay' index="2" />
+                        <Field name='LuminanceHeatmap' displayname='Luminance heatmap' index="3" />
+                    </Fields>
+                </Property>
+                <Property name='DisplayMode' type='enum'>
+                    <Property name='DisplayName' type='string' value='Display mode'/>
+                    <Property name="Default" type="enum" value="0" />
+                    <Fields>
+                        <Field name='SDR' displayname='SDR' index="0" />
+                        <Field name='HDR' displayname='HDR' index="1" />
+                    </Fields>
+                </Property>
+                <Property name='WhiteScale' type='float'>
+                    <Property name='DisplayName' type='string' value='White scale'/>
+                    <Property name='Default' type='float' value='1.0' />
+                </Property>
+                <Property name='TonemapInputMaxLuminance' type='float'>
+                    <Property name='DisplayName' type='string' value='Tonemap input max luminance (nits)'/>
+                    <Property name='Default' type='float' value='4000.0' />
+                </Property>
+                <Property name='TonemapOutputMaxLuminance' type='float'>
+                    <Property name='DisplayName' type='string' value='Tonemap output max luminance (nits)'/>
+                    <Property name='Default' type='float' value='270.0' />
+                </Property>
+                <Property name='OutputScale' type='float'>
+                    <Property name='DisplayName' type='string' value='SDR white level correction'/>
+                    <Property name='Default' type='float' value='1.0' />
+                </Property>
+            </Effect>
+            );
+
+    // This defines the bindings from specific properties to the callback functions
+    // on the class that ID2D1Effect::SetValue() & GetValue() will call.
+    // The order matches FUSEDRENDER_PROP.
+    const D2D1_PROPERTY_BINDING bindings[] =
+    {
+        D2D1_VALUE_TYPE_BINDING(L"Kind", &SetKind, &GetKind),
+        D2D1_VALUE_TYPE_BINDING(L"DisplayMode", &SetDisplayMode, &GetDisplayMode),
+        D2D1_VALUE_TYPE_BINDING(L"WhiteScale", &SetWhiteScale, &GetWhiteScale),
+        D2D1_VALUE_TYPE_BINDING(L"TonemapInputMaxLuminance", &SetTonemapInputMaxLuminance, &GetTonemapInputMaxLuminance),
+        D2D1_VALUE_TYPE_BINDING(L"TonemapOutputMaxLuminance", &SetTonemapOutputMaxLuminance, &GetTonemapOutputMaxLuminance),
+        D2D1_VALUE_TYPE_BINDING(L"OutputScale", &SetOutputScale, &GetOutputScale),
+    };
+
+    // This registers the effect with the factory, which will make the effect
+    // instantiatable.
+    return pFactory->RegisterEffectFromString(
+        CLSID_CustomFusedRenderEffect,
+        pszXml,
+        bindings,
+        ARRAYSIZE(bindings),
+        CreateFusedRenderImpl
+        );
+}
+
+IFACEMETHODIMP FusedRenderEffect::Initialize(
+    _In_ ID2D1EffectContext* pEffectContext,
+    _In_ ID2D1TransformGraph* pTransformGraph
+    )
+{
+    m_effectContext = pEffectContext;
+    BasicReaderWriter^ reader = ref new BasicReaderWriter();
+
+    // Every variant is loaded up front, so that changing Kind or DisplayMode only switches shaders.
+    // As with a single shader, loading one which is already loaded does nothing.
+    HRESULT hr = S_OK;
+    for (const auto& variant : sc_pixelShaders)
+    {
+        Platform::Array<unsigned char, 1U>^ data;
+
+        try
+        {
+            data = reader->ReadData(ref new Platform::String(variant.filename));
+        }
+        catch (Platform::Exception^ e)
+        {
+            // Return error if file can not be read.
+            return e->HResult;
+        }
+
+        hr = pEffectContext->LoadPixelShader(*variant.guid, data->Data, data->Length);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+    }
+
+    // The graph consists of a single transform. In fact, this class is the transform,
+    // reducing the complexity of implementing an effect when all we need to
+    // do is use a single pixel shader.
+    return pTransformGraph->SetSingleTransformNode(this);
+}
+
+const GUID& FusedRenderEffect::GetPixelShader() const
+{
+    switch (m_kind)
+    {
+    case FUSEDRENDER_KIND_HDR_TONEMAP:
+        return m_displayMode == D2D1_HDRTONEMAP_DISPLAY_MODE_HDR ?
+            *sc_pixelShaders[1].guid : *sc_pixelShaders[2].guid;
+
+    case FUSEDRENDER_KIND_SDR_OVERLAY:
+        return *sc_pixelShaders[3].guid;
+
+    case FUSEDRENDER_KIND_LUMINANCE_HEATMAP:
+        return *sc_pixelShaders[4].guid;
+
+    case FUSEDRENDER_KIND_NONE:
+    default:
+        return *sc_pixelShaders[0].guid;
+    }
+}
+
+IFACEMETHODIMP FusedRenderEffect::PrepareForRender(D2D1_CHANGE_TYPE changeType)
+{
+    // Kind or DisplayMode may have changed the variant.
+    HRESULT hr = m_drawInfo->SetPixelShader(GetPixelShader());
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    return m_drawInfo->SetPixelShaderConstantBuffer(reinterpret_cast<BYTE*>(&m_constants), sizeof(m_constants));
+}
+
+// SetGraph is only called when the number of inputs changes. This never happens as we publish this effect
+// as a single input effect.
+IFACEMETHODIMP FusedRenderEffect::SetGraph(_In_ ID2D1TransformGraph* pGraph)
+{
+    return E_NOTIMPL;
+}
+
+// Called to assign a new render info class, which is used to inform D2D on
+// how to set the state of the GPU.
+IFACEMETHODIMP FusedRenderEffect::SetDrawInfo(_In_ ID2D1DrawInfo* pDrawInfo)
+{
+    m_drawInfo = pDrawInfo;
+
+    return m_drawInfo->SetPixelShader(GetPixelShader());
+}
+
+// Calculates the mapping between the output and input rects.
+IFACEMETHODIMP FusedRenderEffect::MapOutputRectToInputRects(
+    _In_ const D2D1_RECT_L* pOutputRect,
+    _Out_writes_(inputRectCount) D2D1_RECT_L* pInputRects,
+    UINT32 inputRectCount
+    ) const
+{
+    // This effect has exactly one input, so if there is more than one input rect,
+    // something is wrong.
+    if (inputRectCount != 1)
+    {
+        return E_INVALIDARG;
+    }
+
+    pInputRects[0] = *pOutputRect;
+
+    return S_OK;
+}
+
+IFACEMETHODIMP FusedRenderEffect::MapInputRectsToOutputRect(
+    _In_reads_(inputRectCount) CONST D2D1_RECT_L* pInputRects,
+    _In_reads_(inputRectCount) CONST D2D1_RECT_L* pInputOpaqueSubRects,
+    UINT32 inputRectCount,
+    _Out_ D2D1_RECT_L* pOutputRect,
+    _Out_ D2D1_RECT_L* pOutputOpaqueSubRect
+    )
+{
+    // This effect has exactly one input, so if there is more than one input rect,
+    // something is wrong.
+    if (inputRectCount != 1)
+    {
+        return E_INVALIDARG;
+    }
+
+    *pOutputRect = pInputRects[0];
+    m_inputRect = pInputRects[0];
+
+    // Indicate that entire output might contain transparency.
+    ZeroMemory(pOutputOpaqueSubRect, sizeof(*pOutputOpaqueSubRect));
+
+    return S_OK;
+}
+
+IFACEMETHODIMP FusedRenderEffect::MapInvalidRect(
+    UINT32 inputIndex,
+    D2D1_RECT_L invalidInputRect,
+    _Out_ D2D1_RECT_L* pInvalidOutputRect
+    ) const
+{
+    // Indicate that the entire output may be invalid.
+    *pInvalidOutputRect = m_inputRect;
+
+    return S_OK;
+}
+
+IFACEMETHODIMP_(UINT32) FusedRenderEffect::GetInputCount() const
+{
+    return 1;
+}
+
+// D2D ensures that that effects are only referenced from one thread at a time.
+// To improve performance, we simply increment/decrement our reference count
+// rather than use atomic InterlockedIncrement()/InterlockedDecrement() functions.
+IFACEMETHODIMP_(ULONG) FusedRenderEffect::AddRef()
+{
+    m_refCount++;
+    return m_refCount;
+}
+
+IFACEMETHODIMP_(ULONG) FusedRenderEffect::Release()
+{
+    m_refCount--;
+
+    if (m_refCount == 0)
+    {
+        delete this;
+        return 0;
+    }
+    else
+    {
+        return m_refCount;
+    }
+}
+
+// This enables the stack of parent interfaces to be queried.
+IFACEMETHODIMP FusedRenderEffect::QueryInterface(
+    _In_ REFIID riid,
+    _Outptr_ void** ppOutput
+    )
+{
+    *ppOutput = nullptr;
+    HRESULT hr = S_OK;
+
+    if (riid == __uuidof(ID2D1EffectImpl))
+    {
+        *ppOutput = reinterpret_cast<ID2D1EffectImpl*>(this);
+    }
+    else if (riid == __uuidof(ID2D1DrawTransform))
+    {
+        *ppOutput = static_cast<ID2D1DrawTransform*>(this);
+    }
+    else if (riid == __uuidof(ID2D1Transform))
+    {
+        *ppOutput = static_cast<ID2D1Transform*>(this);
+    }
+    else if (riid == __uuidof(ID2D1TransformNode))
+    {
+        *ppOutput = static_cast<ID2D1TransformNode*>(this);
+    }
+    else if (riid == __uuidof(IUnknown))
+    {
+        *ppOutput = this;
+    }
+    else
+    {
+        hr = E_NOINTERFACE;
+    }
+
+    if (*ppOutput != nullptr)
+    {
+        AddRef();
+    }
+
+    return hr;
+}
@@ -0,0 +1,142 @@
+//*********************************************************
+//
+// FusedRenderEffect
+//
+// Applies all of the renderer's per pixel stages after color
+// management in a single pass: white scale, then the
+// RenderEffectKind, then the SDR white level correction used
+// with the tonemapper on SDR displays. The chained graph
+// renders each of these to an intermediate surface.
+//
+// Each kind and display mode combination is a separate pixel
+// shader, composed at compile time from RenderStages.hlsli,
+// which the chained effects also use; the effect selects one
+// by its Kind and DisplayMode properties. The input is
+// simple, so Direct2D can also link the shader into the
+// preceding effect's pass.
+//
+// The HDR tonemap stage is the custom Reinhard tonemapper:
+// the Direct2D HDR tonemapper cannot be fused. SphereMap
+// samples its input spatially and is never fused.
+//
+//*********************************************************
+
+#pragma once
+
+DEFINE_GUID(GUID_FusedRenderNonePixelShader, 0x4e189241, 0x7bd0, 0x4a11, 0x81, 0x90, 0x9a, 0x91, 0xd9, 0xbd, 0xb5, 0x5d);
+DEFINE_GUID(GUID_FusedRenderTonemapHdrDisplayPixelShader, 0x9f87f961, 0x52e8, 0x4a20, 0x9b, 0x0c, 0xc2, 0xc1, 0x26, 0x58, 0xb3, 0x5a);
+DEFINE_GUID(GUID_FusedRenderTonemapSdrDisplayPixelShader, 0x85490809, 0xc649, 0x4111, 0x90, 0x6b, 0x69, 0xec, 0x0d, 0x00, 0xff, 0xe1);
+DEFINE_GUID(GUID_FusedRenderSdrOverlayPixelShader, 0xf08c8297, 0x853b, 0x4363, 0x83, 0xc1, 0x11, 0x46, 0x7a, 0xf4, 0xcc, 0x0f);
+DEFINE_GUID(GUID_FusedRenderHeatmapPixelShader, 0xda764402, 0x3aa4, 0x438b, 0xa7, 0x27, 0x15, 0x0e, 0x3c, 0x50, 0x64, 0x4b);
+DEFINE_GUID(CLSID_CustomFusedRenderEffect, 0x471bf571, 0xdf38, 0x4395, 0xaf, 0xa8, 0xea, 0x1b, 0xd6, 0xc9, 0x3b, 0xee);
+
+enum FUSEDRENDER_PROP
+{
+    FUSEDRENDER_PROP_KIND = 0,
+    FUSEDRENDER_PROP_DISPLAY_MODE = 1,                  // D2D1_HDRTONEMAP_DISPLAY_MODE.
+    FUSEDRENDER_PROP_WHITE_SCALE = 2,
+    FUSEDRENDER_PROP_TONEMAP_INPUT_MAX_LUMINANCE = 3,   // In nits.
+    FUSEDRENDER_PROP_TONEMAP_OUTPUT_MAX_LUMINANCE = 4,  // In nits.
+    FUSEDRENDER_PROP_OUTPUT_SCALE = 5,                  // SDR white level correction; SDR display mode only.
+};
+
+// The fusable RenderEffectKind values.
+enum FUSEDRENDER_KIND
+{
+    FUSEDRENDER_KIND_NONE = 0,
+    FUSEDRENDER_KIND_HDR_TONEMAP = 1,
+    FUSEDRENDER_KIND_SDR_OVERLAY = 2,
+    FUSEDRENDER_KIND_LUMINANCE_HEATMAP = 3,
+};
+
+// Our effect contains one transform, which is simply a wrapper around a pixel shader. As such,
+// we can simply make the effect itself act as the transform.
+class FusedRenderEffect : public ID2D1EffectImpl, public ID2D1DrawTransform
+{
+public:
+    // Declare effect registration methods.
+    static HRESULT Register(_In_ ID2D1Factory1* pFactory);
+
+    static HRESULT __stdcall CreateFusedRenderImpl(_Outptr_ IUnknown** ppEffectImpl);
+
+    // Declare property getter/setters
+    HRESULT SetKind(FUSEDRENDER_KIND kind);
+    FUSEDRENDER_KIND GetKind() const;
+
+    HRESULT SetDisplayMode(D2D1_HDRTONEMAP_DISPLAY_MODE mode);
+    D2D1_HDRTONEMAP_DISPLAY_MODE GetDisplayMode() const;
+
+    HRESULT SetWhiteScale(float scale);
+    float GetWhiteScale() const;
+
+    HRESULT SetTonemapInputMaxLuminance(float nits);
+    float GetTonemapInputMaxLuminance() const;
+
+    HRESULT SetTonemapOutputMaxLuminance(float nits);
+    float GetTonemapOutputMaxLuminance() const;
+
+    HRESULT SetOutputScale(float scale);
+    float GetOutputScale() const;
+
+    // Declare ID2D1EffectImpl implementation methods.
+    IFACEMETHODIMP Initialize(
+        _In_ ID2D1EffectContext* pContextInternal,
+        _In_ ID2D1TransformGraph* pTransformGraph
+        );
+
+    IFACEMETHODIMP PrepareForRender(D2D1_CHANGE_TYPE changeType);
+
+    IFACEMETHODIMP SetGraph(_In_ ID2D1TransformGraph* pGraph);
+
+    // Declare ID2D1DrawTransform implementation methods.
+    IFACEMETHODIMP SetDrawInfo(_In_ ID2D1DrawInfo* pRenderInfo);
+
+    // Declare ID2D1Transform implementation methods.
+    IFACEMETHODIMP MapOutputRectToInputRects(
+        _In_ const D2D1_RECT_L* pOutputRect,
+        _Out_writes_(inputRectCount) D2D1_RECT_L* pInputRects,
+        UINT32 inputRectCount
+        ) const;
+
+    IFACEMETHODIMP MapInputRectsToOutputRect(
+        _In_reads_(inputRectCount) CONST D2D1_RECT_L* pInputRects,
+        _In_reads_(inputRectCount) CONST D2D1_RECT_L* pInputOpaqueSubRects,
+        UINT32 inputRectCount,
+        _Out_ D2D1_RECT_L* pOutputRect,
+        _Out_ D2D1_RECT_L* pOutputOpaqueSubRect
+        );
+
+    IFACEMETHODIMP MapInvalidRect(
+        UINT32 inputIndex,
+        D2D1_RECT_L invalidInputRect,
+        _Out_ D2D1_RECT_L* pInvalidOutputRect
+        ) const;
+
+    // Declare ID2D1TransformNode implementation methods.
+    IFACEMETHODIMP_(UINT32) GetInputCount() const;
+
+    // Declare IUnknown implementation methods.
+    IFACEMETHODIMP_(ULONG) AddRef();
+    IFACEMETHODIMP_(ULONG) Release();
+    IFACEMETHODIMP QueryInterface(_In_ REFIID riid, _Outptr_ void** ppOutput);
+
+private:
+    FusedRenderEffect();
+    const GUID& GetPixelShader() const;
+
+    // This struct defines the constant buffer shared by the pixel shader variants.
+    struct
+    {
+        float whiteScale;
+        float tonemapInputMax;  // In scRGB values.
+        float tonemapOutputMax; // In scRGB values.
+        float outputScale;
+    } m_constants;
+
+    Microsoft::WRL::ComPtr<ID2D1DrawInfo>      m_drawInfo;
+    Microsoft::WRL::ComPtr<ID2D1EffectContext> m_effectContext;
+    LONG                                       m_refCount;
+    D2D1_RECT_L                                m_inputRect;
+    FUSEDRENDER_KIND                           m_kind;
+    D2D1_HDRTONEMAP_DISPLAY_MODE               m_displayMode;
+};
@@ -0,0 +1,32 @@
+//*********************************************************
+//
+// FusedRenderTonemapSdrDisplay
+//
+// A FusedRenderEffect shader variant; see FusedRenderEffect.h.
+//
+//*********************************************************
+
+// Custom effects using pixel shaders should use HLSL helper functions defined in
+// d2d1effecthelpers.hlsli to make use of effect shader linking.
+#define D2D_INPUT_COUNT 1           // The pixel shader takes 1 input texture.
+#define D2D_INPUT0_SIMPLE
+
+// Note that the custom build step must provide the correct path to find d2d1effecthelpers.hlsli when calling fxc.exe.
+#include "d2d1effecthelpers.hlsli"
+#include "RenderStages.hlsli"
+
+// Shared by every variant; matches FusedRenderEffect's m_constants.
+cbuffer constants : register(b0)
+{
+    float whiteScale;
+    float tonemapInputMax;  // In scRGB values.
+    float tonemapOutputMax; // In scRGB values.
+    float outputScale;
+};
+
+// RenderEffectKind::HdrTonemap on an SDR or WCG display: white scale, the tonemapper, then
+// the SDR white level correction.
+D2D_PS_ENTRY(main)
+{
+    return WhiteScale(SimpleTonemap(WhiteScale(D2DGetInput(0), whiteScale), tonemapInputMax, tonemapOutputMax), outputScale);
+}
@@ -14,13 +14,16 @@
 #include "DirectXPage.xaml.h"
 #include "DirectXHelper.h"
 #include "DirectXTex.h"
+#include "ColorProfileCache.h"
 #include "ImageExporter.h"
 #include "MagicConstants.h"
+#include "RenderPipeline.h"
 #include "SimpleTonemapEffect.h"
 #include "DirectXTex\DirectXTexEXR.h"
 
 using namespace HDRImageViewer;
 
+using namespace concurrency;
 using namespace DirectX;
 using namespace Microsoft::WRL;
 using namespace Platform;
@@ -37,19 +40,28 @@ HDRImageViewerRenderer::HDRImageViewerRenderer(
     const std::shared_ptr<DX::DeviceResources>& deviceResources
     ) :
     m_deviceResources(deviceResources),
+    m_prefetchCache(sc_prefetchByteBudget),
     m_renderEffectKind(RenderEffectKind::None),
     m_zoom(1.0f),
     m_minZoom(1.0f), // Dynamically calculated on window size.
     m_imageOffset(),
     m_pointerPos(),
     m_imageCLL{ -1.0f, -1.0f },
+    m_isImageCLLKnown(false),
     m_brightnessAdjust(1.0f),
     m_imageInfo{},
-    m_isComputeSupported(false)
+    m_isComputeSupported(false),
+    m_isTonemapFusable(false)
 {
     // Register to be notified if the GPU device is lost or recreated.
     m_deviceResources->RegisterDeviceNotify(this);
 
+    m_diskCache = std::make_shared<DecodedImageCache>(
+        ApplicationData::Current->LocalCacheFolder->Path,
+        m_deviceResources->GetWicImagingFactory(),
+        sc_diskCacheByteLimit,
+        sc_diskCacheEntryLimit);
+
     CreateDeviceIndependentResources();
     CreateDeviceDependentResources();
     CreateWindowSizeDependentResources();
@@ -66,13 +78,14 @@ void HDRImageViewerRenderer::CreateDeviceIndependentResources()
     auto fact = m_deviceResources->GetD2DFactory();
 
     // TODO: This instance never does anything as it gets overwritten upon image load.
-    m_imageLoader = std::make_unique<ImageLoader>(m_deviceResources);
+    m_imageLoader = std::make_shared<ImageLoader>(m_deviceResources);
 
     // Register the custom render effects.
     DX::ThrowIfFailed(SimpleTonemapEffect::Register(fact));
     DX::ThrowIfFailed(SdrOverlayEffect::Register(fact));
     DX::ThrowIfFailed(LuminanceHeatmapEffect::Register(fact));
     DX::ThrowIfFailed(SphereMapEffect::Register(fact));
+    DX::ThrowIfFailed(FusedRenderEffect::Register(fact));
 }
 
 void HDRImageViewerRenderer::CreateDeviceDependentResources()
@@ -84,6 +97,8 @@ void HDRImageViewerRenderer::CreateDeviceDependentResources()
 
 void HDRImageViewerRenderer::ReleaseDeviceDependentResources()
 {
+    // Prefetched images are cheap to decode again compared to restoring each one on the new device.
+    m_prefetchCache.Clear();
     m_imageLoader->ReleaseDeviceDependentResources();
 }
 
@@ -111,57 +126,101 @@ void HDRImageViewerRenderer::SetRenderOptions(
 
     UpdateWhiteLevelScale(m_brightnessAdjust, sdrWhite);
 
-    // Adjust the Direct2D effect graph based on RenderEffectKind.
-    // Some RenderEffectKind values require us to apply brightness adjustment
-    // after the effect as their numerical output is affected by any luminance boost.
-    switch (m_renderEffectKind)
+    bool isHdrDisplay = m_dispInfo->CurrentAdvancedColorKind == AdvancedColorKind::HighDynamicRange;
+
+    // Where every stage after color management is per pixel and our own, the fused effect applies
+    // them all in a single pass; the equivalent chained graphs are below. The Direct2D HDR
+    // tonemapper can't be fused.
+    bool isFused =
+        RenderPipeline::IsFusable(m_renderEffectKind) &&
+        (m_renderEffectKind != RenderEffectKind::HdrTonemap || m_isTonemapFusable);
+
+    if (isFused)
     {
-    // Effect graph: ImageSource > ColorManagement > WhiteScale > HDRTonemap > WhiteScale2*
-    case RenderEffectKind::HdrTonemap:
-        if (m_dispInfo->CurrentAdvancedColorKind != AdvancedColorKind::HighDynamicRange)
-        {
-            // *Second white scale is needed as an integral part of using the Direct2D HDR
-            // tonemapper on SDR/WCG displays to stay within [0, 1] numeric range.
-            m_finalOutput = m_sdrWhiteScaleEffect.Get();
-        }
-        else
+        FUSEDRENDER_KIND kind = FUSEDRENDER_KIND_NONE;
+        switch (m_renderEffectKind)
         {
-            m_finalOutput = m_hdrTonemapEffect.Get();
+        case RenderEffectKind::HdrTonemap:
+            kind = FUSEDRENDER_KIND_HDR_TONEMAP;
+            break;
+
+        case RenderEffectKind::SdrOverlay:
+            kind = FUSEDRENDER_KIND_SDR_OVERLAY;
+            break;
+
+        case RenderEffectKind::LuminanceHeatmap:
+            kind = FUSEDRENDER_KIND_LUMINANCE_HEATMAP;
+            break;
+
+        default:
+            break;
         }
 
-        m_sdrWhiteScaleEffect->SetInputEffect(0, m_hdrTonemapEffect.Get());
-        m_whiteScaleEffect->SetInputEffect(0, m_colorManagementEffect.Get());
-        break;
+        // Effect graph: ImageSource > ColorManagement > FusedRender
+        m_finalOutput = m_fusedRenderEffect.Get();
+        DX::ThrowIfFailed(m_fusedRenderEffect->SetValue(FUSEDRENDER_PROP_KIND, kind));
+        DX::ThrowIfFailed(
+            m_fusedRenderEffect->SetValue(
+                FUSEDRENDER_PROP_DISPLAY_MODE,
+                isHdrDisplay ? D2D1_HDRTONEMAP_DISPLAY_MODE_HDR : D2D1_HDRTONEMAP_DISPLAY_MODE_SDR));
+    }
+    else
+    {
+        // Adjust the Direct2D effect graph based on RenderEffectKind.
+        // Some RenderEffectKind values require us to apply brightness adjustment
+        // after the effect as their numerical output is affected by any luminance boost.
+        switch (m_renderEffectKind)
+        {
+        // Effect graph: ImageSource > ColorManagement > WhiteScale > HDRTonemap > WhiteScale2*
+        case RenderEffectKind::HdrTonemap:
+            if (m_dispInfo->CurrentAdvancedColorKind != AdvancedColorKind::HighDynamicRange)
+            {
+                // *Second white scale is needed as an integral part of using the Direct2D HDR
+                // tonemapper on SDR/WCG displays to stay within [0, 1] numeric range.
+                m_finalOutput = m_sdrWhiteScaleEffect.Get();
+            }
+            else
+            {
+                m_finalOutput = m_hdrTonemapEffect.Get();
+            }
+
+            m_sdrWhiteScaleEffect->SetInputEffect(0, m_hdrTonemapEffect.Get());
+            m_whiteScaleEffect->SetInputEffect(0, m_viewingOutput.Get());
+            break;
 
-    // Effect graph: ImageSource > ColorManagement > WhiteScale
-    case RenderEffectKind::None:
-        m_finalOutput = m_whiteScaleEffect.Get();
-        m_whiteScaleEffect->SetInputEffect(0, m_colorManagementEffect.Get());
-        break;
+        // Effect graph: ImageSource > ColorManagement > WhiteScale
+        case RenderEffectKind::None:
+            m_finalOutput = m_whiteScaleEffect.Get();
+            m_whiteScaleEffect->SetInputEffect(0, m_viewingOutput.Get());
+            break;
 
-    // Effect graph: ImageSource > ColorManagement > Heatmap > WhiteScale
-    case RenderEffectKind::LuminanceHeatmap:
-        m_finalOutput = m_whiteScaleEffect.Get();
-        m_whiteScaleEffect->SetInputEffect(0, m_heatmapEffect.Get());
-        break;
+        // Effect graph: ImageSource > ColorManagement > Heatmap > WhiteScale
+        case RenderEffectKind::LuminanceHeatmap:
+            m_finalOutput = m_whiteScaleEffect.Get();
+            m_whiteScaleEffect->SetInputEffect(0, m_heatmapEffect.Get());
+            break;
 
-    // Effect graph: ImageSource > ColorManagement > SdrOverlay > WhiteScale
-    case RenderEffectKind::SdrOverlay:
-        m_finalOutput = m_whiteScaleEffect.Get();
-        m_whiteScaleEffect->SetInputEffect(0, m_sdrOverlayEffect.Get());
-        break;
+        // Effect graph: ImageSource > ColorManagement > SdrOverlay > WhiteScale
+        case RenderEffectKind::SdrOverlay:
+            m_finalOutput = m_whiteScaleEffect.Get();
+            m_whiteScaleEffect->SetInputEffect(0, m_sdrOverlayEffect.Get());
+            break;
 
-    // Effect graph: ImageSource > ColorManagement > WhiteScale > SphereMap
-    case RenderEffectKind::SphereMap:
-        m_finalOutput = m_sphereMapEffect.Get();
-        m_whiteScaleEffect->SetInputEffect(0, m_colorManagementEffect.Get());
-        break;
+        // Effect graph: ImageSource > ColorManagement > WhiteScale > SphereMap
+        case RenderEffectKind::SphereMap:
+            m_finalOutput = m_sphereMapEffect.Get();
+            m_whiteScaleEffect->SetInputEffect(0, m_viewingOutput.Get());
+            break;
 
-    default:
-        throw ref new NotImplementedException();
-        break;
+        default:
+            throw ref new NotImplementedException();
+            break;
+        }
     }
 
+    // Tiled images only contain the tiles in view, but the sphere map can show any part of the image.
+    UpdateImageTransformState();
+
     float targetMaxNits = GetBestDispMaxLuminance();
 
     // Update HDR tonemappers with display information.
@@ -184,6 +243,13 @@ void HDRImageViewerRenderer::SetRenderOptions(
 
     DX::ThrowIfFailed(m_hdrTonemapEffect->SetValue(D2D1_HDRTONEMAP_PROP_DISPLAY_MODE, mode));
 
+    // The fused effect's tonemap stage takes the same values, and applies the white level correction
+    // below in its SDR display mode.
+    DX::ThrowIfFailed(m_fusedRenderEffect->SetValue(FUSEDRENDER_PROP_TONEMAP_INPUT_MAX_LUMINANCE, maxCLL));
+    DX::ThrowIfFailed(m_fusedRenderEffect->SetValue(FUSEDRENDER_PROP_TONEMAP_OUTPUT_MAX_LUMINANCE, targetMaxNits));
+    DX::ThrowIfFailed(
+        m_fusedRenderEffect->SetValue(FUSEDRENDER_PROP_OUTPUT_SCALE, D2D1_SCENE_REFERRED_SDR_WHITE_LEVEL / targetMaxNits));
+
     // If an HDR tonemapper is used on an SDR or WCG display, perform additional white level correction.
     if (m_dispInfo->CurrentAdvancedColorKind != AdvancedColorKind::HighDynamicRange)
     {
@@ -200,25 +266,280 @@ void HDRImageViewerRenderer::SetRenderOptions(
     Draw();
 }
 
-ImageInfo HDRImageViewerRenderer::LoadImageFromWic(_In_ IStream * imageStream)
+// Progressive loading: decodes a quick, reduced resolution preview which can be rendered while the
+// full image is loaded by a subsequent LoadImageAsync call with the same stream. The returned
+// ImageInfo is not valid if no preview could be produced cheaply; the full load is still required.
+ImageInfo HDRImageViewerRenderer::LoadPreviewFromWic(_In_ IStream* imageStream, cancellation_token cancel)
+{
+    PrepareImageLoader(cancel);
+    auto info = m_imageLoader->LoadPreviewFromWic(imageStream);
+    if (info.isValid)
+    {
+        m_imageInfo = info;
+    }
+
+    return info;
+}
+
+ImageInfo HDRImageViewerRenderer::LoadPreviewFromDirectXTex(_In_ IStream* imageStream, String ^ extension, cancellation_token cancel)
+{
+    PrepareImageLoader(cancel);
+    auto info = m_imageLoader->LoadPreviewFromDirectXTex(imageStream, extension);
+    if (info.isValid)
+    {
+        m_imageInfo = info;
+    }
+
+    return info;
+}
+
+ImageInfo HDRImageViewerRenderer::SelectImageSubresource(unsigned int frame, unsigned int mip)
 {
-    m_imageLoader = std::make_unique<ImageLoader>(m_deviceResources);
-    m_imageInfo = m_imageLoader->LoadImageFromWic(imageStream);
+    m_isImageCLLKnown = false;
+    m_imageInfo = m_imageLoader->SelectSubresource(frame, mip);
     return m_imageInfo;
 }
 
-ImageInfo HDRImageViewerRenderer::LoadImageFromDirectXTex(String ^ filename, String ^ extension)
+// Only the CPU side of the load runs on the thread pool; the loader is created with
+// deferDeviceResources and its Direct2D resources, which are single threaded, are created in the
+// continuation. Until then the current image, e.g. a preview, is still drawn from its own loader.
+task<ImageInfo> HDRImageViewerRenderer::LoadImageAsync(
+    _In_opt_ HANDLE file,
+    _In_ IStream* imageStream,
+    String^ extension,
+    cancellation_token cancel)
+{
+    auto options = m_loaderOptions;
+    options.deferDeviceResources = true;
+    auto loader = std::make_shared<ImageLoader>(m_deviceResources, options, cancel);
+
+    return DecodeOnThreadPool(loader, file, imageStream, extension).then([this, loader, cancel](ImageInfo info)
+    {
+        if (cancel.is_canceled())
+        {
+            return ImageInfo{};
+        }
+
+        if (loader->GetState() == ImageLoaderState::NeedDeviceResources)
+        {
+            loader->CreateDeviceDependentResources();
+            info.isValid = (loader->GetState() == ImageLoaderState::LoadingSucceeded);
+        }
+
+        m_imageLoader = loader;
+        m_imageInfo = info;
+        m_isImageCLLKnown = false;
+        return m_imageInfo;
+    }, task_continuation_context::use_current());
+}
+
+// A preview always starts from a new loader; replacing the old one releases whatever a superseded
+// load had decoded. The full load does not refine the preview's loader, which is still drawn while
+// LoadImageAsync decodes on the thread pool, but replaces it once its own loader is ready.
+void HDRImageViewerRenderer::PrepareImageLoader(cancellation_token cancel)
 {
-    m_imageLoader = std::make_unique<ImageLoader>(m_deviceResources);
-    m_imageInfo = m_imageLoader->LoadImageFromDirectXTex(filename, extension);
+    m_isImageCLLKnown = false;
+    m_imageLoader = std::make_shared<ImageLoader>(m_deviceResources, m_loaderOptions, cancel);
+}
+
+// Makes a cached image current. Returns an invalid ImageInfo on a miss; the caller then loads
+// the image normally.
+ImageInfo HDRImageViewerRenderer::LoadImageFromCache(const std::wstring& key)
+{
+    auto loader = m_prefetchCache.Lookup(key);
+    if (loader == nullptr)
+    {
+        return ImageInfo{};
+    }
+
+    m_imageLoader = loader;
+    m_imageInfo = m_imageLoader->GetImageInfo();
+    m_isImageCLLKnown = false;
     return m_imageInfo;
 }
 
+// Keeps the fully loaded current image so that navigating back to it is a cache hit.
+void HDRImageViewerRenderer::CacheCurrentImage(const std::wstring& key, int position)
+{
+    if (m_imageLoader != nullptr &&
+        m_imageLoader->GetState() == ImageLoaderState::LoadingSucceeded)
+    {
+        m_prefetchCache.Insert(key, position, m_imageLoader, m_imageLoader->GetResidentBytes());
+    }
+}
+
+bool HDRImageViewerRenderer::IsImageCached(const std::wstring& key) const
+{
+    return m_prefetchCache.Contains(key);
+}
+
+// Decodes a neighbouring image into the cache without affecting the current image. The decode
+// runs on the thread pool; only creating its Direct2D resources, which are single threaded, runs
+// in a continuation on the calling (UI) thread. Callers cancel it as soon as the user navigates.
+// Failures are not reported, the image is simply not cached and a real load will report the
+// error. DirectXTex formats are mapped from file if it is a valid handle, and otherwise read from
+// imageStream. Takes ownership of file.
+task<void> HDRImageViewerRenderer::PrefetchImage(
+    _In_opt_ HANDLE file,
+    _In_ IStream* imageStream,
+    String^ extension,
+    const std::wstring& key,
+    int position,
+    cancellation_token cancel)
+{
+    if (m_prefetchCache.Contains(key))
+    {
+        Wrappers::FileHandle unused(file);
+        return task_from_result();
+    }
+
+    auto options = m_loaderOptions;
+    options.deferDeviceResources = true;
+    auto loader = std::make_shared<ImageLoader>(m_deviceResources, options, cancel);
+
+    return DecodeOnThreadPool(loader, file, imageStream, extension).then([this, loader, key, position, cancel](ImageInfo)
+    {
+        if (loader->GetState() != ImageLoaderState::NeedDeviceResources || cancel.is_canceled())
+        {
+            return;
+        }
+
+        loader->CreateDeviceDependentResources();
+
+        if (loader->GetState() == ImageLoaderState::LoadingSucceeded)
+        {
+            loader->EnsureDecoded();
+            m_prefetchCache.Insert(key, position, loader, loader->GetResidentBytes());
+        }
+    }, task_continuation_context::use_current());
+}
+
+// Runs the CPU side of a load on the thread pool; loader must have been created with
+// deferDeviceResources. Takes ownership of file.
+task<ImageInfo> HDRImageViewerRenderer::DecodeOnThreadPool(
+    const std::shared_ptr<ImageLoader>& loader,
+    _In_opt_ HANDLE file,
+    _In_ IStream* imageStream,
+    String^ extension)
+{
+    auto fileHandle = std::make_shared<Wrappers::FileHandle>(file);
+
+    bool useDirectXTex = false;
+    for (auto type : { L".hdr", L".exr", L".dds" })
+    {
+        if (CompareStringOrdinal(extension->Data(), -1, type, -1, TRUE) == CSTR_EQUAL)
+        {
+            useDirectXTex = true;
+        }
+    }
+
+    ComPtr<IStream> stream = imageStream;
+
+    return create_task([loader, fileHandle, stream, extension, useDirectXTex]()
+    {
+        if (!useDirectXTex)
+        {
+            return loader->LoadImageFromWic(stream.Get());
+        }
+        else if (fileHandle->IsValid())
+        {
+            return loader->LoadImageFromDirectXTex(fileHandle->Get(), extension);
+        }
+        else
+        {
+            return loader->LoadImageFromDirectXTex(stream.Get(), extension);
+        }
+    });
+}
+
+void HDRImageViewerRenderer::SetPrefetchWindow(int position, int radius)
+{
+    m_prefetchCache.SetWindow(position, radius);
+}
+
+void HDRImageViewerRenderer::ClearPrefetchCache()
+{
+    m_prefetchCache.Clear();
+}
+
+ImagePrefetchStats HDRImageViewerRenderer::GetPrefetchStats() const
+{
+    return m_prefetchCache.GetStats();
+}
+
+// Restores an image decoded in an earlier session, including its HDR metadata, so neither the
+// decode nor the histogram pass is repeated. Returns an invalid ImageInfo on a miss.
+ImageInfo HDRImageViewerRenderer::LoadImageFromDiskCache(const std::wstring& key)
+{
+    DecodedImage decoded;
+    if (m_diskCache->Lookup(key, decoded) != S_OK)
+    {
+        return ImageInfo{};
+    }
+
+    auto loader = std::make_shared<ImageLoader>(m_deviceResources, m_loaderOptions);
+    auto info = loader->LoadImageFromDecoded(decoded);
+    if (loader->GetState() != ImageLoaderState::LoadingSucceeded)
+    {
+        return ImageInfo{};
+    }
+
+    m_imageLoader = loader;
+    m_imageInfo = info;
+    m_imageCLL = decoded.cll;
+    m_isImageCLLKnown = true;
+    return m_imageInfo;
+}
+
+// Persists the current image once its HDR metadata has been computed. The file is written on a
+// worker thread; images which can't be persisted (see ImageLoader::CreatePersistableSource) and
+// write failures are silently skipped.
+void HDRImageViewerRenderer::StoreImageInDiskCache(const std::wstring& key)
+{
+    ComPtr<IWICBitmapSource> pixels;
+    if (m_isImageCLLKnown ||
+        m_imageLoader == nullptr ||
+        FAILED(m_imageLoader->CreatePersistableSource(&pixels)))
+    {
+        return;
+    }
+
+    auto cache = m_diskCache;
+    auto info = m_imageInfo;
+    auto cll = m_imageCLL;
+
+    create_task([cache, key, info, cll, pixels]() {
+        cache->Store(key, info, cll, pixels.Get());
+    }).then([](task<void> previousTask) {
+        try
+        {
+            previousTask.get();
+        }
+        catch (...)
+        {
+            // The entry is only an optimization; the next open decodes the file again.
+        }
+    });
+}
+
+// True if the image loader has something to render, even if it is only a preview.
+bool HDRImageViewerRenderer::IsImageLoaded() const
+{
+    return m_imageLoader != nullptr &&
+        (m_imageLoader->GetState() == ImageLoaderState::LoadingSucceeded ||
+         m_imageLoader->GetState() == ImageLoaderState::PreviewReady);
+}
+
 void HDRImageViewerRenderer::ExportImageToSdr(_In_ IStream* outputStream, GUID wicFormat)
 {
     ImageExporter::ExportToSdr(m_imageLoader.get(), m_deviceResources.get(), outputStream, wicFormat);
 }
 
+void HDRImageViewerRenderer::ExportImageToRgbe(_In_ IStream* outputStream)
+{
+    ImageExporter::ExportToRgbe(m_imageLoader.get(), m_deviceResources.get(), outputStream);
+}
+
 // Test only. Exports to DXGI encoded DDS.
 void HDRImageViewerRenderer::ExportAsDdsTest(_In_ IStream* outputStream)
 {
@@ -236,42 +557,16 @@ void HDRImageViewerRenderer::CreateImageDependentResources()
     auto d2dFactory = m_deviceResources->GetD2DFactory();
     auto context = m_deviceResources->GetD2DDeviceContext();
 
-    // Next, configure the app's effect pipeline, consisting of a color management effect
-    // followed by a tone mapping effect.
-
-    DX::ThrowIfFailed(context->CreateEffect(CLSID_D2D1ColorManagement, &m_colorManagementEffect));
-
-    DX::ThrowIfFailed(
-        m_colorManagementEffect->SetValue(
-            D2D1_COLORMANAGEMENT_PROP_QUALITY,
-            D2D1_COLORMANAGEMENT_QUALITY_BEST));   // Required for floating point and DXGI color space support.
-
-    // The color management effect takes a source color space and a destination color space,
-    // and performs the appropriate math to convert images between them.
-    DX::ThrowIfFailed(
-        m_colorManagementEffect->SetValue(
-            D2D1_COLORMANAGEMENT_PROP_SOURCE_COLOR_CONTEXT,
-            m_imageLoader->GetImageColorContext()));
-
-    // The destination color space is the render target's (swap chain's) color space. This app uses an
-    // FP16 swap chain, which requires the colorspace to be scRGB.
-    ComPtr<ID2D1ColorContext1> destColorContext;
-    DX::ThrowIfFailed(
-        context->CreateColorContextFromDxgiColorSpace(
-            DXGI_COLOR_SPACE_RGB_FULL_G10_NONE_P709, // scRGB
-            &destColorContext));
-
-    DX::ThrowIfFailed(
-        m_colorManagementEffect->SetValue(
-            D2D1_COLORMANAGEMENT_PROP_DESTINATION_COLOR_CONTEXT,
-            destColorContext.Get()));
+    // Next, configure the app's effect pipeline, consisting of color management, an optional
+    // viewing LUT, and a tone mapping effect.
+    CreateColorManagementEffects();
 
     // White level scale is used to multiply the color values in the image; this allows the user
     // to adjust the brightness of the image on an HDR display.
     DX::ThrowIfFailed(context->CreateEffect(CLSID_D2D1ColorMatrix, &m_whiteScaleEffect));
 
     // Input to white level scale may be modified in SetRenderOptions.
-    m_whiteScaleEffect->SetInputEffect(0, m_colorManagementEffect.Get());
+    m_whiteScaleEffect->SetInputEffect(0, m_viewingOutput.Get());
 
     // Set the actual matrix in SetRenderOptions.
 
@@ -290,11 +585,14 @@ void HDRImageViewerRenderer::CreateImageDependentResources()
         tonemapper = CLSID_CustomSimpleTonemapEffect;
     }
 
+    m_isTonemapFusable = (tonemapper == CLSID_CustomSimpleTonemapEffect);
+
     DX::ThrowIfFailed(context->CreateEffect(tonemapper, &m_hdrTonemapEffect));
     DX::ThrowIfFailed(context->CreateEffect(CLSID_D2D1WhiteLevelAdjustment, &m_sdrWhiteScaleEffect));
     DX::ThrowIfFailed(context->CreateEffect(CLSID_CustomSdrOverlayEffect, &m_sdrOverlayEffect));
     DX::ThrowIfFailed(context->CreateEffect(CLSID_CustomLuminanceHeatmapEffect, &m_heatmapEffect));
     DX::ThrowIfFailed(context->CreateEffect(CLSID_CustomSphereMapEffect, &m_sphereMapEffect));
+    DX::ThrowIfFailed(context->CreateEffect(CLSID_CustomFusedRenderEffect, &m_fusedRenderEffect));
 
     // TEST: border effect to remove seam at the boundary of the image (subpixel sampling)
     // Unclear if we can force D2D_BORDER_MODE_HARD somewhere to avoid the seam.
@@ -318,8 +616,11 @@ void HDRImageViewerRenderer::CreateImageDependentResources()
 
     // For the following effects, we want white level scale to be applied after
     // tonemapping (otherwise brightness adjustments will affect numerical values).
-    m_heatmapEffect->SetInputEffect(0, m_colorManagementEffect.Get());
-    m_sdrOverlayEffect->SetInputEffect(0, m_colorManagementEffect.Get());
+    m_heatmapEffect->SetInputEffect(0, m_viewingOutput.Get());
+    m_sdrOverlayEffect->SetInputEffect(0, m_viewingOutput.Get());
+
+    // The fused effect applies white scale itself, at whichever point the kind's chained graph does.
+    m_fusedRenderEffect->SetInputEffect(0, m_viewingOutput.Get());
 
     // The remainder of the Direct2D effect graph is constructed in SetRenderOptions based on the
     // selected RenderEffectKind.
@@ -327,6 +628,84 @@ void HDRImageViewerRenderer::CreateImageDependentResources()
     CreateHistogramResources();
 }
 
+// Creates the color management stage of the pipeline, from the image's color context to scRGB,
+// followed by the viewing LUT if one is set.
+void HDRImageViewerRenderer::CreateColorManagementEffects()
+{
+    auto context = m_deviceResources->GetD2DDeviceContext();
+    auto sourceColorContext = m_imageLoader->GetImageColorContext();
+
+    m_colorManagementEffect.Reset();
+    m_colorManagementOutput.Reset();
+
+    // Baking replaces the per pixel transform with a single 3D lookup. Floating point images can
+    // exceed [0, 1], which the LUT clamps, so they always use the effect.
+    if (m_loaderOptions.colorManagementLutSize > 0 && !m_imageInfo.isFloat)
+    {
+        std::shared_ptr<const Lut3D> lut;
+        HRESULT hr = Lut3D::GetColorManagementLut(context, sourceColorContext, m_loaderOptions.colorManagementLutSize, lut);
+
+        // Color contexts without an ICC profile (DXGI color spaces, EXIF sRGB) use the effect.
+        if (hr != WINCODEC_ERR_UNSUPPORTEDOPERATION)
+        {
+            DX::ThrowIfFailed(hr);
+            DX::ThrowIfFailed(lut->CreateEffects(context, &m_colorManagementEffect, &m_colorManagementOutput));
+        }
+    }
+
+    if (!m_colorManagementEffect)
+    {
+        DX::ThrowIfFailed(context->CreateEffect(CLSID_D2D1ColorManagement, &m_colorManagementEffect));
+
+        DX::ThrowIfFailed(
+            m_colorManagementEffect->SetValue(
+                D2D1_COLORMANAGEMENT_PROP_QUALITY,
+                D2D1_COLORMANAGEMENT_QUALITY_BEST));   // Required for floating point and DXGI color space support.
+
+        // The color management effect takes a source color space and a destination color space,
+        // and performs the appropriate math to convert images between them.
+        DX::ThrowIfFailed(
+            m_colorManagementEffect->SetValue(
+                D2D1_COLORMANAGEMENT_PROP_SOURCE_COLOR_CONTEXT,
+                sourceColorContext));
+
+        // The destination color space is the render target's (swap chain's) color space. This app uses an
+        // FP16 swap chain, which requires the colorspace to be scRGB.
+        ComPtr<ID2D1ColorContext1> destColorContext;
+        DX::ThrowIfFailed(
+            context->CreateColorContextFromDxgiColorSpace(
+                DXGI_COLOR_SPACE_RGB_FULL_G10_NONE_P709, // scRGB
+                &destColorContext));
+
+        DX::ThrowIfFailed(
+            m_colorManagementEffect->SetValue(
+                D2D1_COLORMANAGEMENT_PROP_DESTINATION_COLOR_CONTEXT,
+                destColorContext.Get()));
+
+        m_colorManagementOutput = m_colorManagementEffect;
+    }
+
+    m_viewingOutput = m_colorManagementOutput;
+
+    if (m_viewingLut)
+    {
+        ComPtr<ID2D1Effect> first;
+        DX::ThrowIfFailed(m_viewingLut->CreateEffects(context, &first, &m_viewingOutput));
+        first->SetInputEffect(0, m_colorManagementOutput.Get());
+    }
+}
+
+void HDRImageViewerRenderer::SetViewingLut(const std::shared_ptr<const Lut3D>& lut)
+{
+    m_viewingLut = lut;
+
+    if (IsImageLoaded())
+    {
+        // Recreates the whole graph, which SetRenderOptions then reconnects.
+        CreateImageDependentResources();
+    }
+}
+
 // Perform histogram pipeline setup; this should occur as part of image resource creation.
 // Histogram results in no visual output but is used to calculate HDR metadata for the image.
 void HDRImageViewerRenderer::CreateHistogramResources()
@@ -341,7 +720,7 @@ void HDRImageViewerRenderer::CreateHistogramResources()
 
     // The right place to compute HDR metadata is after color management to the
     // image's native colorspace but before any tonemapping or adjustments for the display.
-    m_histogramPrescale->SetInputEffect(0, m_colorManagementEffect.Get());
+    m_histogramPrescale->SetInputEffect(0, m_colorManagementOutput.Get());
 
     // 2. Convert scRGB data into luminance (nits).
     // 3. Normalize color values. Histogram operates on [0-1] numeric range,
@@ -409,11 +788,14 @@ void HDRImageViewerRenderer::ReleaseImageDependentResources()
 
     m_loadedImage.Reset();
     m_colorManagementEffect.Reset();
+    m_colorManagementOutput.Reset();
+    m_viewingOutput.Reset();
     m_whiteScaleEffect.Reset();
     m_sdrWhiteScaleEffect.Reset();
     m_hdrTonemapEffect.Reset();
     m_sdrOverlayEffect.Reset();
     m_heatmapEffect.Reset();
+    m_fusedRenderEffect.Reset();
     m_histogramPrescale.Reset();
     m_histogramEffect.Reset();
     m_finalOutput.Reset();
@@ -482,8 +864,7 @@ void HDRImageViewerRenderer::UpdateManipulationState(_In_ ManipulationUpdatedEve
 ImageCLL HDRImageViewerRenderer::FitImageToWindow(bool computeMetadata)
 {
     // TODO: Suspect this sometimes crashes due to AV. Need to root cause.
-    if (m_imageLoader != nullptr &&
-        m_imageLoader->GetState() == ImageLoaderState::LoadingSucceeded)
+    if (IsImageLoaded())
     {
         Size panelSize = m_deviceResources->GetLogicalSize();
 
@@ -556,16 +937,45 @@ void HDRImageViewerRenderer::UpdateWhiteLevelScale(float brightnessAdjustment, f
         0, 0, 0    , 0); //     No offset.
 
     DX::ThrowIfFailed(m_whiteScaleEffect->SetValue(D2D1_COLORMATRIX_PROP_COLOR_MATRIX, matrix));
+    DX::ThrowIfFailed(m_fusedRenderEffect->SetValue(FUSEDRENDER_PROP_WHITE_SCALE, scale));
 }
 
 // Call this after updating any spatial transform state to regenerate the effect graph.
 void HDRImageViewerRenderer::UpdateImageTransformState()
 {
-    if (m_imageLoader->GetState() == ImageLoaderState::LoadingSucceeded)
+    if (IsImageLoaded())
     {
+        // Very large images are drawn from only the tiles in view. The sphere map can show any
+        // part of the image.
+        Size panelSize = m_deviceResources->GetLogicalSize();
+        D2D1_RECT_F visibleRect = D2D1::RectF(
+            -m_imageOffset.x / m_zoom,
+            -m_imageOffset.y / m_zoom,
+            (panelSize.Width - m_imageOffset.x) / m_zoom,
+            (panelSize.Height - m_imageOffset.y) / m_zoom);
+
+        bool isSphereMap = (m_renderEffectKind == RenderEffectKind::SphereMap);
+
         // Set the new image as the new source to the effect pipeline.
-        m_loadedImage = m_imageLoader->GetLoadedImage(m_zoom);
+        m_loadedImage.Attach(m_imageLoader->GetLoadedImage(m_zoom, isSphereMap ? nullptr : &visibleRect));
         m_colorManagementEffect->SetInput(0, m_loadedImage.Get());
+
+        // A finer level of a multi-resolution image is being decoded in the background; the
+        // resident level is drawn meanwhile. Draw again once it can be swapped in, unless the
+        // image has been replaced by then.
+        task<void> refinement;
+        if (m_imageLoader->TakeRefinement(&refinement))
+        {
+            auto loader = m_imageLoader;
+            refinement.then([this, loader]()
+            {
+                if (m_imageLoader == loader)
+                {
+                    UpdateImageTransformState();
+                    Draw();
+                }
+            }, task_continuation_context::use_current());
+        }
     }
 }
 
@@ -574,6 +984,11 @@ void HDRImageViewerRenderer::UpdateImageTransformState()
 // Performs Begin/EndDraw on the D2D context.
 void HDRImageViewerRenderer::ComputeHdrMetadata()
 {
+    if (m_isImageCLLKnown)
+    {
+        return;
+    }
+
     // Initialize with a sentinel value.
     m_imageCLL = { -1.0f, -1.0f };
 
@@ -759,6 +1174,7 @@ void HDRImageViewerRenderer::OnDeviceLost()
 {
     ReleaseImageDependentResources();
     ReleaseDeviceDependentResources();
+    ColorProfileCache::ReleaseDeviceResources();
 }
 
 // Notifies renderers that device resources may now be recreated.
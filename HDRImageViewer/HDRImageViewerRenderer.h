@@ -15,8 +15,12 @@
 #include "SdrOverlayEffect.h"
 #include "LuminanceHeatmapEffect.h"
 #include "SphereMapEffect.h"
+#include "FusedRenderEffect.h"
 #include "RenderOptions.h"
 #include "ImageLoader.h"
+#include "ImagePrefetchCache.h"
+#include "DecodedImageCache.h"
+#include "Lut3D.h"
 
 namespace HDRImageViewer
 {
@@ -49,9 +53,54 @@ namespace HDRImageViewer
             Windows::Graphics::Display::AdvancedColorInfo^ acInfo
             );
 
-        ImageInfo LoadImageFromWic(_In_ IStream* imageStream);
-        ImageInfo LoadImageFromDirectXTex(_In_ Platform::String^ filename, _In_ Platform::String^ extension);
+        // Applies a creative or display LUT to the scRGB output of color management, before
+        // brightness and tonemapping; nullptr removes it. Call SetRenderOptions afterwards.
+        void SetViewingLut(const std::shared_ptr<const Lut3D>& lut);
+
+        // Loads return an invalid ImageInfo, without an error, if cancel is canceled before they finish.
+        ImageInfo LoadPreviewFromWic(
+            _In_ IStream* imageStream,
+            concurrency::cancellation_token cancel = concurrency::cancellation_token::none());
+        ImageInfo LoadPreviewFromDirectXTex(
+            _In_ IStream* imageStream,
+            _In_ Platform::String^ extension,
+            concurrency::cancellation_token cancel = concurrency::cancellation_token::none());
+
+        // Decodes the full image on the thread pool; it replaces the current one, e.g. a preview,
+        // in a continuation on the calling (UI) thread. DirectXTex formats are mapped from file if it
+        // is a valid handle, and otherwise read from imageStream. Takes ownership of file.
+        concurrency::task<ImageInfo> LoadImageAsync(
+            _In_opt_ HANDLE file,
+            _In_ IStream* imageStream,
+            _In_ Platform::String^ extension,
+            concurrency::cancellation_token cancel);
+
+        // Switches to another frame or mip level of the loaded image; see ImageLoader::SelectSubresource.
+        // The caller must then call CreateImageDependentResources, as after a load.
+        ImageInfo SelectImageSubresource(unsigned int frame, unsigned int mip);
+
+        // Folder navigation. Images are identified by key (their path) and their position in the
+        // folder; all of these must be called on the UI thread, like the loads above.
+        ImageInfo LoadImageFromCache(const std::wstring& key);
+        void      CacheCurrentImage(const std::wstring& key, int position);
+        bool      IsImageCached(const std::wstring& key) const;
+        concurrency::task<void> PrefetchImage(
+            _In_opt_ HANDLE file,
+            _In_ IStream* imageStream,
+            _In_ Platform::String^ extension,
+            const std::wstring& key,
+            int position,
+            concurrency::cancellation_token cancel);
+        void      SetPrefetchWindow(int position, int radius);
+        void      ClearPrefetchCache();
+        ImagePrefetchStats GetPrefetchStats() const;
+
+        // Decoded images persisted across sessions, keyed by DecodedImageCache::MakeKey.
+        ImageInfo LoadImageFromDiskCache(const std::wstring& key);
+        void      StoreImageInDiskCache(const std::wstring& key);
+
         void      ExportImageToSdr(_In_ IStream* outputStream, GUID wicFormat);
+        void      ExportImageToRgbe(_In_ IStream* outputStream);
         void      ExportAsDdsTest(_In_ IStream* outputStream);
 
         // IDeviceNotify methods handle device lost and restored.
@@ -66,9 +115,17 @@ namespace HDRImageViewer
             return (v < low) ? low : (v > high) ? high : v;
         }
 
+        void PrepareImageLoader(concurrency::cancellation_token cancel);
+        static concurrency::task<ImageInfo> DecodeOnThreadPool(
+            const std::shared_ptr<ImageLoader>& loader,
+            _In_opt_ HANDLE file,
+            _In_ IStream* imageStream,
+            _In_ Platform::String^ extension);
+        bool IsImageLoaded() const;
         void CreateHistogramResources();
         void UpdateWhiteLevelScale(float brightnessAdjustment, float sdrWhiteLevel);
         void UpdateImageTransformState();
+        void CreateColorManagementEffects();
         void ComputeHdrMetadata();
         void EmitHdrMetadata();
 
@@ -76,17 +133,23 @@ namespace HDRImageViewer
 
         // Cached pointer to device resources.
         std::shared_ptr<DX::DeviceResources>                    m_deviceResources;
-        std::unique_ptr<ImageLoader>                            m_imageLoader;
+        std::shared_ptr<ImageLoader>                            m_imageLoader;
+        ImageLoaderOptions                                      m_loaderOptions;
+        ImagePrefetchCache                                      m_prefetchCache;
+        std::shared_ptr<DecodedImageCache>                      m_diskCache;
 
         // WIC and Direct2D resources.
-        Microsoft::WRL::ComPtr<ID2D1TransformedImageSource>     m_loadedImage;
-        Microsoft::WRL::ComPtr<ID2D1Effect>                     m_colorManagementEffect;
+        Microsoft::WRL::ComPtr<ID2D1Image>                      m_loadedImage;
+        Microsoft::WRL::ComPtr<ID2D1Effect>                     m_colorManagementEffect;  // Input of color management: the effect, or a baked LUT.
+        Microsoft::WRL::ComPtr<ID2D1Effect>                     m_colorManagementOutput;  // Output of color management.
+        Microsoft::WRL::ComPtr<ID2D1Effect>                     m_viewingOutput;          // Output of color management and the viewing LUT.
         Microsoft::WRL::ComPtr<ID2D1Effect>                     m_whiteScaleEffect;
         Microsoft::WRL::ComPtr<ID2D1Effect>                     m_sdrWhiteScaleEffect;
         Microsoft::WRL::ComPtr<ID2D1Effect>                     m_hdrTonemapEffect;
         Microsoft::WRL::ComPtr<ID2D1Effect>                     m_sdrOverlayEffect;
         Microsoft::WRL::ComPtr<ID2D1Effect>                     m_heatmapEffect;
         Microsoft::WRL::ComPtr<ID2D1Effect>                     m_sphereMapEffect;
+        Microsoft::WRL::ComPtr<ID2D1Effect>                     m_fusedRenderEffect;      // Replaces the effects above where possible.
         Microsoft::WRL::ComPtr<ID2D1Effect>                     m_histogramPrescale;
         Microsoft::WRL::ComPtr<ID2D1Effect>                     m_histogramEffect;
         Microsoft::WRL::ComPtr<ID2D1Effect>                     m_finalOutput;
@@ -98,9 +161,12 @@ namespace HDRImageViewer
         D2D1_POINT_2F                                           m_imageOffset;
         D2D1_POINT_2F                                           m_pointerPos;
         ImageCLL                                                m_imageCLL;
+        bool                                                    m_isImageCLLKnown; // m_imageCLL was restored from the disk cache.
         float                                                   m_brightnessAdjust;
         Windows::Graphics::Display::AdvancedColorInfo^          m_dispInfo;
         ImageInfo                                               m_imageInfo;
         bool                                                    m_isComputeSupported;
+        bool                                                    m_isTonemapFusable;       // The custom tonemapper is in use.
+        std::shared_ptr<const Lut3D>                            m_viewingLut;
     };
 }
\ No newline at end of file
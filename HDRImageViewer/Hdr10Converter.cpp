@@ -0,0 +1,91 @@
+#include "pch.h"
+#include "Hdr10Converter.h"
+#include "TransferFunctions.h"
+
+#include <array>
+#include <DirectXPackedVector.h>
+#include <ppl.h>
+
+using namespace HDRImageViewer;
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+static const UINT sc_RowsPerTask = 16; // Rows per parallel work item.
+static const float sc_ScRgbReferenceNits = 80.0f; // Luminance of scRGB 1.0.
+
+namespace
+{
+    /// <summary>
+    /// Linear scRGB value of each 10 bit PQ code value.
+    /// </summary>
+    const std::array<float, 1024>& GetPqTable()
+    {
+        static const std::array<float, 1024> s_table = []()
+        {
+            std::array<float, 1024> table;
+            for (size_t i = 0; i < table.size(); i++)
+            {
+                table[i] = TransferFunctions::EvaluateExact(TransferFunction::PqEotf, i / 1023.0f) / sc_ScRgbReferenceNits;
+            }
+
+            return table;
+        }();
+
+        return s_table;
+    }
+}
+
+/// <summary>
+/// Each row of the BT.2020 to BT.709 matrix is the contribution of one input channel, so a
+/// pixel is three multiply-adds of broadcast channel values.
+/// </summary>
+void Hdr10Converter::ConvertRow(const uint32_t* src, size_t count, uint16_t* half)
+{
+    static const XMVECTORF32 s_fromR = { { {  1.660491f, -0.124550f, -0.018151f, 0.0f } } };
+    static const XMVECTORF32 s_fromG = { { { -0.587641f,  1.132900f, -0.100579f, 0.0f } } };
+    static const XMVECTORF32 s_fromB = { { { -0.072850f, -0.008349f,  1.118730f, 0.0f } } };
+    static const float s_alpha[4] = { 0.0f, 1.0f / 3.0f, 2.0f / 3.0f, 1.0f };
+
+    const auto& pq = GetPqTable();
+    auto dst = reinterpret_cast<XMHALF4*>(half);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t p = src[i];
+
+        XMVECTOR v = XMVectorMultiply(XMVectorReplicate(pq[p & 0x3FF]), s_fromR);
+        v = XMVectorMultiplyAdd(XMVectorReplicate(pq[(p >> 10) & 0x3FF]), s_fromG, v);
+        v = XMVectorMultiplyAdd(XMVectorReplicate(pq[(p >> 20) & 0x3FF]), s_fromB, v);
+        v = XMVectorSetW(v, s_alpha[p >> 30]);
+
+        XMStoreHalf4(&dst[i], v);
+    }
+}
+
+void Hdr10Converter::ConvertRows(
+    const uint8_t* src,
+    UINT srcStride,
+    uint8_t* dst,
+    UINT dstStride,
+    UINT width,
+    UINT height,
+    const concurrency::cancellation_token& cancel)
+{
+    // Builds the table once, outside of the parallel loop.
+    GetPqTable();
+
+    concurrency::parallel_for(0u, (height + sc_RowsPerTask - 1) / sc_RowsPerTask, [&](UINT task)
+    {
+        if (cancel.is_canceled())
+            return;
+
+        for (UINT y = task * sc_RowsPerTask; y < (std::min)((task + 1) * sc_RowsPerTask, height); y++)
+        {
+            ConvertRow(
+                reinterpret_cast<const uint32_t*>(src + y * srcStride),
+                width,
+                reinterpret_cast<uint16_t*>(dst + y * dstStride));
+        }
+    });
+}
@@ -0,0 +1,45 @@
+//*********************************************************
+//
+// Hdr10Converter
+//
+// Converts HDR10 (BT.2100: ST.2084 PQ transfer function,
+// BT.2020 primaries) pixels packed as R10G10B10A2 to FP16
+// scRGB (linear BT.709 primaries, 1.0 = 80 nits) on the CPU.
+//
+// There are only 1024 possible code values per channel, so
+// the PQ EOTF is a table lookup; the gamut conversion and the
+// FP16 packing are vectorized with DirectXMath. Rows are
+// spread across all cores.
+//
+//*********************************************************
+
+#pragma once
+
+namespace HDRImageViewer
+{
+    class Hdr10Converter
+    {
+    public:
+        /// <summary>
+        /// Converts rows of GUID_WICPixelFormat32bppR10G10B10A2HDR10 pixels to
+        /// GUID_WICPixelFormat64bppRGBAHalf. Returns immediately if cancel is canceled;
+        /// the destination is then incomplete.
+        /// </summary>
+        static void ConvertRows(
+            _In_ const uint8_t* src,
+            UINT srcStride,
+            _Out_ uint8_t* dst,
+            UINT dstStride,
+            UINT width,
+            UINT height,
+            const concurrency::cancellation_token& cancel = concurrency::cancellation_token::none());
+
+        /// <summary>
+        /// Converts a single row; see ConvertRows.
+        /// </summary>
+        static void ConvertRow(
+            _In_reads_(count) const uint32_t* src,
+            size_t count,
+            _Out_writes_(count * 4) uint16_t* half);
+    };
+}
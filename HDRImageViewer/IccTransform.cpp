@@ -0,0 +1,339 @@
+#include "pch.h"
+#include "IccTransform.h"
+
+#include <DirectXPackedVector.h>
+#include <ppl.h>
+
+using namespace HDRImageViewer;
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+static const UINT sc_RowsPerTask = 16; // Rows per parallel work item.
+static const UINT sc_CurveSegments = 4096; // Linearly interpolated segments per tone curve table.
+static const size_t sc_HeaderBytes = 128;
+static const size_t sc_TagEntryBytes = 12;
+
+namespace
+{
+    // ICC values are big endian.
+
+    uint32_t ReadUInt32(_In_reads_bytes_(4) const uint8_t* p)
+    {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    uint16_t ReadUInt16(_In_reads_bytes_(2) const uint8_t* p)
+    {
+        return static_cast<uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    float ReadS15Fixed16(_In_reads_bytes_(4) const uint8_t* p)
+    {
+        return static_cast<int32_t>(ReadUInt32(p)) / 65536.0f;
+    }
+
+    /// <summary>
+    /// Finds a tag's data in the tag table. Returns WINCODEC_ERR_UNSUPPORTEDOPERATION if the tag is
+    /// absent, as profiles lacking the matrix/TRC tags are valid but of another class.
+    /// </summary>
+    HRESULT FindTag(const uint8_t* profile, size_t size, uint32_t signature, const uint8_t** tag, size_t* tagSize)
+    {
+        uint32_t tagCount = ReadUInt32(profile + sc_HeaderBytes);
+        for (uint32_t i = 0; i < tagCount; i++)
+        {
+            const uint8_t* entry = profile + sc_HeaderBytes + 4 + i * sc_TagEntryBytes;
+            if (ReadUInt32(entry) != signature)
+                continue;
+
+            uint32_t offset = ReadUInt32(entry + 4);
+            uint32_t length = ReadUInt32(entry + 8);
+            if (offset > size || length > size - offset)
+                return WINCODEC_ERR_BADHEADER;
+
+            *tag = profile + offset;
+            *tagSize = length;
+            return S_OK;
+        }
+
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+    }
+
+    /// <summary>
+    /// Reads a colorant: the PCS (D50 XYZ) value of a full intensity primary.
+    /// </summary>
+    HRESULT ReadColorant(const uint8_t* profile, size_t size, uint32_t signature, XMFLOAT3& xyz)
+    {
+        const uint8_t* tag = nullptr;
+        size_t tagSize = 0;
+        HRESULT hr = FindTag(profile, size, signature, &tag, &tagSize);
+        if (FAILED(hr))
+            return hr;
+
+        if (tagSize < 20 || ReadUInt32(tag) != 'XYZ ')
+            return WINCODEC_ERR_BADHEADER;
+
+        xyz = XMFLOAT3(ReadS15Fixed16(tag + 8), ReadS15Fixed16(tag + 12), ReadS15Fixed16(tag + 16));
+        return S_OK;
+    }
+
+    /// <summary>
+    /// Samples a curveType or parametricCurveType tone curve, which maps encoded values to linear.
+    /// </summary>
+    HRESULT ReadCurve(const uint8_t* profile, size_t size, uint32_t signature, std::vector<float>& curve)
+    {
+        const uint8_t* tag = nullptr;
+        size_t tagSize = 0;
+        HRESULT hr = FindTag(profile, size, signature, &tag, &tagSize);
+        if (FAILED(hr))
+            return hr;
+
+        if (tagSize < 12)
+            return WINCODEC_ERR_BADHEADER;
+
+        curve.resize(sc_CurveSegments + 1);
+
+        uint32_t type = ReadUInt32(tag);
+        if (type == 'curv')
+        {
+            uint32_t count = ReadUInt32(tag + 8);
+            if (count > (tagSize - 12) / 2)
+                return WINCODEC_ERR_BADHEADER;
+
+            const uint8_t* entries = tag + 12;
+            for (UINT i = 0; i <= sc_CurveSegments; i++)
+            {
+                float x = static_cast<float>(i) / sc_CurveSegments;
+
+                if (count == 0)
+                {
+                    // Identity.
+                    curve[i] = x;
+                }
+                else if (count == 1)
+                {
+                    // A gamma exponent, as u8Fixed8Number.
+                    curve[i] = powf(x, ReadUInt16(entries) / 256.0f);
+                }
+                else
+                {
+                    // A table of evenly spaced samples, interpolated.
+                    float position = x * (count - 1);
+                    uint32_t index = (std::min)(static_cast<uint32_t>(position), count - 2);
+                    float fraction = position - index;
+                    float y0 = ReadUInt16(entries + index * 2) / 65535.0f;
+                    float y1 = ReadUInt16(entries + index * 2 + 2) / 65535.0f;
+                    curve[i] = y0 + (y1 - y0) * fraction;
+                }
+            }
+        }
+        else if (type == 'para')
+        {
+            static const UINT s_parameterCounts[] = { 1, 3, 4, 5, 7 };
+
+            uint16_t function = ReadUInt16(tag + 8);
+            if (function >= ARRAYSIZE(s_parameterCounts))
+                return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+            if (tagSize < 12 + s_parameterCounts[function] * 4)
+                return WINCODEC_ERR_BADHEADER;
+
+            float p[7] = {};
+            for (UINT i = 0; i < s_parameterCounts[function]; i++)
+            {
+                p[i] = ReadS15Fixed16(tag + 12 + i * 4);
+            }
+
+            // Every function type is a special case of Y = (aX + b)^g + e for X >= d, else cX + f.
+            float g = p[0], a = 1.0f, b = 0.0f, c = 0.0f, d = 0.0f, e = 0.0f, f = 0.0f;
+            switch (function)
+            {
+            case 1:
+                a = p[1]; b = p[2]; d = a != 0.0f ? -b / a : 0.0f;
+                break;
+            case 2:
+                a = p[1]; b = p[2]; d = a != 0.0f ? -b / a : 0.0f; e = p[3]; f = p[3];
+                break;
+            case 3:
+                a = p[1]; b = p[2]; c = p[3]; d = p[4];
+                break;
+            case 4:
+                a = p[1]; b = p[2]; c = p[3]; d = p[4]; e = p[5]; f = p[6];
+                break;
+            }
+
+            for (UINT i = 0; i <= sc_CurveSegments; i++)
+            {
+                float x = static_cast<float>(i) / sc_CurveSegments;
+                curve[i] = x >= d ? powf((std::max)(a * x + b, 0.0f), g) + e : c * x + f;
+            }
+        }
+        else
+        {
+            return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+        }
+
+        return S_OK;
+    }
+
+    // Scales normalized RGB to curve table positions, leaving alpha.
+    const XMVECTORF32 s_curveScale = { { {
+        static_cast<float>(sc_CurveSegments), static_cast<float>(sc_CurveSegments), static_cast<float>(sc_CurveSegments), 1.0f } } };
+
+    float EvaluateCurve(const std::vector<float>& curve, float position)
+    {
+        UINT index = (std::min)(static_cast<UINT>(position), sc_CurveSegments - 1);
+        float fraction = position - index;
+        return curve[index] + (curve[index + 1] - curve[index]) * fraction;
+    }
+}
+
+HRESULT IccTransform::CreateFromProfile(const uint8_t* profile, size_t size, IccTransform& transform)
+{
+    if (size < sc_HeaderBytes + 4 ||
+        ReadUInt32(profile) > size ||
+        ReadUInt32(profile + 36) != 'acsp')
+    {
+        return WINCODEC_ERR_BADHEADER;
+    }
+
+    uint32_t tagCount = ReadUInt32(profile + sc_HeaderBytes);
+    if (tagCount > (size - sc_HeaderBytes - 4) / sc_TagEntryBytes)
+    {
+        return WINCODEC_ERR_BADHEADER;
+    }
+
+    // Matrix/TRC profiles convert RGB data to an XYZ PCS.
+    if (ReadUInt32(profile + 16) != 'RGB ' ||
+        ReadUInt32(profile + 20) != 'XYZ ')
+    {
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+    }
+
+    static const uint32_t s_colorants[] = { 'rXYZ', 'gXYZ', 'bXYZ' };
+    static const uint32_t s_curves[] = { 'rTRC', 'gTRC', 'bTRC' };
+
+    XMFLOAT3 colorants[3];
+    for (int i = 0; i < 3; i++)
+    {
+        HRESULT hr = ReadColorant(profile, size, s_colorants[i], colorants[i]);
+        if (FAILED(hr))
+            return hr;
+
+        hr = ReadCurve(profile, size, s_curves[i], transform.m_curves[i]);
+        if (FAILED(hr))
+            return hr;
+    }
+
+    // The sRGB profile's colorants, i.e. BT.709 primaries adapted to D50 with Bradford, as CMMs do.
+    static const XMMATRIX s_bt709ToPcs(
+        0.4360747f, 0.2225045f, 0.0139322f, 0.0f,
+        0.3850649f, 0.7168786f, 0.0971045f, 0.0f,
+        0.1430804f, 0.0606169f, 0.7141733f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f);
+
+    // Row vector convention: profile RGB to PCS, then PCS to BT.709.
+    XMMATRIX profileToPcs(
+        XMVectorSetW(XMLoadFloat3(&colorants[0]), 0.0f),
+        XMVectorSetW(XMLoadFloat3(&colorants[1]), 0.0f),
+        XMVectorSetW(XMLoadFloat3(&colorants[2]), 0.0f),
+        g_XMIdentityR3);
+
+    XMMATRIX toBt709 = XMMatrixMultiply(profileToPcs, XMMatrixInverse(nullptr, s_bt709ToPcs));
+
+    XMStoreFloat4(&transform.m_fromR, toBt709.r[0]);
+    XMStoreFloat4(&transform.m_fromG, toBt709.r[1]);
+    XMStoreFloat4(&transform.m_fromB, toBt709.r[2]);
+
+    return S_OK;
+}
+
+HRESULT IccTransform::CreateFromWicColorContext(IWICColorContext* colorContext, IccTransform& transform)
+{
+    WICColorContextType type = WICColorContextUninitialized;
+    HRESULT hr = colorContext->GetType(&type);
+    if (FAILED(hr))
+        return hr;
+
+    if (type != WICColorContextProfile)
+        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+    UINT size = 0;
+    hr = colorContext->GetProfileBytes(0, nullptr, &size);
+    if (FAILED(hr))
+        return hr;
+
+    std::vector<uint8_t> profile(size);
+    hr = colorContext->GetProfileBytes(size, profile.data(), &size);
+    if (FAILED(hr))
+        return hr;
+
+    return CreateFromProfile(profile.data(), profile.size(), transform);
+}
+
+XMVECTOR IccTransform::Evaluate(FXMVECTOR encoded) const
+{
+    XMFLOAT4A position;
+    XMStoreFloat4A(&position, XMVectorMultiply(XMVectorSaturate(encoded), s_curveScale));
+
+    XMVECTOR v = XMVectorMultiply(XMVectorReplicate(EvaluateCurve(m_curves[0], position.x)), XMLoadFloat4(&m_fromR));
+    v = XMVectorMultiplyAdd(XMVectorReplicate(EvaluateCurve(m_curves[1], position.y)), XMLoadFloat4(&m_fromG), v);
+    v = XMVectorMultiplyAdd(XMVectorReplicate(EvaluateCurve(m_curves[2], position.z)), XMLoadFloat4(&m_fromB), v);
+
+    return XMVectorSetW(v, XMVectorGetW(encoded));
+}
+
+/// <summary>
+/// Tone curves are looked up per channel; as in Hdr10Converter::ConvertRow, the matrix is then
+/// three multiply-adds of broadcast channel values.
+/// </summary>
+void IccTransform::ConvertRow(const uint16_t* src, size_t count, uint16_t* half) const
+{
+    XMVECTOR fromR = XMLoadFloat4(&m_fromR);
+    XMVECTOR fromG = XMLoadFloat4(&m_fromG);
+    XMVECTOR fromB = XMLoadFloat4(&m_fromB);
+
+    auto pixels = reinterpret_cast<const XMUSHORTN4*>(src);
+    auto dst = reinterpret_cast<XMHALF4*>(half);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Curve table positions in xyz, and alpha in w.
+        XMFLOAT4A position;
+        XMStoreFloat4A(&position, XMVectorMultiply(XMLoadUShortN4(&pixels[i]), s_curveScale));
+
+        XMVECTOR v = XMVectorMultiply(XMVectorReplicate(EvaluateCurve(m_curves[0], position.x)), fromR);
+        v = XMVectorMultiplyAdd(XMVectorReplicate(EvaluateCurve(m_curves[1], position.y)), fromG, v);
+        v = XMVectorMultiplyAdd(XMVectorReplicate(EvaluateCurve(m_curves[2], position.z)), fromB, v);
+
+        // The source is straight alpha; scRGB is premultiplied.
+        v = XMVectorMultiply(v, XMVectorReplicate(position.w));
+        v = XMVectorSetW(v, position.w);
+
+        XMStoreHalf4(&dst[i], v);
+    }
+}
+
+void IccTransform::ConvertRows(
+    const uint8_t* src,
+    UINT srcStride,
+    uint8_t* dst,
+    UINT dstStride,
+    UINT width,
+    UINT height,
+    const concurrency::cancellation_token& cancel) const
+{
+    concurrency::parallel_for(0u, (height + sc_RowsPerTask - 1) / sc_RowsPerTask, [&](UINT task)
+    {
+        if (cancel.is_canceled())
+            return;
+
+        for (UINT y = task * sc_RowsPerTask; y < (std::min)((task + 1) * sc_RowsPerTask, height); y++)
+        {
+            ConvertRow(
+                reinterpret_cast<const uint16_t*>(src + static_cast<size_t>(y) * srcStride),
+                width,
+                reinterpret_cast<uint16_t*>(dst + static_cast<size_t>(y) * dstStride));
+        }
+    });
+}
@@ -0,0 +1,81 @@
+//*********************************************************
+//
+// IccTransform
+//
+// Converts pixels tagged with a matrix/TRC RGB ICC profile
+// (e.g. ProPhoto, Adobe RGB, Display P3 and most camera and
+// scanner profiles) to FP16 scRGB on the CPU, as the
+// Direct2D color management effect does on the GPU.
+//
+// Parsing reduces the profile to a tone curve per channel,
+// sampled into a lookup table, and a single 3x3 matrix from
+// linear profile RGB through the D50 PCS to linear BT.709.
+// The matrix and FP16 packing are vectorized with
+// DirectXMath, and rows are spread across all cores.
+//
+// LUT based (A2B0) profiles are not supported.
+//
+//*********************************************************
+
+#pragma once
+
+#include <array>
+
+namespace HDRImageViewer
+{
+    class IccTransform
+    {
+    public:
+        /// <summary>
+        /// Parses an ICC profile. Returns WINCODEC_ERR_BADHEADER if it is malformed, or
+        /// WINCODEC_ERR_UNSUPPORTEDOPERATION if it is not an RGB matrix/TRC profile.
+        /// </summary>
+        static HRESULT CreateFromProfile(
+            _In_reads_bytes_(size) const uint8_t* profile,
+            size_t size,
+            _Out_ IccTransform& transform);
+
+        /// <summary>
+        /// Parses the profile of a WICColorContextProfile color context; see CreateFromProfile.
+        /// EXIF color space contexts return WINCODEC_ERR_UNSUPPORTEDOPERATION.
+        /// </summary>
+        static HRESULT CreateFromWicColorContext(_In_ IWICColorContext* colorContext, _Out_ IccTransform& transform);
+
+        /// <summary>
+        /// Converts one straight alpha color, encoded in the profile's color space, to linear BT.709.
+        /// RGB is clamped to [0, 1]; alpha is passed through.
+        /// </summary>
+        DirectX::XMVECTOR Evaluate(DirectX::FXMVECTOR encoded) const;
+
+        /// <summary>
+        /// Converts rows of GUID_WICPixelFormat64bppRGBA pixels encoded in the profile's color space
+        /// to GUID_WICPixelFormat64bppPRGBAHalf scRGB. Returns immediately if cancel is canceled;
+        /// the destination is then incomplete.
+        /// </summary>
+        void ConvertRows(
+            _In_ const uint8_t* src,
+            UINT srcStride,
+            _Out_ uint8_t* dst,
+            UINT dstStride,
+            UINT width,
+            UINT height,
+            const concurrency::cancellation_token& cancel = concurrency::cancellation_token::none()) const;
+
+        /// <summary>
+        /// Converts a single row; see ConvertRows.
+        /// </summary>
+        void ConvertRow(
+            _In_reads_(count * 4) const uint16_t* src,
+            size_t count,
+            _Out_writes_(count * 4) uint16_t* half) const;
+
+    private:
+        // Each tone curve is sampled at sc_CurveSegments + 1 evenly spaced points in [0, 1].
+        std::array<std::vector<float>, 3>   m_curves;
+
+        // Rows of the linear profile RGB to linear BT.709 matrix, i.e. the contribution of each channel.
+        DirectX::XMFLOAT4                   m_fromR;
+        DirectX::XMFLOAT4                   m_fromG;
+        DirectX::XMFLOAT4                   m_fromB;
+    };
+}
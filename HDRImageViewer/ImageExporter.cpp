@@ -2,13 +2,18 @@
 #include "DirectXHelper.h"
 #include "ImageExporter.h"
 #include "MagicConstants.h"
-#include "SimpleTonemapEffect.h"
+#include "FusedRenderEffect.h"
 #include "DirectXTex.h"
+#include "RgbeCodec.h"
+
+#include <ppl.h>
 
 using namespace Microsoft::WRL;
 
 using namespace HDRImageViewer;
 
+static const UINT sc_ExportStripRows = 1024; // Rows rendered per pass when reading back the image from Direct2D.
+
 ImageExporter::ImageExporter()
 {
     throw ref new Platform::NotImplementedException;
@@ -31,49 +36,138 @@ void ImageExporter::ExportToSdr(ImageLoader* loader, DX::DeviceResources* res, I
     // This graph is derived from, but not identical to RenderEffectKind::HdrTonemap.
     // TODO: Is there any way to keep this better in sync with the main render pipeline?
 
-    ComPtr<ID2D1TransformedImageSource> source = loader->GetLoadedImage(1.0f);
+    ComPtr<ID2D1Effect> colorManage = CreateScRgbSource(loader, res);
 
-    ComPtr<ID2D1Effect> colorManage;
-    IFT(ctx->CreateEffect(CLSID_D2D1ColorManagement, &colorManage));
-    colorManage->SetInput(0, source.Get());
-    IFT(colorManage->SetValue(D2D1_COLORMANAGEMENT_PROP_QUALITY, D2D1_COLORMANAGEMENT_QUALITY_BEST));
+    float scale = D2D1_SCENE_REFERRED_SDR_WHITE_LEVEL / sc_DefaultSdrDispMaxNits;
+    ComPtr<ID2D1Image> d2dImage;
 
-    ComPtr<ID2D1ColorContext> sourceCtx = loader->GetImageColorContext();
-    IFT(colorManage->SetValue(D2D1_COLORMANAGEMENT_PROP_SOURCE_COLOR_CONTEXT, sourceCtx.Get()));
+    if (DX::CheckPlatformSupport(DX::Win1809))
+    {
+        ComPtr<ID2D1Effect> tonemap;
+        IFT(ctx->CreateEffect(CLSID_D2D1HdrToneMap, &tonemap));
+        tonemap->SetInputEffect(0, colorManage.Get());
+        IFT(tonemap->SetValue(D2D1_HDRTONEMAP_PROP_OUTPUT_MAX_LUMINANCE, sc_DefaultSdrDispMaxNits));
+        IFT(tonemap->SetValue(D2D1_HDRTONEMAP_PROP_DISPLAY_MODE, D2D1_HDRTONEMAP_DISPLAY_MODE_SDR));
+
+        ComPtr<ID2D1Effect> whiteScale;
+        IFT(ctx->CreateEffect(CLSID_D2D1ColorMatrix, &whiteScale));
+        whiteScale->SetInputEffect(0, tonemap.Get());
+
+        D2D1_MATRIX_5X4_F matrix = D2D1::Matrix5x4F(
+            scale, 0, 0, 0,  // [R] Multiply each color channel
+            0, scale, 0, 0,  // [G] by the scale factor in 
+            0, 0, scale, 0,  // [B] linear gamma space.
+            0, 0, 0, 1,      // [A] Preserve alpha values.
+            0, 0, 0, 0);     //     No offset.
+
+        IFT(whiteScale->SetValue(D2D1_COLORMATRIX_PROP_COLOR_MATRIX, matrix));
+
+        whiteScale->GetOutput(&d2dImage);
+    }
+    else
+    {
+        // With the custom tonemapper, the tonemap and white scale stages run in a single pass; the
+        // fused effect's SDR display mode applies scale after the tonemapper, as above.
+        ComPtr<ID2D1Effect> fused;
+        IFT(ctx->CreateEffect(CLSID_CustomFusedRenderEffect, &fused));
+        fused->SetInputEffect(0, colorManage.Get());
+        IFT(fused->SetValue(FUSEDRENDER_PROP_KIND, FUSEDRENDER_KIND_HDR_TONEMAP));
+        IFT(fused->SetValue(FUSEDRENDER_PROP_DISPLAY_MODE, D2D1_HDRTONEMAP_DISPLAY_MODE_SDR));
+        IFT(fused->SetValue(FUSEDRENDER_PROP_TONEMAP_OUTPUT_MAX_LUMINANCE, sc_DefaultSdrDispMaxNits));
+        IFT(fused->SetValue(FUSEDRENDER_PROP_OUTPUT_SCALE, scale));
+
+        fused->GetOutput(&d2dImage);
+    }
 
-    ComPtr<ID2D1ColorContext1> destCtx;
-    // scRGB
-    IFT(ctx->CreateColorContextFromDxgiColorSpace(DXGI_COLOR_SPACE_RGB_FULL_G10_NONE_P709, &destCtx));
-    IFT(colorManage->SetValue(D2D1_COLORMANAGEMENT_PROP_DESTINATION_COLOR_CONTEXT, destCtx.Get()));
+    ImageExporter::ExportToWic(d2dImage.Get(), loader->GetImageInfo().size, res, stream, wicFormat);
+}
 
-    GUID tmGuid = {};
-    if (DX::CheckPlatformSupport(DX::Win1809)) tmGuid = CLSID_D2D1HdrToneMap;
-    else tmGuid = CLSID_CustomSimpleTonemapEffect;
+/// <summary>
+/// Saves the image as a Radiance RGBE (.hdr) file. Pixel values are linear scRGB, i.e. BT.709
+/// primaries with 1.0 = 80 nits, and are not tonemapped.
+/// </summary>
+/// <remarks>
+/// The image is rendered and read back in strips of sc_ExportStripRows so that GPU memory use
+/// does not grow with the size of the image. Scanlines are packed and run length encoded in parallel.
+/// </remarks>
+void ImageExporter::ExportToRgbe(ImageLoader* loader, DX::DeviceResources* res, IStream* stream)
+{
+    auto ctx = res->GetD2DDeviceContext();
 
-    ComPtr<ID2D1Effect> tonemap;
-    IFT(ctx->CreateEffect(tmGuid, &tonemap));
-    tonemap->SetInputEffect(0, colorManage.Get());
-    IFT(tonemap->SetValue(D2D1_HDRTONEMAP_PROP_OUTPUT_MAX_LUMINANCE, sc_DefaultSdrDispMaxNits));
-    IFT(tonemap->SetValue(D2D1_HDRTONEMAP_PROP_DISPLAY_MODE, D2D1_HDRTONEMAP_DISPLAY_MODE_SDR));
+    ComPtr<ID2D1Effect> colorManage = CreateScRgbSource(loader, res);
 
-    ComPtr<ID2D1Effect> whiteScale;
-    IFT(ctx->CreateEffect(CLSID_D2D1ColorMatrix, &whiteScale));
-    whiteScale->SetInputEffect(0, tonemap.Get());
+    auto size = loader->GetImageInfo().size;
 
-    float scale = D2D1_SCENE_REFERRED_SDR_WHITE_LEVEL / sc_DefaultSdrDispMaxNits;
-    D2D1_MATRIX_5X4_F matrix = D2D1::Matrix5x4F(
-        scale, 0, 0, 0,  // [R] Multiply each color channel
-        0, scale, 0, 0,  // [G] by the scale factor in 
-        0, 0, scale, 0,  // [B] linear gamma space.
-        0, 0, 0, 1,      // [A] Preserve alpha values.
-        0, 0, 0, 0);     //     No offset.
+    RgbeImage image = {};
+    image.width = static_cast<UINT>(size.Width);
+    image.height = static_cast<UINT>(size.Height);
+    image.pixels.resize(static_cast<size_t>(image.width) * image.height * 4);
 
-    IFT(whiteScale->SetValue(D2D1_COLORMATRIX_PROP_COLOR_MATRIX, matrix));
+    UINT stripRows = min(image.height, sc_ExportStripRows);
 
-    ComPtr<ID2D1Image> d2dImage;
-    whiteScale->GetOutput(&d2dImage);
+    D2D1_BITMAP_PROPERTIES1 targetProps = D2D1::BitmapProperties1(
+        D2D1_BITMAP_OPTIONS_TARGET,
+        D2D1::PixelFormat(DXGI_FORMAT_R16G16B16A16_FLOAT, D2D1_ALPHA_MODE_PREMULTIPLIED));
 
-    ImageExporter::ExportToWic(d2dImage.Get(), loader->GetImageInfo().size, res, stream, wicFormat);
+    D2D1_BITMAP_PROPERTIES1 readbackProps = D2D1::BitmapProperties1(
+        D2D1_BITMAP_OPTIONS_CPU_READ | D2D1_BITMAP_OPTIONS_CANNOT_DRAW,
+        D2D1::PixelFormat(DXGI_FORMAT_R16G16B16A16_FLOAT, D2D1_ALPHA_MODE_PREMULTIPLIED));
+
+    ComPtr<ID2D1Bitmap1> target;
+    ComPtr<ID2D1Bitmap1> readback;
+    IFT(ctx->CreateBitmap(D2D1::SizeU(image.width, stripRows), nullptr, 0, &targetProps, &target));
+    IFT(ctx->CreateBitmap(D2D1::SizeU(image.width, stripRows), nullptr, 0, &readbackProps, &readback));
+
+    ComPtr<ID2D1Image> oldTarget;
+    ctx->GetTarget(&oldTarget);
+    ctx->SetTarget(target.Get());
+
+    try
+    {
+        for (UINT y = 0; y < image.height; y += stripRows)
+        {
+            UINT rows = min(stripRows, image.height - y);
+
+            ctx->BeginDraw();
+            ctx->Clear(D2D1::ColorF(0, 0, 0, 0));
+            ctx->SetTransform(D2D1::Matrix3x2F::Translation(0.0f, -static_cast<float>(y)));
+            ctx->DrawImage(colorManage.Get(), D2D1_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+            ctx->SetTransform(D2D1::Matrix3x2F::Identity());
+            IFT(ctx->EndDraw());
+
+            D2D1_POINT_2U origin = { 0, 0 };
+            D2D1_RECT_U strip = { 0, 0, image.width, rows };
+            IFT(readback->CopyFromBitmap(&origin, target.Get(), &strip));
+
+            D2D1_MAPPED_RECT mapped = {};
+            IFT(readback->Map(D2D1_MAP_OPTIONS_READ, &mapped));
+
+            concurrency::parallel_for(0u, rows, [&](UINT row)
+            {
+                RgbeCodec::CompressFromHalf(
+                    reinterpret_cast<const uint16_t*>(mapped.bits + static_cast<size_t>(row) * mapped.pitch),
+                    image.width,
+                    image.pixels.data() + (static_cast<size_t>(y) + row) * image.width * 4);
+            });
+
+            IFT(readback->Unmap());
+        }
+    }
+    catch (...)
+    {
+        ctx->SetTarget(oldTarget.Get());
+        throw;
+    }
+
+    ctx->SetTarget(oldTarget.Get());
+
+    std::vector<uint8_t> file;
+    IFT(RgbeCodec::Encode(image, file));
+
+    ULONG written = 0;
+    IFT(stream->Write(file.data(), static_cast<ULONG>(file.size()), &written));
+    IFT(written == file.size() ? S_OK : E_FAIL);
+    IFT(stream->Commit(STGC_DEFAULT));
 }
 
 /// <summary>
@@ -193,3 +287,29 @@ void ImageExporter::ExportToWic(ID2D1Image* img, Windows::Foundation::Size size,
     IFT(encoder->Commit());
     IFT(stream->Commit(STGC_DEFAULT));
 }
+
+/// <summary>
+/// Creates a color management effect that converts the loaded image at full size to scRGB.
+/// </summary>
+ComPtr<ID2D1Effect> ImageExporter::CreateScRgbSource(ImageLoader* loader, DX::DeviceResources* res)
+{
+    auto ctx = res->GetD2DDeviceContext();
+
+    ComPtr<ID2D1Image> source;
+    source.Attach(loader->GetLoadedImage(1.0f));
+
+    ComPtr<ID2D1Effect> colorManage;
+    IFT(ctx->CreateEffect(CLSID_D2D1ColorManagement, &colorManage));
+    colorManage->SetInput(0, source.Get());
+    IFT(colorManage->SetValue(D2D1_COLORMANAGEMENT_PROP_QUALITY, D2D1_COLORMANAGEMENT_QUALITY_BEST));
+
+    ComPtr<ID2D1ColorContext> sourceCtx = loader->GetImageColorContext();
+    IFT(colorManage->SetValue(D2D1_COLORMANAGEMENT_PROP_SOURCE_COLOR_CONTEXT, sourceCtx.Get()));
+
+    ComPtr<ID2D1ColorContext1> destCtx;
+    // scRGB
+    IFT(ctx->CreateColorContextFromDxgiColorSpace(DXGI_COLOR_SPACE_RGB_FULL_G10_NONE_P709, &destCtx));
+    IFT(colorManage->SetValue(D2D1_COLORMANAGEMENT_PROP_DESTINATION_COLOR_CONTEXT, destCtx.Get()));
+
+    return colorManage;
+}
@@ -21,11 +21,14 @@ namespace HDRImageViewer
 
         static void ExportToSdr(_In_ ImageLoader* loader, _In_ DX::DeviceResources* res, IStream* stream, GUID wicFormat);
 
+        static void ExportToRgbe(_In_ ImageLoader* loader, _In_ DX::DeviceResources* res, IStream* stream);
+
         static void ExportToDds(_In_ IWICBitmap* bitmap, _In_ IStream* stream, DXGI_FORMAT outputFmt);
 
         static std::vector<DirectX::XMFLOAT4> DumpD2DTarget(_In_ DX::DeviceResources* res);
 
     private:
+        static Microsoft::WRL::ComPtr<ID2D1Effect> CreateScRgbSource(_In_ ImageLoader* loader, _In_ DX::DeviceResources* res);
         static void ExportToWic(_In_ ID2D1Image* img, Windows::Foundation::Size size, _In_ DX::DeviceResources* res, IStream* stream, GUID wicFormat);
     };
 }
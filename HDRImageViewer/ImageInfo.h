@@ -13,6 +13,13 @@ namespace HDRImageViewer
         bool                                            forceBT2100ColorSpace;
         bool                                            isValid;
         bool                                            isHeif;
+
+        // Subresources of the container: frames are pages, array slices, cube faces, volume
+        // slices or EXR parts. A count of 0 means the image is the only one.
+        unsigned int                                    frameCount;
+        unsigned int                                    mipCount;
+        unsigned int                                    frameIndex;
+        unsigned int                                    mipIndex;
     };
 
     struct ImageCLL
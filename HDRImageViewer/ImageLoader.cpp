@@ -1,8 +1,18 @@
 #include "pch.h"
 #include "ImageLoader.h"
 #include "DirectXHelper.h"
+#include "ColorProfileCache.h"
+#include "DecodedImageCache.h"
+#include "FormatConverter.h"
+#include "Hdr10Converter.h"
+#include "ImageProbe.h"
+#include "MipPyramid.h"
 #include "DirectXTex.h"
 #include "DirectXTex\DirectXTexEXR.h"
+#include "RgbeCodec.h"
+#include "VirtualImage.h"
+
+#include <ppl.h>
 
 using namespace HDRImageViewer;
 
@@ -13,17 +23,35 @@ using namespace std;
 using namespace Windows::Foundation;
 using namespace Windows::Graphics::Display;
 
-static const unsigned int sc_MaxBytesPerPixel = 16; // Covers all supported image formats (128bpp).
-
-ImageLoader::ImageLoader(const std::shared_ptr<DX::DeviceResources>& deviceResources) :
+static const unsigned int sc_StreamingStripRows = 256; // Rows decoded per call when streaming into a WIC bitmap.
+static const size_t sc_ExrInitialLevelMaxDimension = 4096; // Largest mip level of a multi-resolution EXR decoded up front.
+static const size_t sc_DecompressBandBlockRows = 16; // Rows of 4x4 blocks decompressed per task.
+static const UINT sc_Hdr10StripRows = 256; // Rows of an HDR10 image copied from the decoder at a time.
+static const UINT sc_MipMinDimension = 256; // The coarsest mip level is no larger than this.
+static const size_t sc_SubresourceCacheSize = 4; // Previously selected subresources kept decoded.
+
+ImageLoader::ImageLoader(
+    const std::shared_ptr<DX::DeviceResources>& deviceResources,
+    const ImageLoaderOptions& options,
+    concurrency::cancellation_token cancel) :
     m_deviceResources(deviceResources),
+    m_options(options),
+    m_cancel(cancel),
+    m_maxBitmapSize(deviceResources->GetD2DDeviceContext()->GetMaximumBitmapSize()),
     m_state(ImageLoaderState::NotInitialized),
-    m_imageInfo{}
+    m_imageInfo{},
+    m_isPreview(false),
+    m_isHdr10Linear(false),
+    m_exrResidentLevel(0),
+    m_exrPendingLevel(0),
+    m_isExrLevelPending(false),
+    m_isExrLevelTaken(false)
 {
 }
 
 ImageLoader::~ImageLoader()
 {
+    CancelExrLevelDecode();
 }
 
 /// <summary>
@@ -43,7 +71,7 @@ ImageInfo ImageLoader::LoadImageFromWic(_In_ IStream* imageStream)
 /// </summary>
 void ImageLoader::LoadImageFromWicInt(_In_ IStream* imageStream)
 {
-    EnforceStates(1, ImageLoaderState::NotInitialized);
+    EnforceStates(2, ImageLoaderState::NotInitialized, ImageLoaderState::PreviewReady);
 
     auto wicFactory = m_deviceResources->GetWicImagingFactory();
 
@@ -55,12 +83,34 @@ void ImageLoader::LoadImageFromWicInt(_In_ IStream* imageStream)
         WICDecodeMetadataCacheOnDemand,
         &decoder));
 
+    UINT frameCount = 0;
+    IFRIMG(decoder->GetFrameCount(&frameCount));
+
+    if (frameCount > 1)
+    {
+        // Other frames (e.g. TIFF pages) are decoded only once they are selected.
+        m_wicDecoder = decoder;
+    }
+
+    LoadWicFrame(decoder.Get(), 0);
+
+    m_imageInfo.frameCount = frameCount;
+    m_imageInfo.mipCount = 1;
+}
+
+/// <summary>
+/// Decodes one frame of a WIC container, handling the special case WIC decoders.
+/// </summary>
+void ImageLoader::LoadWicFrame(_In_ IWICBitmapDecoder* decoder, unsigned int index)
+{
     ComPtr<IWICBitmapFrameDecode> frame;
-    IFRIMG(decoder->GetFrame(0, &frame));
+    IFRIMG(decoder->GetFrame(index, &frame));
 
     GUID fmt;
     IFRIMG(decoder->GetContainerFormat(&fmt));
 
+    IFRIMG(CheckCanceled());
+
     // Perform initial detection and handling of special case WIC decoders.
     if (fmt == GUID_ContainerFormatHeif)
     {
@@ -86,7 +136,7 @@ void ImageLoader::LoadImageFromWicInt(_In_ IStream* imageStream)
     else if (fmt == GUID_ContainerFormatWmp)
     {
         // Xbox One HDR screenshots have to be specially detected and are always HDR10/BT.2100.
-        if (IsImageXboxHdrScreenshot(frame.Get()))
+        if (ImageProbe::IsXboxHdrScreenshot(frame.Get()))
         {
             m_imageInfo.forceBT2100ColorSpace = true;
         }
@@ -106,52 +156,585 @@ void ImageLoader::LoadImageFromWicInt(_In_ IStream* imageStream)
 /// <param name="extension">File extension with leading period. Needed as DirectXTex doesn't auto-detect codec type.</param>
 ImageInfo ImageLoader::LoadImageFromDirectXTex(String^ filename, String^ extension)
 {
-    LoadImageFromDirectXTexInt(filename, extension);
+    // If the file can't be opened, the invalid handle fails the load.
+    Wrappers::FileHandle file(CreateFile2(filename->Data(), GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr));
+    LoadImageFromDirectXTexInt(file.Get(), nullptr, extension);
 
     return m_imageInfo;
 }
 
 /// <summary>
-/// Internal method is needed because IFRIMG macro methods must return void.
-/// If any failure occurs during image loading, immediately exits with
-/// m_state and imageinfo set to failed.
+/// As above, but reads the image from an open file handle, e.g. one brokered for a file outside
+/// the sandbox by DX::OpenStorageFileHandle. The file is memory mapped, so the decoders read it
+/// in place. The caller may close the handle once this returns.
+/// </summary>
+/// <param name="extension">File extension with leading period. Needed as DirectXTex doesn't auto-detect codec type.</param>
+ImageInfo ImageLoader::LoadImageFromDirectXTex(HANDLE file, String^ extension)
+{
+    LoadImageFromDirectXTexInt(file, nullptr, extension);
+
+    return m_imageInfo;
+}
+
+/// <summary>
+/// As above, but reads the image from a stream, so files outside the sandbox (e.g. from a
+/// FileOpenPicker) don't need to be copied to the temp folder first.
+/// </summary>
+/// <param name="extension">File extension with leading period. Needed as DirectXTex doesn't auto-detect codec type.</param>
+ImageInfo ImageLoader::LoadImageFromDirectXTex(IStream* imageStream, String^ extension)
+{
+    LoadImageFromDirectXTexInt(nullptr, imageStream, extension);
+
+    return m_imageInfo;
+}
+
+/// <summary>
+/// Restores an image from the disk cache. No decoding takes place; Direct2D reads the pixels
+/// from the mapped entry.
+/// </summary>
+ImageInfo ImageLoader::LoadImageFromDecoded(const DecodedImage& image)
+{
+    LoadImageFromDecodedInt(image);
+
+    return m_imageInfo;
+}
+
+/// <summary>
+/// Internal method for LoadImageFromDecoded.
+/// </summary>
+void ImageLoader::LoadImageFromDecodedInt(const DecodedImage& image)
+{
+    EnforceStates(1, ImageLoaderState::NotInitialized);
+
+    m_imageInfo = image.info;
+    m_imageInfo.isValid = false;
+    m_residentSize = m_imageInfo.size;
+
+    WICPixelFormatGUID pixelFmt = {};
+    IFRIMG(image.pixels->GetPixelFormat(&pixelFmt));
+    m_isHdr10Linear = (m_imageInfo.isHeif && m_imageInfo.forceBT2100ColorSpace && pixelFmt == GUID_WICPixelFormat64bppRGBAHalf);
+
+    if (m_imageInfo.isHeif == true &&
+        m_imageInfo.forceBT2100ColorSpace == true &&
+        m_isHdr10Linear == false)
+    {
+        // CreateHeifHdr10GpuResources uploads from a locked IWICBitmap.
+        ComPtr<IWICBitmap> hdr10Bitmap;
+        IFRIMG(m_deviceResources->GetWicImagingFactory()->CreateBitmapFromSource(
+            image.pixels.Get(),
+            WICBitmapCacheOnLoad,
+            &hdr10Bitmap));
+
+        IFRIMG(hdr10Bitmap.As(&m_wicCachedSource));
+    }
+    else
+    {
+        m_wicCachedSource = image.pixels;
+    }
+
+    IFRIMG(CreateMipPyramid());
+
+    m_state = ImageLoaderState::NeedDeviceResources;
+
+    if (!m_options.deferDeviceResources)
+    {
+        CreateDeviceDependentResourcesInternal();
+    }
+
+    m_imageInfo.isValid = true;
+}
+
+/// <summary>
+/// Quickly decodes a reduced resolution preview of an image using WIC, for progressive loading.
+/// </summary>
+/// <remarks>
+/// On success the loader is in PreviewReady, and the image is rendered at its full size from the
+/// preview until LoadImageFromWic is called with the same stream. If there is no cheap way to
+/// produce a preview the returned ImageInfo is not valid and the loader stays NotInitialized.
+/// The stream position is restored so it can be passed to LoadImageFromWic unchanged.
+/// </remarks>
+ImageInfo ImageLoader::LoadPreviewFromWic(_In_ IStream* imageStream)
+{
+    ULARGE_INTEGER start = {};
+    IFT(imageStream->Seek({}, STREAM_SEEK_CUR, &start));
+
+    LoadPreviewFromWicInt(imageStream);
+
+    LARGE_INTEGER rewind = {};
+    rewind.QuadPart = start.QuadPart;
+    IFT(imageStream->Seek(rewind, STREAM_SEEK_SET, nullptr));
+
+    return m_imageInfo;
+}
+
+/// <summary>
+/// As LoadPreviewFromWic, for the formats handled by LoadImageFromDirectXTex. Only OpenEXR
+/// images with a preview attribute or multiple resolution levels produce a preview.
+/// </summary>
+ImageInfo ImageLoader::LoadPreviewFromDirectXTex(_In_ IStream* imageStream, String^ extension)
+{
+    ULARGE_INTEGER start = {};
+    IFT(imageStream->Seek({}, STREAM_SEEK_CUR, &start));
+
+    LoadPreviewFromDirectXTexInt(imageStream, extension);
+
+    LARGE_INTEGER rewind = {};
+    rewind.QuadPart = start.QuadPart;
+    IFT(imageStream->Seek(rewind, STREAM_SEEK_SET, nullptr));
+
+    return m_imageInfo;
+}
+
+/// <summary>
+/// Makes another frame (page, array item, cube face, volume slice or EXR part) or mip level of
+/// the loaded container current. See ImageInfo::frameCount and ImageInfo::mipCount.
+/// </summary>
+/// <remarks>
+/// Only the selected subresource is decoded. The last few subresources stay decoded, so stepping
+/// back to one of them is immediate. Afterwards, device dependent resources are created and the
+/// caller must get the loaded image and color context again.
+/// </remarks>
+ImageInfo ImageLoader::SelectSubresource(unsigned int frame, unsigned int mip)
+{
+    SelectSubresourceInt(frame, mip);
+
+    return m_imageInfo;
+}
+
+/// <summary>
+/// Internal method for SelectSubresource.
+/// </summary>
+void ImageLoader::SelectSubresourceInt(unsigned int frame, unsigned int mip)
+{
+    EnforceStates(1, ImageLoaderState::LoadingSucceeded);
+
+    unsigned int frameCount = m_imageInfo.frameCount;
+    unsigned int mipCount = m_imageInfo.mipCount;
+    if (frame >= max(frameCount, 1u) || mip >= max(mipCount, 1u))
+    {
+        throw ref new COMException(E_INVALIDARG);
+    }
+
+    if (frame == m_imageInfo.frameIndex && mip == m_imageInfo.mipIndex)
+    {
+        return;
+    }
+
+    StoreSubresource();
+
+    // Everything describing the current subresource is released; the container stays open.
+    m_imageSource.Reset();
+    m_mipImageSources.clear();
+    m_virtualImage.reset();
+    m_colorContext.Reset();
+
+    m_wicCachedSource.Reset();
+    m_wicColorContext.Reset();
+    m_colorProfile.reset();
+    m_decodedSource.Reset();
+    m_mipLevels.clear();
+    CancelExrLevelDecode();
+    m_exrReader.reset();
+    m_exrResidentLevel = 0;
+    m_isHdr10Linear = false;
+    m_imageInfo = {};
+
+    if (!RestoreSubresource(frame, mip))
+    {
+        m_state = ImageLoaderState::NotInitialized;
+
+        if (m_wicDecoder)
+        {
+            LoadWicFrame(m_wicDecoder.Get(), frame);
+        }
+        else if (m_ddsImage)
+        {
+            LoadDdsImage(*m_ddsImage, frame, mip);
+        }
+        else
+        {
+            LoadImageFromExrInt(m_exrFile.Get(), m_exrStream.Get(), frame);
+        }
+
+        // Selection happens on the UI thread, so device resources are never deferred here.
+        if (m_state == ImageLoaderState::NeedDeviceResources)
+        {
+            CreateDeviceDependentResourcesInternal();
+        }
+    }
+
+    m_imageInfo.frameCount = frameCount;
+    m_imageInfo.mipCount = mipCount;
+    m_imageInfo.frameIndex = frame;
+    m_imageInfo.mipIndex = mip;
+}
+
+/// <summary>
+/// Keeps the current subresource decoded so it can be selected again without decoding.
+/// </summary>
+void ImageLoader::StoreSubresource()
+{
+    // A multi-resolution EXR part may only be partially resident; it is decoded again instead.
+    if (m_exrReader)
+    {
+        return;
+    }
+
+    Subresource current =
+    {
+        m_imageInfo.frameIndex,
+        m_imageInfo.mipIndex,
+        m_imageInfo,
+        m_wicCachedSource,
+        m_wicColorContext,
+        m_colorProfile,
+        m_mipLevels,
+        m_residentSize,
+        m_isHdr10Linear
+    };
+
+    m_subresources.push_front(current);
+
+    if (m_subresources.size() > sc_SubresourceCacheSize)
+    {
+        m_subresources.pop_back();
+    }
+}
+
+/// <summary>
+/// Makes a previously stored subresource current, if it is still kept.
+/// </summary>
+bool ImageLoader::RestoreSubresource(unsigned int frame, unsigned int mip)
+{
+    auto found = std::find_if(m_subresources.begin(), m_subresources.end(), [=](const Subresource& s)
+    {
+        return s.frame == frame && s.mip == mip;
+    });
+
+    if (found == m_subresources.end())
+    {
+        return false;
+    }
+
+    m_imageInfo = found->info;
+    m_wicCachedSource = found->wicCachedSource;
+    m_wicColorContext = found->wicColorContext;
+    m_colorProfile = found->colorProfile;
+    m_mipLevels = found->mipLevels;
+    m_residentSize = found->residentSize;
+    m_isHdr10Linear = found->isHdr10Linear;
+
+    m_subresources.erase(found);
+
+    m_state = ImageLoaderState::NeedDeviceResources;
+
+    CreateDeviceDependentResourcesInternal();
+
+    return true;
+}
+
+/// <summary>
+/// Internal method for LoadPreviewFromWic. Failures to produce a preview are not reported;
+/// the full load that follows reports them instead.
 /// </summary>
-void ImageLoader::LoadImageFromDirectXTexInt(String^ filename, String^ extension)
+void ImageLoader::LoadPreviewFromWicInt(_In_ IStream* imageStream)
 {
     EnforceStates(1, ImageLoaderState::NotInitialized);
 
-    ComPtr<IWICBitmapSource> decodedSource;
+    if (m_options.previewMaxDimension == 0)
+    {
+        return;
+    }
+
+    auto wicFactory = m_deviceResources->GetWicImagingFactory();
+
+    ComPtr<IWICBitmapDecoder> decoder;
+    ComPtr<IWICBitmapFrameDecode> frame;
+    GUID fmt;
+    if (FAILED(wicFactory->CreateDecoderFromStream(imageStream, nullptr, WICDecodeMetadataCacheOnDemand, &decoder)) ||
+        FAILED(decoder->GetFrame(0, &frame)) ||
+        FAILED(decoder->GetContainerFormat(&fmt)))
+    {
+        return;
+    }
+
+    // HEIF HDR10 images need a special full resolution codepath; see CreateHeifHdr10CpuResources.
+    if (fmt == GUID_ContainerFormatHeif)
+    {
+        return;
+    }
 
-    auto dxtScratch = new ScratchImage();
-    auto filestr = filename->Data();
+    if (fmt == GUID_ContainerFormatWmp && ImageProbe::IsXboxHdrScreenshot(frame.Get()))
+    {
+        m_imageInfo.forceBT2100ColorSpace = true;
+    }
+
+    ComPtr<IWICBitmap> preview;
+    if (CreateWicPreview(frame.Get(), &preview) != S_OK)
+    {
+        return;
+    }
+
+    // Image info is read from the frame, so it already describes the full image.
+    LoadImageCommon(frame.Get(), preview.Get());
+}
+
+/// <summary>
+/// Internal method for LoadPreviewFromDirectXTex.
+/// </summary>
+void ImageLoader::LoadPreviewFromDirectXTexInt(_In_ IStream* imageStream, String^ extension)
+{
+    EnforceStates(1, ImageLoaderState::NotInitialized);
+
+    if (m_options.previewMaxDimension == 0 ||
+        !(extension == L".EXR" || extension == L".exr"))
+    {
+        return;
+    }
+
+    EXRImageReader reader;
+    TexMetadata metadata = {};
+    if (FAILED(OpenExrReader(&reader, nullptr, imageStream, 0, &metadata)))
+    {
+        return;
+    }
+
+    ComPtr<IWICBitmapSource> preview;
+    ScratchImage previewImage;
+    if (reader.ReadPreview(previewImage) == S_OK)
+    {
+        auto image = previewImage.GetImage(0, 0, 0);
+
+        ComPtr<IWICBitmap> previewBitmap;
+        auto fact = m_deviceResources->GetWicImagingFactory();
+        if (FAILED(fact->CreateBitmapFromMemory(
+                static_cast<UINT>(image->width),
+                static_cast<UINT>(image->height),
+                ImageProbe::TranslateDxgiFormatToWic(image->format),
+                static_cast<UINT>(image->rowPitch),
+                static_cast<UINT>(image->slicePitch),
+                image->pixels,
+                &previewBitmap)))
+        {
+            return;
+        }
+
+        // The preview attribute is gamma encoded 8 bit; WIC linearizes it when converting to
+        // FP16, so the preview is treated exactly like the floating point image it stands in for.
+        if (FAILED(ConvertWicSource(previewBitmap.Get(), GUID_WICPixelFormat64bppRGBAHalf, &preview)))
+        {
+            return;
+        }
+    }
+    else
+    {
+        // Otherwise use the finest resolution level that fits within the preview size, if any.
+        size_t level = 0;
+        for (; level + 1 < reader.GetLevelCount(); level++)
+        {
+            size_t levelWidth, levelHeight;
+            if (FAILED(reader.GetLevelSize(level, &levelWidth, &levelHeight)))
+            {
+                return;
+            }
+
+            if (max(levelWidth, levelHeight) <= m_options.previewMaxDimension)
+            {
+                break;
+            }
+        }
+
+        ComPtr<IWICBitmap> levelBitmap;
+        if (level == 0 ||
+            FAILED(DecodeExrLevel(&reader, level, &levelBitmap)))
+        {
+            return;
+        }
+
+        preview = levelBitmap;
+    }
+
+    LoadImageCommon(preview.Get(), preview.Get());
+
+    // Image info always describes the full resolution image.
+    m_imageInfo.size = Size(static_cast<float>(metadata.width), static_cast<float>(metadata.height));
+}
+
+/// <summary>
+/// Decodes a reduced resolution copy of a frame no larger than ImageLoaderOptions::previewMaxDimension.
+/// </summary>
+/// <remarks>
+/// Uses IWICBitmapSourceTransform so that codecs which can scale while decoding (e.g. JPEG, using
+/// DCT scaling) never decode the full image. Returns S_FALSE if the codec can't produce a smaller
+/// image, or the image is already small enough to not need a preview.
+/// </remarks>
+HRESULT ImageLoader::CreateWicPreview(_In_ IWICBitmapFrameDecode* frame, _COM_Outptr_result_maybenull_ IWICBitmap** preview)
+{
+    *preview = nullptr;
+
+    UINT width, height;
+    HRESULT hr = frame->GetSize(&width, &height);
+    if (FAILED(hr))
+        return hr;
+
+    UINT maxDimension = m_options.previewMaxDimension;
+    if (max(width, height) <= maxDimension)
+        return S_FALSE;
+
+    ComPtr<IWICBitmapSourceTransform> transform;
+    if (FAILED(frame->QueryInterface(IID_PPV_ARGS(&transform))))
+        return S_FALSE;
+
+    float scale = static_cast<float>(maxDimension) / max(width, height);
+    UINT previewWidth = max(static_cast<UINT>(width * scale), 1u);
+    UINT previewHeight = max(static_cast<UINT>(height * scale), 1u);
+
+    // The codec adjusts the size to the closest one it can decode to directly.
+    hr = transform->GetClosestSize(&previewWidth, &previewHeight);
+    if (FAILED(hr))
+        return hr;
+
+    if (previewWidth >= width || previewHeight >= height)
+        return S_FALSE;
+
+    WICPixelFormatGUID previewFmt;
+    hr = frame->GetPixelFormat(&previewFmt);
+    if (SUCCEEDED(hr))
+    {
+        hr = transform->GetClosestPixelFormat(&previewFmt);
+    }
+
+    if (FAILED(hr))
+        return hr;
+
+    ComPtr<IWICBitmap> previewBitmap;
+    auto fact = m_deviceResources->GetWicImagingFactory();
+    hr = fact->CreateBitmap(previewWidth, previewHeight, previewFmt, WICBitmapCacheOnLoad, &previewBitmap);
+    if (FAILED(hr))
+        return hr;
+
+    {
+        ComPtr<IWICBitmapLock> lock;
+        hr = previewBitmap->Lock({}, WICBitmapLockWrite, &lock);
+        if (FAILED(hr))
+            return hr;
+
+        UINT lockStride = 0, lockSize = 0;
+        WICInProcPointer lockData = nullptr;
+        hr = lock->GetStride(&lockStride);
+        if (SUCCEEDED(hr))
+        {
+            hr = lock->GetDataPointer(&lockSize, &lockData);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = transform->CopyPixels(
+                nullptr,
+                previewWidth,
+                previewHeight,
+                &previewFmt,
+                WICBitmapTransformRotate0,
+                lockStride,
+                lockSize,
+                lockData);
+        }
+
+        // The lock must be released before the bitmap is consumed by WIC or Direct2D.
+    }
+
+    if (FAILED(hr))
+        return hr;
+
+    *preview = previewBitmap.Detach();
+    return S_OK;
+}
+
+/// <summary>
+/// Internal method is needed because IFRIMG macro methods must return void.
+/// If any failure occurs during image loading, immediately exits with
+/// m_state and imageinfo set to failed.
+/// </summary>
+/// <remarks>Exactly one of file and imageStream is used; the stream takes precedence.</remarks>
+void ImageLoader::LoadImageFromDirectXTexInt(HANDLE file, IStream* imageStream, String^ extension)
+{
+    EnforceStates(2, ImageLoaderState::NotInitialized, ImageLoaderState::PreviewReady);
 
     if (extension == L".EXR" || extension == L".exr")
     {
-        IFRIMG(LoadFromEXRFile(filestr, nullptr, *dxtScratch));
+        LoadImageFromExrInt(file, imageStream);
+        return;
     }
-    else if (extension == L".HDR" || extension == L".hdr")
+
+    if (extension == L".HDR" || extension == L".hdr")
+    {
+        LoadImageFromRgbeInt(file, imageStream);
+        return;
+    }
+
+    // A single image ScratchImage only needs to live until its pixels have been copied into a
+    // WIC bitmap; arrays, cubemaps, volumes and mip chains keep it for the other subresources.
+    auto dxtScratch = std::make_unique<ScratchImage>();
+
+    if (imageStream)
     {
-        IFRIMG(LoadFromHDRFile(filestr, nullptr, *dxtScratch));
+        std::vector<byte> data;
+        IFRIMG(DX::ReadStreamToEnd(imageStream, data));
+        IFRIMG(LoadFromDDSMemory(data.data(), data.size(), 0, nullptr, *dxtScratch));
     }
     else
     {
-        IFRIMG(LoadFromDDSFile(filestr, 0, nullptr, *dxtScratch));
+        // The view only needs to outlive parsing; subresources are copied into dxtScratch.
+        DX::FileView view;
+        IFRIMG(view.Map(file));
+        IFRIMG(LoadFromDDSMemory(view.Data(), view.Size(), 0, nullptr, *dxtScratch));
+    }
+
+    IFRIMG(CheckCanceled());
+
+    const TexMetadata& metadata = dxtScratch->GetMetadata();
+    UINT frameCount = static_cast<UINT>(metadata.IsVolumemap() ? metadata.depth : metadata.arraySize);
+    UINT mipCount = static_cast<UINT>(metadata.mipLevels);
+
+    // Only the first image is decoded up front.
+    LoadDdsImage(*dxtScratch, 0, 0);
+
+    if (frameCount > 1 || mipCount > 1)
+    {
+        m_ddsImage = std::move(dxtScratch);
     }
 
-    auto image = dxtScratch->GetImage(0, 0, 0); // Always get the first image.
+    m_imageInfo.frameCount = frameCount;
+    m_imageInfo.mipCount = mipCount;
+}
+
+/// <summary>
+/// Decodes one subresource of a DDS file. For a volume texture frame is the depth slice,
+/// otherwise it is the array item; each cube face is an item.
+/// </summary>
+void ImageLoader::LoadDdsImage(const ScratchImage& ddsImage, unsigned int frame, unsigned int mip)
+{
+    const TexMetadata& metadata = ddsImage.GetMetadata();
+
+    // Volume textures halve their depth with each mip level.
+    auto image = metadata.IsVolumemap() ?
+        ddsImage.GetImage(mip, 0, (std::min)(static_cast<size_t>(frame), (std::max)(metadata.depth >> mip, size_t(1)) - 1)) :
+        ddsImage.GetImage(mip, frame, 0);
+
+    IFRIMG(image != nullptr ? S_OK : E_INVALIDARG);
 
     // Decompress if the image uses block compression. This does not use WIC and Direct2D's
     // native support for BC1, BC2, and BC3 formats.
-    auto decompScratch = new ScratchImage();
     if (DirectX::IsCompressed(image->format))
     {
-        IFRIMG(DirectX::Decompress(*image, DXGI_FORMAT_UNKNOWN, *decompScratch));
+        ComPtr<IWICBitmap> decompBitmap;
+        IFRIMG(DecompressToWicBitmap(*image, &decompBitmap));
 
-        // Memory for each Image is managed by ScratchImage.
-        image = decompScratch->GetImage(0, 0, 0);
+        LoadImageCommon(decompBitmap.Get());
+        return;
     }
 
-    GUID wicFmt = TranslateDxgiFormatToWic(image->format);
+    GUID wicFmt = ImageProbe::TranslateDxgiFormatToWic(image->format);
 
     // Fail if we don't know how to load in WIC.
     IFRIMG(wicFmt == GUID_WICPixelFormatUndefined ? E_FAIL : S_OK);
@@ -168,24 +751,476 @@ void ImageLoader::LoadImageFromDirectXTexInt(String^ filename, String^ extension
         &dxtWicBitmap));
 
     LoadImageCommon(dxtWicBitmap.Get());
+}
 
-    // TODO: Common code to check file type?
-    if (extension == L".HDR" || extension == L".hdr")
+/// <summary>
+/// Decompresses a block compressed image into a new WIC bitmap.
+/// </summary>
+/// <remarks>
+/// DirectX::Decompress runs on a single thread, so the image is split into independent bands of
+/// block rows which are decompressed in parallel. Each band is copied into the bitmap as soon as it
+/// is decoded, so no full-size intermediate ScratchImage is allocated.
+/// </remarks>
+HRESULT ImageLoader::DecompressToWicBitmap(const Image& image, _COM_Outptr_ IWICBitmap** bitmap)
+{
+    *bitmap = nullptr;
+
+    // DXGI_FORMAT_UNKNOWN lets DirectXTex pick the output format; BC6H would otherwise be FP32.
+    DXGI_FORMAT decompFmt = DXGI_FORMAT_UNKNOWN;
+    if (m_options.bc6hToHalf &&
+        (image.format == DXGI_FORMAT_BC6H_UF16 || image.format == DXGI_FORMAT_BC6H_SF16))
+    {
+        decompFmt = DXGI_FORMAT_R16G16B16A16_FLOAT;
+    }
+
+    size_t blockRows = (image.height + 3) / 4;
+    size_t bandCount = (blockRows + sc_DecompressBandBlockRows - 1) / sc_DecompressBandBlockRows;
+
+    auto decompressBand = [&](size_t band, ScratchImage& output)
+    {
+        size_t firstBlockRow = band * sc_DecompressBandBlockRows;
+        size_t numBlockRows = min(sc_DecompressBandBlockRows, blockRows - firstBlockRow);
+
+        // For compressed formats rowPitch is the size of one row of blocks.
+        Image bandImage = image;
+        bandImage.height = min(numBlockRows * 4, image.height - firstBlockRow * 4);
+        bandImage.pixels = image.pixels + firstBlockRow * image.rowPitch;
+        bandImage.slicePitch = numBlockRows * image.rowPitch;
+
+        return DirectX::Decompress(bandImage, decompFmt, output);
+    };
+
+    // The first band determines the output format and therefore the bitmap to create.
+    ScratchImage firstBand;
+    HRESULT hr = decompressBand(0, firstBand);
+    if (FAILED(hr))
+        return hr;
+
+    GUID wicFmt = ImageProbe::TranslateDxgiFormatToWic(firstBand.GetMetadata().format);
+
+    // Fail if we don't know how to load in WIC.
+    if (wicFmt == GUID_WICPixelFormatUndefined)
+        return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+
+    ComPtr<IWICBitmap> decompBitmap;
+    auto fact = m_deviceResources->GetWicImagingFactory();
+    hr = fact->CreateBitmap(
+        static_cast<UINT>(image.width),
+        static_cast<UINT>(image.height),
+        wicFmt,
+        WICBitmapCacheOnLoad,
+        &decompBitmap);
+
+    if (FAILED(hr))
+        return hr;
+
+    {
+        ComPtr<IWICBitmapLock> lock;
+        hr = decompBitmap->Lock({}, WICBitmapLockWrite, &lock);
+        if (FAILED(hr))
+            return hr;
+
+        UINT lockStride = 0, lockSize = 0;
+        WICInProcPointer lockData = nullptr;
+        hr = lock->GetStride(&lockStride);
+        if (SUCCEEDED(hr))
+        {
+            hr = lock->GetDataPointer(&lockSize, &lockData);
+        }
+
+        if (FAILED(hr))
+            return hr;
+
+        auto copyBand = [&](size_t band, const ScratchImage& decoded)
+        {
+            auto src = decoded.GetImage(0, 0, 0);
+            size_t rowBytes = min(src->rowPitch, static_cast<size_t>(lockStride));
+            auto dest = lockData + band * sc_DecompressBandBlockRows * 4 * lockStride;
+
+            for (size_t y = 0; y < src->height; y++)
+            {
+                memcpy(dest + y * lockStride, src->pixels + y * src->rowPitch, rowBytes);
+            }
+        };
+
+        copyBand(0, firstBand);
+        firstBand.Release();
+
+        std::vector<HRESULT> bandResults(bandCount, S_OK);
+        concurrency::parallel_for(size_t(1), bandCount, [&](size_t band)
+        {
+            bandResults[band] = CheckCanceled();
+            if (FAILED(bandResults[band]))
+                return;
+
+            ScratchImage decoded;
+            bandResults[band] = decompressBand(band, decoded);
+            if (SUCCEEDED(bandResults[band]))
+            {
+                copyBand(band, decoded);
+            }
+        });
+
+        for (auto bandHr : bandResults)
+        {
+            if (FAILED(bandHr))
+                return bandHr;
+        }
+
+        // The lock must be released before the bitmap is consumed by WIC or Direct2D.
+    }
+
+    *bitmap = decompBitmap.Detach();
+    return S_OK;
+}
+
+/// <summary>
+/// Loads a Radiance RGBE image, keeping it resident at 32bpp.
+/// </summary>
+/// <remarks>
+/// The bitmap source expands to FP16 inside CopyPixels, so only the regions requested by
+/// WIC or Direct2D are ever held in expanded form.
+/// </remarks>
+void ImageLoader::LoadImageFromRgbeInt(HANDLE file, IStream* imageStream)
+{
+    auto image = std::make_shared<RgbeImage>();
+    IFRIMG(imageStream
+        ? RgbeCodec::DecodeStream(imageStream, *image, m_cancel)
+        : RgbeCodec::DecodeFile(file, *image, m_cancel));
+
+    ComPtr<IWICBitmapSource> rgbeSource;
+    IFRIMG(RgbeCodec::CreateBitmapSource(image, &rgbeSource));
+
+    // A Radiance file holds a single image, counted like a single frame WIC image.
+    m_imageInfo.frameCount = 1;
+    m_imageInfo.mipCount = 1;
+
+    LoadImageCommon(rgbeSource.Get());
+
+    // Report the native RGBE bit depth rather than that of the FP16 source.
+    // 16 bpc is not strictly accurate but best preserves the intent of RGBE.
+    m_imageInfo.bitsPerPixel = 32;
+    m_imageInfo.bitsPerChannel = 16;
+}
+
+/// <summary>
+/// Streams an OpenEXR image directly into a WIC bitmap.
+/// </summary>
+/// <remarks>
+/// Unlike the generic DirectXTex path, no intermediate ScratchImage is allocated, so only
+/// one full-size copy of the decoded image exists at any time. Multi-resolution (tiled mip/ripmap)
+/// files initially decode only a reduced level; see UpdateExrResidentLevel. Only the given part
+/// of a multi-part file is decoded.
+/// </remarks>
+void ImageLoader::LoadImageFromExrInt(HANDLE file, IStream* imageStream, unsigned int part)
+{
+    auto reader = std::make_unique<EXRImageReader>();
+    TexMetadata metadata = {};
+
+    // A stream reader holds a reference to imageStream for as long as finer levels may be needed.
+    IFRIMG(OpenExrReader(reader.get(), file, imageStream, part, &metadata));
+
+    UINT partCount = static_cast<UINT>(reader->GetPartCount());
+    if (partCount > 1)
+    {
+        // Reopened to decode another part when it is selected. The caller's handle is only
+        // valid for the duration of this load, so keep a duplicate.
+        if (!imageStream && file != m_exrFile.Get())
+        {
+            HANDLE duplicate = INVALID_HANDLE_VALUE;
+            IFRIMG(DuplicateHandle(GetCurrentProcess(), file, GetCurrentProcess(), &duplicate, 0, FALSE, DUPLICATE_SAME_ACCESS)
+                ? S_OK : HRESULT_FROM_WIN32(GetLastError()));
+            m_exrFile.Attach(duplicate);
+        }
+
+        m_exrStream = imageStream;
+    }
+
+    // Start from the finest level that fits within sc_ExrInitialLevelMaxDimension.
+    size_t level = 0;
+    for (; level + 1 < reader->GetLevelCount(); level++)
+    {
+        size_t levelWidth, levelHeight;
+        IFRIMG(reader->GetLevelSize(level, &levelWidth, &levelHeight));
+
+        if (max(levelWidth, levelHeight) <= sc_ExrInitialLevelMaxDimension)
+        {
+            break;
+        }
+    }
+
+    ComPtr<IWICBitmap> exrBitmap;
+    IFRIMG(DecodeExrLevel(reader.get(), level, &exrBitmap));
+
+    if (level > 0)
+    {
+        // Keep the reader so finer levels can be decoded as the user zooms in.
+        m_exrReader = std::move(reader);
+        m_exrResidentLevel = level;
+    }
+    else
+    {
+        reader->Close();
+    }
+
+    LoadImageCommon(exrBitmap.Get());
+
+    // Image info always describes the full resolution image regardless of the resident level.
+    m_imageInfo.size = Size(static_cast<float>(metadata.width), static_cast<float>(metadata.height));
+    m_imageInfo.frameCount = partCount;
+    m_imageInfo.mipCount = 1;
+}
+
+/// <summary>
+/// Opens an OpenEXR image from a file or stream with the decode settings in ImageLoaderOptions.
+/// </summary>
+HRESULT ImageLoader::OpenExrReader(
+    _In_ EXRImageReader* reader,
+    _In_opt_ HANDLE file,
+    _In_opt_ IStream* imageStream,
+    size_t part,
+    _Out_ TexMetadata* metadata)
+{
+    auto flags = m_options.exrPreserveFp32 ? EXR_FLAGS_PRESERVE_FP32 : EXR_FLAGS_NONE;
+    auto layer = m_options.exrLayer.empty() ? nullptr : m_options.exrLayer.c_str();
+
+    return imageStream
+        ? reader->Open(imageStream, metadata, m_options.exrThreadCount, flags, layer, part)
+        : reader->Open(file, metadata, m_options.exrThreadCount, flags, layer, part);
+}
+
+/// <summary>
+/// Decodes one resolution level of an OpenEXR image into a new WIC bitmap.
+/// </summary>
+HRESULT ImageLoader::DecodeExrLevel(_In_ EXRImageReader* reader, size_t level, _COM_Outptr_ IWICBitmap** bitmap)
+{
+    return DecodeExrLevel(m_deviceResources->GetWicImagingFactory(), reader, level, m_options.exrThreadCount, m_cancel, bitmap);
+}
+
+/// <summary>
+/// As above, but independent of the loader so that it can run on the thread pool.
+/// </summary>
+HRESULT ImageLoader::DecodeExrLevel(
+    _In_ IWICImagingFactory* fact,
+    _In_ EXRImageReader* reader,
+    size_t level,
+    int threadCount,
+    const concurrency::cancellation_token& cancel,
+    _COM_Outptr_ IWICBitmap** bitmap)
+{
+    *bitmap = nullptr;
+
+    GUID wicFmt = ImageProbe::TranslateDxgiFormatToWic(reader->GetMetadata().format);
+
+    // Fail if we don't know how to load in WIC.
+    if (wicFmt == GUID_WICPixelFormatUndefined)
+        return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+
+    size_t levelWidth, levelHeight;
+    HRESULT hr = reader->GetLevelSize(level, &levelWidth, &levelHeight);
+    if (FAILED(hr))
+        return hr;
+
+    auto width = static_cast<UINT>(levelWidth);
+    auto height = static_cast<UINT>(levelHeight);
+
+    ComPtr<IWICBitmap> exrBitmap;
+    hr = fact->CreateBitmap(width, height, wicFmt, WICBitmapCacheOnLoad, &exrBitmap);
+    if (FAILED(hr))
+        return hr;
+
+    {
+        ComPtr<IWICBitmapLock> lock;
+        hr = exrBitmap->Lock({}, WICBitmapLockWrite, &lock);
+        if (FAILED(hr))
+            return hr;
+
+        UINT lockStride = 0, lockSize = 0;
+        WICInProcPointer lockData = nullptr;
+        hr = lock->GetStride(&lockStride);
+        if (SUCCEEDED(hr))
+        {
+            hr = lock->GetDataPointer(&lockSize, &lockData);
+        }
+
+        if (FAILED(hr))
+            return hr;
+
+        if (level > 0)
+        {
+            // Reduced levels are small; decode them in one call.
+            hr = reader->ReadLevel(level, lockData, lockStride);
+        }
+        else
+        {
+            // Each strip is handed to OpenEXR in one call so that it can decompress the chunks
+            // within it in parallel; scale the strip height with the thread budget.
+            UINT threads = threadCount < 0 ?
+                std::thread::hardware_concurrency() : static_cast<UINT>(threadCount);
+            UINT stripRows = sc_StreamingStripRows * max(threads, 1u);
+
+            for (UINT row = 0; row < height && SUCCEEDED(hr); row += stripRows)
+            {
+                UINT numRows = min(stripRows, height - row);
+                hr = cancel.is_canceled() ? E_ABORT : S_OK;
+                if (SUCCEEDED(hr))
+                {
+                    hr = reader->ReadScanlines(row, numRows, lockData + static_cast<size_t>(row) * lockStride, lockStride);
+                }
+            }
+        }
+
+        // The lock must be released before the bitmap is consumed by WIC or Direct2D.
+    }
+
+    if (FAILED(hr))
+        return hr;
+
+    *bitmap = exrBitmap.Detach();
+    return S_OK;
+}
+
+/// <summary>
+/// For multi-resolution EXR images, makes sure the resident level has at least one texel
+/// per display pixel at the given zoom. A finer level is decoded on the thread pool; the
+/// resident level keeps being displayed until a later call finds the decode complete and
+/// swaps it in. See TakeRefinement.
+/// </summary>
+/// <remarks>
+/// Levels are only ever refined; a finer level stays resident after zooming back out.
+/// If decoding fails the coarser level continues to be displayed, and no further levels are tried.
+/// </remarks>
+void ImageLoader::UpdateExrResidentLevel(float zoom)
+{
+    if (m_isExrLevelPending)
+    {
+        if (!m_exrLevelDecode.is_done())
+        {
+            return;
+        }
+
+        m_isExrLevelPending = false;
+
+        ComPtr<IWICBitmap> exrBitmap = m_exrLevelDecode.get();
+        m_exrLevelDecode = concurrency::task<ComPtr<IWICBitmap>>();
+
+        ComPtr<IWICBitmapSource> cachedSource;
+        if (!exrBitmap ||
+            FAILED(CreateCachedWicSource(exrBitmap.Get(), &cachedSource)))
+        {
+            m_exrReader.reset();
+            return;
+        }
+
+        ComPtr<ID2D1ImageSourceFromWic> wicImageSource;
+        IFT(m_deviceResources->GetD2DDeviceContext()->CreateImageSourceFromWic(cachedSource.Get(), &wicImageSource));
+        IFT(wicImageSource.As(&m_imageSource));
+
+        UINT width, height;
+        IFT(cachedSource->GetSize(&width, &height));
+
+        m_wicCachedSource = cachedSource;
+        m_residentSize = Size(static_cast<float>(width), static_cast<float>(height));
+        m_exrResidentLevel = m_exrPendingLevel;
+
+        if (m_exrResidentLevel == 0)
+        {
+            // Nothing finer left to load.
+            m_exrReader.reset();
+            return;
+        }
+    }
+
+    size_t level = m_exrResidentLevel;
+    while (level > 0)
+    {
+        size_t levelWidth, levelHeight;
+        if (FAILED(m_exrReader->GetLevelSize(level, &levelWidth, &levelHeight)))
+        {
+            return;
+        }
+
+        if (levelWidth >= m_imageInfo.size.Width * zoom &&
+            levelHeight >= m_imageInfo.size.Height * zoom)
+        {
+            break;
+        }
+
+        level--;
+    }
+
+    if (level == m_exrResidentLevel)
+    {
+        return;
+    }
+
+    // The task only holds references to what it uses, so it may outlive the loader.
+    auto reader = m_exrReader;
+    ComPtr<IWICImagingFactory> fact = m_deviceResources->GetWicImagingFactory();
+    int threadCount = m_options.exrThreadCount;
+    auto cancel = m_exrLevelCancel.get_token();
+
+    m_exrLevelDecode = concurrency::create_task([reader, fact, level, threadCount, cancel]()
+    {
+        ComPtr<IWICBitmap> exrBitmap;
+        if (FAILED(DecodeExrLevel(fact.Get(), reader.get(), level, threadCount, cancel, &exrBitmap)))
+        {
+            exrBitmap.Reset();
+        }
+
+        return exrBitmap;
+    });
+
+    m_exrPendingLevel = level;
+    m_isExrLevelPending = true;
+    m_isExrLevelTaken = false;
+}
+
+/// <summary>
+/// Abandons a finer EXR level being decoded in the background. The task ends early and
+/// releases its share of the reader; nothing waits for it.
+/// </summary>
+void ImageLoader::CancelExrLevelDecode()
+{
+    if (m_isExrLevelPending)
+    {
+        m_exrLevelCancel.cancel();
+        m_exrLevelCancel = concurrency::cancellation_token_source();
+        m_exrLevelDecode = concurrency::task<ComPtr<IWICBitmap>>();
+        m_isExrLevelPending = false;
+    }
+}
+
+/// <summary>
+/// Returns the background decode of a finer level started by the last GetLoadedImage call, if
+/// there is one that hasn't been returned before. Once it completes, GetLoadedImage returns the
+/// finer level, so the caller should draw again.
+/// </summary>
+bool ImageLoader::TakeRefinement(concurrency::task<void>* refinement)
+{
+    if (!m_isExrLevelPending || m_isExrLevelTaken)
     {
-        // Manually fix up Radiance RGBE image file bit depth as DirectXTex expands it to 128bpp.
-        // 16 bpc is not strictly accurate but best preserves the intent of RGBE.
-        m_imageInfo.bitsPerPixel = 32;
-        m_imageInfo.bitsPerChannel = 16;
+        return false;
     }
+
+    m_isExrLevelTaken = true;
+
+    // The decode reports failure with a null bitmap rather than throwing.
+    *refinement = m_exrLevelDecode.then([](ComPtr<IWICBitmap>) {});
+    return true;
 }
 
 /// <summary>
 /// After initial decode, obtains image information and do common setup.
 /// Populates all members of ImageInfo.
 /// </summary>
-void ImageLoader::LoadImageCommon(_In_ IWICBitmapSource* source)
+/// <param name="preview">If set, this reduced resolution copy of source is rendered instead, and the
+/// loader ends up in PreviewReady. Image info is still read from source.</param>
+void ImageLoader::LoadImageCommon(_In_ IWICBitmapSource* source, _In_opt_ IWICBitmapSource* preview)
 {
-    EnforceStates(1, ImageLoaderState::NotInitialized);
+    EnforceStates(2, ImageLoaderState::NotInitialized, ImageLoaderState::PreviewReady);
+
+    m_isPreview = (preview != nullptr);
 
     auto wicFactory = m_deviceResources->GetWicImagingFactory();
 
@@ -200,18 +1235,24 @@ void ImageLoader::LoadImageCommon(_In_ IWICBitmapSource* source)
         imageFmt = GUID_WICPixelFormat32bppR10G10B10A2HDR10;
     }
 
-    PopulatePixelFormatInfo(m_imageInfo, imageFmt);
-    PopulateImageInfoACKind(m_imageInfo, source);
+    IFRIMG(ImageProbe::GetPixelFormatInfo(wicFactory, imageFmt, m_imageInfo));
 
     UINT width;
     UINT height;
     IFRIMG(source->GetSize(&width, &height));
     m_imageInfo.size = Size(static_cast<float>(width), static_cast<float>(height));
+    m_residentSize = m_imageInfo.size;
+
+    if (m_isPreview)
+    {
+        IFRIMG(preview->GetSize(&width, &height));
+        m_residentSize = Size(static_cast<float>(width), static_cast<float>(height));
+    }
 
     if (m_imageInfo.isHeif == true &&
         m_imageInfo.forceBT2100ColorSpace == true)
     {
-        CreateHeifHdr10CpuResources(source);
+        IFRIMG(CreateHeifHdr10CpuResources(source));
     }
     else
     {
@@ -225,43 +1266,37 @@ void ImageLoader::LoadImageCommon(_In_ IWICBitmapSource* source)
                 1,
                 m_wicColorContext.GetAddressOf(),
                 &m_imageInfo.numProfiles));
+
+            // Images sharing a profile share its color context and transforms. EXIF color space
+            // contexts have no profile and keep using the WIC color context.
+            if (m_imageInfo.numProfiles >= 1)
+            {
+                ColorProfileCache::GetProfile(m_wicColorContext.Get(), m_colorProfile);
+            }
         }
 
-        // When decoding, preserve the numeric representation (float vs. non-float)
-        // of the native image data. This avoids WIC performing an implicit gamma conversion
-        // which occurs when converting between a fixed-point/integer pixel format (sRGB gamma)
-        // and a float-point pixel format (linear gamma). Gamma adjustment, if specified by
-        // the ICC profile, will be performed by the Direct2D color management effect.
+        IFRIMG(CreateCachedWicSource(m_isPreview ? preview : source, &m_wicCachedSource));
 
-        WICPixelFormatGUID fmt = {};
-        if (m_imageInfo.isFloat)
-        {
-            fmt = GUID_WICPixelFormat64bppPRGBAHalf; // Equivalent to DXGI_FORMAT_R16G16B16A16_FLOAT.
-        }
-        else
+        // Full decodes held in memory can be written to the disk cache. WIC frames are decoded
+        // on demand, and a multi-resolution EXR is only partially resident.
+        if (frame == nullptr && !m_isPreview && m_exrReader == nullptr)
         {
-            fmt = GUID_WICPixelFormat64bppPRGBA; // Equivalent to DXGI_FORMAT_R16G16B16A16_UNORM.
-                                                 // Many SDR images (e.g. JPEG) use <=32bpp, so it
-                                                 // is possible to further optimize this for memory usage.
+            m_decodedSource = source;
         }
+    }
 
-        ComPtr<IWICFormatConverter> format;
-        IFRIMG(wicFactory->CreateFormatConverter(&format));
-
-        IFRIMG(format->Initialize(
-            source,
-            fmt,
-            WICBitmapDitherTypeNone,
-            nullptr,
-            0.0f,
-            WICBitmapPaletteTypeCustom));
+    // Classify only once numProfiles is known, as ImageProbe does.
+    PopulateImageInfoACKind(m_imageInfo);
+    IFRIMG(CheckCanceled());
 
-        IFRIMG(format.As(&m_wicCachedSource));
-    }
+    IFRIMG(CreateMipPyramid());
 
     m_state = ImageLoaderState::NeedDeviceResources;
 
-    CreateDeviceDependentResourcesInternal();
+    if (!m_options.deferDeviceResources)
+    {
+        CreateDeviceDependentResourcesInternal();
+    }
 
     m_imageInfo.isValid = true;
 }
@@ -271,57 +1306,136 @@ void ImageLoader::LoadImageCommon(_In_ IWICBitmapSource* source)
 /// </summary>
 /// <param name="source">Must be a valid HEIF HDR10 IWICBitmapFrameDecode.</param>
 /// <remarks>
-/// GUID_WICPixelFormat32bppR10G10B10A2HDR10 has very limited support in WIC and D2D, so instead
-/// we must create a full resolution WIC bitmap cache and drop into D3D to upload to GPU.
+/// GUID_WICPixelFormat32bppR10G10B10A2HDR10 has very limited support in WIC and D2D. By default
+/// the image is converted to FP16 scRGB in strips as it is copied out of the decoder, and the
+/// result is an ordinary WIC image with CPU access. The decoder still decodes the whole frame on
+/// the first strip, so this does not reduce peak memory below a full frame of HDR10 pixels.
+/// Otherwise we must create a full resolution WIC bitmap cache and drop into D3D to upload to GPU.
 ///
-/// Needs to be paired with CreateHeifHdr10GpuResources.
+/// Needs to be paired with CreateHeifHdr10GpuResources unless m_isHdr10Linear is set.
 /// </remarks>
-void ImageLoader::CreateHeifHdr10CpuResources(IWICBitmapSource* source)
+HRESULT ImageLoader::CreateHeifHdr10CpuResources(IWICBitmapSource* source)
 {
     // Sanity checks
-    IFRIMG(m_imageInfo.isHeif == true ? S_OK : WINCODEC_ERR_INVALIDPARAMETER);
-    IFRIMG(m_imageInfo.forceBT2100ColorSpace == true ? S_OK : WINCODEC_ERR_INVALIDPARAMETER);
+    if (m_imageInfo.isHeif != true ||
+        m_imageInfo.forceBT2100ColorSpace != true)
+    {
+        return WINCODEC_ERR_INVALIDPARAMETER;
+    }
 
     auto fact = m_deviceResources->GetWicImagingFactory();
 
     UINT width, height = 0;
-    IFRIMG(source->GetSize(&width, &height));
+    HRESULT hr = source->GetSize(&width, &height);
+    if (FAILED(hr))
+        return hr;
 
     ComPtr<IWICBitmapFrameDecode> frame;
-    IFRIMG(source->QueryInterface(IID_PPV_ARGS(&frame)));
+    hr = source->QueryInterface(IID_PPV_ARGS(&frame));
+    if (FAILED(hr))
+        return hr;
 
     ComPtr<IWICBitmapSourceTransform> sourceTransform;
-    IFRIMG(frame.As(&sourceTransform));
+    hr = frame.As(&sourceTransform);
+    if (FAILED(hr))
+        return hr;
 
     GUID hdr10Fmt = GUID_WICPixelFormat32bppR10G10B10A2HDR10;
 
-    ComPtr<IWICBitmap> hdr10Bitmap;
-    IFRIMG(fact->CreateBitmap(
+    // HEVC decodes the whole frame in the first CopyPixels call, so this is the last point to
+    // cancel before the decode; strips after the first only copy out of the decoded frame.
+    hr = CheckCanceled();
+    if (FAILED(hr))
+        return hr;
+
+    m_isHdr10Linear = m_options.hdr10ToScRgb;
+
+    ComPtr<IWICBitmap> cacheBitmap;
+    hr = fact->CreateBitmap(
         width,
         height,
-        hdr10Fmt,
+        m_isHdr10Linear ? GUID_WICPixelFormat64bppRGBAHalf : hdr10Fmt,
         WICBitmapCacheOnLoad,
-        &hdr10Bitmap));
+        &cacheBitmap);
+    if (FAILED(hr))
+        return hr;
+
+    {
+        ComPtr<IWICBitmapLock> lock;
+        hr = cacheBitmap->Lock({}, WICBitmapLockWrite, &lock);
+        if (FAILED(hr))
+            return hr;
+
+        UINT lockStride, lockSize = 0;
+        WICInProcPointer lockData = nullptr;
+        hr = lock->GetStride(&lockStride);
+        if (FAILED(hr))
+            return hr;
+
+        hr = lock->GetDataPointer(&lockSize, &lockData);
+        if (FAILED(hr))
+            return hr;
+
+        if (m_isHdr10Linear)
+        {
+            UINT stripStride = width * sizeof(uint32_t);
+            std::vector<uint8_t> strip(static_cast<size_t>(stripStride) * min(sc_Hdr10StripRows, height));
 
-    ComPtr<IWICBitmapLock> lock;
-    IFRIMG(hdr10Bitmap->Lock({}, WICBitmapLockWrite, &lock));
+            for (UINT y = 0; y < height; y += sc_Hdr10StripRows)
+            {
+                UINT rows = min(sc_Hdr10StripRows, height - y);
+                WICRect rect = { 0, static_cast<INT>(y), static_cast<INT>(width), static_cast<INT>(rows) };
+
+                hr = sourceTransform->CopyPixels(
+                    &rect,
+                    width,
+                    rows,
+                    &hdr10Fmt, // Assumes we have already checked GetClosestPixelFormat
+                    WICBitmapTransformRotate0,
+                    stripStride,
+                    stripStride * rows,
+                    strip.data());
+                if (FAILED(hr))
+                    return hr;
+
+                Hdr10Converter::ConvertRows(
+                    strip.data(),
+                    stripStride,
+                    lockData + static_cast<size_t>(y) * lockStride,
+                    lockStride,
+                    width,
+                    rows,
+                    m_cancel);
+
+                hr = CheckCanceled();
+                if (FAILED(hr))
+                    return hr;
+            }
+        }
+        else
+        {
+            hr = sourceTransform->CopyPixels(
+                {},
+                width,
+                height,
+                &hdr10Fmt, // Assumes we have already checked GetClosestPixelFormat
+                WICBitmapTransformRotate0,
+                lockStride,
+                lockSize,
+                lockData);
+            if (FAILED(hr))
+                return hr;
+        }
 
-    UINT lockStride, lockSize = 0;
-    WICInProcPointer lockData = nullptr;
-    IFRIMG(lock->GetStride(&lockStride));
-    IFRIMG(lock->GetDataPointer(&lockSize, &lockData));
+        // The lock must be released before the bitmap is consumed by WIC or Direct2D.
+    }
 
-    IFRIMG(sourceTransform->CopyPixels(
-        {},
-        width,
-        height,
-        &hdr10Fmt, // Assumes we have already checked GetClosestPixelFormat
-        WICBitmapTransformRotate0,
-        lockStride,
-        lockSize,
-        lockData));
+    hr = cacheBitmap.As(&m_wicCachedSource);
+    if (FAILED(hr))
+        return hr;
 
-    IFRIMG(hdr10Bitmap.As(&m_wicCachedSource));
+    m_decodedSource = m_wicCachedSource;
+    return S_OK;
 }
 
 /// <summary>
@@ -377,6 +1491,82 @@ void ImageLoader::CreateHeifHdr10GpuResources()
         &m_imageSource));
 }
 
+/// <summary>
+/// Converts decoded image data to the pixel format that is cached in memory and uploaded to Direct2D.
+/// </summary>
+HRESULT ImageLoader::CreateCachedWicSource(_In_ IWICBitmapSource* source, _COM_Outptr_ IWICBitmapSource** cachedSource)
+{
+    // When decoding, preserve the numeric representation (float vs. non-float)
+    // of the native image data. This avoids WIC performing an implicit gamma conversion
+    // which occurs when converting between a fixed-point/integer pixel format (sRGB gamma)
+    // and a float-point pixel format (linear gamma). Gamma adjustment, if specified by
+    // the ICC profile, will be performed by the Direct2D color management effect.
+
+    WICPixelFormatGUID fmt = {};
+    if (m_imageInfo.isFloat)
+    {
+        fmt = GUID_WICPixelFormat64bppPRGBAHalf; // Equivalent to DXGI_FORMAT_R16G16B16A16_FLOAT.
+    }
+    else if (m_options.nativeDepthCache && m_imageInfo.bitsPerChannel <= 8)
+    {
+        fmt = GUID_WICPixelFormat32bppPBGRA; // Equivalent to DXGI_FORMAT_B8G8R8A8_UNORM.
+    }
+    else if (m_options.nativeDepthCache && m_imageInfo.bitsPerChannel == 10)
+    {
+        fmt = GUID_WICPixelFormat32bppRGBA1010102; // Equivalent to DXGI_FORMAT_R10G10B10A2_UNORM.
+    }
+    else
+    {
+        fmt = GUID_WICPixelFormat64bppPRGBA; // Equivalent to DXGI_FORMAT_R16G16B16A16_UNORM.
+    }
+
+    return ConvertWicSource(source, fmt, cachedSource);
+}
+
+/// <summary>
+/// Creates a format converter, or returns the source itself if it is already in the requested format.
+/// FormatConverter is used for the pairs it supports, otherwise a WIC format converter.
+/// </summary>
+HRESULT ImageLoader::ConvertWicSource(_In_ IWICBitmapSource* source, WICPixelFormatGUID fmt, _COM_Outptr_ IWICBitmapSource** converted)
+{
+    *converted = nullptr;
+
+    WICPixelFormatGUID sourceFmt = {};
+    HRESULT hr = source->GetPixelFormat(&sourceFmt);
+    if (FAILED(hr))
+        return hr;
+
+    if (sourceFmt == fmt)
+    {
+        source->AddRef();
+        *converted = source;
+        return S_OK;
+    }
+
+    if (m_options.fastFormatConversion && FormatConverter::CanConvert(sourceFmt, fmt))
+    {
+        return FormatConverter::CreateBitmapSource(source, fmt, converted);
+    }
+
+    ComPtr<IWICFormatConverter> format;
+    hr = m_deviceResources->GetWicImagingFactory()->CreateFormatConverter(&format);
+    if (FAILED(hr))
+        return hr;
+
+    hr = format->Initialize(
+        source,
+        fmt,
+        WICBitmapDitherTypeNone,
+        nullptr,
+        0.0f,
+        WICBitmapPaletteTypeCustom);
+    if (FAILED(hr))
+        return hr;
+
+    *converted = format.Detach();
+    return S_OK;
+}
+
 /// <summary>
 /// (Re)initializes all long-lived device dependent resources.
 /// </summary>
@@ -389,20 +1579,69 @@ void ImageLoader::CreateDeviceDependentResourcesInternal()
 
     // Load the image from WIC using ID2D1ImageSource.
     if (m_imageInfo.isHeif == true &&
-        m_imageInfo.forceBT2100ColorSpace == true)
+        m_imageInfo.forceBT2100ColorSpace == true &&
+        m_isHdr10Linear == false)
     {
         CreateHeifHdr10GpuResources();
     }
+    else if (UseVirtualImage())
+    {
+        m_virtualImage = std::make_unique<VirtualImage>(
+            m_deviceResources,
+            m_wicCachedSource.Get(),
+            m_imageInfo,
+            m_options.virtualImageTileBudget);
+    }
     else
     {
         ComPtr<ID2D1ImageSourceFromWic> wicImageSource;
-        IFRIMG(context->CreateImageSourceFromWic(m_wicCachedSource.Get(), &wicImageSource));
+        HRESULT hr = context->CreateImageSourceFromWic(m_wicCachedSource.Get(), &wicImageSource);
+
+        if (FAILED(hr) && m_options.nativeDepthCache && !m_imageInfo.isFloat)
+        {
+            // Not every native depth format can be consumed by Direct2D (e.g. packed 10 bit);
+            // fall back to the 16 bpc format, which always can.
+            ComPtr<IWICBitmapSource> fullDepthSource;
+            hr = ConvertWicSource(m_wicCachedSource.Get(), GUID_WICPixelFormat64bppPRGBA, &fullDepthSource);
+            if (SUCCEEDED(hr))
+            {
+                hr = context->CreateImageSourceFromWic(fullDepthSource.Get(), &wicImageSource);
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                m_wicCachedSource = fullDepthSource;
+            }
+        }
+
+        IFRIMG(hr);
         IFRIMG(wicImageSource.As(&m_imageSource));
+
+        // Levels follow any fallback format chosen above.
+        WICPixelFormatGUID cachedFmt = {};
+        IFRIMG(m_wicCachedSource->GetPixelFormat(&cachedFmt));
+
+        m_mipImageSources.clear();
+        for (auto& level : m_mipLevels)
+        {
+            ComPtr<IWICBitmapSource> levelSource;
+            IFRIMG(ConvertWicSource(level.Get(), cachedFmt, &levelSource));
+
+            ComPtr<ID2D1ImageSourceFromWic> levelImageSource;
+            IFRIMG(context->CreateImageSourceFromWic(levelSource.Get(), &levelImageSource));
+
+            m_mipImageSources.push_back(levelImageSource);
+        }
     }
 
+    // HDR10 images converted on the CPU are already in scRGB.
+    if (m_isHdr10Linear)
+    {
+        IFT(context->CreateColorContext(D2D1_COLOR_SPACE_SCRGB, nullptr, 0, &m_colorContext));
+    }
     // Xbox One HDR screenshots and HEIF HDR images use the HDR10/BT.2100 colorspace, but this is not represented
     // in a WIC color context so we must manually set behavior.
-    if (m_imageInfo.forceBT2100ColorSpace)
+    else if (m_imageInfo.forceBT2100ColorSpace)
     {
         // TODO: Need consistent rules for using IFRIMG vs. IFT (when are errors exceptional?).
         ComPtr<ID2D1ColorContext1> colorContext1;
@@ -411,6 +1650,10 @@ void ImageLoader::CreateDeviceDependentResourcesInternal()
         IFT(colorContext1.As(&m_colorContext));
     }
     // If the image contains an embedded color profile, use it.
+    else if (m_colorProfile)
+    {
+        IFT(m_colorProfile->GetColorContext(context, &m_colorContext));
+    }
     else if (m_imageInfo.numProfiles >= 1)
     {
         IFT(context->CreateColorContextFromWicColorContext(
@@ -428,24 +1671,108 @@ void ImageLoader::CreateDeviceDependentResourcesInternal()
             &m_colorContext));
     }
 
-    m_state = ImageLoaderState::LoadingSucceeded;
+    m_state = m_isPreview ? ImageLoaderState::PreviewReady : ImageLoaderState::LoadingSucceeded;
+}
+
+/// <summary>
+/// Whether the image is too large to hand to Direct2D as one image source.
+/// </summary>
+bool ImageLoader::UseVirtualImage()
+{
+    // Previews are small, and multi-resolution EXR images manage their own levels.
+    if (m_isPreview || m_exrReader)
+    {
+        return false;
+    }
+
+    auto width = static_cast<uint64_t>(m_residentSize.Width);
+    auto height = static_cast<uint64_t>(m_residentSize.Height);
+    return width * height >= m_options.virtualImageMinPixels ||
+        width > m_maxBitmapSize ||
+        height > m_maxBitmapSize;
+}
+
+/// <summary>
+/// Builds the mip pyramid used when zoomed out, unless the image is drawn another way. This is
+/// part of the CPU side of a load, so it runs on the loading thread. Returns E_ABORT if canceled.
+/// </summary>
+/// <remarks>
+/// The pyramid is filtered from strips of m_wicCachedSource. Sources which decode from a WIC
+/// frame are not decoded into memory for it, so Direct2D's cache remains the only full copy.
+/// </remarks>
+HRESULT ImageLoader::CreateMipPyramid()
+{
+    m_mipLevels.clear();
+
+    // Multi-resolution EXR images and tiled images have levels of their own. PQ encoded HDR10
+    // can't be linearized by WIC, and neither can integer images with an embedded color profile,
+    // which WIC would wrongly assume to be sRGB encoded.
+    if (!m_options.mipPyramid ||
+        m_isPreview ||
+        m_exrReader ||
+        (m_imageInfo.forceBT2100ColorSpace && !m_isHdr10Linear) ||
+        (m_imageInfo.numProfiles > 0 && !m_imageInfo.isFloat) ||
+        UseVirtualImage())
+    {
+        return S_OK;
+    }
+
+    auto fact = m_deviceResources->GetWicImagingFactory();
+
+    HRESULT hr = MipPyramid::Build(fact, m_wicCachedSource.Get(), sc_MipMinDimension, m_cancel, m_mipLevels);
+    if (FAILED(hr))
+    {
+        m_mipLevels.clear();
+    }
+
+    return hr;
 }
 
 /// <summary>
 /// Gets the Direct2D image representing decoded image data.
 /// </summary>
-/// <remarks>Call this every time a new zoom factor is desired.</remarks>
-ID2D1TransformedImageSource* ImageLoader::GetLoadedImage(float zoom)
+/// <param name="visibleRect">The part of the image in view, in image pixels; if null, the whole image.
+/// Only used by images which are drawn from tiles.</param>
+/// <remarks>Call this every time a new zoom factor or view position is desired.</remarks>
+ID2D1Image* ImageLoader::GetLoadedImage(float zoom, _In_opt_ const D2D1_RECT_F* visibleRect)
 {
-    EnforceStates(1, ImageLoaderState::LoadingSucceeded);
+    EnforceStates(2, ImageLoaderState::LoadingSucceeded, ImageLoaderState::PreviewReady);
+
+    if (m_virtualImage)
+    {
+        ComPtr<ID2D1Image> tiles;
+        IFT(m_virtualImage->GetImage(zoom, visibleRect, &tiles));
+        return tiles.Detach();
+    }
+
+    if (m_exrReader)
+    {
+        UpdateExrResidentLevel(zoom);
+    }
+
+    // Zoomed out, draw from the coarsest mip level which still has a pixel per displayed pixel.
+    ComPtr<ID2D1ImageSource> imageSource = m_imageSource;
+    Size sourceSize = m_residentSize;
+    for (size_t level = 0; level < m_mipImageSources.size() && ldexpf(zoom, static_cast<int>(level) + 1) <= 1.0f; level++)
+    {
+        UINT width, height;
+        IFT(m_mipLevels[level]->GetSize(&width, &height));
+
+        imageSource = m_mipImageSources[level];
+        sourceSize = Size(static_cast<float>(width), static_cast<float>(height));
+    }
+
+    // A reduced resolution level may be resident; scale it to the size of the full image.
+    float scaleX = zoom * m_imageInfo.size.Width / sourceSize.Width;
+    float scaleY = zoom * m_imageInfo.size.Height / sourceSize.Height;
 
     // When using ID2D1ImageSource, the recommend method of scaling is to use
     // ID2D1TransformedImageSource. It is inexpensive to recreate this object.
     D2D1_TRANSFORMED_IMAGE_SOURCE_PROPERTIES props =
     {
         D2D1_ORIENTATION_DEFAULT,
-        zoom,
-        zoom,
+        scaleX,
+        scaleY,
         D2D1_INTERPOLATION_MODE_LINEAR, // This is ignored when using DrawImage.
         D2D1_TRANSFORMED_IMAGE_SOURCE_OPTIONS_NONE
     };
@@ -453,7 +1780,7 @@ ID2D1TransformedImageSource* ImageLoader::GetLoadedImage(float zoom)
     ComPtr<ID2D1TransformedImageSource> source;
 
     IFT(m_deviceResources->GetD2DDeviceContext()->CreateTransformedImageSource(
-        m_imageSource.Get(),
+        imageSource.Get(),
         &props,
         &source));
 
@@ -465,7 +1792,7 @@ ID2D1TransformedImageSource* ImageLoader::GetLoadedImage(float zoom)
 /// </summary>
 ID2D1ColorContext* ImageLoader::GetImageColorContext()
 {
-    EnforceStates(1, ImageLoaderState::LoadingSucceeded);
+    EnforceStates(2, ImageLoaderState::LoadingSucceeded, ImageLoaderState::PreviewReady);
 
     // Do NOT call GetImageColorContextInternal - it was already called by LoadImageCommon.
     return m_colorContext.Get();
@@ -476,11 +1803,110 @@ ID2D1ColorContext* ImageLoader::GetImageColorContext()
 /// </summary>
 ImageInfo ImageLoader::GetImageInfo()
 {
-    EnforceStates(2, ImageLoaderState::LoadingSucceeded, ImageLoaderState::NeedDeviceResources);
+    EnforceStates(3, ImageLoaderState::LoadingSucceeded, ImageLoaderState::PreviewReady, ImageLoaderState::NeedDeviceResources);
 
     return m_imageInfo;
 }
 
+/// <summary>
+/// Forces the full decode that Direct2D would otherwise defer until the image is first drawn,
+/// so a prefetched image is ready to display.
+/// </summary>
+void ImageLoader::EnsureDecoded()
+{
+    EnforceStates(1, ImageLoaderState::LoadingSucceeded);
+
+    // Tiled images are decoded as tiles come into view.
+    ComPtr<ID2D1ImageSourceFromWic> wicImageSource;
+    if (m_imageSource != nullptr &&
+        SUCCEEDED(m_imageSource.As(&wicImageSource)))
+    {
+        IFT(wicImageSource->EnsureCached(nullptr));
+    }
+
+    for (auto& level : m_mipImageSources)
+    {
+        IFT(level.As(&wicImageSource));
+        IFT(wicImageSource->EnsureCached(nullptr));
+    }
+}
+
+/// <summary>
+/// Creates a source of the resident pixels for writing them to the disk cache on a worker thread.
+/// It converts from the in-memory decode independently of m_wicCachedSource, which Direct2D may be
+/// reading at the same time. Fails if the image can't be persisted.
+/// </summary>
+HRESULT ImageLoader::CreatePersistableSource(_COM_Outptr_ IWICBitmapSource** source)
+{
+    *source = nullptr;
+
+    // The disk cache holds single images, not containers of subresources.
+    if (m_state != ImageLoaderState::LoadingSucceeded ||
+        m_decodedSource == nullptr ||
+        m_imageInfo.numProfiles > 0 ||
+        m_imageInfo.frameCount > 1 ||
+        m_imageInfo.mipCount > 1)
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    WICPixelFormatGUID fmt = {};
+    HRESULT hr = m_wicCachedSource->GetPixelFormat(&fmt);
+    if (FAILED(hr))
+        return hr;
+
+    return ConvertWicSource(m_decodedSource.Get(), fmt, source);
+}
+
+/// <summary>
+/// Estimates the memory held for the image: the resident WIC source at its cached pixel format,
+/// its mip levels, and those of other subresources kept decoded. Once decoded, Direct2D holds a
+/// copy of about the same size of the current subresource.
+/// </summary>
+size_t ImageLoader::GetResidentBytes()
+{
+    EnforceStates(3, ImageLoaderState::LoadingSucceeded, ImageLoaderState::PreviewReady, ImageLoaderState::NeedDeviceResources);
+
+    size_t bytes = GetSourceBytes(m_wicCachedSource.Get());
+    for (auto& level : m_mipLevels)
+    {
+        bytes += GetSourceBytes(level.Get());
+    }
+
+    for (auto& subresource : m_subresources)
+    {
+        bytes += GetSourceBytes(subresource.wicCachedSource.Get());
+        for (auto& level : subresource.mipLevels)
+        {
+            bytes += GetSourceBytes(level.Get());
+        }
+    }
+
+    return bytes;
+}
+
+size_t ImageLoader::GetSourceBytes(_In_ IWICBitmapSource* source)
+{
+    UINT width = 0, height = 0;
+    IFT(source->GetSize(&width, &height));
+
+    WICPixelFormatGUID format = {};
+    IFT(source->GetPixelFormat(&format));
+
+    UINT bitsPerPixel = 32;
+    if (format != GUID_WICPixelFormat32bppR10G10B10A2HDR10)
+    {
+        ComPtr<IWICComponentInfo> componentInfo;
+        IFT(m_deviceResources->GetWicImagingFactory()->CreateComponentInfo(format, &componentInfo));
+
+        ComPtr<IWICPixelFormatInfo> pixelFormatInfo;
+        IFT(componentInfo.As(&pixelFormatInfo));
+        IFT(pixelFormatInfo->GetBitsPerPixel(&bitsPerPixel));
+    }
+
+    return static_cast<size_t>(width) * height * bitsPerPixel / 8;
+}
+
 /// <summary>
 /// For testing only. Obtains the cached WIC source.
 /// </summary>
@@ -504,6 +1930,7 @@ void ImageLoader::CreateDeviceDependentResources()
     {
     case ImageLoaderState::NotInitialized:
     case ImageLoaderState::LoadingFailed:
+    case ImageLoaderState::LoadingCanceled:
         // No-op if there is nothing to be rendered.
         break;
 
@@ -512,6 +1939,7 @@ void ImageLoader::CreateDeviceDependentResources()
         break;
 
     case ImageLoaderState::LoadingSucceeded:
+    case ImageLoaderState::PreviewReady:
     default:
         IFT(WINCODEC_ERR_WRONGSTATE);
         break;
@@ -532,13 +1960,17 @@ void ImageLoader::ReleaseDeviceDependentResources()
     {
     case ImageLoaderState::NotInitialized:
     case ImageLoaderState::LoadingFailed:
+    case ImageLoaderState::LoadingCanceled:
         // No-op if there is nothing to be rendered.
         break;
 
     case ImageLoaderState::LoadingSucceeded:
+    case ImageLoaderState::PreviewReady:
         m_state = ImageLoaderState::NeedDeviceResources;
 
         m_imageSource.Reset();
+        m_mipImageSources.clear();
+        m_virtualImage.reset();
         m_colorContext.Reset();
         break;
 
@@ -552,173 +1984,16 @@ void ImageLoader::ReleaseDeviceDependentResources()
 /// <summary>
 /// Determines what advanced color kind the image is.
 /// </summary>
-/// <param name="info">Requires that pixel format info be populated.</param>
-/// <param name="source">For some detection types, IWICBitmapFrameDecode is needed. TODO: Not anymore?</param>
-void ImageLoader::PopulateImageInfoACKind(ImageInfo& info, _In_ IWICBitmapSource* source)
+/// <param name="info">Requires that pixel format info and numProfiles be populated.</param>
+void ImageLoader::PopulateImageInfoACKind(ImageInfo& info)
 {
-    UNREFERENCED_PARAMETER(source);
-
     if (info.bitsPerPixel == 0 ||
         info.bitsPerChannel == 0)
     {
         IFRIMG(WINCODEC_ERR_INVALIDPARAMETER);
     }
 
-    info.imageKind = AdvancedColorKind::StandardDynamicRange;
-
-    // Bit depth > 8bpc or color gamut > sRGB signifies a WCG image.
-    // The presence of a color profile is used as an approximation for wide gamut.
-    if (info.bitsPerChannel > 8 || info.numProfiles >= 1)
-    {
-        info.imageKind = AdvancedColorKind::WideColorGamut;
-    }
-
-    // Currently, all supported floating point images are considered HDR.
-    // This includes JPEG XR, OpenEXR, and Radiance RGBE.
-    if (info.isFloat == true)
-    {
-        info.imageKind = AdvancedColorKind::HighDynamicRange;
-    }
-
-    // All images using the HDR10/BT.2100 colorspace are HDR. Currently, WIC color contexts cannot
-    // represent BT.2100, so all supported BT.2100 images have the force flag set.
-    // This includes Xbox One JPEG XR screenshots and HEIF HDR images.
-    if (m_imageInfo.forceBT2100ColorSpace == true)
-    {
-        m_imageInfo.imageKind = AdvancedColorKind::HighDynamicRange;
-    }
-}
-
-/// <summary>
-/// Fills in the bit depth (channel/pixel) and float fields.
-/// </summary>
-void ImageLoader::PopulatePixelFormatInfo(ImageInfo& info, WICPixelFormatGUID format)
-{
-    // This format doesn't support IWICComponentInfo, rely on hardcoded knowledge.
-    if (format == GUID_WICPixelFormat32bppR10G10B10A2HDR10)
-    {
-        info.bitsPerChannel = 10;
-        info.bitsPerPixel = 32;
-        info.isFloat = false;
-    }
-    else
-    {
-        auto wicFactory = m_deviceResources->GetWicImagingFactory();
-        ComPtr<IWICComponentInfo> componentInfo;
-        IFRIMG(wicFactory->CreateComponentInfo(format, &componentInfo));
-
-        ComPtr<IWICPixelFormatInfo2> pixelFormatInfo;
-        IFRIMG(componentInfo.As(&pixelFormatInfo));
-
-        WICPixelFormatNumericRepresentation formatNumber;
-        IFRIMG(pixelFormatInfo->GetNumericRepresentation(&formatNumber));
-
-        IFRIMG(pixelFormatInfo->GetBitsPerPixel(&info.bitsPerPixel));
-
-        // Calculate the bits per channel (bit depth) using GetChannelMask.
-        // This accounts for nonstandard color channel packing and padding, e.g. 32bppRGB,
-        // but assumes each channel has equal bits (e.g. RGB565 doesn't work).
-        unsigned char channelMaskBytes[sc_MaxBytesPerPixel];
-        ZeroMemory(channelMaskBytes, ARRAYSIZE(channelMaskBytes));
-        unsigned int maskSize;
-
-        IFRIMG(pixelFormatInfo->GetChannelMask(
-            0,  // Read the first color channel.
-            ARRAYSIZE(channelMaskBytes),
-            channelMaskBytes,
-            &maskSize));
-
-        // Count up the number of bits set in the mask for the first color channel.
-        for (unsigned int i = 0; i < maskSize * 8; i++)
-        {
-            unsigned int byte = i / 8;
-            unsigned int bit = i % 8;
-            if ((channelMaskBytes[byte] & (1 << bit)) != 0)
-            {
-                info.bitsPerChannel += 1;
-            }
-        }
-
-        info.isFloat = (WICPixelFormatNumericRepresentationFloat == formatNumber) ? true : false;
-    }
-}
-
-/// <summary>
-/// Detects if the image is an Xbox One HDR screenshot.
-/// </summary>
-/// <remarks>
-/// Xbox One HDR screenshots use JPEG XR with 10-bit precision and the HDR10 colorspace, however they are
-/// indistinguishable from SDR/sRGB 10-bit JPEG XRs except for custom XMP metadata embedded in them.
-/// Relies on caller to ensure the container is JPEG XR (IWICBitmapDecoder).
-/// </remarks>
-bool ImageLoader::IsImageXboxHdrScreenshot(IWICBitmapFrameDecode* frame)
-{
-    WICPixelFormatGUID fmt = {};
-    IFT(frame->GetPixelFormat(&fmt));
-    if (fmt != GUID_WICPixelFormat32bppBGR101010)
-    {
-        return false;
-    }
-
-    ComPtr<IWICMetadataQueryReader> metadata;
-    if (FAILED(frame->GetMetadataQueryReader(&metadata)))
-    {
-        // If metadata is not supported, this returns WINCODEC_ERR_UNSUPPORTEDOPERATION.
-        return false;
-    }
-
-    // TODO: RAII wrapper for PROPVARIANT.
-    PROPVARIANT prop;
-    PropVariantInit(&prop);
-    if (FAILED(metadata->GetMetadataByName(L"/ifd/xmp/{wstr=http://ns.microsoft.com/gamedvr/1.0/}:Extended", &prop)))
-    {
-        // If the Xbox-specific metadata is not found, this returns WINCODEC_ERR_PROPERTYNOTFOUND.
-        PropVariantClear(&prop);
-        return false;
-    }
-    else
-    {
-        PropVariantClear(&prop);
-        return true;
-    }
-}
-
-
-/// <summary>
-/// Translates DXGI_FORMAT to the best equivalent WIC pixel format.
-/// </summary>
-/// <remarks>
-/// Returns GUID_WICPixelFormatUndefined if we don't know the right WIC pixel format.
-/// This list is highly incomplete and only covers the most important DXGI_FORMATs for HDR.
-/// </remarks>
-GUID ImageLoader::TranslateDxgiFormatToWic(DXGI_FORMAT fmt)
-{
-    switch (fmt)
-    {
-    case DXGI_FORMAT_R8G8B8A8_SINT:
-    case DXGI_FORMAT_R8G8B8A8_SNORM:
-    case DXGI_FORMAT_R8G8B8A8_TYPELESS:
-    case DXGI_FORMAT_R8G8B8A8_UNORM:
-    case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
-    case DXGI_FORMAT_R8G8B8A8_UINT:
-        return GUID_WICPixelFormat32bppRGBA;
-        break;
-
-    case DXGI_FORMAT_R16G16B16A16_FLOAT:
-        // Used by OpenEXR.
-        return GUID_WICPixelFormat64bppRGBAHalf;
-        break;
-
-    case DXGI_FORMAT_R32G32B32A32_FLOAT:
-        // Used by Radiance RGBE; specifically DirectXTex expands out to FP32
-        // even though WIC offers a native GUID_WICPixelFormat32bppRGBE.
-        return GUID_WICPixelFormat128bppRGBAFloat;
-        break;
-
-    default:
-        return GUID_WICPixelFormatUndefined;
-        break;
-    }
+    ImageProbe::ClassifyAdvancedColorKind(info);
 }
 
 /// <summary>
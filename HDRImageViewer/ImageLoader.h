@@ -10,6 +10,11 @@
 // of device lost/restored events, i.e. it does not
 // independently register for DX::IDeviceNotify.
 //
+// Construct it, and create its device resources, on the thread
+// that owns the Direct2D device context. With
+// ImageLoaderOptions::deferDeviceResources a full load only
+// uses WIC and the CPU decoders, so it may run on any thread.
+//
 // Throws WINCODEC_ERR_[foo] HRESULTs in exceptions as these
 // match well with the intended error states.
 //
@@ -20,42 +25,92 @@
 #include "ImageInfo.h"
 
 #include <cstdarg>
+#include <list>
+
+namespace DirectX
+{
+    class EXRImageReader;
+    struct Image;
+    class ScratchImage;
+    struct TexMetadata;
+}
 
 namespace HDRImageViewer
 {
+    class ColorProfile;
+    struct DecodedImage;
+    class VirtualImage;
+
     /// <summary>
     /// State machine.
     /// </summary>
     /// <remarks>
     /// Valid transitions:
-    /// NotInitialized      --> LoadingSucceeded || LoadingFailed
+    /// NotInitialized      --> PreviewReady || LoadingSucceeded || LoadingFailed || LoadingCanceled || NeedDeviceResources
+    /// PreviewReady        --> LoadingSucceeded || LoadingFailed || LoadingCanceled || NeedDeviceResources
     /// LoadingFailed       --> [N/A]
+    /// LoadingCanceled     --> [N/A]
     /// LoadingSucceeded    --> NeedDeviceResources
-    /// NeedDeviceResources --> LoadingSucceeded
+    /// NeedDeviceResources --> LoadingSucceeded || PreviewReady
     /// </remarks>
     enum ImageLoaderState
     {
         NotInitialized,
         LoadingSucceeded,
         LoadingFailed,
-        NeedDeviceResources // Device resources must be (re)created but otherwise image data is valid.
+        NeedDeviceResources, // Device resources must be (re)created but otherwise image data is valid.
+        PreviewReady,        // A reduced resolution preview can be rendered; the full image is not loaded yet.
+        LoadingCanceled      // The load was canceled through its cancellation_token; no error should be reported.
+    };
+
+    /// <summary>
+    /// Decode settings. The defaults are tuned for interactive viewing.
+    /// </summary>
+    struct ImageLoaderOptions
+    {
+        int         exrThreadCount = -1;     // OpenEXR decompression threads; -1 sizes to the machine, 0 is single threaded.
+        bool        exrPreserveFp32 = false; // Keep FP32 EXR channels at full precision rather than converting to FP16.
+        std::string exrLayer;                // EXR layer ("diffuse") or single channel ("depth.Z") to load; empty for RGBA.
+        bool        nativeDepthCache = true; // Cache integer images at their native bit depth (8 or 10 bpc) rather than 16 bpc.
+        bool        bc6hToHalf = true;       // Decompress BC6H DDS to FP16, which is lossless, rather than DirectXTex's default FP32.
+        UINT        previewMaxDimension = 1024; // Longest side of the progressive loading preview; 0 disables previews.
+        bool        hdr10ToScRgb = true;     // Convert HEIF HDR10 to FP16 scRGB on the CPU rather than leaving PQ decoding to Direct2D.
+        uint64_t    virtualImageMinPixels = 128ull * 1024 * 1024; // Draw images this large, or beyond the GPU bitmap size limit, from tiles; see VirtualImage.
+        size_t      virtualImageTileBudget = 256 * 1024 * 1024;   // Bytes of tiles kept resident for a VirtualImage.
+        bool        mipPyramid = true;       // Build reduced resolution levels at load time for zoomed out rendering; see MipPyramid.
+        bool        fastFormatConversion = true; // Convert to the cached pixel format with FormatConverter where it has a kernel, rather than WIC.
+        UINT        colorManagementLutSize = 0;  // Color manage integer images through a Lut3D baked at this many points per axis (e.g. 33); 0 uses the color management effect.
+        bool        deferDeviceResources = false; // Full loads stop at NeedDeviceResources; call CreateDeviceDependentResources afterwards on the UI thread.
     };
 
     class ImageLoader
     {
     public:
-        ImageLoader(const std::shared_ptr<DX::DeviceResources>& deviceResources);
+        ImageLoader(
+            const std::shared_ptr<DX::DeviceResources>& deviceResources,
+            const ImageLoaderOptions& options = ImageLoaderOptions(),
+            concurrency::cancellation_token cancel = concurrency::cancellation_token::none());
         ~ImageLoader();
 
         ImageLoaderState GetState() const { return m_state; };
 
         ImageInfo LoadImageFromWic(_In_ IStream* imageStream);
         ImageInfo LoadImageFromDirectXTex(_In_ Platform::String^ filename, _In_ Platform::String^ extension);
+        ImageInfo LoadImageFromDirectXTex(_In_ HANDLE file, _In_ Platform::String^ extension);
+        ImageInfo LoadImageFromDirectXTex(_In_ IStream* imageStream, _In_ Platform::String^ extension);
+        ImageInfo LoadImageFromDecoded(const DecodedImage& image);
+        ImageInfo LoadPreviewFromWic(_In_ IStream* imageStream);
+        ImageInfo LoadPreviewFromDirectXTex(_In_ IStream* imageStream, _In_ Platform::String^ extension);
+        ImageInfo SelectSubresource(unsigned int frame, unsigned int mip);
 
-        ID2D1TransformedImageSource* GetLoadedImage(float zoom);
+        ID2D1Image* GetLoadedImage(float zoom, _In_opt_ const D2D1_RECT_F* visibleRect = nullptr);
         ID2D1ColorContext* GetImageColorContext();
         ImageInfo GetImageInfo();
         IWICBitmapSource* GetWicSourceTest();
+        size_t GetResidentBytes();
+        void EnsureDecoded();
+        HRESULT CreatePersistableSource(_COM_Outptr_ IWICBitmapSource** source);
+        bool TakeRefinement(_Out_ concurrency::task<void>* refinement);
 
         void CreateDeviceDependentResources();
         void ReleaseDeviceDependentResources();
@@ -84,6 +139,11 @@ namespace HDRImageViewer
                 throw ref new Platform::COMException(WINCODEC_ERR_BADIMAGE);
             }
 
+            if (m_state == ImageLoaderState::LoadingCanceled)
+            {
+                throw ref new Platform::COMException(E_ABORT);
+            }
+
             throw ref new Platform::COMException(WINCODEC_ERR_WRONGSTATE);
         }
 
@@ -93,33 +153,113 @@ namespace HDRImageViewer
         /// </summary>
 #define IFRIMG(hr) if (FAILED(hr)) { \
                 m_imageInfo.isValid = false; \
-                m_state = ImageLoaderState::LoadingFailed; \
+                m_state = m_cancel.is_canceled() ? ImageLoaderState::LoadingCanceled : ImageLoaderState::LoadingFailed; \
                 return; }
 
+        /// <summary>
+        /// Returns E_ABORT once the load has been canceled. Long running decode loops check this between
+        /// strips or tiles; load routines check it between stages with IFRIMG(CheckCanceled()).
+        /// </summary>
+        inline HRESULT CheckCanceled() const
+        {
+            return m_cancel.is_canceled() ? E_ABORT : S_OK;
+        }
+
+        struct Subresource
+        {
+            unsigned int                                            frame;
+            unsigned int                                            mip;
+            ImageInfo                                               info;
+            Microsoft::WRL::ComPtr<IWICBitmapSource>                wicCachedSource;
+            Microsoft::WRL::ComPtr<IWICColorContext>                wicColorContext;
+            std::shared_ptr<ColorProfile>                           colorProfile;
+            std::vector<Microsoft::WRL::ComPtr<IWICBitmapSource>>   mipLevels;
+            Windows::Foundation::Size                               residentSize;
+            bool                                                    isHdr10Linear;
+        };
+
         void LoadImageFromWicInt(_In_ IStream* imageStream);
-        void LoadImageFromDirectXTexInt(_In_ Platform::String^ filename, _In_ Platform::String^ extension);
-        void LoadImageCommon(_In_ IWICBitmapSource* source);
+        void LoadWicFrame(_In_ IWICBitmapDecoder* decoder, unsigned int index);
+        void LoadImageFromDirectXTexInt(_In_opt_ HANDLE file, _In_opt_ IStream* imageStream, _In_ Platform::String^ extension);
+        void LoadImageFromExrInt(_In_opt_ HANDLE file, _In_opt_ IStream* imageStream, unsigned int part = 0);
+        void LoadDdsImage(const DirectX::ScratchImage& ddsImage, unsigned int frame, unsigned int mip);
+        void SelectSubresourceInt(unsigned int frame, unsigned int mip);
+        void StoreSubresource();
+        bool RestoreSubresource(unsigned int frame, unsigned int mip);
+        void LoadImageFromDecodedInt(const DecodedImage& image);
+        void LoadPreviewFromWicInt(_In_ IStream* imageStream);
+        void LoadPreviewFromDirectXTexInt(_In_ IStream* imageStream, _In_ Platform::String^ extension);
+        HRESULT CreateWicPreview(_In_ IWICBitmapFrameDecode* frame, _COM_Outptr_result_maybenull_ IWICBitmap** preview);
+        HRESULT OpenExrReader(
+            _In_ DirectX::EXRImageReader* reader,
+            _In_opt_ HANDLE file,
+            _In_opt_ IStream* imageStream,
+            size_t part,
+            _Out_ DirectX::TexMetadata* metadata);
+        void LoadImageFromRgbeInt(_In_opt_ HANDLE file, _In_opt_ IStream* imageStream);
+        HRESULT DecompressToWicBitmap(const DirectX::Image& image, _COM_Outptr_ IWICBitmap** bitmap);
+        HRESULT DecodeExrLevel(_In_ DirectX::EXRImageReader* reader, size_t level, _COM_Outptr_ IWICBitmap** bitmap);
+        static HRESULT DecodeExrLevel(
+            _In_ IWICImagingFactory* fact,
+            _In_ DirectX::EXRImageReader* reader,
+            size_t level,
+            int threadCount,
+            const concurrency::cancellation_token& cancel,
+            _COM_Outptr_ IWICBitmap** bitmap);
+        void CancelExrLevelDecode();
+        void UpdateExrResidentLevel(float zoom);
+        void LoadImageCommon(_In_ IWICBitmapSource* source, _In_opt_ IWICBitmapSource* preview = nullptr);
+        HRESULT CreateCachedWicSource(_In_ IWICBitmapSource* source, _COM_Outptr_ IWICBitmapSource** cachedSource);
+        HRESULT ConvertWicSource(_In_ IWICBitmapSource* source, WICPixelFormatGUID fmt, _COM_Outptr_ IWICBitmapSource** converted);
         void CreateDeviceDependentResourcesInternal();
+        bool UseVirtualImage();
+        HRESULT CreateMipPyramid();
+        size_t GetSourceBytes(_In_ IWICBitmapSource* source);
 
-        void PopulateImageInfoACKind(ImageInfo& info, _In_ IWICBitmapSource* source);
-        void PopulatePixelFormatInfo(ImageInfo& info, WICPixelFormatGUID format);
-        bool IsImageXboxHdrScreenshot(_In_ IWICBitmapFrameDecode * frame);
-        GUID TranslateDxgiFormatToWic(DXGI_FORMAT fmt);
+        void PopulateImageInfoACKind(ImageInfo& info);
         bool CheckCanDecode(_In_ IWICBitmapFrameDecode* frame);
-        void CreateHeifHdr10CpuResources(_In_ IWICBitmapSource* source);
+        HRESULT CreateHeifHdr10CpuResources(_In_ IWICBitmapSource* source);
         void CreateHeifHdr10GpuResources();
 
         std::shared_ptr<DX::DeviceResources>                    m_deviceResources;
+        ImageLoaderOptions                                      m_options;
+        concurrency::cancellation_token                         m_cancel;
+        UINT32                                                  m_maxBitmapSize;    // Queried up front, as loads may run off the UI thread.
 
         // Device-independent
         Microsoft::WRL::ComPtr<IWICBitmapSource>                m_wicCachedSource;
         Microsoft::WRL::ComPtr<IWICColorContext>                m_wicColorContext;
+        std::shared_ptr<ColorProfile>                           m_colorProfile;     // The embedded ICC profile, shared through ColorProfileCache.
+        Microsoft::WRL::ComPtr<IWICBitmapSource>                m_decodedSource;    // In-memory decode m_wicCachedSource converts from, if it can be persisted.
+        std::vector<Microsoft::WRL::ComPtr<IWICBitmapSource>>   m_mipLevels;        // Levels 1 and up of m_wicCachedSource; see MipPyramid.
 
         ImageLoaderState                                        m_state;
         ImageInfo                                               m_imageInfo;
+        bool                                                    m_isPreview;        // m_wicCachedSource is a reduced resolution preview.
+        bool                                                    m_isHdr10Linear;    // HDR10 image converted to scRGB; see Hdr10Converter.
+
+        // Multi-resolution EXR images keep their reader open so finer levels can be decoded on demand.
+        // Finer levels are decoded on the thread pool, which shares the reader until the decode ends.
+        std::shared_ptr<DirectX::EXRImageReader>                m_exrReader;
+        size_t                                                  m_exrResidentLevel;
+        concurrency::task<Microsoft::WRL::ComPtr<IWICBitmap>>   m_exrLevelDecode;   // Only valid while m_isExrLevelPending.
+        concurrency::cancellation_token_source                  m_exrLevelCancel;
+        size_t                                                  m_exrPendingLevel;
+        bool                                                    m_isExrLevelPending;
+        bool                                                    m_isExrLevelTaken;  // Returned by TakeRefinement.
+        Windows::Foundation::Size                               m_residentSize;     // Size of m_wicCachedSource.
+
+        // Containers with more than one subresource stay open so the others can be decoded when selected.
+        Microsoft::WRL::ComPtr<IWICBitmapDecoder>               m_wicDecoder;
+        std::unique_ptr<DirectX::ScratchImage>                  m_ddsImage;         // Still block compressed, if it was in the file.
+        Microsoft::WRL::Wrappers::FileHandle                    m_exrFile;
+        Microsoft::WRL::ComPtr<IStream>                         m_exrStream;
+        std::list<Subresource>                                  m_subresources;     // Previously selected, most recent first.
 
         // Device-dependent. Everything here needs to be reset in ReleaseDeviceDependentResources.
         Microsoft::WRL::ComPtr<ID2D1ImageSource>                m_imageSource;
+        std::unique_ptr<VirtualImage>                           m_virtualImage;     // Used instead of m_imageSource for very large images.
+        std::vector<Microsoft::WRL::ComPtr<ID2D1ImageSource>>   m_mipImageSources;  // One per m_mipLevels entry.
         Microsoft::WRL::ComPtr<ID2D1ColorContext>               m_colorContext;
     };
 }
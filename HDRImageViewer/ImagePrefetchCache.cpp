@@ -0,0 +1,128 @@
+#include "pch.h"
+#include "ImagePrefetchCache.h"
+
+using namespace HDRImageViewer;
+
+ImagePrefetchCache::ImagePrefetchCache(size_t byteBudget) :
+    m_byteBudget(byteBudget),
+    m_residentBytes(0),
+    m_position(0),
+    m_useCounter(0),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0)
+{
+}
+
+std::shared_ptr<ImageLoader> ImagePrefetchCache::Lookup(const std::wstring& key)
+{
+    for (auto& entry : m_entries)
+    {
+        if (entry.key == key)
+        {
+            m_hits++;
+            entry.lastUse = ++m_useCounter;
+            return entry.loader;
+        }
+    }
+
+    m_misses++;
+    return nullptr;
+}
+
+bool ImagePrefetchCache::Contains(const std::wstring& key) const
+{
+    for (const auto& entry : m_entries)
+    {
+        if (entry.key == key)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ImagePrefetchCache::Insert(const std::wstring& key, int position, const std::shared_ptr<ImageLoader>& loader, size_t bytes)
+{
+    for (size_t i = 0; i < m_entries.size(); i++)
+    {
+        if (m_entries[i].key == key)
+        {
+            // Replacing an entry is not an eviction.
+            m_residentBytes -= m_entries[i].bytes;
+            m_entries.erase(m_entries.begin() + i);
+            break;
+        }
+    }
+
+    m_entries.push_back({ key, position, loader, bytes, ++m_useCounter });
+    m_residentBytes += bytes;
+
+    TrimToBudget();
+}
+
+void ImagePrefetchCache::SetWindow(int position, int radius)
+{
+    m_position = position;
+
+    for (size_t i = m_entries.size(); i-- > 0; )
+    {
+        if (abs(m_entries[i].position - position) > radius)
+        {
+            Evict(i);
+        }
+    }
+
+    TrimToBudget();
+}
+
+void ImagePrefetchCache::SetByteBudget(size_t byteBudget)
+{
+    m_byteBudget = byteBudget;
+    TrimToBudget();
+}
+
+void ImagePrefetchCache::Clear()
+{
+    m_evictions += m_entries.size();
+    m_entries.clear();
+    m_residentBytes = 0;
+}
+
+ImagePrefetchStats ImagePrefetchCache::GetStats() const
+{
+    return { m_hits, m_misses, m_evictions, m_residentBytes, m_entries.size() };
+}
+
+void ImagePrefetchCache::Evict(size_t index)
+{
+    m_residentBytes -= m_entries[index].bytes;
+    m_entries.erase(m_entries.begin() + index);
+    m_evictions++;
+}
+
+/// <summary>
+/// Evicts the entry furthest from the current position, and the least recently used of those,
+/// until the resident size fits the budget.
+/// </summary>
+void ImagePrefetchCache::TrimToBudget()
+{
+    while (m_residentBytes > m_byteBudget && !m_entries.empty())
+    {
+        size_t victim = 0;
+        for (size_t i = 1; i < m_entries.size(); i++)
+        {
+            int distance = abs(m_entries[i].position - m_position);
+            int victimDistance = abs(m_entries[victim].position - m_position);
+
+            if (distance > victimDistance ||
+                (distance == victimDistance && m_entries[i].lastUse < m_entries[victim].lastUse))
+            {
+                victim = i;
+            }
+        }
+
+        Evict(victim);
+    }
+}
@@ -0,0 +1,95 @@
+//*********************************************************
+//
+// ImagePrefetchCache
+//
+// Holds fully loaded ImageLoader instances for the images
+// around the current one in a folder, so stepping to a
+// neighbour does not need to decode it again.
+//
+// Entries are identified by a key (the file path) and by
+// their position in the folder. When the resident size
+// exceeds the byte budget, the entries furthest from the
+// current position are evicted first, least recently used
+// among equally distant entries.
+//
+// Like ImageLoader itself, the cache is not thread safe and
+// must only be used from the thread that owns the Direct2D
+// device context.
+//
+//*********************************************************
+
+#pragma once
+
+#include "ImageLoader.h"
+
+#include <vector>
+
+namespace HDRImageViewer
+{
+    /// <summary>
+    /// Counters for tuning the prefetch window and budget.
+    /// </summary>
+    struct ImagePrefetchStats
+    {
+        uint64_t    hits;
+        uint64_t    misses;
+        uint64_t    evictions;
+        size_t      residentBytes;
+        size_t      entryCount;
+    };
+
+    class ImagePrefetchCache
+    {
+    public:
+        explicit ImagePrefetchCache(size_t byteBudget);
+
+        /// <summary>
+        /// Returns the loader cached for key, or nullptr. Counts a hit or a miss.
+        /// </summary>
+        std::shared_ptr<ImageLoader> Lookup(const std::wstring& key);
+
+        /// <summary>
+        /// True if key is resident; does not affect the counters or the LRU order.
+        /// </summary>
+        bool Contains(const std::wstring& key) const;
+
+        /// <summary>
+        /// Adds or replaces an entry. bytes is the caller's estimate of the loader's resident size.
+        /// The entry may be evicted immediately if it alone exceeds the budget.
+        /// </summary>
+        void Insert(const std::wstring& key, int position, const std::shared_ptr<ImageLoader>& loader, size_t bytes);
+
+        /// <summary>
+        /// Moves the window of interest: entries more than radius positions away from position
+        /// are evicted, and the remainder is trimmed to the budget by distance from position.
+        /// </summary>
+        void SetWindow(int position, int radius);
+
+        void SetByteBudget(size_t byteBudget);
+        void Clear();
+
+        ImagePrefetchStats GetStats() const;
+
+    private:
+        struct Entry
+        {
+            std::wstring                    key;
+            int                             position;
+            std::shared_ptr<ImageLoader>    loader;
+            size_t                          bytes;
+            uint64_t                        lastUse;
+        };
+
+        void Evict(size_t index);
+        void TrimToBudget();
+
+        std::vector<Entry>  m_entries; // The window is a handful of images, so a linear search is cheapest.
+        size_t              m_byteBudget;
+        size_t              m_residentBytes;
+        int                 m_position;
+        uint64_t            m_useCounter;
+        uint64_t            m_hits;
+        uint64_t            m_misses;
+        uint64_t            m_evictions;
+    };
+}
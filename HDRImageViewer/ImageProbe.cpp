@@ -0,0 +1,620 @@
+#include "pch.h"
+#include "ImageProbe.h"
+#include "DirectXHelper.h"
+#include "DirectXTex.h"
+#include "DirectXTex\DirectXTexEXR.h"
+#include "RgbeCodec.h"
+
+#include <iomanip>
+#include <thread>
+
+using namespace HDRImageViewer;
+
+using namespace concurrency;
+using namespace DirectX;
+using namespace Microsoft::WRL;
+using namespace Platform;
+using namespace Windows::Foundation::Collections;
+using namespace Windows::Graphics::Display;
+using namespace Windows::Storage;
+using namespace Windows::Storage::Streams;
+
+static const unsigned int sc_MaxBytesPerPixel = 16; // Covers all supported image formats (128bpp).
+static const size_t sc_DdsHeaderBytes = 148; // Magic, DDS_HEADER and DDS_HEADER_DXT10.
+static const size_t sc_RgbeHeaderMaxBytes = 64 * 1024; // Radiance headers are a few lines of text.
+static const unsigned int sc_ProbeFilesPerCore = 4; // Files opened at once per core by ProbeFilesAsync.
+
+namespace
+{
+    /// <summary>
+    /// Reads up to size bytes from the current position of a stream.
+    /// </summary>
+    HRESULT ReadStreamPrefix(_In_ IStream* stream, size_t size, _Out_ std::vector<uint8_t>& data)
+    {
+        data.resize(size);
+
+        ULONG bytesRead = 0;
+        HRESULT hr = stream->Read(data.data(), static_cast<ULONG>(size), &bytesRead);
+        if (FAILED(hr))
+            return hr;
+
+        data.resize(bytesRead);
+        return S_OK;
+    }
+
+    /// <summary>
+    /// The format DirectX::Decompress produces for a block compressed format when ImageLoader
+    /// lets it choose; see ImageLoader::DecompressToWicBitmap.
+    /// </summary>
+    DXGI_FORMAT GetDecompressedFormat(DXGI_FORMAT fmt, const ImageLoaderOptions& options)
+    {
+        switch (fmt)
+        {
+        case DXGI_FORMAT_BC1_UNORM:
+        case DXGI_FORMAT_BC2_UNORM:
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC7_UNORM:
+            return DXGI_FORMAT_R8G8B8A8_UNORM;
+
+        case DXGI_FORMAT_BC1_UNORM_SRGB:
+        case DXGI_FORMAT_BC2_UNORM_SRGB:
+        case DXGI_FORMAT_BC3_UNORM_SRGB:
+        case DXGI_FORMAT_BC7_UNORM_SRGB:
+            return DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+
+        case DXGI_FORMAT_BC4_UNORM:
+            return DXGI_FORMAT_R8_UNORM;
+
+        case DXGI_FORMAT_BC4_SNORM:
+            return DXGI_FORMAT_R8_SNORM;
+
+        case DXGI_FORMAT_BC5_UNORM:
+            return DXGI_FORMAT_R8G8_UNORM;
+
+        case DXGI_FORMAT_BC5_SNORM:
+            return DXGI_FORMAT_R8G8_SNORM;
+
+        case DXGI_FORMAT_BC6H_UF16:
+        case DXGI_FORMAT_BC6H_SF16:
+            return options.bc6hToHalf ? DXGI_FORMAT_R16G16B16A16_FLOAT : DXGI_FORMAT_R32G32B32A32_FLOAT;
+
+        default:
+            return DXGI_FORMAT_UNKNOWN;
+        }
+    }
+}
+
+HRESULT ImageProbe::ProbeStream(
+    _In_ IWICImagingFactory* wicFactory,
+    _In_ IStream* imageStream,
+    _In_ String^ extension,
+    const ImageLoaderOptions& options,
+    _Out_ ImageInfo& info)
+{
+    info = {};
+
+    HRESULT hr = S_OK;
+    if (extension == L".EXR" || extension == L".exr")
+    {
+        hr = ProbeExr(wicFactory, imageStream, options, info);
+    }
+    else if (extension == L".HDR" || extension == L".hdr")
+    {
+        hr = ProbeRgbe(imageStream, info);
+    }
+    else if (extension == L".DDS" || extension == L".dds")
+    {
+        hr = ProbeDds(wicFactory, imageStream, options, info);
+    }
+    else
+    {
+        hr = ProbeWic(wicFactory, imageStream, info);
+    }
+
+    if (FAILED(hr))
+    {
+        info = {};
+        return hr;
+    }
+
+    ClassifyAdvancedColorKind(info);
+    info.isValid = true;
+
+    return S_OK;
+}
+
+/// <summary>
+/// Mirrors ImageLoader::LoadImageFromWicInt up to the point where pixels are decoded. Unlike a
+/// full load, this does not verify that the codec for HEIF images is installed.
+/// </summary>
+HRESULT ImageProbe::ProbeWic(_In_ IWICImagingFactory* wicFactory, _In_ IStream* imageStream, _Out_ ImageInfo& info)
+{
+    ComPtr<IWICBitmapDecoder> decoder;
+    HRESULT hr = wicFactory->CreateDecoderFromStream(imageStream, nullptr, WICDecodeMetadataCacheOnDemand, &decoder);
+    if (FAILED(hr))
+        return hr;
+
+    UINT frameCount = 0;
+    hr = decoder->GetFrameCount(&frameCount);
+    if (FAILED(hr))
+        return hr;
+
+    ComPtr<IWICBitmapFrameDecode> frame;
+    hr = decoder->GetFrame(0, &frame);
+    if (FAILED(hr))
+        return hr;
+
+    GUID containerFmt = {};
+    hr = decoder->GetContainerFormat(&containerFmt);
+    if (FAILED(hr))
+        return hr;
+
+    WICPixelFormatGUID pixelFmt = {};
+    hr = frame->GetPixelFormat(&pixelFmt);
+    if (FAILED(hr))
+        return hr;
+
+    if (containerFmt == GUID_ContainerFormatHeif)
+    {
+        info.isHeif = true;
+
+        ComPtr<IWICBitmapSourceTransform> sourceTransform;
+        hr = frame.As(&sourceTransform);
+        if (FAILED(hr))
+            return hr;
+
+        GUID checkHDR10Fmt = GUID_WICPixelFormat32bppR10G10B10A2HDR10;
+        hr = sourceTransform->GetClosestPixelFormat(&checkHDR10Fmt);
+        if (FAILED(hr))
+            return hr;
+
+        if (checkHDR10Fmt == GUID_WICPixelFormat32bppR10G10B10A2HDR10)
+        {
+            // ImageLoader decodes these at 10 bpc rather than the reported format.
+            info.forceBT2100ColorSpace = true;
+            pixelFmt = GUID_WICPixelFormat32bppR10G10B10A2HDR10;
+        }
+    }
+    else if (containerFmt == GUID_ContainerFormatWmp)
+    {
+        info.forceBT2100ColorSpace = IsXboxHdrScreenshot(frame.Get());
+    }
+
+    hr = GetPixelFormatInfo(wicFactory, pixelFmt, info);
+    if (FAILED(hr))
+        return hr;
+
+    UINT width = 0, height = 0;
+    hr = frame->GetSize(&width, &height);
+    if (FAILED(hr))
+        return hr;
+
+    info.size = Windows::Foundation::Size(static_cast<float>(width), static_cast<float>(height));
+    info.frameCount = frameCount;
+    info.mipCount = 1;
+
+    if (!info.forceBT2100ColorSpace)
+    {
+        // Only counts the color contexts; none are read.
+        hr = frame->GetColorContexts(0, nullptr, &info.numProfiles);
+        if (FAILED(hr))
+            return hr;
+    }
+
+    return S_OK;
+}
+
+HRESULT ImageProbe::ProbeDds(
+    _In_ IWICImagingFactory* wicFactory,
+    _In_ IStream* imageStream,
+    const ImageLoaderOptions& options,
+    _Out_ ImageInfo& info)
+{
+    std::vector<uint8_t> header;
+    HRESULT hr = ReadStreamPrefix(imageStream, sc_DdsHeaderBytes, header);
+    if (FAILED(hr))
+        return hr;
+
+    TexMetadata metadata = {};
+    hr = GetMetadataFromDDSMemory(header.data(), header.size(), DDS_FLAGS_NONE, metadata);
+    if (FAILED(hr))
+        return hr;
+
+    DXGI_FORMAT fmt = metadata.format;
+    if (DirectX::IsCompressed(fmt))
+    {
+        fmt = GetDecompressedFormat(fmt, options);
+    }
+
+    GUID wicFmt = TranslateDxgiFormatToWic(fmt);
+    if (wicFmt == GUID_WICPixelFormatUndefined)
+        return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+
+    hr = GetPixelFormatInfo(wicFactory, wicFmt, info);
+    if (FAILED(hr))
+        return hr;
+
+    info.size = Windows::Foundation::Size(static_cast<float>(metadata.width), static_cast<float>(metadata.height));
+
+    // As counted by ImageLoader::LoadImageFromDirectXTexInt: volume slices or array slices.
+    info.frameCount = static_cast<UINT>(metadata.IsVolumemap() ? metadata.depth : metadata.arraySize);
+    info.mipCount = static_cast<UINT>(metadata.mipLevels);
+    return S_OK;
+}
+
+HRESULT ImageProbe::ProbeRgbe(_In_ IStream* imageStream, _Out_ ImageInfo& info)
+{
+    std::vector<uint8_t> header;
+    HRESULT hr = ReadStreamPrefix(imageStream, sc_RgbeHeaderMaxBytes, header);
+    if (FAILED(hr))
+        return hr;
+
+    UINT width = 0, height = 0;
+    size_t headerSize = 0;
+    hr = RgbeCodec::ParseHeader(header.data(), header.size(), &width, &height, &headerSize);
+    if (FAILED(hr))
+        return hr;
+
+    // As reported by ImageLoader::LoadImageFromRgbeInt. Radiance files hold a single image.
+    info.bitsPerPixel = 32;
+    info.bitsPerChannel = 16;
+    info.isFloat = true;
+    info.frameCount = 1;
+    info.mipCount = 1;
+    info.size = Windows::Foundation::Size(static_cast<float>(width), static_cast<float>(height));
+    return S_OK;
+}
+
+HRESULT ImageProbe::ProbeExr(
+    _In_ IWICImagingFactory* wicFactory,
+    _In_ IStream* imageStream,
+    const ImageLoaderOptions& options,
+    _Out_ ImageInfo& info)
+{
+    auto flags = options.exrPreserveFp32 ? EXR_FLAGS_PRESERVE_FP32 : EXR_FLAGS_NONE;
+    auto layer = options.exrLayer.empty() ? nullptr : options.exrLayer.c_str();
+
+    // Opening only reads the header; no scanlines are decoded.
+    EXRImageReader reader;
+    TexMetadata metadata = {};
+    HRESULT hr = reader.Open(imageStream, &metadata, 0, flags, layer);
+    if (FAILED(hr))
+        return hr;
+
+    UINT partCount = static_cast<UINT>(reader.GetPartCount());
+    reader.Close();
+
+    GUID wicFmt = TranslateDxgiFormatToWic(metadata.format);
+    if (wicFmt == GUID_WICPixelFormatUndefined)
+        return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+
+    hr = GetPixelFormatInfo(wicFactory, wicFmt, info);
+    if (FAILED(hr))
+        return hr;
+
+    info.size = Windows::Foundation::Size(static_cast<float>(metadata.width), static_cast<float>(metadata.height));
+
+    // Parts are frames; the levels of a multi-resolution part are not subresources.
+    info.frameCount = partCount;
+    info.mipCount = 1;
+    return S_OK;
+}
+
+/// <summary>
+/// Opens a bounded number of files at a time; each one is probed on the thread pool as soon
+/// as it is open. Files which fail to open or probe are reported with their error.
+/// </summary>
+task<std::vector<std::wstring>> ImageProbe::ProbeFilesAsync(
+    const std::vector<StorageFile^>& files,
+    const ImageLoaderOptions& options)
+{
+    auto inputs = files;
+
+    return create_task([inputs, options]() {
+        ComPtr<IWICImagingFactory> wicFactory;
+        DX::ThrowIfFailed(
+            CoCreateInstance(
+                CLSID_WICImagingFactory2,
+                nullptr,
+                CLSCTX_INPROC_SERVER,
+                IID_PPV_ARGS(&wicFactory)));
+
+        auto results = std::make_shared<std::vector<std::wstring>>(inputs.size());
+        size_t batchSize = (std::max)(1u, std::thread::hardware_concurrency()) * sc_ProbeFilesPerCore;
+
+        for (size_t first = 0; first < inputs.size(); first += batchSize)
+        {
+            std::vector<task<void>> probes;
+            for (size_t i = first; i < (std::min)(first + batchSize, inputs.size()); i++)
+            {
+                auto file = inputs[i];
+                probes.push_back(create_task(file->OpenReadAsync()).then(
+                    [wicFactory, file, i, options, results](task<IRandomAccessStreamWithContentType^> openTask)
+                {
+                    ImageInfo info = {};
+                    HRESULT hr = S_OK;
+                    try
+                    {
+                        ComPtr<IStream> stream;
+                        DX::ThrowIfFailed(CreateStreamOverRandomAccessStream(openTask.get(), IID_PPV_ARGS(&stream)));
+
+                        hr = ProbeStream(wicFactory.Get(), stream.Get(), file->FileType, options, info);
+                    }
+                    catch (Exception^ e)
+                    {
+                        hr = e->HResult;
+                    }
+
+                    (*results)[i] = FormatJson(file->Path, hr, info);
+                }, task_continuation_context::use_arbitrary()));
+            }
+
+            when_all(probes.begin(), probes.end()).wait();
+        }
+
+        return std::move(*results);
+    });
+}
+
+/// <summary>
+/// Formats one line of the batch probe output, e.g.
+/// {"file":"C:\\images\\a.exr","width":1920,"height":1080,"bitsPerChannel":16,"bitsPerPixel":64,
+///  "isFloat":true,"profiles":0,"kind":"HDR","bt2100":false,"heif":false,"frames":1,"mips":1}
+/// or {"file":"...","error":"0x88982f50"} on failure.
+/// </summary>
+std::wstring ImageProbe::FormatJson(_In_ String^ path, HRESULT hr, const ImageInfo& info)
+{
+    std::wstringstream json;
+    json << L"{\"file\":\"";
+
+    for (auto c = path->Begin(); c != path->End(); c++)
+    {
+        switch (*c)
+        {
+        case L'"':  json << L"\\\""; break;
+        case L'\\': json << L"\\\\"; break;
+        case L'\n': json << L"\\n"; break;
+        case L'\r': json << L"\\r"; break;
+        case L'\t': json << L"\\t"; break;
+        default:
+            if (*c < 0x20)
+            {
+                json << L"\\u" << std::hex << std::setw(4) << std::setfill(L'0') << static_cast<unsigned int>(*c) << std::dec;
+            }
+            else
+            {
+                json << *c;
+            }
+            break;
+        }
+    }
+
+    json << L"\"";
+
+    if (FAILED(hr))
+    {
+        json << L",\"error\":\"0x" << std::hex << std::setw(8) << std::setfill(L'0') << static_cast<uint32_t>(hr) << L"\"}";
+        return json.str();
+    }
+
+    const wchar_t* kind = L"SDR";
+    if (info.imageKind == AdvancedColorKind::HighDynamicRange)
+    {
+        kind = L"HDR";
+    }
+    else if (info.imageKind == AdvancedColorKind::WideColorGamut)
+    {
+        kind = L"WCG";
+    }
+
+    json
+        << L",\"width\":" << static_cast<unsigned int>(info.size.Width)
+        << L",\"height\":" << static_cast<unsigned int>(info.size.Height)
+        << L",\"bitsPerChannel\":" << info.bitsPerChannel
+        << L",\"bitsPerPixel\":" << info.bitsPerPixel
+        << L",\"isFloat\":" << (info.isFloat ? L"true" : L"false")
+        << L",\"profiles\":" << info.numProfiles
+        << L",\"kind\":\"" << kind << L"\""
+        << L",\"bt2100\":" << (info.forceBT2100ColorSpace ? L"true" : L"false")
+        << L",\"heif\":" << (info.isHeif ? L"true" : L"false")
+        << L",\"frames\":" << info.frameCount
+        << L",\"mips\":" << info.mipCount
+        << L"}";
+
+    return json.str();
+}
+
+void ImageProbe::AppendSupportedFileTypes(_In_ IVector<String^>^ fileTypes)
+{
+    fileTypes->Append(L".jxr");
+    fileTypes->Append(L".jpg");
+    fileTypes->Append(L".png");
+    fileTypes->Append(L".tif");
+    fileTypes->Append(L".hdr");
+    fileTypes->Append(L".exr");
+    fileTypes->Append(L".dds");
+
+    if (DX::CheckPlatformSupport(DX::OSVer::Win1903))
+    {
+        fileTypes->Append(L".heic");
+        fileTypes->Append(L".avif");
+    }
+}
+
+HRESULT ImageProbe::GetPixelFormatInfo(_In_ IWICImagingFactory* wicFactory, WICPixelFormatGUID format, _Inout_ ImageInfo& info)
+{
+    // This format doesn't support IWICComponentInfo, rely on hardcoded knowledge.
+    if (format == GUID_WICPixelFormat32bppR10G10B10A2HDR10)
+    {
+        info.bitsPerChannel = 10;
+        info.bitsPerPixel = 32;
+        info.isFloat = false;
+        return S_OK;
+    }
+
+    ComPtr<IWICComponentInfo> componentInfo;
+    HRESULT hr = wicFactory->CreateComponentInfo(format, &componentInfo);
+    if (FAILED(hr))
+        return hr;
+
+    ComPtr<IWICPixelFormatInfo2> pixelFormatInfo;
+    hr = componentInfo.As(&pixelFormatInfo);
+    if (FAILED(hr))
+        return hr;
+
+    WICPixelFormatNumericRepresentation formatNumber;
+    hr = pixelFormatInfo->GetNumericRepresentation(&formatNumber);
+    if (FAILED(hr))
+        return hr;
+
+    hr = pixelFormatInfo->GetBitsPerPixel(&info.bitsPerPixel);
+    if (FAILED(hr))
+        return hr;
+
+    // Calculate the bits per channel (bit depth) using GetChannelMask.
+    // This accounts for nonstandard color channel packing and padding, e.g. 32bppRGB,
+    // but assumes each channel has equal bits (e.g. RGB565 doesn't work).
+    unsigned char channelMaskBytes[sc_MaxBytesPerPixel];
+    ZeroMemory(channelMaskBytes, ARRAYSIZE(channelMaskBytes));
+    unsigned int maskSize;
+
+    hr = pixelFormatInfo->GetChannelMask(
+        0,  // Read the first color channel.
+        ARRAYSIZE(channelMaskBytes),
+        channelMaskBytes,
+        &maskSize);
+    if (FAILED(hr))
+        return hr;
+
+    // Count up the number of bits set in the mask for the first color channel.
+    info.bitsPerChannel = 0;
+    for (unsigned int i = 0; i < maskSize * 8; i++)
+    {
+        unsigned int byte = i / 8;
+        unsigned int bit = i % 8;
+        if ((channelMaskBytes[byte] & (1 << bit)) != 0)
+        {
+            info.bitsPerChannel += 1;
+        }
+    }
+
+    info.isFloat = (WICPixelFormatNumericRepresentationFloat == formatNumber) ? true : false;
+    return S_OK;
+}
+
+void ImageProbe::ClassifyAdvancedColorKind(_Inout_ ImageInfo& info)
+{
+    info.imageKind = AdvancedColorKind::StandardDynamicRange;
+
+    // Bit depth > 8bpc or color gamut > sRGB signifies a WCG image.
+    // The presence of a color profile is used as an approximation for wide gamut.
+    if (info.bitsPerChannel > 8 || info.numProfiles >= 1)
+    {
+        info.imageKind = AdvancedColorKind::WideColorGamut;
+    }
+
+    // Currently, all supported floating point images are considered HDR.
+    // This includes JPEG XR, OpenEXR, and Radiance RGBE.
+    if (info.isFloat == true)
+    {
+        info.imageKind = AdvancedColorKind::HighDynamicRange;
+    }
+
+    // All images using the HDR10/BT.2100 colorspace are HDR. Currently, WIC color contexts cannot
+    // represent BT.2100, so all supported BT.2100 images have the force flag set.
+    // This includes Xbox One JPEG XR screenshots and HEIF HDR images.
+    if (info.forceBT2100ColorSpace == true)
+    {
+        info.imageKind = AdvancedColorKind::HighDynamicRange;
+    }
+}
+
+/// <summary>
+/// Detects if the image is an Xbox One HDR screenshot.
+/// </summary>
+/// <remarks>
+/// Xbox One HDR screenshots use JPEG XR with 10-bit precision and the HDR10 colorspace, however they are
+/// indistinguishable from SDR/sRGB 10-bit JPEG XRs except for custom XMP metadata embedded in them.
+/// Relies on caller to ensure the container is JPEG XR (IWICBitmapDecoder).
+/// </remarks>
+bool ImageProbe::IsXboxHdrScreenshot(IWICBitmapFrameDecode* frame)
+{
+    WICPixelFormatGUID fmt = {};
+    IFT(frame->GetPixelFormat(&fmt));
+    if (fmt != GUID_WICPixelFormat32bppBGR101010)
+    {
+        return false;
+    }
+
+    ComPtr<IWICMetadataQueryReader> metadata;
+    if (FAILED(frame->GetMetadataQueryReader(&metadata)))
+    {
+        // If metadata is not supported, this returns WINCODEC_ERR_UNSUPPORTEDOPERATION.
+        return false;
+    }
+
+    // TODO: RAII wrapper for PROPVARIANT.
+    PROPVARIANT prop;
+    PropVariantInit(&prop);
+    if (FAILED(metadata->GetMetadataByName(L"/ifd/xmp/{wstr=http://ns.microsoft.com/gamedvr/1.0/}:Extended", &prop)))
+    {
+        // If the Xbox-specific metadata is not found, this returns WINCODEC_ERR_PROPERTYNOTFOUND.
+        PropVariantClear(&prop);
+        return false;
+    }
+    else
+    {
+        PropVariantClear(&prop);
+        return true;
+    }
+}
+
+/// <summary>
+/// Translates DXGI_FORMAT to the best equivalent WIC pixel format.
+/// </summary>
+/// <remarks>
+/// Returns GUID_WICPixelFormatUndefined if we don't know the right WIC pixel format.
+/// This list is highly incomplete and only covers the most important DXGI_FORMATs for HDR.
+/// </remarks>
+GUID ImageProbe::TranslateDxgiFormatToWic(DXGI_FORMAT fmt)
+{
+    switch (fmt)
+    {
+    case DXGI_FORMAT_R8G8B8A8_SINT:
+    case DXGI_FORMAT_R8G8B8A8_SNORM:
+    case DXGI_FORMAT_R8G8B8A8_TYPELESS:
+    case DXGI_FORMAT_R8G8B8A8_UNORM:
+    case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+    case DXGI_FORMAT_R8G8B8A8_UINT:
+        return GUID_WICPixelFormat32bppRGBA;
+        break;
+
+    case DXGI_FORMAT_R16G16B16A16_FLOAT:
+        // Used by OpenEXR and BC6H decompression.
+        return GUID_WICPixelFormat64bppRGBAHalf;
+        break;
+
+    case DXGI_FORMAT_R32G32B32A32_FLOAT:
+        // Used by OpenEXR when preserving FP32 channels.
+        return GUID_WICPixelFormat128bppRGBAFloat;
+        break;
+
+    case DXGI_FORMAT_R32G32B32_FLOAT:
+        // Used by OpenEXR for opaque FP32 images.
+        return GUID_WICPixelFormat96bppRGBFloat;
+        break;
+
+    case DXGI_FORMAT_R16_FLOAT:
+        // Used by OpenEXR for luminance-only images and single channels.
+        return GUID_WICPixelFormat16bppGrayHalf;
+        break;
+
+    case DXGI_FORMAT_R32_FLOAT:
+        return GUID_WICPixelFormat32bppGrayFloat;
+        break;
+
+    default:
+        return GUID_WICPixelFormatUndefined;
+        break;
+    }
+}
@@ -0,0 +1,74 @@
+//*********************************************************
+//
+// ImageProbe
+//
+// Fills ImageInfo from an image's headers alone, without
+// decoding any pixels, for every container ImageLoader
+// supports. The result matches what a full load reports.
+//
+// Also holds the pixel format knowledge shared with
+// ImageLoader, and a batch probe which processes many
+// files in parallel and reports one JSON line per file.
+//
+// Everything here is thread safe.
+//
+//*********************************************************
+
+#pragma once
+
+#include "ImageInfo.h"
+#include "ImageLoader.h"
+
+namespace HDRImageViewer
+{
+    class ImageProbe
+    {
+    public:
+        /// <summary>
+        /// Reads ImageInfo from the headers of the image in imageStream. extension selects the
+        /// container as for ImageLoader; options select the decode settings that affect the result.
+        /// </summary>
+        static HRESULT ProbeStream(
+            _In_ IWICImagingFactory* wicFactory,
+            _In_ IStream* imageStream,
+            _In_ Platform::String^ extension,
+            const ImageLoaderOptions& options,
+            _Out_ ImageInfo& info);
+
+        /// <summary>
+        /// Probes files in parallel. Returns one JSON object per file, in input order.
+        /// </summary>
+        static concurrency::task<std::vector<std::wstring>> ProbeFilesAsync(
+            const std::vector<Windows::Storage::StorageFile^>& files,
+            const ImageLoaderOptions& options);
+
+        static std::wstring FormatJson(_In_ Platform::String^ path, HRESULT hr, const ImageInfo& info);
+
+        /// <summary>
+        /// The file types the app can open, for file pickers and folder queries.
+        /// </summary>
+        static void AppendSupportedFileTypes(_In_ Windows::Foundation::Collections::IVector<Platform::String^>^ fileTypes);
+
+        // Pixel format helpers shared with ImageLoader.
+
+        /// <summary>
+        /// Fills in the bit depth (channel/pixel) and float fields.
+        /// </summary>
+        static HRESULT GetPixelFormatInfo(_In_ IWICImagingFactory* wicFactory, WICPixelFormatGUID format, _Inout_ ImageInfo& info);
+
+        /// <summary>
+        /// Determines what advanced color kind the image is. Requires that pixel format info,
+        /// numProfiles and forceBT2100ColorSpace be populated.
+        /// </summary>
+        static void ClassifyAdvancedColorKind(_Inout_ ImageInfo& info);
+
+        static bool IsXboxHdrScreenshot(_In_ IWICBitmapFrameDecode* frame);
+        static GUID TranslateDxgiFormatToWic(DXGI_FORMAT fmt);
+
+    private:
+        static HRESULT ProbeWic(_In_ IWICImagingFactory* wicFactory, _In_ IStream* imageStream, _Out_ ImageInfo& info);
+        static HRESULT ProbeDds(_In_ IWICImagingFactory* wicFactory, _In_ IStream* imageStream, const ImageLoaderOptions& options, _Out_ ImageInfo& info);
+        static HRESULT ProbeRgbe(_In_ IStream* imageStream, _Out_ ImageInfo& info);
+        static HRESULT ProbeExr(_In_ IWICImagingFactory* wicFactory, _In_ IStream* imageStream, const ImageLoaderOptions& options, _Out_ ImageInfo& info);
+    };
+}
@@ -0,0 +1,442 @@
+#include "pch.h"
+#include "Lut3D.h"
+#include "ColorProfileCache.h"
+
+#include <DirectXPackedVector.h>
+#include <ppl.h>
+
+using namespace HDRImageViewer;
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+using namespace Microsoft::WRL;
+
+static const UINT sc_RowsPerTask = 16; // Rows per parallel work item.
+static const UINT sc_MaxCubeSize = 256; // Largest LUT_3D_SIZE accepted from a .cube file.
+
+namespace
+{
+    /// <summary>
+    /// Tetrahedral interpolation: the unit cube around position is split into six tetrahedra along
+    /// its neutral diagonal, and the one containing position is chosen by the order of the
+    /// fractional coordinates. Its four corners are blended with three multiply-adds.
+    /// position is in grid units and must lie within the grid.
+    /// </summary>
+    XMVECTOR Interpolate(const std::vector<XMFLOAT4>& entries, UINT size, FXMVECTOR position)
+    {
+        XMVECTOR base = XMVectorMin(XMVectorTruncate(position), XMVectorReplicate(static_cast<float>(size - 2)));
+
+        XMFLOAT4A corner;
+        XMFLOAT4A fraction;
+        XMStoreFloat4A(&corner, base);
+        XMStoreFloat4A(&fraction, XMVectorSubtract(position, base));
+
+        const size_t dr = 1;
+        const size_t dg = size;
+        const size_t db = static_cast<size_t>(size) * size;
+
+        // Corner offsets along the path from the origin corner to the opposite one, and the
+        // fractions sorted in decreasing order.
+        size_t first, second;
+        float a, b, c;
+        if (fraction.x >= fraction.y)
+        {
+            if (fraction.y >= fraction.z)       { first = dr; second = dg; a = fraction.x; b = fraction.y; c = fraction.z; }
+            else if (fraction.x >= fraction.z)  { first = dr; second = db; a = fraction.x; b = fraction.z; c = fraction.y; }
+            else                                { first = db; second = dr; a = fraction.z; b = fraction.x; c = fraction.y; }
+        }
+        else
+        {
+            if (fraction.z >= fraction.y)       { first = db; second = dg; a = fraction.z; b = fraction.y; c = fraction.x; }
+            else if (fraction.z >= fraction.x)  { first = dg; second = db; a = fraction.y; b = fraction.z; c = fraction.x; }
+            else                                { first = dg; second = dr; a = fraction.y; b = fraction.x; c = fraction.z; }
+        }
+
+        const XMFLOAT4* origin = &entries[static_cast<size_t>(corner.x) + static_cast<size_t>(corner.y) * dg + static_cast<size_t>(corner.z) * db];
+
+        XMVECTOR c0 = XMLoadFloat4(origin);
+        XMVECTOR c1 = XMLoadFloat4(origin + first);
+        XMVECTOR c2 = XMLoadFloat4(origin + first + second);
+        XMVECTOR c3 = XMLoadFloat4(origin + dr + dg + db);
+
+        XMVECTOR v = XMVectorMultiplyAdd(XMVectorReplicate(a), XMVectorSubtract(c1, c0), c0);
+        v = XMVectorMultiplyAdd(XMVectorReplicate(b), XMVectorSubtract(c2, c1), v);
+        return XMVectorMultiplyAdd(XMVectorReplicate(c), XMVectorSubtract(c3, c2), v);
+    }
+}
+
+HRESULT Lut3D::Bake(UINT size, const std::function<XMVECTOR(FXMVECTOR)>& transform, Lut3D& lut)
+{
+    if (size < 2 || size > sc_MaxCubeSize)
+        return E_INVALIDARG;
+
+    try
+    {
+        lut.m_entries.resize(static_cast<size_t>(size) * size * size);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    lut.m_size = size;
+    lut.m_domainMin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    lut.m_domainMax = XMFLOAT3(1.0f, 1.0f, 1.0f);
+
+    const float step = 1.0f / (size - 1);
+
+    concurrency::parallel_for(0u, size, [&](UINT b)
+    {
+        XMFLOAT4* entry = &lut.m_entries[static_cast<size_t>(b) * size * size];
+        for (UINT g = 0; g < size; g++)
+        {
+            for (UINT r = 0; r < size; r++, entry++)
+            {
+                XMVECTOR color = XMVectorSet(r * step, g * step, b * step, 1.0f);
+                XMStoreFloat4(entry, XMVectorSetW(transform(color), 1.0f));
+            }
+        }
+    });
+
+    return S_OK;
+}
+
+/// <summary>
+/// Draws an image with one pixel per grid point through the color management effect, and reads
+/// it back. Grid coordinates k / (size - 1) are exact in FP16 for the usual 2^n + 1 sizes.
+/// </summary>
+HRESULT Lut3D::BakeColorManagement(ID2D1DeviceContext2* context, ID2D1ColorContext* source, UINT size, Lut3D& lut)
+{
+    if (size < 2 || size > sc_MaxCubeSize)
+        return E_INVALIDARG;
+
+    // Red and green vary along rows, blue down columns.
+    const UINT width = size * size;
+    const float step = 1.0f / (size - 1);
+
+    std::vector<XMHALF4> grid(static_cast<size_t>(width) * size);
+    for (UINT b = 0; b < size; b++)
+    {
+        for (UINT g = 0; g < size; g++)
+        {
+            for (UINT r = 0; r < size; r++)
+            {
+                grid[(static_cast<size_t>(b) * size + g) * size + r] = XMHALF4(r * step, g * step, b * step, 1.0f);
+            }
+        }
+    }
+
+    D2D1_BITMAP_PROPERTIES1 inputProps = D2D1::BitmapProperties1(
+        D2D1_BITMAP_OPTIONS_NONE,
+        D2D1::PixelFormat(DXGI_FORMAT_R16G16B16A16_FLOAT, D2D1_ALPHA_MODE_PREMULTIPLIED));
+
+    ComPtr<ID2D1Bitmap1> input;
+    HRESULT hr = context->CreateBitmap(D2D1::SizeU(width, size), grid.data(), width * sizeof(XMHALF4), &inputProps, &input);
+    if (FAILED(hr))
+        return hr;
+
+    ComPtr<ID2D1Effect> colorManagement;
+    hr = context->CreateEffect(CLSID_D2D1ColorManagement, &colorManagement);
+    if (FAILED(hr))
+        return hr;
+
+    colorManagement->SetInput(0, input.Get());
+
+    hr = colorManagement->SetValue(D2D1_COLORMANAGEMENT_PROP_QUALITY, D2D1_COLORMANAGEMENT_QUALITY_BEST);
+    if (FAILED(hr))
+        return hr;
+
+    hr = colorManagement->SetValue(D2D1_COLORMANAGEMENT_PROP_SOURCE_COLOR_CONTEXT, source);
+    if (FAILED(hr))
+        return hr;
+
+    ComPtr<ID2D1ColorContext1> scRgb;
+    hr = context->CreateColorContextFromDxgiColorSpace(DXGI_COLOR_SPACE_RGB_FULL_G10_NONE_P709, &scRgb);
+    if (FAILED(hr))
+        return hr;
+
+    hr = colorManagement->SetValue(D2D1_COLORMANAGEMENT_PROP_DESTINATION_COLOR_CONTEXT, scRgb.Get());
+    if (FAILED(hr))
+        return hr;
+
+    D2D1_BITMAP_PROPERTIES1 targetProps = D2D1::BitmapProperties1(
+        D2D1_BITMAP_OPTIONS_TARGET,
+        D2D1::PixelFormat(DXGI_FORMAT_R16G16B16A16_FLOAT, D2D1_ALPHA_MODE_PREMULTIPLIED));
+
+    D2D1_BITMAP_PROPERTIES1 readbackProps = D2D1::BitmapProperties1(
+        D2D1_BITMAP_OPTIONS_CPU_READ | D2D1_BITMAP_OPTIONS_CANNOT_DRAW,
+        D2D1::PixelFormat(DXGI_FORMAT_R16G16B16A16_FLOAT, D2D1_ALPHA_MODE_PREMULTIPLIED));
+
+    ComPtr<ID2D1Bitmap1> target;
+    ComPtr<ID2D1Bitmap1> readback;
+    hr = context->CreateBitmap(D2D1::SizeU(width, size), nullptr, 0, &targetProps, &target);
+    if (FAILED(hr))
+        return hr;
+
+    hr = context->CreateBitmap(D2D1::SizeU(width, size), nullptr, 0, &readbackProps, &readback);
+    if (FAILED(hr))
+        return hr;
+
+    // Draws one grid pixel per target pixel, whatever the display DPI.
+    ComPtr<ID2D1Image> previousTarget;
+    context->GetTarget(&previousTarget);
+
+    D2D1_MATRIX_3X2_F previousTransform;
+    context->GetTransform(&previousTransform);
+
+    float dpiX, dpiY;
+    context->GetDpi(&dpiX, &dpiY);
+
+    context->SetTarget(target.Get());
+    context->SetDpi(96.0f, 96.0f);
+    context->BeginDraw();
+    context->SetTransform(D2D1::Matrix3x2F::Identity());
+    context->Clear(D2D1::ColorF(0, 0, 0, 0));
+    context->DrawImage(colorManagement.Get(), D2D1_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+    hr = context->EndDraw();
+
+    context->SetTransform(previousTransform);
+    context->SetDpi(dpiX, dpiY);
+    context->SetTarget(previousTarget.Get());
+
+    if (FAILED(hr))
+        return hr;
+
+    hr = readback->CopyFromBitmap(nullptr, target.Get(), nullptr);
+    if (FAILED(hr))
+        return hr;
+
+    D2D1_MAPPED_RECT mapped = {};
+    hr = readback->Map(D2D1_MAP_OPTIONS_READ, &mapped);
+    if (FAILED(hr))
+        return hr;
+
+    lut.m_size = size;
+    lut.m_domainMin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    lut.m_domainMax = XMFLOAT3(1.0f, 1.0f, 1.0f);
+    lut.m_entries.resize(static_cast<size_t>(size) * size * size);
+
+    for (UINT b = 0; b < size; b++)
+    {
+        auto row = reinterpret_cast<const XMHALF4*>(mapped.bits + static_cast<size_t>(b) * mapped.pitch);
+        for (UINT i = 0; i < width; i++)
+        {
+            XMStoreFloat4(&lut.m_entries[static_cast<size_t>(b) * width + i], XMVectorSetW(XMLoadHalf4(&row[i]), 1.0f));
+        }
+    }
+
+    return readback->Unmap();
+}
+
+HRESULT Lut3D::GetColorManagementLut(ID2D1DeviceContext2* context, ID2D1ColorContext* source, UINT size, std::shared_ptr<const Lut3D>& lut)
+{
+    lut.reset();
+
+    std::shared_ptr<ColorProfile> profile;
+    HRESULT hr = ColorProfileCache::GetProfile(source, profile);
+    if (FAILED(hr))
+        return hr;
+
+    return profile->GetColorManagementLut(context, size, lut);
+}
+
+HRESULT Lut3D::ParseCube(const char* text, size_t length, Lut3D& lut)
+{
+    std::istringstream stream(std::string(text, length));
+    std::string line;
+
+    UINT size = 0;
+    XMFLOAT3 domainMin(0.0f, 0.0f, 0.0f);
+    XMFLOAT3 domainMax(1.0f, 1.0f, 1.0f);
+    std::vector<XMFLOAT4> entries;
+
+    while (std::getline(stream, line))
+    {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+
+        std::istringstream fields(line.substr(start));
+
+        if (isalpha(static_cast<unsigned char>(line[start])))
+        {
+            // TITLE and unknown keywords are ignored.
+            std::string keyword;
+            fields >> keyword;
+
+            if (keyword == "LUT_3D_SIZE")
+            {
+                fields >> size;
+                if (fields.fail() || size < 2 || size > sc_MaxCubeSize || !entries.empty())
+                    return WINCODEC_ERR_BADHEADER;
+
+                entries.reserve(static_cast<size_t>(size) * size * size);
+            }
+            else if (keyword == "LUT_1D_SIZE")
+            {
+                // Resolve style shaper + cube files put a 1D table first; only pure 3D tables are read.
+                return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+            }
+            else if (keyword == "DOMAIN_MIN")
+            {
+                fields >> domainMin.x >> domainMin.y >> domainMin.z;
+            }
+            else if (keyword == "DOMAIN_MAX")
+            {
+                fields >> domainMax.x >> domainMax.y >> domainMax.z;
+            }
+            else if (keyword == "LUT_3D_INPUT_RANGE")
+            {
+                float minimum = 0.0f, maximum = 0.0f;
+                fields >> minimum >> maximum;
+                domainMin = XMFLOAT3(minimum, minimum, minimum);
+                domainMax = XMFLOAT3(maximum, maximum, maximum);
+            }
+
+            if (fields.fail())
+                return WINCODEC_ERR_BADHEADER;
+        }
+        else
+        {
+            XMFLOAT4 entry(0.0f, 0.0f, 0.0f, 1.0f);
+            fields >> entry.x >> entry.y >> entry.z;
+            if (fields.fail() || size == 0)
+                return WINCODEC_ERR_BADHEADER;
+
+            entries.push_back(entry);
+        }
+    }
+
+    if (size == 0 ||
+        entries.size() != static_cast<size_t>(size) * size * size ||
+        domainMax.x <= domainMin.x || domainMax.y <= domainMin.y || domainMax.z <= domainMin.z)
+    {
+        return WINCODEC_ERR_BADHEADER;
+    }
+
+    lut.m_size = size;
+    lut.m_entries = std::move(entries);
+    lut.m_domainMin = domainMin;
+    lut.m_domainMax = domainMax;
+    return S_OK;
+}
+
+XMVECTOR Lut3D::Sample(FXMVECTOR color) const
+{
+    XMVECTOR domainMin = XMLoadFloat3(&m_domainMin);
+    XMVECTOR scale = XMVectorDivide(XMVectorReplicate(static_cast<float>(m_size - 1)), XMVectorSubtract(XMLoadFloat3(&m_domainMax), domainMin));
+
+    XMVECTOR position = XMVectorMultiply(XMVectorSubtract(color, domainMin), scale);
+    position = XMVectorClamp(position, XMVectorZero(), XMVectorReplicate(static_cast<float>(m_size - 1)));
+
+    return XMVectorSetW(Interpolate(m_entries, m_size, position), XMVectorGetW(color));
+}
+
+void Lut3D::ConvertRow(const uint16_t* src, size_t count, uint16_t* half) const
+{
+    // Baked LUTs have the unit domain, which 16 bpc values never leave.
+    XMVECTOR scale = XMVectorReplicate(static_cast<float>(m_size - 1));
+
+    auto pixels = reinterpret_cast<const XMUSHORTN4*>(src);
+    auto dst = reinterpret_cast<XMHALF4*>(half);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        XMVECTOR encoded = XMLoadUShortN4(&pixels[i]);
+        XMVECTOR alpha = XMVectorSplatW(encoded);
+
+        XMVECTOR v = Interpolate(m_entries, m_size, XMVectorMultiply(encoded, scale));
+
+        // The source is straight alpha; scRGB is premultiplied.
+        XMStoreHalf4(&dst[i], XMVectorSelect(alpha, XMVectorMultiply(v, alpha), g_XMSelect1110));
+    }
+}
+
+void Lut3D::ConvertRows(
+    const uint8_t* src,
+    UINT srcStride,
+    uint8_t* dst,
+    UINT dstStride,
+    UINT width,
+    UINT height,
+    const concurrency::cancellation_token& cancel) const
+{
+    concurrency::parallel_for(0u, (height + sc_RowsPerTask - 1) / sc_RowsPerTask, [&](UINT task)
+    {
+        if (cancel.is_canceled())
+            return;
+
+        for (UINT y = task * sc_RowsPerTask; y < (std::min)((task + 1) * sc_RowsPerTask, height); y++)
+        {
+            ConvertRow(
+                reinterpret_cast<const uint16_t*>(src + static_cast<size_t>(y) * srcStride),
+                width,
+                reinterpret_cast<uint16_t*>(dst + static_cast<size_t>(y) * dstStride));
+        }
+    });
+}
+
+HRESULT Lut3D::CreateEffects(ID2D1DeviceContext2* context, ID2D1Effect** first, ID2D1Effect** last) const
+{
+    *first = nullptr;
+    *last = nullptr;
+
+    // The effect indexes the table with red varying fastest, as it is stored.
+    UINT32 extents[3] = { m_size, m_size, m_size };
+    UINT32 strides[2] = { m_size * sizeof(XMFLOAT4), m_size * m_size * sizeof(XMFLOAT4) };
+
+    ComPtr<ID2D1LookupTable3D> table;
+    HRESULT hr = context->CreateLookupTable3D(
+        D2D1_BUFFER_PRECISION_32BPC_FLOAT,
+        extents,
+        reinterpret_cast<const BYTE*>(m_entries.data()),
+        static_cast<UINT32>(m_entries.size() * sizeof(XMFLOAT4)),
+        strides,
+        &table);
+    if (FAILED(hr))
+        return hr;
+
+    ComPtr<ID2D1Effect> lutEffect;
+    hr = context->CreateEffect(CLSID_D2D1LookupTable3D, &lutEffect);
+    if (FAILED(hr))
+        return hr;
+
+    hr = lutEffect->SetValue(D2D1_LOOKUPTABLE3D_PROP_LUT, table.Get());
+    if (FAILED(hr))
+        return hr;
+
+    hr = lutEffect->SetValue(D2D1_LOOKUPTABLE3D_PROP_ALPHA_MODE, D2D1_ALPHA_MODE_PREMULTIPLIED);
+    if (FAILED(hr))
+        return hr;
+
+    ComPtr<ID2D1Effect> firstEffect = lutEffect;
+
+    if (m_domainMin.x != 0.0f || m_domainMin.y != 0.0f || m_domainMin.z != 0.0f ||
+        m_domainMax.x != 1.0f || m_domainMax.y != 1.0f || m_domainMax.z != 1.0f)
+    {
+        float scaleR = 1.0f / (m_domainMax.x - m_domainMin.x);
+        float scaleG = 1.0f / (m_domainMax.y - m_domainMin.y);
+        float scaleB = 1.0f / (m_domainMax.z - m_domainMin.z);
+
+        D2D1_MATRIX_5X4_F toUnit = D2D1::Matrix5x4F(
+            scaleR, 0, 0, 0,
+            0, scaleG, 0, 0,
+            0, 0, scaleB, 0,
+            0, 0, 0, 1,
+            -m_domainMin.x * scaleR, -m_domainMin.y * scaleG, -m_domainMin.z * scaleB, 0);
+
+        hr = context->CreateEffect(CLSID_D2D1ColorMatrix, &firstEffect);
+        if (FAILED(hr))
+            return hr;
+
+        hr = firstEffect->SetValue(D2D1_COLORMATRIX_PROP_COLOR_MATRIX, toUnit);
+        if (FAILED(hr))
+            return hr;
+
+        lutEffect->SetInputEffect(0, firstEffect.Get());
+    }
+
+    *first = firstEffect.Detach();
+    *last = lutEffect.Detach();
+    return S_OK;
+}
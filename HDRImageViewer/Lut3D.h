@@ -0,0 +1,111 @@
+//*********************************************************
+//
+// Lut3D
+//
+// A color transform sampled on a regular RGB grid (e.g. 33
+// or 65 points per axis) and reconstructed with tetrahedral
+// interpolation, which is exact for neutrals and for
+// transforms that are separable per channel.
+//
+// A LUT is baked from any transform: a CPU function, or the
+// Direct2D color management effect for a source color
+// context, which covers LUT based ICC profiles that
+// IccTransform cannot evaluate. Baked LUTs are cached by
+// profile hash. User .cube files load as viewing LUTs.
+//
+// A LUT applies on the CPU, vectorized with DirectXMath and
+// spread across all cores, or on the GPU through the
+// Direct2D 3D lookup table effect.
+//
+//*********************************************************
+
+#pragma once
+
+#include <functional>
+
+namespace HDRImageViewer
+{
+    class Lut3D
+    {
+    public:
+        /// <summary>
+        /// Samples transform, which maps a color in [0, 1] to its output, at size points per axis.
+        /// transform is called concurrently.
+        /// </summary>
+        static HRESULT Bake(
+            UINT size,
+            const std::function<DirectX::XMVECTOR(DirectX::FXMVECTOR)>& transform,
+            _Out_ Lut3D& lut);
+
+        /// <summary>
+        /// Samples the Direct2D color management transform from source to scRGB, as used by the
+        /// renderer, at size points per axis. Performs Begin/EndDraw on the context.
+        /// </summary>
+        static HRESULT BakeColorManagement(
+            _In_ ID2D1DeviceContext2* context,
+            _In_ ID2D1ColorContext* source,
+            UINT size,
+            _Out_ Lut3D& lut);
+
+        /// <summary>
+        /// Returns the LUT of a source color context's transform to scRGB, shared through the
+        /// profile's ColorProfileCache entry and baked on first use. Returns
+        /// WINCODEC_ERR_UNSUPPORTEDOPERATION for color contexts without a profile.
+        /// </summary>
+        static HRESULT GetColorManagementLut(
+            _In_ ID2D1DeviceContext2* context,
+            _In_ ID2D1ColorContext* source,
+            UINT size,
+            _Out_ std::shared_ptr<const Lut3D>& lut);
+
+        /// <summary>
+        /// Parses an Adobe/Resolve .cube file with a 3D table. Returns WINCODEC_ERR_BADHEADER if it
+        /// is malformed, or WINCODEC_ERR_UNSUPPORTEDOPERATION for 1D only tables.
+        /// </summary>
+        static HRESULT ParseCube(_In_reads_bytes_(length) const char* text, size_t length, _Out_ Lut3D& lut);
+
+        UINT GetSize() const { return m_size; }
+
+        /// <summary>
+        /// Interpolates the output for a color, which is clamped to the domain. w is passed through.
+        /// </summary>
+        DirectX::XMVECTOR Sample(DirectX::FXMVECTOR color) const;
+
+        /// <summary>
+        /// As IccTransform::ConvertRows, for a LUT baked from a transform of straight alpha encoded
+        /// colors to scRGB: GUID_WICPixelFormat64bppRGBA to GUID_WICPixelFormat64bppPRGBAHalf.
+        /// </summary>
+        void ConvertRows(
+            _In_ const uint8_t* src,
+            UINT srcStride,
+            _Out_ uint8_t* dst,
+            UINT dstStride,
+            UINT width,
+            UINT height,
+            const concurrency::cancellation_token& cancel = concurrency::cancellation_token::none()) const;
+
+        /// <summary>
+        /// Converts a single row; see ConvertRows.
+        /// </summary>
+        void ConvertRow(
+            _In_reads_(count * 4) const uint16_t* src,
+            size_t count,
+            _Out_writes_(count * 4) uint16_t* half) const;
+
+        /// <summary>
+        /// Creates Direct2D effects which apply the LUT to premultiplied input: set the input of
+        /// first and draw last. They are the same effect unless the domain is not [0, 1], in which
+        /// case first is a color matrix that maps it there.
+        /// </summary>
+        HRESULT CreateEffects(
+            _In_ ID2D1DeviceContext2* context,
+            _COM_Outptr_ ID2D1Effect** first,
+            _COM_Outptr_ ID2D1Effect** last) const;
+
+    private:
+        UINT                                m_size = 0;
+        std::vector<DirectX::XMFLOAT4>      m_entries;      // Red varies fastest, then green, then blue; w is 1.
+        DirectX::XMFLOAT3                   m_domainMin = { 0.0f, 0.0f, 0.0f };
+        DirectX::XMFLOAT3                   m_domainMax = { 1.0f, 1.0f, 1.0f };
+    };
+}
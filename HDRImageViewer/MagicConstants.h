@@ -11,4 +11,12 @@ static const float sc_MinZoomSphereMap = 0.25f;
 // luminance above ~1.5 nits, up to 1 million nits.
 static const unsigned int sc_histNumBins = 400;
 static const float        sc_histGamma = 0.1f;
-static const unsigned int sc_histMaxNits = 1000000;
\ No newline at end of file
+static const unsigned int sc_histMaxNits = 1000000;
+// Folder navigation keeps this many images on each side of the current one decoded, within
+// the byte budget. Decoded HDR images are 8 bytes per pixel, so 1 GB holds about five 24MP images.
+static const int          sc_prefetchRadius = 2;
+static const size_t       sc_prefetchByteBudget = 1024ull * 1024 * 1024;
+
+// Decoded images persisted across sessions in the app's local cache folder.
+static const uint64_t     sc_diskCacheByteLimit = 4ull * 1024 * 1024 * 1024;
+static const uint32_t     sc_diskCacheEntryLimit = 32;
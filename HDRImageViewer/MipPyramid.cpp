@@ -0,0 +1,206 @@
+#include "pch.h"
+#include "MipPyramid.h"
+
+#include <DirectXPackedVector.h>
+#include <ppl.h>
+
+using namespace HDRImageViewer;
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+using namespace Microsoft::WRL;
+
+static const UINT sc_BytesPerPixel = sizeof(XMHALF4);
+static const UINT sc_StripRows = 64; // Level 1 rows filtered per strip of the source.
+static const UINT sc_RowsPerTask = 16; // Rows per parallel work item.
+
+namespace
+{
+    /// <summary>
+    /// Stores a filtered level in the pixel format of the source it was built from.
+    /// </summary>
+    HRESULT CreateLevelBitmap(
+        _In_ IWICImagingFactory* wicFactory,
+        std::vector<uint8_t>& pixels,
+        UINT width,
+        UINT height,
+        WICPixelFormatGUID format,
+        _COM_Outptr_ IWICBitmapSource** level)
+    {
+        *level = nullptr;
+
+        // Copies the pixels.
+        ComPtr<IWICBitmap> halfBitmap;
+        HRESULT hr = wicFactory->CreateBitmapFromMemory(
+            width,
+            height,
+            GUID_WICPixelFormat64bppPRGBAHalf,
+            width * sc_BytesPerPixel,
+            static_cast<UINT>(pixels.size()),
+            pixels.data(),
+            &halfBitmap);
+        if (FAILED(hr))
+            return hr;
+
+        if (format == GUID_WICPixelFormat64bppPRGBAHalf)
+        {
+            return halfBitmap.CopyTo(level);
+        }
+
+        ComPtr<IWICFormatConverter> converter;
+        hr = wicFactory->CreateFormatConverter(&converter);
+        if (FAILED(hr))
+            return hr;
+
+        hr = converter->Initialize(halfBitmap.Get(), format, WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeCustom);
+        if (FAILED(hr))
+            return hr;
+
+        ComPtr<IWICBitmap> bitmap;
+        hr = wicFactory->CreateBitmapFromSource(converter.Get(), WICBitmapCacheOnLoad, &bitmap);
+        if (FAILED(hr))
+            return hr;
+
+        return bitmap.CopyTo(level);
+    }
+}
+
+HRESULT MipPyramid::Build(
+    IWICImagingFactory* wicFactory,
+    IWICBitmapSource* source,
+    UINT minDimension,
+    const concurrency::cancellation_token& cancel,
+    std::vector<ComPtr<IWICBitmapSource>>& levels)
+{
+    levels.clear();
+
+    UINT width = 0, height = 0;
+    HRESULT hr = source->GetSize(&width, &height);
+    if (FAILED(hr))
+        return hr;
+
+    WICPixelFormatGUID format = {};
+    hr = source->GetPixelFormat(&format);
+    if (FAILED(hr))
+        return hr;
+
+    if ((std::max)(width, height) <= minDimension)
+    {
+        return S_OK;
+    }
+
+    // Converting integer formats to float linearizes them.
+    ComPtr<IWICFormatConverter> linearSource;
+    hr = wicFactory->CreateFormatConverter(&linearSource);
+    if (FAILED(hr))
+        return hr;
+
+    hr = linearSource->Initialize(source, GUID_WICPixelFormat64bppPRGBAHalf, WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeCustom);
+    if (FAILED(hr))
+        return hr;
+
+    // Level 1 is filtered from strips of the source, so no full resolution FP16 copy is made.
+    UINT levelWidth = (width + 1) / 2;
+    UINT levelHeight = (height + 1) / 2;
+    std::vector<uint8_t> level(static_cast<size_t>(levelWidth) * sc_BytesPerPixel * levelHeight);
+
+    UINT stripStride = width * sc_BytesPerPixel;
+    std::vector<uint8_t> strip(static_cast<size_t>(stripStride) * sc_StripRows * 2);
+
+    for (UINT y = 0; y < levelHeight; y += sc_StripRows)
+    {
+        if (cancel.is_canceled())
+            return E_ABORT;
+
+        UINT rows = (std::min)(sc_StripRows, levelHeight - y);
+        UINT sourceRows = (std::min)(rows * 2, height - y * 2);
+        WICRect rect = { 0, static_cast<INT>(y * 2), static_cast<INT>(width), static_cast<INT>(sourceRows) };
+
+        hr = linearSource->CopyPixels(&rect, stripStride, stripStride * sourceRows, strip.data());
+        if (FAILED(hr))
+            return hr;
+
+        DownsampleRows(
+            strip.data(),
+            stripStride,
+            width,
+            sourceRows,
+            level.data() + static_cast<size_t>(y) * levelWidth * sc_BytesPerPixel,
+            levelWidth * sc_BytesPerPixel,
+            rows);
+    }
+
+    // Each further level is filtered from the previous one.
+    while (true)
+    {
+        ComPtr<IWICBitmapSource> levelBitmap;
+        hr = CreateLevelBitmap(wicFactory, level, levelWidth, levelHeight, format, &levelBitmap);
+        if (FAILED(hr))
+            return hr;
+
+        levels.push_back(levelBitmap);
+
+        if ((std::max)(levelWidth, levelHeight) <= minDimension)
+        {
+            break;
+        }
+
+        if (cancel.is_canceled())
+            return E_ABORT;
+
+        UINT nextWidth = (levelWidth + 1) / 2;
+        UINT nextHeight = (levelHeight + 1) / 2;
+        std::vector<uint8_t> next(static_cast<size_t>(nextWidth) * sc_BytesPerPixel * nextHeight);
+
+        DownsampleRows(
+            level.data(),
+            levelWidth * sc_BytesPerPixel,
+            levelWidth,
+            levelHeight,
+            next.data(),
+            nextWidth * sc_BytesPerPixel,
+            nextHeight);
+
+        level.swap(next);
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+    }
+
+    return S_OK;
+}
+
+void MipPyramid::DownsampleRows(
+    const uint8_t* src,
+    UINT srcStride,
+    UINT srcWidth,
+    UINT srcHeight,
+    uint8_t* dst,
+    UINT dstStride,
+    UINT dstHeight)
+{
+    static const XMVECTORF32 s_quarter = { { { 0.25f, 0.25f, 0.25f, 0.25f } } };
+
+    UINT dstWidth = (srcWidth + 1) / 2;
+
+    concurrency::parallel_for(0u, (dstHeight + sc_RowsPerTask - 1) / sc_RowsPerTask, [&](UINT task)
+    {
+        for (UINT y = task * sc_RowsPerTask; y < (std::min)((task + 1) * sc_RowsPerTask, dstHeight); y++)
+        {
+            auto top = reinterpret_cast<const XMHALF4*>(src + static_cast<size_t>(y * 2) * srcStride);
+            auto bottom = reinterpret_cast<const XMHALF4*>(src + static_cast<size_t>((std::min)(y * 2 + 1, srcHeight - 1)) * srcStride);
+            auto out = reinterpret_cast<XMHALF4*>(dst + static_cast<size_t>(y) * dstStride);
+
+            for (UINT x = 0; x < dstWidth; x++)
+            {
+                UINT left = x * 2;
+                UINT right = (std::min)(left + 1, srcWidth - 1);
+
+                XMVECTOR sum = XMVectorAdd(XMLoadHalf4(&top[left]), XMLoadHalf4(&top[right]));
+                sum = XMVectorAdd(sum, XMLoadHalf4(&bottom[left]));
+                sum = XMVectorAdd(sum, XMLoadHalf4(&bottom[right]));
+
+                XMStoreHalf4(&out[x], XMVectorMultiply(sum, s_quarter));
+            }
+        }
+    });
+}
@@ -0,0 +1,51 @@
+//*********************************************************
+//
+// MipPyramid
+//
+// Builds successively halved copies of an image at load
+// time, so zooming out samples the nearest level instead of
+// resampling the full resolution image every frame.
+//
+// Filtering is a 2x2 box in linear light on premultiplied
+// FP16, so HDR highlights and sRGB encoded images average
+// correctly. Integer images are linearized and re-encoded
+// by WIC's float conversions, which assume sRGB, so callers
+// must not pass integer images with other encodings. Rows
+// of each level are filtered in parallel with DirectXMath.
+//
+//*********************************************************
+
+#pragma once
+
+namespace HDRImageViewer
+{
+    class MipPyramid
+    {
+    public:
+        /// <summary>
+        /// Builds levels 1 and up of source in its own pixel format, until the longest side is
+        /// at most minDimension. source must support CopyPixels of row ranges. Returns E_ABORT if
+        /// cancel is canceled.
+        /// </summary>
+        static HRESULT Build(
+            _In_ IWICImagingFactory* wicFactory,
+            _In_ IWICBitmapSource* source,
+            UINT minDimension,
+            const concurrency::cancellation_token& cancel,
+            _Out_ std::vector<Microsoft::WRL::ComPtr<IWICBitmapSource>>& levels);
+
+        /// <summary>
+        /// 2x2 box filters GUID_WICPixelFormat64bppPRGBAHalf rows. Destination row y is the average
+        /// of source rows 2y and 2y + 1; the last row and column are repeated where the source
+        /// size is odd.
+        /// </summary>
+        static void DownsampleRows(
+            _In_ const uint8_t* src,
+            UINT srcStride,
+            UINT srcWidth,
+            UINT srcHeight,
+            _Out_ uint8_t* dst,
+            UINT dstStride,
+            UINT dstHeight);
+    };
+}
@@ -0,0 +1,306 @@
+#include "pch.h"
+#include "RenderPipeline.h"
+
+#include <DirectXPackedVector.h>
+#include <ppl.h>
+
+using namespace HDRImageViewer;
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+static const UINT sc_RowsPerTask = 16; // Rows per parallel work item.
+
+namespace
+{
+    /// <summary>
+    /// RenderPipelineConstants splatted, with luminances in scRGB values.
+    /// </summary>
+    struct StageParams
+    {
+        XMVECTOR whiteScale;
+        XMVECTOR tonemapInputMax;
+        XMVECTOR tonemapOutputMax;
+        XMVECTOR outputScale;
+    };
+
+    // Each stage matches the function of the same name in RenderStages.hlsli. Stages take and return
+    // premultiplied scRGB.
+
+    struct WhiteScaleStage
+    {
+        static XMVECTOR XM_CALLCONV Apply(FXMVECTOR color, const StageParams& params)
+        {
+            return XMVectorSelect(color, XMVectorMultiply(color, params.whiteScale), g_XMSelect1110);
+        }
+    };
+
+    struct SimpleTonemapStage
+    {
+        static XMVECTOR XM_CALLCONV Apply(FXMVECTOR color, const StageParams& params)
+        {
+            XMVECTOR v = XMVectorDivide(color, params.tonemapInputMax);
+            v = XMVectorAdd(v, v); // output / 1 + output
+            v = XMVectorMultiply(v, params.tonemapOutputMax);
+
+            return XMVectorSelect(color, v, g_XMSelect1110);
+        }
+    };
+
+    struct OutputScaleStage
+    {
+        static XMVECTOR XM_CALLCONV Apply(FXMVECTOR color, const StageParams& params)
+        {
+            return XMVectorSelect(color, XMVectorMultiply(color, params.outputScale), g_XMSelect1110);
+        }
+    };
+
+    struct SdrOverlayStage
+    {
+        static XMVECTOR XM_CALLCONV Apply(FXMVECTOR color, const StageParams&)
+        {
+            static const XMVECTORF32 sc_weights = { { { 0.3f, 0.59f, 0.11f, 0.0f } } };
+
+            // Wide gamut and high dynamic range colors pass through; SDR colors become grayscale.
+            XMVECTOR output = XMVector3Equal(color, XMVectorSaturate(color)) ?
+                XMVector3Dot(sc_weights, color) :
+                color;
+
+            return XMVectorSetW(output, 1.0f);
+        }
+    };
+
+    struct LuminanceHeatmapStage
+    {
+        static float Sign(float v)
+        {
+            return static_cast<float>((v > 0.0f) - (v < 0.0f));
+        }
+
+        static XMVECTOR XM_CALLCONV Apply(FXMVECTOR color, const StageParams&)
+        {
+            static const XMVECTORF32 sc_weights = { { { 0.2126f, 0.7152f, 0.0722f, 0.0f } } };
+            static const float sc_stopNits[] = { 0.0f, 3.16f, 10.0f, 31.6f, 100.0f, 316.0f, 1000.0f, 3160.0f, 10000.0f };
+            static const XMVECTORF32 sc_stopColors[] =
+            {
+                { { { 0.0f, 0.0f, 0.0f, 1.0f } } }, // Black
+                { { { 0.0f, 0.0f, 1.0f, 1.0f } } }, // Blue
+                { { { 0.0f, 1.0f, 1.0f, 1.0f } } }, // Cyan
+                { { { 0.0f, 1.0f, 0.0f, 1.0f } } }, // Green
+                { { { 1.0f, 1.0f, 0.0f, 1.0f } } }, // Yellow
+                { { { 1.0f, 0.2f, 0.0f, 1.0f } } }, // Orange
+                { { { 1.0f, 0.0f, 0.0f, 1.0f } } }, // Red
+                { { { 1.0f, 0.0f, 1.0f, 1.0f } } }, // Magenta
+                { { { 1.0f, 1.0f, 1.0f, 1.0f } } }, // White
+            };
+
+            float nits = XMVectorGetX(XMVector3Dot(sc_weights, color)) * 80.0f;
+
+            // As in the shader, segments are weighted by the difference of the signs at their ends,
+            // so a value on a stop takes half of each adjacent segment.
+            XMVECTOR output = XMVectorZero();
+            for (size_t i = 0; i + 1 < ARRAYSIZE(sc_stopNits); i++)
+            {
+                float use = Sign(nits - sc_stopNits[i]) - Sign(nits - sc_stopNits[i + 1]);
+                if (use != 0.0f)
+                {
+                    float t = (nits - sc_stopNits[i]) / (sc_stopNits[i + 1] - sc_stopNits[i]);
+                    output = XMVectorMultiplyAdd(XMVectorLerp(sc_stopColors[i], sc_stopColors[i + 1], t), XMVectorReplicate(use), output);
+                }
+            }
+
+            return output;
+        }
+    };
+
+    /// <summary>
+    /// Composes stages, applied in order, into one function.
+    /// </summary>
+    template <typename... Stages>
+    struct Pipeline;
+
+    template <>
+    struct Pipeline<>
+    {
+        static XMVECTOR XM_CALLCONV Apply(FXMVECTOR color, const StageParams&)
+        {
+            return color;
+        }
+
+        template <typename F>
+        static void ForEachStage(F&&)
+        {
+        }
+    };
+
+    template <typename First, typename... Rest>
+    struct Pipeline<First, Rest...>
+    {
+        static XMVECTOR XM_CALLCONV Apply(FXMVECTOR color, const StageParams& params)
+        {
+            return Pipeline<Rest...>::Apply(First::Apply(color, params), params);
+        }
+
+        template <typename F>
+        static void ForEachStage(F&& f)
+        {
+            f(First());
+            Pipeline<Rest...>::ForEachStage(f);
+        }
+    };
+
+    /// <summary>
+    /// The stages for each fusable RenderEffectKind and display mode, as in
+    /// HDRImageViewerRenderer::SetRenderOptions.
+    /// </summary>
+    template <RenderEffectKind Kind, bool IsHdrDisplay>
+    struct RenderStages;
+
+    template <bool IsHdrDisplay>
+    struct RenderStages<RenderEffectKind::None, IsHdrDisplay> :
+        Pipeline<WhiteScaleStage> {};
+
+    template <>
+    struct RenderStages<RenderEffectKind::HdrTonemap, true> :
+        Pipeline<WhiteScaleStage, SimpleTonemapStage> {};
+
+    template <>
+    struct RenderStages<RenderEffectKind::HdrTonemap, false> :
+        Pipeline<WhiteScaleStage, SimpleTonemapStage, OutputScaleStage> {};
+
+    template <bool IsHdrDisplay>
+    struct RenderStages<RenderEffectKind::SdrOverlay, IsHdrDisplay> :
+        Pipeline<SdrOverlayStage, WhiteScaleStage> {};
+
+    template <bool IsHdrDisplay>
+    struct RenderStages<RenderEffectKind::LuminanceHeatmap, IsHdrDisplay> :
+        Pipeline<LuminanceHeatmapStage, WhiteScaleStage> {};
+
+    /// <summary>
+    /// Calls f with the RenderStages instance for kind and display mode.
+    /// </summary>
+    template <typename F>
+    HRESULT DispatchStages(RenderEffectKind kind, bool isHdrDisplay, F&& f)
+    {
+        switch (kind)
+        {
+        case RenderEffectKind::None:
+            f(RenderStages<RenderEffectKind::None, false>());
+            return S_OK;
+
+        case RenderEffectKind::HdrTonemap:
+            if (isHdrDisplay)
+            {
+                f(RenderStages<RenderEffectKind::HdrTonemap, true>());
+            }
+            else
+            {
+                f(RenderStages<RenderEffectKind::HdrTonemap, false>());
+            }
+            return S_OK;
+
+        case RenderEffectKind::SdrOverlay:
+            f(RenderStages<RenderEffectKind::SdrOverlay, false>());
+            return S_OK;
+
+        case RenderEffectKind::LuminanceHeatmap:
+            f(RenderStages<RenderEffectKind::LuminanceHeatmap, false>());
+            return S_OK;
+
+        default:
+            return E_INVALIDARG;
+        }
+    }
+
+    StageParams GetStageParams(const RenderPipelineConstants& constants)
+    {
+        StageParams params;
+        params.whiteScale = XMVectorReplicate(constants.whiteScale);
+        params.tonemapInputMax = XMVectorReplicate(constants.tonemapInputMax / 80.0f); // scRGB 1.0 == 80 nits.
+        params.tonemapOutputMax = XMVectorReplicate(constants.tonemapOutputMax / 80.0f);
+        params.outputScale = XMVectorReplicate(constants.outputScale);
+
+        return params;
+    }
+
+    /// <summary>
+    /// Applies PipelineT::Apply to every pixel: one pass over the image.
+    /// </summary>
+    template <typename PipelineT>
+    void ProcessRows(
+        const StageParams& params,
+        const uint8_t* src,
+        UINT srcStride,
+        uint8_t* dst,
+        UINT dstStride,
+        UINT width,
+        UINT height)
+    {
+        concurrency::parallel_for(0u, (height + sc_RowsPerTask - 1) / sc_RowsPerTask, [&](UINT task)
+        {
+            for (UINT y = task * sc_RowsPerTask; y < (std::min)((task + 1) * sc_RowsPerTask, height); y++)
+            {
+                auto in = reinterpret_cast<const XMHALF4*>(src + static_cast<size_t>(y) * srcStride);
+                auto out = reinterpret_cast<XMHALF4*>(dst + static_cast<size_t>(y) * dstStride);
+
+                for (UINT x = 0; x < width; x++)
+                {
+                    XMStoreHalf4(&out[x], PipelineT::Apply(XMLoadHalf4(&in[x]), params));
+                }
+            }
+        });
+    }
+}
+
+bool RenderPipeline::IsFusable(RenderEffectKind kind)
+{
+    return kind != RenderEffectKind::SphereMap;
+}
+
+HRESULT RenderPipeline::Process(
+    RenderEffectKind kind,
+    bool isHdrDisplay,
+    const RenderPipelineConstants& constants,
+    const uint8_t* src,
+    UINT srcStride,
+    uint8_t* dst,
+    UINT dstStride,
+    UINT width,
+    UINT height)
+{
+    StageParams params = GetStageParams(constants);
+
+    return DispatchStages(kind, isHdrDisplay, [&](auto stages)
+    {
+        ProcessRows<decltype(stages)>(params, src, srcStride, dst, dstStride, width, height);
+    });
+}
+
+HRESULT RenderPipeline::ProcessChained(
+    RenderEffectKind kind,
+    bool isHdrDisplay,
+    const RenderPipelineConstants& constants,
+    const uint8_t* src,
+    UINT srcStride,
+    uint8_t* dst,
+    UINT dstStride,
+    UINT width,
+    UINT height)
+{
+    StageParams params = GetStageParams(constants);
+
+    return DispatchStages(kind, isHdrDisplay, [&](auto stages)
+    {
+        // The first stage reads the source; each later one rewrites dst, as an intermediate surface.
+        const uint8_t* input = src;
+        UINT inputStride = srcStride;
+
+        decltype(stages)::ForEachStage([&](auto stage)
+        {
+            ProcessRows<Pipeline<decltype(stage)>>(params, input, inputStride, dst, dstStride, width, height);
+
+            input = dst;
+            inputStride = dstStride;
+        });
+    });
+}
@@ -0,0 +1,79 @@
+//*********************************************************
+//
+// RenderPipeline
+//
+// The renderer's per pixel stages after color management
+// (white scale, the RenderEffectKind, and the SDR white
+// level correction used with the tonemapper on SDR displays)
+// on the CPU, for FP16 scRGB images.
+//
+// The stages for each RenderEffectKind and display mode are
+// composed at compile time into one kernel, which loads and
+// stores each pixel once; FusedRenderEffect is its GPU
+// counterpart. ProcessChained instead applies one stage per
+// pass over the whole image, like the chained effect graph,
+// as a reference and a benchmark baseline.
+//
+// Stages match RenderStages.hlsli; the HDR tonemap stage is
+// the custom Reinhard tonemapper. SphereMap samples its
+// input spatially and is not supported.
+//
+//*********************************************************
+
+#pragma once
+
+#include "RenderOptions.h"
+
+namespace HDRImageViewer
+{
+    /// <summary>
+    /// Parameters of the stages, as set on the renderer's effects.
+    /// </summary>
+    struct RenderPipelineConstants
+    {
+        float   whiteScale;         // SDR white level and brightness adjustment.
+        float   tonemapInputMax;    // In nits.
+        float   tonemapOutputMax;   // In nits.
+        float   outputScale;        // SDR white level correction; SDR displays only.
+    };
+
+    class RenderPipeline
+    {
+    public:
+        /// <summary>
+        /// Whether kind has a fused kernel: all kinds except SphereMap.
+        /// </summary>
+        static bool IsFusable(RenderEffectKind kind);
+
+        /// <summary>
+        /// Applies the stages for kind and display mode to rows of width premultiplied FP16 RGBA
+        /// pixels in a single pass, in parallel. src and dst may be the same. Returns
+        /// E_INVALIDARG if IsFusable is false.
+        /// </summary>
+        static HRESULT Process(
+            RenderEffectKind kind,
+            bool isHdrDisplay,
+            const RenderPipelineConstants& constants,
+            _In_ const uint8_t* src,
+            UINT srcStride,
+            _Out_ uint8_t* dst,
+            UINT dstStride,
+            UINT width,
+            UINT height);
+
+        /// <summary>
+        /// As Process, but applies each stage in a separate parallel pass over the whole image,
+        /// through dst, as the chained Direct2D effect graph does.
+        /// </summary>
+        static HRESULT ProcessChained(
+            RenderEffectKind kind,
+            bool isHdrDisplay,
+            const RenderPipelineConstants& constants,
+            _In_ const uint8_t* src,
+            UINT srcStride,
+            _Out_ uint8_t* dst,
+            UINT dstStride,
+            UINT width,
+            UINT height);
+    };
+}
@@ -0,0 +1,704 @@
+#include "pch.h"
+#include "RgbeCodec.h"
+#include "DirectXHelper.h"
+
+#include <DirectXPackedVector.h>
+#include <ppl.h>
+
+#if defined(_M_ARM) || defined(_M_ARM64)
+#include <arm_neon.h>
+#else
+#include <emmintrin.h>
+#endif
+
+using namespace HDRImageViewer;
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+using namespace Microsoft::WRL;
+using namespace Microsoft::WRL::Wrappers;
+
+static const UINT sc_RowsPerTask = 16; // Scanlines per parallel work item when decoding, encoding or expanding.
+
+namespace
+{
+    /// <summary>
+    /// Interleaves the four component planes of an adaptive RLE scanline into RGBE pixels.
+    /// </summary>
+    void InterleavePlanes(_In_reads_bytes_(width * 4) const uint8_t* planes, UINT width, _Out_writes_bytes_(width * 4) uint8_t* scanline)
+    {
+        const uint8_t* r = planes;
+        const uint8_t* g = planes + width;
+        const uint8_t* b = planes + width * 2;
+        const uint8_t* e = planes + width * 3;
+
+        UINT x = 0;
+
+#if defined(_M_ARM) || defined(_M_ARM64)
+        for (; x + 16 <= width; x += 16)
+        {
+            uint8x16x4_t v = { { vld1q_u8(r + x), vld1q_u8(g + x), vld1q_u8(b + x), vld1q_u8(e + x) } };
+            vst4q_u8(scanline + x * 4, v);
+        }
+#else
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i vr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + x));
+            __m128i vg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + x));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+            __m128i ve = _mm_loadu_si128(reinterpret_cast<const __m128i*>(e + x));
+
+            __m128i rgLo = _mm_unpacklo_epi8(vr, vg);
+            __m128i rgHi = _mm_unpackhi_epi8(vr, vg);
+            __m128i beLo = _mm_unpacklo_epi8(vb, ve);
+            __m128i beHi = _mm_unpackhi_epi8(vb, ve);
+
+            auto dst = reinterpret_cast<__m128i*>(scanline + x * 4);
+            _mm_storeu_si128(dst + 0, _mm_unpacklo_epi16(rgLo, beLo));
+            _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(rgLo, beLo));
+            _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(rgHi, beHi));
+            _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(rgHi, beHi));
+        }
+#endif
+
+        for (; x < width; x++)
+        {
+            scanline[x * 4 + 0] = r[x];
+            scanline[x * 4 + 1] = g[x];
+            scanline[x * 4 + 2] = b[x];
+            scanline[x * 4 + 3] = e[x];
+        }
+    }
+
+    /// <summary>
+    /// Presents an RgbeImage to WIC and Direct2D, expanding to FP16 inside CopyPixels.
+    /// </summary>
+    class RgbeBitmapSource : public RuntimeClass<RuntimeClassFlags<ClassicCom>, IWICBitmapSource>
+    {
+    public:
+        HRESULT RuntimeClassInitialize(const std::shared_ptr<const RgbeImage>& image)
+        {
+            m_image = image;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP GetSize(_Out_ UINT* width, _Out_ UINT* height) override
+        {
+            if (!width || !height) return E_INVALIDARG;
+
+            *width = m_image->width;
+            *height = m_image->height;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP GetPixelFormat(_Out_ WICPixelFormatGUID* format) override
+        {
+            if (!format) return E_INVALIDARG;
+
+            *format = GUID_WICPixelFormat64bppPRGBAHalf;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP GetResolution(_Out_ double* dpiX, _Out_ double* dpiY) override
+        {
+            if (!dpiX || !dpiY) return E_INVALIDARG;
+
+            *dpiX = *dpiY = 96.0;
+            return S_OK;
+        }
+
+        IFACEMETHODIMP CopyPalette(_In_ IWICPalette*) override
+        {
+            return WINCODEC_ERR_PALETTEUNAVAILABLE;
+        }
+
+        IFACEMETHODIMP CopyPixels(_In_opt_ const WICRect* rect, UINT stride, UINT bufferSize, _Out_writes_(bufferSize) BYTE* buffer) override
+        {
+            if (!buffer) return E_INVALIDARG;
+
+            const UINT width = m_image->width;
+            const UINT height = m_image->height;
+
+            WICRect rc = { 0, 0, static_cast<INT>(width), static_cast<INT>(height) };
+            if (rect)
+            {
+                rc = *rect;
+            }
+
+            if (rc.X < 0 || rc.Y < 0 || rc.Width < 0 || rc.Height < 0 ||
+                static_cast<UINT>(rc.X) + static_cast<UINT>(rc.Width) > width ||
+                static_cast<UINT>(rc.Y) + static_cast<UINT>(rc.Height) > height)
+            {
+                return E_INVALIDARG;
+            }
+
+            if (rc.Width == 0 || rc.Height == 0) return S_OK;
+
+            const UINT rowBytes = static_cast<UINT>(rc.Width) * sizeof(XMHALF4);
+            const UINT rows = static_cast<UINT>(rc.Height);
+            if (stride < rowBytes) return E_INVALIDARG;
+
+            if (bufferSize / stride < rows - 1 ||
+                bufferSize - (rows - 1) * stride < rowBytes)
+            {
+                return WINCODEC_ERR_INSUFFICIENTBUFFER;
+            }
+
+            auto expandRows = [&](UINT firstRow, UINT lastRow)
+            {
+                for (UINT y = firstRow; y < lastRow; y++)
+                {
+                    auto src = m_image->pixels.data() + (static_cast<size_t>(rc.Y + y) * width + rc.X) * 4;
+                    auto dst = reinterpret_cast<uint16_t*>(buffer + static_cast<size_t>(y) * stride);
+
+                    RgbeCodec::ExpandToHalf(src, static_cast<size_t>(rc.Width), dst);
+                }
+            };
+
+            // Direct2D requests large regions when it first caches the image; split those across cores.
+            if (rows <= sc_RowsPerTask)
+            {
+                expandRows(0, rows);
+            }
+            else
+            {
+                concurrency::parallel_for(0u, (rows + sc_RowsPerTask - 1) / sc_RowsPerTask, [&](UINT task)
+                {
+                    expandRows(task * sc_RowsPerTask, min((task + 1) * sc_RowsPerTask, rows));
+                });
+            }
+
+            return S_OK;
+        }
+
+    private:
+        std::shared_ptr<const RgbeImage> m_image;
+    };
+}
+
+/// <summary>
+/// Reads and decodes a Radiance file from disk.
+/// </summary>
+HRESULT RgbeCodec::DecodeFile(const wchar_t* filename, RgbeImage& image, const concurrency::cancellation_token& cancel)
+{
+    FileHandle file(CreateFile2(filename, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr));
+    if (!file.IsValid())
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return DecodeFile(file.Get(), image, cancel);
+}
+
+/// <summary>
+/// Decodes a Radiance file from an open handle. The file is mapped rather than read, so the
+/// encoded scanlines are never copied.
+/// </summary>
+HRESULT RgbeCodec::DecodeFile(HANDLE file, RgbeImage& image, const concurrency::cancellation_token& cancel)
+{
+    DX::FileView view;
+    HRESULT hr = view.Map(file);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    return Decode(view.Data(), view.Size(), image, cancel);
+}
+
+/// <summary>
+/// Decodes a Radiance file from the current position of a stream to the end.
+/// </summary>
+HRESULT RgbeCodec::DecodeStream(IStream* stream, RgbeImage& image, const concurrency::cancellation_token& cancel)
+{
+    // The encoded file is only held while decoding.
+    std::vector<uint8_t> data;
+    HRESULT hr = DX::ReadStreamToEnd(stream, data);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    return Decode(data.data(), data.size(), image, cancel);
+}
+
+/// <summary>
+/// Parses the header and resolution line. headerSize receives the offset of the first scanline.
+/// </summary>
+HRESULT RgbeCodec::ParseHeader(const uint8_t* data, size_t size, UINT* width, UINT* height, size_t* headerSize)
+{
+    *width = 0;
+    *height = 0;
+    *headerSize = 0;
+
+    if (!data) return E_INVALIDARG;
+
+    auto cursor = data;
+    auto end = data + size;
+
+    // Reads one header line without its terminator.
+    std::string line;
+    auto readLine = [&]()
+    {
+        auto eol = static_cast<const uint8_t*>(memchr(cursor, '\n', end - cursor));
+        if (!eol) return false;
+
+        line.assign(reinterpret_cast<const char*>(cursor), eol - cursor);
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+
+        cursor = eol + 1;
+        return true;
+    };
+
+    if (!readLine() || line.compare(0, 2, "#?") != 0)
+    {
+        return WINCODEC_ERR_UNKNOWNIMAGEFORMAT;
+    }
+
+    // Header variables end at the first blank line.
+    for (;;)
+    {
+        if (!readLine()) return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+        if (line.empty()) break;
+
+        if (line.compare(0, 7, "FORMAT=") == 0 &&
+            line.compare(7, std::string::npos, "32-bit_rle_rgbe") != 0)
+        {
+            return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED); // e.g. 32-bit_rle_xyze
+        }
+    }
+
+    if (!readLine()) return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+    int parsedHeight = 0;
+    int parsedWidth = 0;
+    if (sscanf_s(line.c_str(), "-Y %d +X %d", &parsedHeight, &parsedWidth) != 2)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    if (parsedWidth <= 0 || parsedHeight <= 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    *width = static_cast<UINT>(parsedWidth);
+    *height = static_cast<UINT>(parsedHeight);
+    *headerSize = cursor - data;
+    return S_OK;
+}
+
+/// <summary>
+/// Decodes a Radiance file held in memory to 32bpp RGBE.
+/// </summary>
+/// <remarks>
+/// Supports the 32-bit_rle_rgbe format with flat, original RLE and adaptive RLE scanlines,
+/// in the standard "-Y height +X width" orientation.
+/// </remarks>
+HRESULT RgbeCodec::Decode(const uint8_t* data, size_t size, RgbeImage& image, const concurrency::cancellation_token& cancel)
+{
+    image.width = 0;
+    image.height = 0;
+    image.pixels.clear();
+
+    if (!data) return E_INVALIDARG;
+
+    UINT headerWidth = 0;
+    UINT headerHeight = 0;
+    size_t headerSize = 0;
+    HRESULT hr = ParseHeader(data, size, &headerWidth, &headerHeight, &headerSize);
+    if (FAILED(hr))
+        return hr;
+
+    auto cursor = data + headerSize;
+    auto end = data + size;
+
+    int height = static_cast<int>(headerHeight);
+    int width = static_cast<int>(headerWidth);
+
+    uint64_t pixelBytes = static_cast<uint64_t>(width) * static_cast<uint64_t>(height) * 4;
+    if (pixelBytes > SIZE_MAX)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // Scanlines are variable length, so first index where each one starts. This pass performs
+    // all validation, so the parallel pass below cannot fail on malformed data.
+    std::vector<const uint8_t*> scanlines;
+    try
+    {
+        scanlines.resize(static_cast<size_t>(height));
+        image.pixels.resize(static_cast<size_t>(pixelBytes));
+    }
+    catch (const std::bad_alloc&)
+    {
+        image.pixels.clear();
+        return E_OUTOFMEMORY;
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        if (y % sc_RowsPerTask == 0 && cancel.is_canceled())
+        {
+            image.pixels.clear();
+            return E_ABORT;
+        }
+
+        scanlines[y] = cursor;
+
+        hr = DecodeScanline(&cursor, end, static_cast<UINT>(width), nullptr, nullptr);
+        if (FAILED(hr))
+        {
+            image.pixels.clear();
+            return hr;
+        }
+    }
+
+    const UINT rows = static_cast<UINT>(height);
+    const size_t rowBytes = static_cast<size_t>(width) * 4;
+
+    try
+    {
+        concurrency::parallel_for(0u, (rows + sc_RowsPerTask - 1) / sc_RowsPerTask, [&](UINT task)
+        {
+            if (cancel.is_canceled())
+                return;
+
+            std::vector<uint8_t> planes(rowBytes);
+
+            for (UINT y = task * sc_RowsPerTask; y < min((task + 1) * sc_RowsPerTask, rows); y++)
+            {
+                auto p = scanlines[y];
+                DecodeScanline(&p, end, static_cast<UINT>(width), image.pixels.data() + y * rowBytes, planes.data());
+            }
+        });
+    }
+    catch (const std::bad_alloc&)
+    {
+        image.pixels.clear();
+        return E_OUTOFMEMORY;
+    }
+
+    // Bands skipped after cancellation leave the image incomplete.
+    if (cancel.is_canceled())
+    {
+        image.pixels.clear();
+        return E_ABORT;
+    }
+
+    image.width = static_cast<UINT>(width);
+    image.height = static_cast<UINT>(height);
+
+    return S_OK;
+}
+
+/// <summary>
+/// Decodes one scanline and advances the cursor past it. Adaptive RLE scanlines are decoded
+/// into planes, a scratch buffer of width * 4 bytes, and then interleaved. If scanline is null
+/// the scanline is only validated and skipped.
+/// </summary>
+HRESULT RgbeCodec::DecodeScanline(const uint8_t** cursor, const uint8_t* end, UINT width, uint8_t* scanline, uint8_t* planes)
+{
+    auto p = *cursor;
+
+    // Adaptive RLE scanlines start with (2, 2, width) and store each component as a separate
+    // run length encoded plane. Writers only use it for widths in [8, 0x7fff].
+    if (width >= 8 && width <= 0x7fff && end - p >= 4 &&
+        p[0] == 2 && p[1] == 2 && ((static_cast<UINT>(p[2]) << 8) | p[3]) == width)
+    {
+        p += 4;
+
+        for (UINT c = 0; c < 4; c++)
+        {
+            uint8_t* plane = scanline ? planes + c * width : nullptr;
+
+            UINT x = 0;
+            while (x < width)
+            {
+                if (p >= end) return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+                UINT count = *p++;
+                if (count > 128)
+                {
+                    // Run of a single value.
+                    count -= 128;
+                    if (count > width - x) return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                    if (p >= end) return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+                    if (plane)
+                    {
+                        memset(plane + x, *p, count);
+                    }
+
+                    p++;
+                }
+                else
+                {
+                    // Literal values.
+                    if (count == 0 || count > width - x) return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+                    if (count > static_cast<size_t>(end - p)) return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+                    if (plane)
+                    {
+                        memcpy(plane + x, p, count);
+                    }
+
+                    p += count;
+                }
+
+                x += count;
+            }
+        }
+
+        if (scanline)
+        {
+            InterleavePlanes(planes, width, scanline);
+        }
+    }
+    else
+    {
+        // Flat pixels, possibly using the original encoding where a (1, 1, 1, n) pixel repeats
+        // the previous pixel n times, and consecutive repeats contribute successive bytes of n.
+        UINT x = 0;
+        UINT shift = 0;
+        while (x < width)
+        {
+            if (end - p < 4) return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+
+            if (p[0] == 1 && p[1] == 1 && p[2] == 1)
+            {
+                if (x == 0 || shift > 16) return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+                UINT count = static_cast<UINT>(p[3]) << shift;
+                if (count > width - x) return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+
+                for (; count > 0; count--, x++)
+                {
+                    if (scanline)
+                    {
+                        memcpy(scanline + x * 4, scanline + (x - 1) * 4, 4);
+                    }
+                }
+
+                shift += 8;
+            }
+            else
+            {
+                if (scanline)
+                {
+                    memcpy(scanline + x * 4, p, 4);
+                }
+
+                x++;
+                shift = 0;
+            }
+
+            p += 4;
+        }
+    }
+
+    *cursor = p;
+    return S_OK;
+}
+
+/// <summary>
+/// Encodes an image as a Radiance file using adaptive RLE scanlines.
+/// </summary>
+HRESULT RgbeCodec::Encode(const RgbeImage& image, std::vector<uint8_t>& file)
+{
+    file.clear();
+
+    if (image.width == 0 || image.height == 0 ||
+        image.pixels.size() != static_cast<size_t>(image.width) * image.height * 4)
+    {
+        return E_INVALIDARG;
+    }
+
+    char header[128];
+    int headerLength = sprintf_s(header, "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %u +X %u\n", image.height, image.width);
+    if (headerLength < 0) return E_FAIL;
+
+    const UINT rows = image.height;
+    const size_t rowBytes = static_cast<size_t>(image.width) * 4;
+    const UINT numTasks = (rows + sc_RowsPerTask - 1) / sc_RowsPerTask;
+
+    try
+    {
+        // Each task encodes a band of scanlines into its own buffer; the bands are then
+        // concatenated in order.
+        std::vector<std::vector<uint8_t>> bands(numTasks);
+
+        concurrency::parallel_for(0u, numTasks, [&](UINT task)
+        {
+            auto& band = bands[task];
+            band.reserve(sc_RowsPerTask * rowBytes);
+
+            for (UINT y = task * sc_RowsPerTask; y < min((task + 1) * sc_RowsPerTask, rows); y++)
+            {
+                EncodeScanline(image.pixels.data() + y * rowBytes, image.width, band);
+            }
+        });
+
+        size_t total = headerLength;
+        for (auto& band : bands)
+        {
+            total += band.size();
+        }
+
+        file.reserve(total);
+        file.insert(file.end(), header, header + headerLength);
+        for (auto& band : bands)
+        {
+            file.insert(file.end(), band.begin(), band.end());
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        file.clear();
+        return E_OUTOFMEMORY;
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Appends one scanline to out, using adaptive RLE where the format allows it.
+/// </summary>
+/// <remarks>
+/// Runs shorter than 4 bytes are folded into literals, as in the reference Radiance encoder.
+/// </remarks>
+void RgbeCodec::EncodeScanline(const uint8_t* scanline, UINT width, std::vector<uint8_t>& out)
+{
+    if (width < 8 || width > 0x7fff)
+    {
+        out.insert(out.end(), scanline, scanline + static_cast<size_t>(width) * 4);
+        return;
+    }
+
+    out.push_back(2);
+    out.push_back(2);
+    out.push_back(static_cast<uint8_t>(width >> 8));
+    out.push_back(static_cast<uint8_t>(width & 0xff));
+
+    for (UINT c = 0; c < 4; c++)
+    {
+        auto value = [&](UINT x) { return scanline[x * 4 + c]; };
+
+        UINT cur = 0;
+        while (cur < width)
+        {
+            // Find the next run of at least 4 equal values.
+            UINT runStart = cur;
+            UINT runCount = 0;
+            UINT prevRunCount = 0;
+            while (runCount < 4 && runStart < width)
+            {
+                runStart += runCount;
+                prevRunCount = runCount;
+                runCount = 1;
+                while (runStart + runCount < width && runCount < 127 &&
+                    value(runStart) == value(runStart + runCount))
+                {
+                    runCount++;
+                }
+            }
+
+            // A short run immediately before the long one is still cheaper as a run.
+            if (prevRunCount > 1 && prevRunCount == runStart - cur)
+            {
+                out.push_back(static_cast<uint8_t>(128 + prevRunCount));
+                out.push_back(value(cur));
+                cur = runStart;
+            }
+
+            // Literals up to the start of the run.
+            while (cur < runStart)
+            {
+                UINT count = min(128u, runStart - cur);
+                out.push_back(static_cast<uint8_t>(count));
+                for (UINT i = 0; i < count; i++)
+                {
+                    out.push_back(value(cur + i));
+                }
+
+                cur += count;
+            }
+
+            if (runCount >= 4)
+            {
+                out.push_back(static_cast<uint8_t>(128 + runCount));
+                out.push_back(value(runStart));
+                cur += runCount;
+            }
+        }
+    }
+}
+
+HRESULT RgbeCodec::CreateBitmapSource(const std::shared_ptr<const RgbeImage>& image, IWICBitmapSource** source)
+{
+    if (!source) return E_POINTER;
+    *source = nullptr;
+
+    if (!image || image->pixels.empty()) return E_INVALIDARG;
+
+    return MakeAndInitialize<RgbeBitmapSource>(source, image);
+}
+
+/// <summary>
+/// The value of an RGBE pixel is mantissa * 2^(e - 136), or black when e is 0. The scale is
+/// built directly from the exponent byte as the float 2^((e - 1) - 127), then multiplied by
+/// 2^-8, which keeps the float exponent field in range for every e.
+/// </summary>
+void RgbeCodec::ExpandToHalf(const uint8_t* rgbe, size_t count, uint16_t* half)
+{
+    static const XMVECTORF32 s_mantissaScale = { { { 1.0f / 256.0f, 1.0f / 256.0f, 1.0f / 256.0f, 0.0f } } };
+
+    auto src = reinterpret_cast<const XMUBYTE4*>(rgbe);
+    auto dst = reinterpret_cast<XMHALF4*>(half);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t e = src[i].w;
+        XMVECTOR exponent = XMVectorReplicateInt((e > 0 ? e - 1 : 0) << 23);
+
+        XMVECTOR v = XMVectorMultiply(XMLoadUByte4(&src[i]), s_mantissaScale);
+        v = XMVectorMultiply(v, exponent);
+        v = XMVectorSelect(g_XMIdentityR3, v, g_XMSelect1110);
+
+        XMStoreHalf4(&dst[i], v);
+    }
+}
+
+/// <summary>
+/// Follows the reference Radiance encoder: the largest component's frexp mantissa sets the
+/// shared exponent, and components are truncated to 8 bits.
+/// </summary>
+void RgbeCodec::CompressFromHalf(const uint16_t* half, size_t count, uint8_t* rgbe)
+{
+    auto src = reinterpret_cast<const XMHALF4*>(half);
+
+    for (size_t i = 0; i < count; i++, rgbe += 4)
+    {
+        XMFLOAT4 v;
+        XMStoreFloat4(&v, XMVectorMax(XMLoadHalf4(&src[i]), g_XMZero));
+
+        float maxComponent = max(v.x, max(v.y, v.z));
+        if (maxComponent < 1e-32f)
+        {
+            rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+            continue;
+        }
+
+        int exponent;
+        float scale = frexpf(maxComponent, &exponent) * 256.0f / maxComponent;
+
+        rgbe[0] = static_cast<uint8_t>(v.x * scale);
+        rgbe[1] = static_cast<uint8_t>(v.y * scale);
+        rgbe[2] = static_cast<uint8_t>(v.z * scale);
+        rgbe[3] = static_cast<uint8_t>(exponent + 128);
+    }
+}
@@ -0,0 +1,106 @@
+//*********************************************************
+//
+// RgbeCodec
+//
+// Reads and writes Radiance RGBE (.hdr) images. Images are kept
+// resident in their native 32bpp shared exponent form, which is
+// a quarter of the size of the FP32 expansion performed by
+// DirectXTex.
+//
+// Pixels are expanded to FP16 only when a consumer requests
+// them through IWICBitmapSource::CopyPixels, and only for the
+// requested rectangle.
+//
+// Scanlines are run length encoded independently, so both
+// decoding and encoding are spread across all cores.
+//
+//*********************************************************
+
+#pragma once
+
+#include <vector>
+
+namespace HDRImageViewer
+{
+    /// <summary>
+    /// A decoded Radiance image: top-down, tightly packed 32bpp RGBE
+    /// (R, G, B mantissas followed by the shared exponent).
+    /// </summary>
+    struct RgbeImage
+    {
+        UINT                    width;
+        UINT                    height;
+        std::vector<uint8_t>    pixels;
+    };
+
+    class RgbeCodec
+    {
+    public:
+        // Decoding returns E_ABORT as soon as cancel is canceled; it is checked between bands of scanlines.
+        static HRESULT DecodeFile(
+            _In_z_ const wchar_t* filename,
+            _Out_ RgbeImage& image,
+            const concurrency::cancellation_token& cancel = concurrency::cancellation_token::none());
+        static HRESULT DecodeFile(
+            _In_ HANDLE file,
+            _Out_ RgbeImage& image,
+            const concurrency::cancellation_token& cancel = concurrency::cancellation_token::none());
+        static HRESULT DecodeStream(
+            _In_ IStream* stream,
+            _Out_ RgbeImage& image,
+            const concurrency::cancellation_token& cancel = concurrency::cancellation_token::none());
+        static HRESULT Decode(
+            _In_reads_bytes_(size) const uint8_t* data,
+            size_t size,
+            _Out_ RgbeImage& image,
+            const concurrency::cancellation_token& cancel = concurrency::cancellation_token::none());
+        static HRESULT Encode(const RgbeImage& image, _Out_ std::vector<uint8_t>& file);
+
+        /// <summary>
+        /// Reads the image size from the header without decoding any scanlines.
+        /// </summary>
+        static HRESULT ParseHeader(
+            _In_reads_bytes_(size) const uint8_t* data,
+            size_t size,
+            _Out_ UINT* width,
+            _Out_ UINT* height,
+            _Out_ size_t* headerSize);
+
+        /// <summary>
+        /// Wraps a decoded image as a GUID_WICPixelFormat64bppPRGBAHalf bitmap source.
+        /// Alpha is always 1, so this is equivalent to straight alpha.
+        /// </summary>
+        static HRESULT CreateBitmapSource(
+            const std::shared_ptr<const RgbeImage>& image,
+            _COM_Outptr_ IWICBitmapSource** source);
+
+        /// <summary>
+        /// Expands RGBE pixels to R16G16B16A16_FLOAT with alpha = 1.
+        /// </summary>
+        static void ExpandToHalf(
+            _In_reads_bytes_(count * 4) const uint8_t* rgbe,
+            size_t count,
+            _Out_writes_(count * 4) uint16_t* half);
+
+        /// <summary>
+        /// Packs R16G16B16A16_FLOAT pixels into RGBE; alpha is dropped and negative values clamp to 0.
+        /// </summary>
+        static void CompressFromHalf(
+            _In_reads_(count * 4) const uint16_t* half,
+            size_t count,
+            _Out_writes_bytes_(count * 4) uint8_t* rgbe);
+
+    private:
+        static HRESULT DecodeScanline(
+            _Inout_ const uint8_t** cursor,
+            _In_ const uint8_t* end,
+            UINT width,
+            _Out_writes_bytes_opt_(width * 4) uint8_t* scanline,
+            _Out_writes_bytes_opt_(width * 4) uint8_t* planes);
+
+        static void EncodeScanline(
+            _In_reads_bytes_(width * 4) const uint8_t* scanline,
+            UINT width,
+            _Inout_ std::vector<uint8_t>& out);
+    };
+}
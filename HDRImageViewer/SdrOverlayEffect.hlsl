@@ -15,6 +15,7 @@
 
 // Note that the custom build step must provide the correct path to find d2d1effecthelpers.hlsli when calling fxc.exe.
 #include "d2d1effecthelpers.hlsli"
+#include "RenderStages.hlsli"
 
 cbuffer constants : register(b0)
 {
@@ -23,19 +24,5 @@ cbuffer constants : register(b0)
 
 D2D_PS_ENTRY(main)
 {
-    float4 output = D2DGetInput(0);
-
-    // Detect if any color component is outside of [0, 1] SDR numeric range.
-    float4 isOutsideSdrVec = abs(sign(output - saturate(output)));
-    float isOutsideSdr = max(max(isOutsideSdrVec.r, isOutsideSdrVec.g), isOutsideSdrVec.b); // 1 = out, 0 = in
-    float isInsideSdr = 1 - isOutsideSdr;                                                   // 0 = out, 1 = in
-
-    // Convert all sRGB/SDR colors to grayscale.
-    float lum = dot(float3(0.3f, 0.59f, 0.11f), output.rgb);
-    float4 insideSdrColor = float4(lum, lum, lum, 1.0f);
-
-    // Pass through wide gamut and high dynamic range colors.
-    float4 outsideSdrColor = float4(output.rgb, 1.0f);
-
-    return insideSdrColor * isInsideSdr + outsideSdrColor * isOutsideSdr;
+    return SdrOverlay(D2DGetInput(0));
 }
\ No newline at end of file
@@ -16,6 +16,7 @@
 
 // Note that the custom build step must provide the correct path to find d2d1effecthelpers.hlsli when calling fxc.exe.
 #include "d2d1effecthelpers.hlsli"
+#include "RenderStages.hlsli"
 
 cbuffer constants : register(b0)
 {
@@ -23,17 +24,6 @@ cbuffer constants : register(b0)
     float outputMax; // In scRGB values.
 };
 
-float reinhard(float input)
-{
-    float output = input / inputMax;
-
-    // Vanilla Reinhard normalizes color values to [0, 1].
-    // This modification scales to the luminance range of the display.
-    output = (output / 1 + output);
-
-    return output * outputMax;
-}
-
 // Implements a rudimentary HDR tonemapper using a modified Reinhard operator.
 
 // Like the Direct2D HDR tonemapper, this effect outputs values in scRGB scene-referred
@@ -42,11 +32,5 @@ float reinhard(float input)
 // white level adjustment to bring the numeric range of the output to [0, 1].
 D2D_PS_ENTRY(main)
 {
-    float4 color = D2DGetInput(0);
-
-    color.r = reinhard(color.r);
-    color.g = reinhard(color.g);
-    color.b = reinhard(color.b);
-
-    return color;
+    return SimpleTonemap(D2DGetInput(0), inputMax, outputMax);
 }
\ No newline at end of file
@@ -0,0 +1,456 @@
+#include "pch.h"
+#include "TransferFunctions.h"
+
+#include <array>
+
+#if !defined(_M_ARM) && !defined(_M_ARM64)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+using namespace HDRImageViewer;
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+// ST.2084 constants.
+static const float sc_PqM1 = 2610.0f / 16384.0f;
+static const float sc_PqM2 = 2523.0f / 4096.0f * 128.0f;
+static const float sc_PqC1 = 3424.0f / 4096.0f;
+static const float sc_PqC2 = 2413.0f / 4096.0f * 32.0f;
+static const float sc_PqC3 = 2392.0f / 4096.0f * 32.0f;
+static const float sc_PqPeakNits = 10000.0f;
+
+// BT.2100 HLG constants.
+static const float sc_HlgA = 0.17883277f;
+static const float sc_HlgB = 0.28466892f;
+static const float sc_HlgC = 0.55991073f;
+
+namespace
+{
+    typedef void (*FloatKernel)(_In_reads_(count) const float* src, _Out_writes_(count) float* dst, size_t count);
+
+    const float s_ln2 = 0.693147181f;
+    const float s_sqrt2 = 1.41421356f;
+    const float s_smallestNormal = 1.17549435e-38f;
+
+    // 2 / (k ln 2) for k = 1, 3, 5, 7: log2 of (1 + s) / (1 - s) as a series in s.
+    const float s_log2Series[4] = { 2.88539008f, 0.961796694f, 0.577078016f, 0.412198583f };
+
+    // (ln 2)^k / k! for k = 0 to 6: 2^f as a series in f.
+    const float s_exp2Series[7] = { 1.0f, 0.693147181f, 0.240226507f, 0.0555041087f, 0.00961812911f, 0.00133335581f, 0.000154035304f };
+
+    // Vector operations for the kernels, which are written once for both vector widths.
+
+    /// <summary>
+    /// Four lanes with DirectXMath: SSE2 on x86 and x64, NEON on ARM.
+    /// </summary>
+    struct DirectXMathFloat4
+    {
+        typedef XMVECTOR Vector;
+        static const size_t Width = 4;
+
+        static Vector Load(_In_reads_(4) const float* p) { return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(p)); }
+        static void Store(_Out_writes_(4) float* p, FXMVECTOR v) { XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(p), v); }
+        static Vector Replicate(float value) { return XMVectorReplicate(value); }
+
+        static Vector Add(FXMVECTOR a, FXMVECTOR b) { return XMVectorAdd(a, b); }
+        static Vector Subtract(FXMVECTOR a, FXMVECTOR b) { return XMVectorSubtract(a, b); }
+        static Vector Multiply(FXMVECTOR a, FXMVECTOR b) { return XMVectorMultiply(a, b); }
+        static Vector MultiplyAdd(FXMVECTOR a, FXMVECTOR b, FXMVECTOR c) { return XMVectorMultiplyAdd(a, b, c); }
+        static Vector Divide(FXMVECTOR a, FXMVECTOR b) { return XMVectorDivide(a, b); }
+        static Vector Min(FXMVECTOR a, FXMVECTOR b) { return XMVectorMin(a, b); }
+        static Vector Max(FXMVECTOR a, FXMVECTOR b) { return XMVectorMax(a, b); }
+        static Vector Sqrt(FXMVECTOR v) { return XMVectorSqrt(v); }
+        static Vector Round(FXMVECTOR v) { return XMVectorRound(v); }
+
+        // Select takes the lanes of ifTrue where control is set, as XMVectorSelect.
+        static Vector Greater(FXMVECTOR a, FXMVECTOR b) { return XMVectorGreater(a, b); }
+        static Vector Select(FXMVECTOR ifFalse, FXMVECTOR ifTrue, FXMVECTOR control) { return XMVectorSelect(ifFalse, ifTrue, control); }
+
+        /// <summary>
+        /// The unbiased exponent of positive normal values. Exponent bits converted from an integer
+        /// and scaled by 2^-23 are exact, which avoids integer shifts that DirectXMath lacks.
+        /// </summary>
+        static Vector Exponent(FXMVECTOR v)
+        {
+            static const XMVECTORU32 s_exponentMask = { { { 0x7F800000, 0x7F800000, 0x7F800000, 0x7F800000 } } };
+            return XMVectorSubtract(XMConvertVectorIntToFloat(XMVectorAndInt(v, s_exponentMask), 23), XMVectorReplicate(127.0f));
+        }
+
+        /// <summary>
+        /// The significand of positive normal values, in [1, 2).
+        /// </summary>
+        static Vector Significand(FXMVECTOR v)
+        {
+            static const XMVECTORU32 s_significandMask = { { { 0x007FFFFF, 0x007FFFFF, 0x007FFFFF, 0x007FFFFF } } };
+            return XMVectorOrInt(XMVectorAndInt(v, s_significandMask), g_XMOne);
+        }
+
+        /// <summary>
+        /// 2^n for integral n in [-126, 127], by building the exponent bits.
+        /// </summary>
+        static Vector Exp2Integer(FXMVECTOR n)
+        {
+            return XMConvertVectorFloatToInt(XMVectorAdd(n, XMVectorReplicate(127.0f)), 23);
+        }
+    };
+
+#if defined(_M_ARM) || defined(_M_ARM64)
+    typedef DirectXMathFloat4 Avx2Float8;
+#else
+    /// <summary>
+    /// Eight lanes with AVX2 and FMA.
+    /// </summary>
+    struct Avx2Float8
+    {
+        typedef __m256 Vector;
+        static const size_t Width = 8;
+
+        static Vector Load(_In_reads_(8) const float* p) { return _mm256_loadu_ps(p); }
+        static void Store(_Out_writes_(8) float* p, Vector v) { _mm256_storeu_ps(p, v); }
+        static Vector Replicate(float value) { return _mm256_set1_ps(value); }
+
+        static Vector Add(Vector a, Vector b) { return _mm256_add_ps(a, b); }
+        static Vector Subtract(Vector a, Vector b) { return _mm256_sub_ps(a, b); }
+        static Vector Multiply(Vector a, Vector b) { return _mm256_mul_ps(a, b); }
+        static Vector MultiplyAdd(Vector a, Vector b, Vector c) { return _mm256_fmadd_ps(a, b, c); }
+        static Vector Divide(Vector a, Vector b) { return _mm256_div_ps(a, b); }
+        static Vector Min(Vector a, Vector b) { return _mm256_min_ps(a, b); }
+        static Vector Max(Vector a, Vector b) { return _mm256_max_ps(a, b); }
+        static Vector Sqrt(Vector v) { return _mm256_sqrt_ps(v); }
+        static Vector Round(Vector v) { return _mm256_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+        static Vector Greater(Vector a, Vector b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+        static Vector Select(Vector ifFalse, Vector ifTrue, Vector control) { return _mm256_blendv_ps(ifFalse, ifTrue, control); }
+
+        static Vector Exponent(Vector v)
+        {
+            __m256i bits = _mm256_srli_epi32(_mm256_castps_si256(v), 23);
+            return _mm256_cvtepi32_ps(_mm256_sub_epi32(bits, _mm256_set1_epi32(127)));
+        }
+
+        static Vector Significand(Vector v)
+        {
+            __m256 significand = _mm256_and_ps(v, _mm256_castsi256_ps(_mm256_set1_epi32(0x007FFFFF)));
+            return _mm256_or_ps(significand, _mm256_set1_ps(1.0f));
+        }
+
+        static Vector Exp2Integer(Vector n)
+        {
+            __m256i exponent = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+            return _mm256_castsi256_ps(_mm256_slli_epi32(exponent, 23));
+        }
+    };
+#endif
+
+    /// <summary>
+    /// log2 of positive normal values: x = 2^e * m with m in [sqrt(1/2), sqrt(2)), and log2(m) is
+    /// the series in s = (m - 1) / (m + 1), which converges fast as |s| < 0.172.
+    /// </summary>
+    template <class Simd>
+    typename Simd::Vector Log2(typename Simd::Vector x)
+    {
+        typedef typename Simd::Vector Vector;
+
+        Vector one = Simd::Replicate(1.0f);
+        Vector e = Simd::Exponent(x);
+        Vector m = Simd::Significand(x);
+
+        Vector isLarge = Simd::Greater(m, Simd::Replicate(s_sqrt2));
+        m = Simd::Select(m, Simd::Multiply(m, Simd::Replicate(0.5f)), isLarge);
+        e = Simd::Select(e, Simd::Add(e, one), isLarge);
+
+        Vector s = Simd::Divide(Simd::Subtract(m, one), Simd::Add(m, one));
+        Vector s2 = Simd::Multiply(s, s);
+
+        Vector p = Simd::MultiplyAdd(Simd::Replicate(s_log2Series[3]), s2, Simd::Replicate(s_log2Series[2]));
+        p = Simd::MultiplyAdd(p, s2, Simd::Replicate(s_log2Series[1]));
+        p = Simd::MultiplyAdd(p, s2, Simd::Replicate(s_log2Series[0]));
+
+        return Simd::MultiplyAdd(s, p, e);
+    }
+
+    /// <summary>
+    /// 2^y, for y clamped to the normal range: y = n + f with integral n and f in [-0.5, 0.5], and
+    /// 2^f is a degree 6 polynomial.
+    /// </summary>
+    template <class Simd>
+    typename Simd::Vector Exp2(typename Simd::Vector y)
+    {
+        typedef typename Simd::Vector Vector;
+
+        y = Simd::Min(Simd::Max(y, Simd::Replicate(-126.0f)), Simd::Replicate(127.0f));
+
+        Vector n = Simd::Round(y);
+        Vector f = Simd::Subtract(y, n);
+
+        Vector p = Simd::Replicate(s_exp2Series[6]);
+        for (int k = 5; k >= 0; k--)
+        {
+            p = Simd::MultiplyAdd(p, f, Simd::Replicate(s_exp2Series[k]));
+        }
+
+        return Simd::Multiply(p, Simd::Exp2Integer(n));
+    }
+
+    /// <summary>
+    /// x^exponent for x >= 0.
+    /// </summary>
+    template <class Simd>
+    typename Simd::Vector Pow(typename Simd::Vector x, float exponent)
+    {
+        typedef typename Simd::Vector Vector;
+
+        Vector zero = Simd::Replicate(0.0f);
+        Vector v = Exp2<Simd>(Simd::Multiply(Log2<Simd>(Simd::Max(x, Simd::Replicate(s_smallestNormal))), Simd::Replicate(exponent)));
+
+        return Simd::Select(zero, v, Simd::Greater(x, zero));
+    }
+
+    template <class Simd>
+    typename Simd::Vector Clamp(typename Simd::Vector v, float maximum)
+    {
+        return Simd::Min(Simd::Max(v, Simd::Replicate(0.0f)), Simd::Replicate(maximum));
+    }
+
+    // Transfer functions; Apply evaluates one vector.
+
+    struct PqEotf
+    {
+        template <class Simd>
+        static typename Simd::Vector Apply(typename Simd::Vector code)
+        {
+            typedef typename Simd::Vector Vector;
+
+            Vector e = Pow<Simd>(Clamp<Simd>(code, 1.0f), 1.0f / sc_PqM2);
+            Vector numerator = Simd::Max(Simd::Subtract(e, Simd::Replicate(sc_PqC1)), Simd::Replicate(0.0f));
+            Vector denominator = Simd::Subtract(Simd::Replicate(sc_PqC2), Simd::Multiply(Simd::Replicate(sc_PqC3), e));
+
+            Vector y = Pow<Simd>(Simd::Divide(numerator, denominator), 1.0f / sc_PqM1);
+            return Simd::Multiply(y, Simd::Replicate(sc_PqPeakNits));
+        }
+    };
+
+    struct PqInverseEotf
+    {
+        template <class Simd>
+        static typename Simd::Vector Apply(typename Simd::Vector nits)
+        {
+            typedef typename Simd::Vector Vector;
+
+            Vector y = Clamp<Simd>(Simd::Multiply(nits, Simd::Replicate(1.0f / sc_PqPeakNits)), 1.0f);
+            Vector ym = Pow<Simd>(y, sc_PqM1);
+
+            Vector numerator = Simd::MultiplyAdd(Simd::Replicate(sc_PqC2), ym, Simd::Replicate(sc_PqC1));
+            Vector denominator = Simd::MultiplyAdd(Simd::Replicate(sc_PqC3), ym, Simd::Replicate(1.0f));
+            return Pow<Simd>(Simd::Divide(numerator, denominator), sc_PqM2);
+        }
+    };
+
+    struct HlgOetf
+    {
+        template <class Simd>
+        static typename Simd::Vector Apply(typename Simd::Vector scene)
+        {
+            typedef typename Simd::Vector Vector;
+
+            Vector e = Clamp<Simd>(scene, 1.0f);
+            Vector low = Simd::Sqrt(Simd::Multiply(e, Simd::Replicate(3.0f)));
+
+            // a ln(12 E - b) + c, with the argument kept positive in the lanes which take low.
+            Vector argument = Simd::MultiplyAdd(e, Simd::Replicate(12.0f), Simd::Replicate(-sc_HlgB));
+            Vector log = Log2<Simd>(Simd::Max(argument, Simd::Replicate(s_smallestNormal)));
+            Vector high = Simd::MultiplyAdd(log, Simd::Replicate(sc_HlgA * s_ln2), Simd::Replicate(sc_HlgC));
+
+            return Simd::Select(low, high, Simd::Greater(e, Simd::Replicate(1.0f / 12.0f)));
+        }
+    };
+
+    struct HlgInverseOetf
+    {
+        template <class Simd>
+        static typename Simd::Vector Apply(typename Simd::Vector code)
+        {
+            typedef typename Simd::Vector Vector;
+
+            Vector v = Clamp<Simd>(code, 1.0f);
+            Vector low = Simd::Multiply(Simd::Multiply(v, v), Simd::Replicate(1.0f / 3.0f));
+
+            // (e^((E' - c) / a) + b) / 12
+            Vector exponent = Simd::Multiply(Simd::Subtract(v, Simd::Replicate(sc_HlgC)), Simd::Replicate(1.0f / (sc_HlgA * s_ln2)));
+            Vector high = Simd::Multiply(Simd::Add(Exp2<Simd>(exponent), Simd::Replicate(sc_HlgB)), Simd::Replicate(1.0f / 12.0f));
+
+            return Simd::Select(low, high, Simd::Greater(v, Simd::Replicate(0.5f)));
+        }
+    };
+
+    template <class Function, class Simd>
+    void ConvertFloats(_In_reads_(count) const float* src, _Out_writes_(count) float* dst, size_t count)
+    {
+        size_t i = 0;
+        for (; i + Simd::Width <= count; i += Simd::Width)
+        {
+            Simd::Store(dst + i, Function::template Apply<Simd>(Simd::Load(src + i)));
+        }
+
+        // The remainder goes through a full vector.
+        if (i < count)
+        {
+            float tail[Simd::Width] = {};
+            std::copy(src + i, src + count, tail);
+            Simd::Store(tail, Function::template Apply<Simd>(Simd::Load(tail)));
+            std::copy(tail, tail + (count - i), dst + i);
+        }
+    }
+
+    /// <summary>
+    /// Kernels indexed by TransferFunction.
+    /// </summary>
+    template <class Simd>
+    std::array<FloatKernel, 4> MakeFloatKernels()
+    {
+        return { {
+            &ConvertFloats<PqEotf, Simd>,
+            &ConvertFloats<PqInverseEotf, Simd>,
+            &ConvertFloats<HlgOetf, Simd>,
+            &ConvertFloats<HlgInverseOetf, Simd>,
+        } };
+    }
+
+    const std::array<FloatKernel, 4>& GetFloatKernels()
+    {
+        static const std::array<FloatKernel, 4> s_kernels = TransferFunctions::IsAvx2Supported() ?
+            MakeFloatKernels<Avx2Float8>() :
+            MakeFloatKernels<DirectXMathFloat4>();
+
+        return s_kernels;
+    }
+
+    /// <summary>
+    /// The output of every FP16 input, rounded from the exact formula.
+    /// </summary>
+    std::vector<HALF> MakeHalfTable(TransferFunction function)
+    {
+        std::vector<HALF> table(65536);
+        for (size_t i = 0; i < table.size(); i++)
+        {
+            float value = XMConvertHalfToFloat(static_cast<HALF>(i));
+            table[i] = XMConvertFloatToHalf(TransferFunctions::EvaluateExact(function, value));
+        }
+
+        return table;
+    }
+
+    const std::vector<HALF>& GetHalfTable(TransferFunction function)
+    {
+        // Each table is built on first use.
+        switch (function)
+        {
+        case TransferFunction::PqEotf:
+        {
+            static const std::vector<HALF> s_table = MakeHalfTable(TransferFunction::PqEotf);
+            return s_table;
+        }
+
+        case TransferFunction::PqInverseEotf:
+        {
+            static const std::vector<HALF> s_table = MakeHalfTable(TransferFunction::PqInverseEotf);
+            return s_table;
+        }
+
+        case TransferFunction::HlgOetf:
+        {
+            static const std::vector<HALF> s_table = MakeHalfTable(TransferFunction::HlgOetf);
+            return s_table;
+        }
+
+        default:
+        {
+            static const std::vector<HALF> s_table = MakeHalfTable(TransferFunction::HlgInverseOetf);
+            return s_table;
+        }
+        }
+    }
+
+    /// <summary>
+    /// Clamps to [0, maximum]; NaN becomes 0.
+    /// </summary>
+    double ClampInput(float value, double maximum)
+    {
+        return value > 0.0f ? (std::min)(static_cast<double>(value), maximum) : 0.0;
+    }
+}
+
+float TransferFunctions::EvaluateExact(TransferFunction function, float value)
+{
+    switch (function)
+    {
+    case TransferFunction::PqEotf:
+    {
+        double e = pow(ClampInput(value, 1.0), 1.0 / sc_PqM2);
+        double y = pow((std::max)(e - sc_PqC1, 0.0) / (sc_PqC2 - sc_PqC3 * e), 1.0 / sc_PqM1);
+        return static_cast<float>(y * sc_PqPeakNits);
+    }
+
+    case TransferFunction::PqInverseEotf:
+    {
+        double ym = pow(ClampInput(value, sc_PqPeakNits) / sc_PqPeakNits, sc_PqM1);
+        return static_cast<float>(pow((sc_PqC1 + sc_PqC2 * ym) / (1.0 + sc_PqC3 * ym), sc_PqM2));
+    }
+
+    case TransferFunction::HlgOetf:
+    {
+        double e = ClampInput(value, 1.0);
+        return static_cast<float>(e <= 1.0 / 12.0 ? sqrt(3.0 * e) : sc_HlgA * log(12.0 * e - sc_HlgB) + sc_HlgC);
+    }
+
+    case TransferFunction::HlgInverseOetf:
+    {
+        double v = ClampInput(value, 1.0);
+        return static_cast<float>(v <= 0.5 ? v * v / 3.0 : (exp((v - sc_HlgC) / sc_HlgA) + sc_HlgB) / 12.0);
+    }
+
+    default:
+        return value;
+    }
+}
+
+void TransferFunctions::Convert(TransferFunction function, const float* src, float* dst, size_t count)
+{
+    GetFloatKernels()[static_cast<size_t>(function)](src, dst, count);
+}
+
+void TransferFunctions::Convert(TransferFunction function, const HALF* src, HALF* dst, size_t count)
+{
+    const auto& table = GetHalfTable(function);
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = table[src[i]];
+    }
+}
+
+/// <summary>
+/// AVX2 and FMA require AVX state to be enabled by the OS as well as the CPUID feature bits.
+/// </summary>
+bool TransferFunctions::IsAvx2Supported()
+{
+#if defined(_M_ARM) || defined(_M_ARM64)
+    return false;
+#else
+    int info[4] = {};
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+
+    return osxsave && avx && fma && avx2 && (_xgetbv(0) & 6) == 6;
+#endif
+}
@@ -0,0 +1,468 @@
+#include "pch.h"
+#include "VirtualImage.h"
+#include "MipPyramid.h"
+
+using namespace HDRImageViewer;
+
+using namespace Microsoft::WRL;
+
+static const UINT sc_TileSize = 512; // Tile edge in pixels.
+static const UINT sc_FilterBytesPerPixel = 8; // GUID_WICPixelFormat64bppPRGBAHalf, which MipPyramid filters.
+
+namespace
+{
+    uint64_t MakeTileKey(UINT level, UINT x, UINT y)
+    {
+        return (static_cast<uint64_t>(level) << 48) | (static_cast<uint64_t>(y) << 24) | x;
+    }
+
+    UINT TileCount(UINT levelSize)
+    {
+        return (levelSize + sc_TileSize - 1) / sc_TileSize;
+    }
+
+    /// <summary>
+    /// The index of the tile boundary at or beyond a level pixel coordinate, within [0, tileCount].
+    /// </summary>
+    UINT32 TileBoundary(float coord, UINT tileCount)
+    {
+        return static_cast<UINT32>((std::min)((std::max)(coord / sc_TileSize, 0.0f), static_cast<float>(tileCount)));
+    }
+
+    /// <summary>
+    /// Converts pixels between formats with WIC. Converting integer formats to float linearizes them.
+    /// </summary>
+    HRESULT ConvertPixels(
+        _In_ IWICImagingFactory* wicFactory,
+        WICPixelFormatGUID srcFormat,
+        UINT width,
+        UINT height,
+        UINT srcStride,
+        _In_ uint8_t* src,
+        WICPixelFormatGUID dstFormat,
+        UINT dstStride,
+        UINT dstSize,
+        _Out_writes_bytes_(dstSize) uint8_t* dst)
+    {
+        // Copies the pixels.
+        ComPtr<IWICBitmap> bitmap;
+        HRESULT hr = wicFactory->CreateBitmapFromMemory(width, height, srcFormat, srcStride, srcStride * height, src, &bitmap);
+        if (FAILED(hr))
+            return hr;
+
+        if (srcFormat == dstFormat)
+        {
+            return bitmap->CopyPixels(nullptr, dstStride, dstSize, dst);
+        }
+
+        ComPtr<IWICFormatConverter> converter;
+        hr = wicFactory->CreateFormatConverter(&converter);
+        if (FAILED(hr))
+            return hr;
+
+        hr = converter->Initialize(bitmap.Get(), dstFormat, WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeCustom);
+        if (FAILED(hr))
+            return hr;
+
+        return converter->CopyPixels(nullptr, dstStride, dstSize, dst);
+    }
+}
+
+VirtualImage::VirtualImage(
+    const std::shared_ptr<DX::DeviceResources>& deviceResources,
+    IWICBitmapSource* source,
+    const ImageInfo& info,
+    size_t tileByteBudget) :
+    m_deviceResources(deviceResources),
+    m_source(source),
+    m_tileByteBudget(tileByteBudget),
+    m_residentBytes(0),
+    m_useCounter(0),
+    m_decodes(0),
+    m_imageLevel(0),
+    m_imageTiles{}
+{
+    // Follows the numeric representation of the resident source, as ImageLoader::CreateCachedWicSource
+    // does, so no gamma conversion occurs; 8 bpc images keep 8 bpc tiles.
+    if (info.isFloat)
+    {
+        m_tileWicFormat = GUID_WICPixelFormat64bppPRGBAHalf;
+        m_tileDxgiFormat = DXGI_FORMAT_R16G16B16A16_FLOAT;
+        m_tileBytesPerPixel = 8;
+    }
+    else if (info.bitsPerChannel <= 8)
+    {
+        m_tileWicFormat = GUID_WICPixelFormat32bppPBGRA;
+        m_tileDxgiFormat = DXGI_FORMAT_B8G8R8A8_UNORM;
+        m_tileBytesPerPixel = 4;
+    }
+    else
+    {
+        m_tileWicFormat = GUID_WICPixelFormat64bppPRGBA;
+        m_tileDxgiFormat = DXGI_FORMAT_R16G16B16A16_UNORM;
+        m_tileBytesPerPixel = 8;
+    }
+
+    // Level 0 is full resolution; each following level halves it, down to a single tile.
+    UINT width = static_cast<UINT>(info.size.Width);
+    UINT height = static_cast<UINT>(info.size.Height);
+    m_levels.push_back({ width, height });
+
+    while (width > sc_TileSize || height > sc_TileSize)
+    {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        m_levels.push_back({ width, height });
+    }
+}
+
+HRESULT VirtualImage::GetImage(float zoom, const D2D1_RECT_F* visibleRect, ID2D1Image** image)
+{
+    *image = nullptr;
+
+    UINT level = ChooseLevel(zoom);
+    const Level& levelInfo = m_levels[level];
+
+    // Level pixels are slightly larger than 2^level full resolution pixels when a dimension was odd.
+    float scaleX = static_cast<float>(m_levels[0].width) / levelInfo.width;
+    float scaleY = static_cast<float>(m_levels[0].height) / levelInfo.height;
+
+    D2D1_RECT_F rect = visibleRect ? *visibleRect :
+        D2D1::RectF(0.0f, 0.0f, static_cast<float>(m_levels[0].width), static_cast<float>(m_levels[0].height));
+
+    UINT tilesX = TileCount(levelInfo.width);
+    UINT tilesY = TileCount(levelInfo.height);
+
+    D2D1_RECT_U tiles = D2D1::RectU(
+        TileBoundary(floorf(rect.left / scaleX), tilesX),
+        TileBoundary(floorf(rect.top / scaleY), tilesY),
+        TileBoundary(ceilf(rect.right / scaleX) + sc_TileSize - 1, tilesX),
+        TileBoundary(ceilf(rect.bottom / scaleY) + sc_TileSize - 1, tilesY));
+
+    auto context = m_deviceResources->GetD2DDeviceContext();
+
+    if (m_image == nullptr ||
+        m_imageLevel != level ||
+        memcmp(&m_imageTiles, &tiles, sizeof(tiles)) != 0)
+    {
+        // Tiles used by this image are marked with the same use count and are not evicted.
+        m_useCounter++;
+
+        std::vector<Tile*> visibleTiles;
+        for (UINT y = tiles.top; y < tiles.bottom; y++)
+        {
+            for (UINT x = tiles.left; x < tiles.right; x++)
+            {
+                Tile* tile = nullptr;
+                HRESULT hr = GetTile(level, x, y, true, &tile);
+                if (FAILED(hr))
+                    return hr;
+
+                visibleTiles.push_back(tile);
+            }
+        }
+
+        // Record the tiles into a command list, which Direct2D treats as any other image. Tiles are
+        // drawn one to one in level pixels, so they abut without filtering across their edges.
+        ComPtr<ID2D1CommandList> commandList;
+        HRESULT hr = context->CreateCommandList(&commandList);
+        if (FAILED(hr))
+            return hr;
+
+        ComPtr<ID2D1Image> previousTarget;
+        context->GetTarget(&previousTarget);
+
+        D2D1_MATRIX_3X2_F previousTransform;
+        context->GetTransform(&previousTransform);
+
+        context->SetTarget(commandList.Get());
+        context->BeginDraw();
+        context->SetTransform(D2D1::Matrix3x2F::Identity());
+
+        for (auto tile : visibleTiles)
+        {
+            D2D1_RECT_F dest = D2D1::RectF(
+                static_cast<float>(tile->levelRect.left),
+                static_cast<float>(tile->levelRect.top),
+                static_cast<float>(tile->levelRect.right),
+                static_cast<float>(tile->levelRect.bottom));
+
+            context->DrawBitmap(
+                tile->bitmap.Get(),
+                dest,
+                1.0f,
+                D2D1_INTERPOLATION_MODE_LINEAR,
+                nullptr);
+        }
+
+        hr = context->EndDraw();
+
+        context->SetTransform(previousTransform);
+        context->SetTarget(previousTarget.Get());
+
+        if (FAILED(hr))
+            return hr;
+
+        hr = commandList->Close();
+        if (FAILED(hr))
+            return hr;
+
+        m_image = commandList;
+        m_imageLevel = level;
+        m_imageTiles = tiles;
+
+        TrimToBudget();
+    }
+
+    // Scale the level to the size of the full image at this zoom, as ImageLoader does for its mip levels.
+    ComPtr<ID2D1Effect> scale;
+    HRESULT hr = context->CreateEffect(CLSID_D2D1Scale, &scale);
+    if (FAILED(hr))
+        return hr;
+
+    scale->SetInput(0, m_image.Get());
+
+    hr = scale->SetValue(D2D1_SCALE_PROP_SCALE, D2D1::Vector2F(zoom * scaleX, zoom * scaleY));
+    if (FAILED(hr))
+        return hr;
+
+    hr = scale->SetValue(D2D1_SCALE_PROP_INTERPOLATION_MODE, D2D1_SCALE_INTERPOLATION_MODE_LINEAR);
+    if (FAILED(hr))
+        return hr;
+
+    hr = scale->SetValue(D2D1_SCALE_PROP_BORDER_MODE, D2D1_BORDER_MODE_HARD);
+    if (FAILED(hr))
+        return hr;
+
+    scale->GetOutput(image);
+    return S_OK;
+}
+
+VirtualImageStats VirtualImage::GetStats() const
+{
+    return { m_tiles.size(), m_residentBytes, m_decodes };
+}
+
+/// <summary>
+/// The coarsest level which still has at least one level pixel per displayed pixel.
+/// </summary>
+UINT VirtualImage::ChooseLevel(float zoom) const
+{
+    UINT level = 0;
+    while (level + 1 < m_levels.size() &&
+           ldexpf(zoom, level + 1) <= 1.0f)
+    {
+        level++;
+    }
+
+    return level;
+}
+
+/// <summary>
+/// Tiles which are not visible, but only used to filter a coarser tile, are marked as used by the
+/// previous image so they can be evicted while the current one is created.
+/// </summary>
+HRESULT VirtualImage::GetTile(UINT level, UINT x, UINT y, bool isVisible, Tile** tile)
+{
+    *tile = nullptr;
+
+    uint64_t key = MakeTileKey(level, x, y);
+    auto found = m_tiles.find(key);
+    if (found == m_tiles.end())
+    {
+        Tile created = {};
+        HRESULT hr = CreateTile(level, x, y, created);
+        if (FAILED(hr))
+            return hr;
+
+        m_residentBytes += created.bytes;
+        found = m_tiles.emplace(key, std::move(created)).first;
+    }
+
+    found->second.lastUse = isVisible ? m_useCounter : m_useCounter - 1;
+    *tile = &found->second;
+    return S_OK;
+}
+
+HRESULT VirtualImage::CreateTile(UINT level, UINT x, UINT y, Tile& tile)
+{
+    const Level& levelInfo = m_levels[level];
+
+    tile.levelRect = D2D1::RectU(
+        x * sc_TileSize,
+        y * sc_TileSize,
+        (std::min)((x + 1) * sc_TileSize, levelInfo.width),
+        (std::min)((y + 1) * sc_TileSize, levelInfo.height));
+
+    UINT width = tile.levelRect.right - tile.levelRect.left;
+    UINT height = tile.levelRect.bottom - tile.levelRect.top;
+    UINT stride = width * m_tileBytesPerPixel;
+    tile.pixels.resize(static_cast<size_t>(stride) * height);
+
+    HRESULT hr = S_OK;
+    if (level == 0)
+    {
+        if (m_tileSource == nullptr)
+        {
+            ComPtr<IWICFormatConverter> converter;
+            hr = m_deviceResources->GetWicImagingFactory()->CreateFormatConverter(&converter);
+            if (FAILED(hr))
+                return hr;
+
+            hr = converter->Initialize(
+                m_source.Get(),
+                m_tileWicFormat,
+                WICBitmapDitherTypeNone,
+                nullptr,
+                0.0f,
+                WICBitmapPaletteTypeCustom);
+            if (FAILED(hr))
+                return hr;
+
+            m_tileSource = converter;
+        }
+
+        WICRect decodeRect = {
+            static_cast<INT>(tile.levelRect.left),
+            static_cast<INT>(tile.levelRect.top),
+            static_cast<INT>(width),
+            static_cast<INT>(height) };
+
+        hr = m_tileSource->CopyPixels(&decodeRect, stride, static_cast<UINT>(tile.pixels.size()), tile.pixels.data());
+        m_decodes++;
+    }
+    else
+    {
+        hr = FilterTile(level, tile.levelRect, tile.pixels);
+    }
+
+    if (FAILED(hr))
+        return hr;
+
+    D2D1_BITMAP_PROPERTIES1 props = D2D1::BitmapProperties1(
+        D2D1_BITMAP_OPTIONS_NONE,
+        D2D1::PixelFormat(m_tileDxgiFormat, D2D1_ALPHA_MODE_PREMULTIPLIED));
+
+    hr = m_deviceResources->GetD2DDeviceContext()->CreateBitmap(
+        D2D1::SizeU(width, height),
+        tile.pixels.data(),
+        stride,
+        &props,
+        &tile.bitmap);
+    if (FAILED(hr))
+        return hr;
+
+    tile.bytes = tile.pixels.size() * 2;
+    return S_OK;
+}
+
+/// <summary>
+/// Fills the pixels of a tile from the up to four tiles of the next finer level which cover it.
+/// Each finer tile may be evicted once copied, so filtering a coarse level from scratch stays
+/// within the budget rather than keeping every finer tile resident.
+/// </summary>
+HRESULT VirtualImage::FilterTile(UINT level, const D2D1_RECT_U& levelRect, std::vector<uint8_t>& pixels)
+{
+    auto wicFactory = m_deviceResources->GetWicImagingFactory();
+    const Level& fine = m_levels[level - 1];
+
+    UINT fineLeft = levelRect.left * 2;
+    UINT fineTop = levelRect.top * 2;
+    UINT fineWidth = (std::min)(levelRect.right * 2, fine.width) - fineLeft;
+    UINT fineHeight = (std::min)(levelRect.bottom * 2, fine.height) - fineTop;
+    UINT fineStride = fineWidth * sc_FilterBytesPerPixel;
+
+    std::vector<uint8_t> finePixels(static_cast<size_t>(fineStride) * fineHeight);
+
+    UINT firstX = fineLeft / sc_TileSize;
+    UINT firstY = fineTop / sc_TileSize;
+    UINT lastX = (std::min)(firstX + 2, TileCount(fine.width));
+    UINT lastY = (std::min)(firstY + 2, TileCount(fine.height));
+
+    for (UINT y = firstY; y < lastY; y++)
+    {
+        for (UINT x = firstX; x < lastX; x++)
+        {
+            Tile* tile = nullptr;
+            HRESULT hr = GetTile(level - 1, x, y, false, &tile);
+            if (FAILED(hr))
+                return hr;
+
+            UINT width = tile->levelRect.right - tile->levelRect.left;
+            UINT height = tile->levelRect.bottom - tile->levelRect.top;
+            size_t offset = static_cast<size_t>(tile->levelRect.top - fineTop) * fineStride +
+                static_cast<size_t>(tile->levelRect.left - fineLeft) * sc_FilterBytesPerPixel;
+
+            hr = ConvertPixels(
+                wicFactory,
+                m_tileWicFormat,
+                width,
+                height,
+                width * m_tileBytesPerPixel,
+                tile->pixels.data(),
+                GUID_WICPixelFormat64bppPRGBAHalf,
+                fineStride,
+                static_cast<UINT>(finePixels.size() - offset),
+                finePixels.data() + offset);
+            if (FAILED(hr))
+                return hr;
+
+            // tile may be evicted from here on.
+            TrimToBudget();
+        }
+    }
+
+    UINT width = levelRect.right - levelRect.left;
+    UINT height = levelRect.bottom - levelRect.top;
+    UINT filteredStride = width * sc_FilterBytesPerPixel;
+    std::vector<uint8_t> filtered(static_cast<size_t>(filteredStride) * height);
+
+    MipPyramid::DownsampleRows(
+        finePixels.data(),
+        fineStride,
+        fineWidth,
+        fineHeight,
+        filtered.data(),
+        filteredStride,
+        height);
+
+    return ConvertPixels(
+        wicFactory,
+        GUID_WICPixelFormat64bppPRGBAHalf,
+        width,
+        height,
+        filteredStride,
+        filtered.data(),
+        m_tileWicFormat,
+        width * m_tileBytesPerPixel,
+        static_cast<UINT>(pixels.size()),
+        pixels.data());
+}
+
+/// <summary>
+/// Evicts least recently used tiles until the budget is met. Tiles used by the current image
+/// are kept even if they alone exceed the budget.
+/// </summary>
+void VirtualImage::TrimToBudget()
+{
+    while (m_residentBytes > m_tileByteBudget)
+    {
+        auto victim = m_tiles.end();
+        for (auto i = m_tiles.begin(); i != m_tiles.end(); i++)
+        {
+            if (i->second.lastUse != m_useCounter &&
+                (victim == m_tiles.end() || i->second.lastUse < victim->second.lastUse))
+            {
+                victim = i;
+            }
+        }
+
+        if (victim == m_tiles.end())
+        {
+            break;
+        }
+
+        m_residentBytes -= victim->second.bytes;
+        m_tiles.erase(victim);
+    }
+}
@@ -0,0 +1,102 @@
+//*********************************************************
+//
+// VirtualImage
+//
+// Renders images which are too large to hand to Direct2D as
+// a single image source, e.g. gigapixel scans and panoramas.
+//
+// The image is divided into fixed size tiles at each level
+// of a pyramid of successively halved resolutions. Only the
+// tiles intersecting the viewport, at the coarsest level
+// that still has one pixel per displayed pixel, are created
+// and uploaded. Full resolution tiles are decoded with
+// region CopyPixels; coarser tiles are 2x2 box filtered in
+// linear light from the four finer tiles they cover, as
+// MipPyramid does, so zooming out reuses tiles already in
+// the cache instead of resampling the source for each level.
+// Tiles are kept in a least recently used cache bounded by a
+// byte budget.
+//
+//*********************************************************
+
+#pragma once
+
+#include "DeviceResources.h"
+#include "ImageInfo.h"
+
+#include <map>
+
+namespace HDRImageViewer
+{
+    struct VirtualImageStats
+    {
+        size_t      tileCount;
+        size_t      residentBytes;
+        uint64_t    decodes;
+    };
+
+    class VirtualImage
+    {
+    public:
+        /// <summary>
+        /// source must support CopyPixels of arbitrary regions, and remain valid and unchanged
+        /// for the lifetime of this object.
+        /// </summary>
+        VirtualImage(
+            const std::shared_ptr<DX::DeviceResources>& deviceResources,
+            _In_ IWICBitmapSource* source,
+            const ImageInfo& info,
+            size_t tileByteBudget);
+
+        /// <summary>
+        /// Returns an image of the tiles which intersect visibleRect, scaled by zoom.
+        /// visibleRect is in full resolution image pixels; if null the whole image is drawn.
+        /// The tiles are recorded at the resolution of their level and reused while the level and
+        /// visible tiles are unchanged; zoom only changes the scale applied to them.
+        /// </summary>
+        HRESULT GetImage(float zoom, _In_opt_ const D2D1_RECT_F* visibleRect, _COM_Outptr_ ID2D1Image** image);
+
+        VirtualImageStats GetStats() const;
+
+    private:
+        struct Level
+        {
+            UINT                                        width;
+            UINT                                        height;
+        };
+
+        struct Tile
+        {
+            Microsoft::WRL::ComPtr<ID2D1Bitmap1>        bitmap;
+            std::vector<uint8_t>                        pixels;     // Kept to filter coarser tiles from.
+            D2D1_RECT_U                                 levelRect;  // Area covered, in level pixels.
+            size_t                                      bytes;      // Of pixels and bitmap.
+            uint64_t                                    lastUse;
+        };
+
+        UINT ChooseLevel(float zoom) const;
+        HRESULT GetTile(UINT level, UINT x, UINT y, bool isVisible, _Outptr_ Tile** tile);
+        HRESULT CreateTile(UINT level, UINT x, UINT y, _Out_ Tile& tile);
+        HRESULT FilterTile(UINT level, const D2D1_RECT_U& levelRect, std::vector<uint8_t>& pixels);
+        void TrimToBudget();
+
+        std::shared_ptr<DX::DeviceResources>            m_deviceResources;
+        Microsoft::WRL::ComPtr<IWICBitmapSource>        m_source;
+        Microsoft::WRL::ComPtr<IWICBitmapSource>        m_tileSource;   // m_source in the tile format; created on first use.
+        WICPixelFormatGUID                              m_tileWicFormat;
+        DXGI_FORMAT                                     m_tileDxgiFormat;
+        UINT                                            m_tileBytesPerPixel;
+        std::vector<Level>                              m_levels;
+
+        std::map<uint64_t, Tile>                        m_tiles;
+        size_t                                          m_tileByteBudget;
+        size_t                                          m_residentBytes;
+        uint64_t                                        m_useCounter;
+        uint64_t                                        m_decodes;
+
+        // The tiles last recorded, in level pixels, and what they were recorded for.
+        Microsoft::WRL::ComPtr<ID2D1CommandList>        m_image;
+        UINT                                            m_imageLevel;
+        D2D1_RECT_U                                     m_imageTiles;
+    };
+}
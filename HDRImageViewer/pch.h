@@ -22,6 +22,7 @@
 #include <shcore.h>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <wrl.h>
 #include <wrl/client.h>
 
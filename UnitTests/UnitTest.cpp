@@ -1,7 +1,29 @@
 #include "pch.h"
 #include "CppUnitTest.h"
 
+#include "..\HDRImageViewer\ColorProfileCache.h"
+#include "..\HDRImageViewer\DecodedImageCache.h"
+#include "..\HDRImageViewer\FormatConverter.h"
+#include "..\HDRImageViewer\FusedRenderEffect.h"
+#include "..\HDRImageViewer\IccTransform.h"
 #include "..\HDRImageViewer\ImageLoader.h"
+#include "..\HDRImageViewer\ImagePrefetchCache.h"
+#include "..\HDRImageViewer\ImageProbe.h"
+#include "..\HDRImageViewer\LuminanceHeatmapEffect.h"
+#include "..\HDRImageViewer\Lut3D.h"
+#include "..\HDRImageViewer\RenderPipeline.h"
+#include "..\HDRImageViewer\RgbeCodec.h"
+#include "..\HDRImageViewer\SdrOverlayEffect.h"
+#include "..\HDRImageViewer\SimpleTonemapEffect.h"
+#include "..\HDRImageViewer\TransferFunctions.h"
+
+#include <DirectXPackedVector.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <wrl/implements.h>
+
 using namespace HDRImageViewer;
 
 using namespace concurrency;
@@ -17,6 +39,68 @@ namespace UnitTests
 {
 #define TESTHR(x) Assert::IsTrue(SUCCEEDED(x), L"Failed HRESULT")
 
+    // Forwards to another stream, but blocks the first read until proceed is set. Lets a test
+    // act on a load while it is known to be decoding on another thread.
+    class GatedStream : public RuntimeClass<RuntimeClassFlags<ClassicCom>, ChainInterfaces<IStream, ISequentialStream>>
+    {
+    public:
+        GatedStream(_In_ IStream* inner) : m_inner(inner), m_isOpen(false) {}
+
+        concurrency::event started;
+        concurrency::event proceed;
+
+        IFACEMETHODIMP Read(_Out_writes_bytes_to_(cb, *pcbRead) void* pv, ULONG cb, _Out_opt_ ULONG* pcbRead) override
+        {
+            if (!m_isOpen.exchange(true))
+            {
+                started.set();
+                proceed.wait();
+            }
+
+            return m_inner->Read(pv, cb, pcbRead);
+        }
+
+        IFACEMETHODIMP Write(_In_reads_bytes_(cb) const void* pv, ULONG cb, _Out_opt_ ULONG* pcbWritten) override
+        {
+            return m_inner->Write(pv, cb, pcbWritten);
+        }
+
+        IFACEMETHODIMP Seek(LARGE_INTEGER move, DWORD origin, _Out_opt_ ULARGE_INTEGER* newPosition) override
+        {
+            return m_inner->Seek(move, origin, newPosition);
+        }
+
+        IFACEMETHODIMP SetSize(ULARGE_INTEGER newSize) override
+        {
+            return m_inner->SetSize(newSize);
+        }
+
+        IFACEMETHODIMP CopyTo(_In_ IStream* stream, ULARGE_INTEGER cb, _Out_opt_ ULARGE_INTEGER* read, _Out_opt_ ULARGE_INTEGER* written) override
+        {
+            return m_inner->CopyTo(stream, cb, read, written);
+        }
+
+        IFACEMETHODIMP Commit(DWORD flags) override { return m_inner->Commit(flags); }
+        IFACEMETHODIMP Revert() override { return m_inner->Revert(); }
+
+        IFACEMETHODIMP LockRegion(ULARGE_INTEGER offset, ULARGE_INTEGER cb, DWORD lockType) override
+        {
+            return m_inner->LockRegion(offset, cb, lockType);
+        }
+
+        IFACEMETHODIMP UnlockRegion(ULARGE_INTEGER offset, ULARGE_INTEGER cb, DWORD lockType) override
+        {
+            return m_inner->UnlockRegion(offset, cb, lockType);
+        }
+
+        IFACEMETHODIMP Stat(_Out_ STATSTG* stat, DWORD flags) override { return m_inner->Stat(stat, flags); }
+        IFACEMETHODIMP Clone(_COM_Outptr_ IStream** stream) override { return m_inner->Clone(stream); }
+
+    private:
+        ComPtr<IStream>     m_inner;
+        std::atomic<bool>   m_isOpen;
+    };
+
     struct TestInputDefinition
     {
         std::wstring                        filename;
@@ -73,8 +157,12 @@ namespace UnitTests
                     ImageInfo info = loader->LoadImageFromWic(iStream.Get());
                     Assert::IsTrue(loader->GetState() == ImageLoaderState::LoadingSucceeded);
 
-                    auto imageSource = loader->GetLoadedImage(1.0f);
-                    auto imageSource2 = loader->GetLoadedImage(0.5f);
+                    // GetLoadedImage returns a new reference.
+                    ComPtr<ID2D1Image> imageSource;
+                    imageSource.Attach(loader->GetLoadedImage(1.0f));
+
+                    ComPtr<ID2D1Image> imageSource2;
+                    imageSource2.Attach(loader->GetLoadedImage(0.5f));
 
                     Assert::AreEqual(info.bitsPerPixel, definitions[i].info.bitsPerPixel);
                     Assert::AreEqual(info.bitsPerChannel, definitions[i].info.bitsPerChannel);
@@ -97,5 +185,1345 @@ namespace UnitTests
                 });
             }
         }
+
+        // Probing reads only the headers, but must report the same ImageInfo as a full load, including
+        // the subresource counts.
+        TEST_METHOD(ProbeMatchesLoad)
+        {
+            m_devRes = std::make_shared<DX::DeviceResources>();
+
+            const wchar_t* filenames[] = {
+                L"Png_BasicSrgbColors_5x5.png",
+                L"Jpg_ProPhotoIcc.jpg",
+                L"Jxr_HdrRuler.jxr",
+                L"Jxr_HdrWithIcc.jxr",
+                L"Jxr_HdrXboxOne_1025px.jxr",
+                L"Tif_16bpcArgbIcc.tif",
+            };
+
+            for (auto filename : filenames)
+            {
+                std::wstring path = std::wstring(L"ms-appx:///TestInputs/") + filename;
+                auto uri = ref new Windows::Foundation::Uri(ref new Platform::String(path.c_str()));
+
+                create_task(StorageFile::GetFileFromApplicationUriAsync(uri)).then([=](StorageFile^ imageFile) {
+
+                    return create_task(imageFile->OpenAsync(FileAccessMode::Read)).then([=](IRandomAccessStream^ stream) {
+
+                        ComPtr<IStream> iStream;
+                        TESTHR(CreateStreamOverRandomAccessStream(stream, IID_PPV_ARGS(&iStream)));
+
+                        ImageInfo probed = {};
+                        TESTHR(ImageProbe::ProbeStream(m_devRes->GetWicImagingFactory(), iStream.Get(), imageFile->FileType, ImageLoaderOptions(), probed));
+
+                        LARGE_INTEGER start = {};
+                        TESTHR(iStream->Seek(start, STREAM_SEEK_SET, nullptr));
+
+                        ImageLoader loader(m_devRes);
+                        ImageInfo loaded = loader.LoadImageFromWic(iStream.Get());
+                        Assert::IsTrue(loader.GetState() == ImageLoaderState::LoadingSucceeded);
+
+                        Assert::AreEqual(loaded.bitsPerPixel, probed.bitsPerPixel, filename);
+                        Assert::AreEqual(loaded.bitsPerChannel, probed.bitsPerChannel, filename);
+                        Assert::AreEqual(loaded.isFloat, probed.isFloat, filename);
+                        Assert::AreEqual(loaded.size.Width, probed.size.Width, filename);
+                        Assert::AreEqual(loaded.size.Height, probed.size.Height, filename);
+                        Assert::AreEqual(loaded.numProfiles, probed.numProfiles, filename);
+                        Assert::IsTrue(loaded.imageKind == probed.imageKind, filename);
+                        Assert::AreEqual(loaded.forceBT2100ColorSpace, probed.forceBT2100ColorSpace, filename);
+                        Assert::AreEqual(loaded.isHeif, probed.isHeif, filename);
+                        Assert::AreEqual(loaded.frameCount, probed.frameCount, filename);
+                        Assert::AreEqual(loaded.mipCount, probed.mipCount, filename);
+                    });
+                }).then([=](task<void> previousTask) {
+                    try
+                    {
+                        previousTask.get();
+                    }
+                    catch (Platform::COMException^ e)
+                    {
+                        Assert::AreEqual(static_cast<int>(S_OK), e->HResult);
+                    }
+                }).get();
+            }
+        }
+
+        // Simulates flipping quickly through images: each load supersedes the previous one, as in
+        // DirectXPage::LoadImage. Every superseded load is canceled from this thread while it decodes
+        // on the thread pool, and must stop in LoadingCanceled. Latencies are only logged.
+        TEST_METHOD(SupersededLoadsAreCanceled)
+        {
+            const int numLoads = 100;
+
+            m_devRes = std::make_shared<DX::DeviceResources>();
+
+            auto uri = ref new Windows::Foundation::Uri(L"ms-appx:///TestInputs/Jxr_HdrXboxOne_1025px.jxr");
+
+            create_task(StorageFile::GetFileFromApplicationUriAsync(uri)).then([=](StorageFile^ imageFile) {
+
+                return create_task(imageFile->OpenAsync(FileAccessMode::Read));
+
+            }).then([=](IRandomAccessStream^ stream) {
+
+                ComPtr<IStream> iStream;
+                TESTHR(CreateStreamOverRandomAccessStream(stream, IID_PPV_ARGS(&iStream)));
+
+                // Loads decode on the thread pool, as in HDRImageViewerRenderer::LoadImageAsync.
+                ImageLoaderOptions options;
+                options.deferDeviceResources = true;
+
+                auto startLoad = [&](const std::shared_ptr<ImageLoader>& loader, IStream* loadStream)
+                {
+                    LARGE_INTEGER start = {};
+                    TESTHR(iStream->Seek(start, STREAM_SEEK_SET, nullptr));
+
+                    ComPtr<IStream> streamRef = loadStream;
+                    return create_task([loader, streamRef]()
+                    {
+                        loader->LoadImageFromWic(streamRef.Get());
+                    });
+                };
+
+                auto elapsedMs = [](std::chrono::steady_clock::time_point begin)
+                {
+                    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                };
+
+                // Reference latency of a single, uncontended load.
+                auto begin = std::chrono::steady_clock::now();
+                auto loader = std::make_shared<ImageLoader>(m_devRes, options);
+                startLoad(loader, iStream.Get()).wait();
+                Assert::IsTrue(loader->GetState() == ImageLoaderState::NeedDeviceResources);
+                loader->CreateDeviceDependentResources();
+                Assert::IsTrue(loader->GetState() == ImageLoaderState::LoadingSucceeded);
+                double referenceMs = elapsedMs(begin);
+
+                double maxCancelMs = 0.0;
+                for (int i = 0; i < numLoads - 1; i++)
+                {
+                    // The gate holds the decode in its first read until the load has been canceled,
+                    // so the cancellation always lands while the load is in flight.
+                    auto gate = Make<GatedStream>(iStream.Get());
+
+                    cancellation_token_source cancellation;
+                    loader = std::make_shared<ImageLoader>(m_devRes, options, cancellation.get_token());
+                    auto load = startLoad(loader, gate.Get());
+
+                    gate->started.wait();
+                    begin = std::chrono::steady_clock::now();
+                    cancellation.cancel();
+                    gate->proceed.set();
+
+                    load.wait();
+                    maxCancelMs = max(maxCancelMs, elapsedMs(begin));
+                    Assert::IsTrue(loader->GetState() == ImageLoaderState::LoadingCanceled);
+                }
+
+                begin = std::chrono::steady_clock::now();
+                loader = std::make_shared<ImageLoader>(m_devRes, options);
+                startLoad(loader, iStream.Get()).wait();
+                loader->CreateDeviceDependentResources();
+                Assert::IsTrue(loader->GetState() == ImageLoaderState::LoadingSucceeded);
+                double finalMs = elapsedMs(begin);
+
+                std::wstringstream log;
+                log << L"Reference load: " << referenceMs << L" ms, final load: " << finalMs << L" ms, "
+                    << L"slowest cancellation: " << maxCancelMs << L" ms";
+                Logger::WriteMessage(log.str().c_str());
+            }).then([=](task<void> previousTask) {
+                try
+                {
+                    previousTask.get();
+                }
+                catch (Platform::COMException^ e)
+                {
+                    Assert::AreEqual(static_cast<int>(S_OK), e->HResult);
+                }
+            }).get();
+        }
+
+        // Benchmark matrix: converts a random image from every source format FormatConverter supports
+        // with both FormatConverter and IWICFormatConverter, logging each one's time. Results must
+        // match within rounding: 1.5 LSB of the coarser integer format, or a half float ULP.
+        TEST_METHOD(FormatConverterMatchesWic)
+        {
+            const UINT width = 2048;
+            const UINT height = 1024;
+            const int runs = 3;
+
+            m_devRes = std::make_shared<DX::DeviceResources>();
+            auto wicFactory = m_devRes->GetWicImagingFactory();
+
+            // Straight alpha RGBA in [0, 1], from which each source format is made by WIC.
+            std::vector<float> pixels(static_cast<size_t>(width) * height * 4);
+            std::mt19937 random(1);
+            std::uniform_real_distribution<float> unorm(0.0f, 1.0f);
+            for (auto& channel : pixels)
+            {
+                channel = unorm(random);
+            }
+
+            ComPtr<IWICBitmap> floatBitmap;
+            TESTHR(wicFactory->CreateBitmapFromMemory(
+                width,
+                height,
+                GUID_WICPixelFormat128bppRGBAFloat,
+                width * 16,
+                static_cast<UINT>(pixels.size() * sizeof(float)),
+                reinterpret_cast<BYTE*>(pixels.data()),
+                &floatBitmap));
+
+            auto getName = [&](REFWICPixelFormatGUID format)
+            {
+                ComPtr<IWICComponentInfo> componentInfo;
+                wchar_t name[64] = {};
+                UINT length = 0;
+                if (SUCCEEDED(wicFactory->CreateComponentInfo(format, &componentInfo)))
+                {
+                    componentInfo->GetFriendlyName(ARRAYSIZE(name), name, &length);
+                }
+                return std::wstring(name);
+            };
+
+            // Normalized channel values of the destination formats.
+            auto readChannels = [](REFWICPixelFormatGUID format, const std::vector<uint8_t>& data, std::vector<float>& channels)
+            {
+                channels.clear();
+                if (format == GUID_WICPixelFormat32bppPBGRA)
+                {
+                    for (auto c : data) channels.push_back(c / 255.0f);
+                }
+                else if (format == GUID_WICPixelFormat64bppPRGBA)
+                {
+                    auto c = reinterpret_cast<const uint16_t*>(data.data());
+                    for (size_t i = 0; i < data.size() / 2; i++) channels.push_back(c[i] / 65535.0f);
+                }
+                else if (format == GUID_WICPixelFormat32bppRGBA1010102)
+                {
+                    auto c = reinterpret_cast<const uint32_t*>(data.data());
+                    for (size_t i = 0; i < data.size() / 4; i++)
+                    {
+                        channels.push_back((c[i] & 0x3FF) / 1023.0f);
+                        channels.push_back(((c[i] >> 10) & 0x3FF) / 1023.0f);
+                        channels.push_back(((c[i] >> 20) & 0x3FF) / 1023.0f);
+                        channels.push_back((c[i] >> 30) / 3.0f);
+                    }
+                }
+                else
+                {
+                    auto c = reinterpret_cast<const DirectX::PackedVector::HALF*>(data.data());
+                    for (size_t i = 0; i < data.size() / 2; i++) channels.push_back(DirectX::PackedVector::XMConvertHalfToFloat(c[i]));
+                }
+            };
+
+            std::wstringstream log;
+            log << L"Converting " << width << L"x" << height << L", best of " << runs << L" runs:\n";
+
+            for (const auto& conversion : FormatConverter::GetConversions())
+            {
+                const WICPixelFormatGUID& sourceFormat = conversion.first;
+                const WICPixelFormatGUID& destinationFormat = conversion.second;
+
+                ComPtr<IWICFormatConverter> makeSource;
+                TESTHR(wicFactory->CreateFormatConverter(&makeSource));
+                if (FAILED(makeSource->Initialize(floatBitmap.Get(), sourceFormat, WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeCustom)))
+                {
+                    log << getName(sourceFormat) << L": skipped, WIC cannot create this format\n";
+                    continue;
+                }
+
+                ComPtr<IWICBitmap> source;
+                TESTHR(wicFactory->CreateBitmapFromSource(makeSource.Get(), WICBitmapCacheOnLoad, &source));
+
+                ImageInfo sourceInfo = {};
+                ImageInfo destinationInfo = {};
+                TESTHR(ImageProbe::GetPixelFormatInfo(wicFactory, sourceFormat, sourceInfo));
+                TESTHR(ImageProbe::GetPixelFormatInfo(wicFactory, destinationFormat, destinationInfo));
+
+                ComPtr<IWICFormatConverter> wicConverter;
+                TESTHR(wicFactory->CreateFormatConverter(&wicConverter));
+                TESTHR(wicConverter->Initialize(source.Get(), destinationFormat, WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeCustom));
+
+                ComPtr<IWICBitmapSource> fastConverter;
+                TESTHR(FormatConverter::CreateBitmapSource(source.Get(), destinationFormat, &fastConverter));
+
+                const UINT stride = width * destinationInfo.bitsPerPixel / 8;
+                std::vector<uint8_t> wicPixels(static_cast<size_t>(stride) * height);
+                std::vector<uint8_t> fastPixels(wicPixels.size());
+
+                auto timeCopy = [&](IWICBitmapSource* converter, std::vector<uint8_t>& output)
+                {
+                    double bestMs = std::numeric_limits<double>::infinity();
+                    for (int run = 0; run < runs; run++)
+                    {
+                        auto begin = std::chrono::steady_clock::now();
+                        TESTHR(converter->CopyPixels(nullptr, stride, static_cast<UINT>(output.size()), output.data()));
+                        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+                        bestMs = min(bestMs, ms);
+                    }
+                    return bestMs;
+                };
+
+                double wicMs = timeCopy(wicConverter.Get(), wicPixels);
+                double fastMs = timeCopy(fastConverter.Get(), fastPixels);
+
+                log << getName(sourceFormat) << L" -> " << getName(destinationFormat) << L": WIC "
+                    << wicMs << L" ms, FormatConverter " << fastMs << L" ms (" << wicMs / fastMs << L"x)\n";
+
+                std::vector<float> expected, actual;
+                readChannels(destinationFormat, wicPixels, expected);
+                readChannels(destinationFormat, fastPixels, actual);
+
+                UINT bits = min(sourceInfo.bitsPerChannel, destinationInfo.bitsPerChannel);
+                float tolerance = 1.5f / ((1u << bits) - 1);
+
+                for (size_t i = 0; i < expected.size(); i++)
+                {
+                    float error = fabsf(expected[i] - actual[i]);
+                    bool matches = destinationInfo.isFloat ?
+                        error <= 2e-3f * max(1.0f, fabsf(expected[i])) :
+                        error <= tolerance;
+
+                    if (!matches)
+                    {
+                        std::wstringstream message;
+                        message << getName(sourceFormat) << L" -> " << getName(destinationFormat) << L": channel " << i
+                            << L" is " << actual[i] << L", WIC gives " << expected[i];
+                        Logger::WriteMessage(log.str().c_str());
+                        Assert::Fail(message.str().c_str());
+                    }
+                }
+            }
+
+            Logger::WriteMessage(log.str().c_str());
+        }
+
+        // Converts ICC tagged images to scRGB with IccTransform, and with the Direct2D color management
+        // effect as the renderer does. Results must agree to within 1% (relative above 1.0).
+        TEST_METHOD(IccTransformMatchesD2D)
+        {
+            const wchar_t* filenames[] = { L"Jpg_ProPhotoIcc.jpg", L"Tif_16bpcArgbIcc.tif" };
+
+            m_devRes = std::make_shared<DX::DeviceResources>();
+            auto wicFactory = m_devRes->GetWicImagingFactory();
+            auto context = m_devRes->GetD2DDeviceContext();
+
+            for (auto filename : filenames)
+            {
+                std::wstring path = std::wstring(L"ms-appx:///TestInputs/") + filename;
+                auto uri = ref new Windows::Foundation::Uri(ref new Platform::String(path.c_str()));
+
+                create_task(StorageFile::GetFileFromApplicationUriAsync(uri)).then([=](StorageFile^ imageFile) {
+
+                    return create_task(imageFile->OpenAsync(FileAccessMode::Read));
+
+                }).then([=](IRandomAccessStream^ stream) {
+
+                    ComPtr<IStream> iStream;
+                    TESTHR(CreateStreamOverRandomAccessStream(stream, IID_PPV_ARGS(&iStream)));
+
+                    // Direct2D: the loaded image through the color management effect.
+                    auto loader = std::make_unique<ImageLoader>(m_devRes);
+                    ImageInfo info = loader->LoadImageFromWic(iStream.Get());
+                    Assert::IsTrue(loader->GetState() == ImageLoaderState::LoadingSucceeded);
+
+                    UINT width = static_cast<UINT>(info.size.Width);
+                    UINT height = static_cast<UINT>(info.size.Height);
+
+                    ComPtr<ID2D1Image> source;
+                    source.Attach(loader->GetLoadedImage(1.0f));
+
+                    ComPtr<ID2D1Effect> colorManage;
+                    TESTHR(context->CreateEffect(CLSID_D2D1ColorManagement, &colorManage));
+                    colorManage->SetInput(0, source.Get());
+                    TESTHR(colorManage->SetValue(D2D1_COLORMANAGEMENT_PROP_QUALITY, D2D1_COLORMANAGEMENT_QUALITY_BEST));
+                    TESTHR(colorManage->SetValue(D2D1_COLORMANAGEMENT_PROP_SOURCE_COLOR_CONTEXT, loader->GetImageColorContext()));
+
+                    ComPtr<ID2D1ColorContext1> scRgb;
+                    TESTHR(context->CreateColorContextFromDxgiColorSpace(DXGI_COLOR_SPACE_RGB_FULL_G10_NONE_P709, &scRgb));
+                    TESTHR(colorManage->SetValue(D2D1_COLORMANAGEMENT_PROP_DESTINATION_COLOR_CONTEXT, scRgb.Get()));
+
+                    D2D1_BITMAP_PROPERTIES1 targetProps = D2D1::BitmapProperties1(
+                        D2D1_BITMAP_OPTIONS_TARGET,
+                        D2D1::PixelFormat(DXGI_FORMAT_R16G16B16A16_FLOAT, D2D1_ALPHA_MODE_PREMULTIPLIED));
+
+                    D2D1_BITMAP_PROPERTIES1 readbackProps = D2D1::BitmapProperties1(
+                        D2D1_BITMAP_OPTIONS_CPU_READ | D2D1_BITMAP_OPTIONS_CANNOT_DRAW,
+                        D2D1::PixelFormat(DXGI_FORMAT_R16G16B16A16_FLOAT, D2D1_ALPHA_MODE_PREMULTIPLIED));
+
+                    ComPtr<ID2D1Bitmap1> target;
+                    ComPtr<ID2D1Bitmap1> readback;
+                    TESTHR(context->CreateBitmap(D2D1::SizeU(width, height), nullptr, 0, &targetProps, &target));
+                    TESTHR(context->CreateBitmap(D2D1::SizeU(width, height), nullptr, 0, &readbackProps, &readback));
+
+                    context->SetTarget(target.Get());
+                    context->BeginDraw();
+                    context->Clear(D2D1::ColorF(0, 0, 0, 0));
+                    context->DrawImage(colorManage.Get(), D2D1_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+                    TESTHR(context->EndDraw());
+                    context->SetTarget(nullptr);
+
+                    TESTHR(readback->CopyFromBitmap(nullptr, target.Get(), nullptr));
+
+                    // CPU: the decoded pixels at 16 bpc, which WIC converts without changing their encoding.
+                    LARGE_INTEGER start = {};
+                    TESTHR(iStream->Seek(start, STREAM_SEEK_SET, nullptr));
+
+                    ComPtr<IWICBitmapDecoder> decoder;
+                    TESTHR(wicFactory->CreateDecoderFromStream(iStream.Get(), nullptr, WICDecodeMetadataCacheOnDemand, &decoder));
+
+                    ComPtr<IWICBitmapFrameDecode> frame;
+                    TESTHR(decoder->GetFrame(0, &frame));
+
+                    ComPtr<IWICColorContext> colorContext;
+                    UINT actualCount = 0;
+                    TESTHR(wicFactory->CreateColorContext(&colorContext));
+                    TESTHR(frame->GetColorContexts(1, colorContext.GetAddressOf(), &actualCount));
+
+                    IccTransform transform;
+                    TESTHR(IccTransform::CreateFromWicColorContext(colorContext.Get(), transform));
+
+                    ComPtr<IWICFormatConverter> converter;
+                    TESTHR(wicFactory->CreateFormatConverter(&converter));
+                    TESTHR(converter->Initialize(frame.Get(), GUID_WICPixelFormat64bppRGBA, WICBitmapDitherTypeNone, nullptr, 0.0f, WICBitmapPaletteTypeCustom));
+
+                    const UINT stride = width * 8;
+                    std::vector<uint8_t> encoded(static_cast<size_t>(stride) * height);
+                    std::vector<uint8_t> linear(encoded.size());
+                    TESTHR(converter->CopyPixels(nullptr, stride, static_cast<UINT>(encoded.size()), encoded.data()));
+
+                    transform.ConvertRows(encoded.data(), stride, linear.data(), stride, width, height);
+
+                    D2D1_MAPPED_RECT mapped = {};
+                    TESTHR(readback->Map(D2D1_MAP_OPTIONS_READ, &mapped));
+
+                    float maxError = 0.0f;
+                    for (UINT y = 0; y < height; y++)
+                    {
+                        auto expected = reinterpret_cast<const DirectX::PackedVector::HALF*>(mapped.bits + static_cast<size_t>(y) * mapped.pitch);
+                        auto actual = reinterpret_cast<const DirectX::PackedVector::HALF*>(linear.data() + static_cast<size_t>(y) * stride);
+
+                        for (UINT i = 0; i < width * 4; i++)
+                        {
+                            float e = DirectX::PackedVector::XMConvertHalfToFloat(expected[i]);
+                            float a = DirectX::PackedVector::XMConvertHalfToFloat(actual[i]);
+                            maxError = max(maxError, fabsf(e - a) / max(1.0f, fabsf(e)));
+                        }
+                    }
+
+                    TESTHR(readback->Unmap());
+
+                    std::wstringstream log;
+                    log << filename << L": largest difference from Direct2D " << maxError;
+                    Logger::WriteMessage(log.str().c_str());
+
+                    Assert::IsTrue(maxError < 0.01f, L"IccTransform differs from Direct2D");
+                }).then([=](task<void> previousTask) {
+                    try
+                    {
+                        previousTask.get();
+                    }
+                    catch (Platform::COMException^ e)
+                    {
+                        Assert::AreEqual(static_cast<int>(S_OK), e->HResult);
+                    }
+                }).get();
+            }
+        }
+
+        // Bakes the ProPhoto profile's IccTransform into LUTs and converts random pixels with both.
+        // Tetrahedral interpolation must stay within 0.2% of the analytic transform. Also parses an
+        // identity .cube file with a non unit domain.
+        TEST_METHOD(Lut3DMatchesAnalyticTransform)
+        {
+            const UINT width = 2048;
+            const UINT height = 1024;
+            const UINT sizes[] = { 17, 33, 65 };
+
+            m_devRes = std::make_shared<DX::DeviceResources>();
+            auto wicFactory = m_devRes->GetWicImagingFactory();
+
+            const char cube[] =
+                "# Identity\n"
+                "TITLE \"Identity\"\n"
+                "LUT_3D_SIZE 2\n"
+                "DOMAIN_MIN 0 0 0\n"
+                "DOMAIN_MAX 2 2 2\n"
+                "0 0 0\n2 0 0\n0 2 0\n2 2 0\n0 0 2\n2 0 2\n0 2 2\n2 2 2\n";
+
+            Lut3D identity;
+            TESTHR(Lut3D::ParseCube(cube, sizeof(cube) - 1, identity));
+            DirectX::XMFLOAT4 sample;
+            DirectX::XMStoreFloat4(&sample, identity.Sample(DirectX::XMVectorSet(0.25f, 1.5f, 3.0f, 0.5f)));
+            Assert::IsTrue(fabsf(sample.x - 0.25f) < 1e-6f && fabsf(sample.y - 1.5f) < 1e-6f && fabsf(sample.z - 2.0f) < 1e-6f && sample.w == 0.5f);
+
+            Lut3D truncated;
+            Assert::AreEqual(static_cast<int>(WINCODEC_ERR_BADHEADER), static_cast<int>(Lut3D::ParseCube(cube, sizeof(cube) - 8, truncated)));
+
+            auto uri = ref new Windows::Foundation::Uri(L"ms-appx:///TestInputs/Jpg_ProPhotoIcc.jpg");
+
+            create_task(StorageFile::GetFileFromApplicationUriAsync(uri)).then([=](StorageFile^ imageFile) {
+
+                return create_task(imageFile->OpenAsync(FileAccessMode::Read));
+
+            }).then([=](IRandomAccessStream^ stream) {
+
+                ComPtr<IStream> iStream;
+                TESTHR(CreateStreamOverRandomAccessStream(stream, IID_PPV_ARGS(&iStream)));
+
+                ComPtr<IWICBitmapDecoder> decoder;
+                TESTHR(wicFactory->CreateDecoderFromStream(iStream.Get(), nullptr, WICDecodeMetadataCacheOnDemand, &decoder));
+
+                ComPtr<IWICBitmapFrameDecode> frame;
+                TESTHR(decoder->GetFrame(0, &frame));
+
+                ComPtr<IWICColorContext> colorContext;
+                UINT actualCount = 0;
+                TESTHR(wicFactory->CreateColorContext(&colorContext));
+                TESTHR(frame->GetColorContexts(1, colorContext.GetAddressOf(), &actualCount));
+
+                IccTransform transform;
+                TESTHR(IccTransform::CreateFromWicColorContext(colorContext.Get(), transform));
+
+                const UINT stride = width * 8;
+                std::vector<uint16_t> encoded(static_cast<size_t>(width) * height * 4);
+                std::mt19937 random(1);
+                std::uniform_int_distribution<int> unorm(0, 65535);
+                for (auto& channel : encoded)
+                {
+                    channel = static_cast<uint16_t>(unorm(random));
+                }
+
+                auto source = reinterpret_cast<const uint8_t*>(encoded.data());
+                std::vector<uint8_t> expected(encoded.size() * 2);
+                std::vector<uint8_t> actual(expected.size());
+
+                auto begin = std::chrono::steady_clock::now();
+                transform.ConvertRows(source, stride, expected.data(), stride, width, height);
+                double analyticMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+                std::wstringstream log;
+                log << L"Converting " << width << L"x" << height << L": IccTransform " << analyticMs << L" ms\n";
+
+                float worstError = 0.0f;
+
+                for (auto size : sizes)
+                {
+                    Lut3D lut;
+                    begin = std::chrono::steady_clock::now();
+                    TESTHR(Lut3D::Bake(size, [&](DirectX::FXMVECTOR color) { return transform.Evaluate(color); }, lut));
+                    double bakeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+                    begin = std::chrono::steady_clock::now();
+                    lut.ConvertRows(source, stride, actual.data(), stride, width, height);
+                    double lutMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+                    auto e = reinterpret_cast<const DirectX::PackedVector::HALF*>(expected.data());
+                    auto a = reinterpret_cast<const DirectX::PackedVector::HALF*>(actual.data());
+
+                    float maxError = 0.0f;
+                    for (size_t i = 0; i < encoded.size(); i++)
+                    {
+                        float error = fabsf(DirectX::PackedVector::XMConvertHalfToFloat(e[i]) - DirectX::PackedVector::XMConvertHalfToFloat(a[i]));
+                        maxError = max(maxError, error);
+                    }
+
+                    log << size << L" point LUT: bake " << bakeMs << L" ms, convert " << lutMs
+                        << L" ms, largest difference " << maxError << L"\n";
+
+                    // Coarse grids are only reported; the sizes used for baking must be accurate.
+                    if (size >= 33)
+                    {
+                        worstError = max(worstError, maxError);
+                    }
+                }
+
+                Logger::WriteMessage(log.str().c_str());
+                Assert::IsTrue(worstError < 0.002f, L"Lut3D differs from IccTransform");
+            }).then([=](task<void> previousTask) {
+                try
+                {
+                    previousTask.get();
+                }
+                catch (Platform::COMException^ e)
+                {
+                    Assert::AreEqual(static_cast<int>(S_OK), e->HResult);
+                }
+            }).get();
+        }
+
+        // Evaluates each transfer function over its whole domain with the FP32 and FP16 kernels and
+        // the exact formulas. Errors, in nits as documented in TransferFunctions.h, must stay within
+        // the documented bounds.
+        TEST_METHOD(TransferFunctionsMatchExact)
+        {
+            using DirectX::PackedVector::HALF;
+
+            struct Case
+            {
+                TransferFunction    function;
+                const wchar_t*      name;
+                float               maximum;        // Largest input.
+                float               floatBound;     // Error bounds in nits.
+                float               halfBound;
+            };
+
+            const Case cases[] =
+            {
+                { TransferFunction::PqEotf,         L"PqEotf",         1.0f,     0.6f,   3.9f },
+                { TransferFunction::PqInverseEotf,  L"PqInverseEotf",  10000.0f, 1.0f,   23.0f },
+                { TransferFunction::HlgOetf,        L"HlgOetf",        1.0f,     0.001f, 1.4f },
+                { TransferFunction::HlgInverseOetf, L"HlgInverseOetf", 1.0f,     0.001f, 0.25f },
+            };
+
+            const size_t count = 4 * 1024 * 1024 + 3; // Not a whole number of vectors.
+            const float hlgPeakNits = 1000.0f;
+
+            std::wstringstream log;
+            log << L"Converting " << count << L" values, " << (TransferFunctions::IsAvx2Supported() ? L"AVX2" : L"DirectXMath") << L" kernels:\n";
+
+            for (const auto& c : cases)
+            {
+                std::vector<float> input(count);
+                std::vector<float> exact(count);
+                std::vector<float> fast(count);
+                std::vector<HALF> halfInput(count);
+                std::vector<HALF> halfOutput(count);
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    input[i] = c.maximum * i / (count - 1);
+                    halfInput[i] = DirectX::PackedVector::XMConvertFloatToHalf(input[i]);
+                }
+
+                auto begin = std::chrono::steady_clock::now();
+                for (size_t i = 0; i < count; i++)
+                {
+                    exact[i] = TransferFunctions::EvaluateExact(c.function, input[i]);
+                }
+                double exactMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+                // Builds the FP16 table outside of the timed run.
+                TransferFunctions::Convert(c.function, halfInput.data(), halfOutput.data(), 1);
+
+                begin = std::chrono::steady_clock::now();
+                TransferFunctions::Convert(c.function, input.data(), fast.data(), count);
+                double floatMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+                begin = std::chrono::steady_clock::now();
+                TransferFunctions::Convert(c.function, halfInput.data(), halfOutput.data(), count);
+                double halfMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+                // Error in nits of an output for input i. Inverse functions are decoded exactly.
+                auto errorNits = [&](float output, float in, float expected)
+                {
+                    switch (c.function)
+                    {
+                    case TransferFunction::PqInverseEotf:
+                        return fabsf(TransferFunctions::EvaluateExact(TransferFunction::PqEotf, output) - in);
+                    case TransferFunction::HlgOetf:
+                        return hlgPeakNits * fabsf(TransferFunctions::EvaluateExact(TransferFunction::HlgInverseOetf, output) - in);
+                    case TransferFunction::HlgInverseOetf:
+                        return hlgPeakNits * fabsf(output - expected);
+                    default:
+                        return fabsf(output - expected);
+                    }
+                };
+
+                float floatError = 0.0f;
+                float halfError = 0.0f;
+                for (size_t i = 0; i < count; i++)
+                {
+                    float e = errorNits(fast[i], input[i], exact[i]);
+                    floatError = max(floatError, e);
+
+                    float halfIn = DirectX::PackedVector::XMConvertHalfToFloat(halfInput[i]);
+                    float halfOut = DirectX::PackedVector::XMConvertHalfToFloat(halfOutput[i]);
+                    e = errorNits(halfOut, halfIn, TransferFunctions::EvaluateExact(c.function, halfIn));
+                    halfError = max(halfError, e);
+                }
+
+                log << c.name << L": exact " << exactMs << L" ms, FP32 " << floatMs << L" ms (" << exactMs / floatMs
+                    << L"x), FP16 " << halfMs << L" ms (" << exactMs / halfMs << L"x); largest error FP32 "
+                    << floatError << L" nits, FP16 " << halfError << L" nits\n";
+
+                if (floatError > c.floatBound || halfError > c.halfBound)
+                {
+                    Logger::WriteMessage(log.str().c_str());
+                    Assert::Fail(c.name);
+                }
+            }
+
+            Logger::WriteMessage(log.str().c_str());
+        }
+
+        // Entries outside the window are evicted when it moves. Over the byte budget, the entry furthest
+        // from the current position goes first, and the least recently used of equally distant ones.
+        TEST_METHOD(ImagePrefetchCacheEvictsByDistanceAndAge)
+        {
+            m_devRes = std::make_shared<DX::DeviceResources>();
+
+            const size_t imageBytes = 100;
+            ImagePrefetchCache cache(3 * imageBytes);
+            cache.SetWindow(10, 3);
+
+            auto a = std::make_shared<ImageLoader>(m_devRes);
+            cache.Insert(L"a", 8, a, imageBytes);
+            cache.Insert(L"b", 12, std::make_shared<ImageLoader>(m_devRes), imageBytes);
+            cache.Insert(L"c", 11, std::make_shared<ImageLoader>(m_devRes), imageBytes);
+
+            // a and b are equally far away; using a leaves b least recently used.
+            Assert::IsTrue(cache.Lookup(L"a") == a);
+
+            cache.Insert(L"d", 9, std::make_shared<ImageLoader>(m_devRes), imageBytes);
+            Assert::IsFalse(cache.Contains(L"b"), L"b should be evicted first");
+            Assert::IsTrue(cache.Contains(L"a") && cache.Contains(L"c") && cache.Contains(L"d"));
+
+            // Replacing an entry is not an eviction.
+            cache.Insert(L"c", 11, std::make_shared<ImageLoader>(m_devRes), imageBytes);
+            Assert::AreEqual(1ull, cache.GetStats().evictions);
+
+            // The furthest entry is evicted even if it was just inserted.
+            cache.Insert(L"e", 13, std::make_shared<ImageLoader>(m_devRes), imageBytes);
+            Assert::IsFalse(cache.Contains(L"e"), L"e is furthest from the position");
+            Assert::AreEqual(2ull, cache.GetStats().evictions);
+
+            // Moving the window evicts a (4 away) and d (3 away), but keeps c.
+            cache.SetWindow(12, 1);
+            Assert::IsFalse(cache.Contains(L"a") || cache.Contains(L"d"));
+            Assert::IsTrue(cache.Contains(L"c"));
+
+            auto stats = cache.GetStats();
+            Assert::AreEqual(4ull, stats.evictions);
+            Assert::AreEqual(size_t(1), stats.entryCount);
+            Assert::AreEqual(imageBytes, stats.residentBytes);
+
+            Assert::IsTrue(cache.Lookup(L"b") == nullptr);
+            stats = cache.GetStats();
+            Assert::AreEqual(1ull, stats.hits);
+            Assert::AreEqual(1ull, stats.misses);
+
+            cache.SetByteBudget(0);
+            stats = cache.GetStats();
+            Assert::AreEqual(size_t(0), stats.entryCount);
+            Assert::AreEqual(size_t(0), stats.residentBytes);
+            Assert::AreEqual(5ull, stats.evictions);
+        }
+
+        // Encodes FP16 pixels as a Radiance file and decodes them again. Widths outside [8, 0x7fff]
+        // can't be run length encoded and use flat scanlines.
+        TEST_METHOD(RgbeRoundTrip)
+        {
+            using DirectX::PackedVector::HALF;
+
+            const UINT widths[] = { 5, 640, 0x7fff + 3 };
+            const UINT height = 3;
+
+            std::mt19937 random(6);
+            std::uniform_real_distribution<float> exponent(-8.0f, 12.0f);
+
+            for (UINT width : widths)
+            {
+                size_t count = static_cast<size_t>(width) * height;
+
+                // Runs of equal pixels exercise the run length encoding, random pixels the literals.
+                std::vector<HALF> original(count * 4);
+                for (size_t i = 0; i < count; i++)
+                {
+                    if (i % 16 < 8 || i == 0)
+                    {
+                        for (size_t c = 0; c < 3; c++)
+                        {
+                            original[i * 4 + c] = DirectX::PackedVector::XMConvertFloatToHalf(exp2f(exponent(random)));
+                        }
+                    }
+                    else
+                    {
+                        std::copy_n(&original[(i - 1) * 4], 3, &original[i * 4]);
+                    }
+
+                    original[i * 4 + 3] = DirectX::PackedVector::XMConvertFloatToHalf(1.0f);
+                }
+
+                RgbeImage image = { width, height };
+                image.pixels.resize(count * 4);
+                RgbeCodec::CompressFromHalf(original.data(), count, image.pixels.data());
+
+                std::vector<uint8_t> file;
+                TESTHR(RgbeCodec::Encode(image, file));
+
+                RgbeImage decoded = {};
+                TESTHR(RgbeCodec::Decode(file.data(), file.size(), decoded));
+
+                Assert::AreEqual(width, decoded.width);
+                Assert::AreEqual(height, decoded.height);
+
+                // The file format itself is lossless.
+                Assert::IsTrue(decoded.pixels == image.pixels, L"RGBE pixels changed by encoding");
+
+                std::vector<HALF> expanded(count * 4);
+                RgbeCodec::ExpandToHalf(decoded.pixels.data(), count, expanded.data());
+
+                // The shared exponent leaves 8 bits of mantissa for the largest component, and the
+                // others are quantized to the same step; allow for rounding to FP16 on top.
+                for (size_t i = 0; i < count; i++)
+                {
+                    float in[3], out[3];
+                    for (size_t c = 0; c < 3; c++)
+                    {
+                        in[c] = DirectX::PackedVector::XMConvertHalfToFloat(original[i * 4 + c]);
+                        out[c] = DirectX::PackedVector::XMConvertHalfToFloat(expanded[i * 4 + c]);
+                    }
+
+                    float bound = max(in[0], max(in[1], in[2])) / 100.0f;
+                    for (size_t c = 0; c < 3; c++)
+                    {
+                        if (fabsf(out[c] - in[c]) > bound)
+                        {
+                            std::wstringstream message;
+                            message << L"Width " << width << L", pixel " << i << L": " << in[c] << L" decoded as " << out[c];
+                            Assert::Fail(message.str().c_str());
+                        }
+                    }
+
+                    Assert::AreEqual(1.0f, DirectX::PackedVector::XMConvertHalfToFloat(expanded[i * 4 + 3]));
+                }
+            }
+        }
+
+        // Stores a decoded Radiance image in the disk cache and maps it back in. Logs the time to open the
+        // file cold (decode) and warm (mapped from the cache), including the upload to the GPU. An entry
+        // must miss for a different key or once truncated, and Trim must evict the least recently used.
+        TEST_METHOD(DecodedImageCacheRoundTrip)
+        {
+            using DirectX::PackedVector::HALF;
+
+            const UINT width = 2048;
+            const UINT height = 1024;
+
+            m_devRes = std::make_shared<DX::DeviceResources>();
+            auto wicFactory = m_devRes->GetWicImagingFactory();
+
+            auto folder = ApplicationData::Current->TemporaryFolder->Path + L"\\DecodedImageCacheTest";
+            CreateDirectoryW(folder->Data(), nullptr);
+
+            auto findEntries = [&]()
+            {
+                std::vector<std::wstring> entries;
+
+                WIN32_FIND_DATAW findData = {};
+                HANDLE find = FindFirstFileExW((std::wstring(folder->Data()) + L"\\*.decoded").c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, 0);
+                if (find != INVALID_HANDLE_VALUE)
+                {
+                    do
+                    {
+                        entries.push_back(std::wstring(folder->Data()) + L"\\" + findData.cFileName);
+                    } while (FindNextFileW(find, &findData));
+
+                    FindClose(find);
+                }
+
+                return entries;
+            };
+
+            for (auto& entry : findEntries())
+            {
+                DeleteFileW(entry.c_str());
+            }
+
+            // Write the source file.
+            std::mt19937 random(14);
+            std::uniform_real_distribution<float> exponent(-8.0f, 12.0f);
+
+            size_t count = static_cast<size_t>(width) * height;
+            std::vector<HALF> original(count * 4);
+            for (size_t i = 0; i < count; i++)
+            {
+                for (size_t c = 0; c < 3; c++)
+                {
+                    original[i * 4 + c] = DirectX::PackedVector::XMConvertFloatToHalf(exp2f(exponent(random)));
+                }
+
+                original[i * 4 + 3] = DirectX::PackedVector::XMConvertFloatToHalf(1.0f);
+            }
+
+            RgbeImage image = { width, height };
+            image.pixels.resize(count * 4);
+            RgbeCodec::CompressFromHalf(original.data(), count, image.pixels.data());
+
+            std::vector<uint8_t> fileData;
+            TESTHR(RgbeCodec::Encode(image, fileData));
+
+            auto sourcePath = folder + L"\\Source.hdr";
+            {
+                Wrappers::FileHandle file(CreateFile2(sourcePath->Data(), GENERIC_WRITE, 0, CREATE_ALWAYS, nullptr));
+                Assert::IsTrue(file.IsValid());
+
+                DWORD written = 0;
+                Assert::IsTrue(WriteFile(file.Get(), fileData.data(), static_cast<DWORD>(fileData.size()), &written, nullptr) != FALSE);
+            }
+
+            DecodedImageCache cache(folder, wicFactory, 1ull << 30, 16);
+            auto key = DecodedImageCache::MakeKey(sourcePath, fileData.size(), 1);
+            const ImageCLL cll = { 1234.0f, 56.0f };
+
+            // Cold: decode the file.
+            auto begin = std::chrono::steady_clock::now();
+
+            auto coldLoader = std::make_shared<ImageLoader>(m_devRes);
+            auto coldInfo = coldLoader->LoadImageFromDirectXTex(sourcePath, L".hdr");
+            Assert::IsTrue(coldLoader->GetState() == ImageLoaderState::LoadingSucceeded);
+            Assert::AreEqual(1u, coldInfo.frameCount);
+            Assert::AreEqual(1u, coldInfo.mipCount);
+            coldLoader->EnsureDecoded();
+
+            double coldMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+            ComPtr<IWICBitmapSource> pixels;
+            TESTHR(coldLoader->CreatePersistableSource(&pixels));
+            TESTHR(cache.Store(key, coldInfo, cll, pixels.Get()));
+
+            // Warm: map the entry back in.
+            begin = std::chrono::steady_clock::now();
+
+            DecodedImage decoded;
+            Assert::AreEqual(S_OK, cache.Lookup(key, decoded));
+
+            auto warmLoader = std::make_shared<ImageLoader>(m_devRes);
+            auto warmInfo = warmLoader->LoadImageFromDecoded(decoded);
+            Assert::IsTrue(warmLoader->GetState() == ImageLoaderState::LoadingSucceeded);
+            warmLoader->EnsureDecoded();
+
+            double warmMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+            std::wstringstream log;
+            log << width << L"x" << height << L" Radiance image: " << coldMs << L" ms cold, " << warmMs << L" ms warm";
+            Logger::WriteMessage(log.str().c_str());
+
+            Assert::AreEqual(coldInfo.size.Width, warmInfo.size.Width);
+            Assert::AreEqual(coldInfo.size.Height, warmInfo.size.Height);
+            Assert::AreEqual(coldInfo.isFloat, warmInfo.isFloat);
+            Assert::IsTrue(coldInfo.imageKind == warmInfo.imageKind);
+            Assert::AreEqual(cll.maxNits, decoded.cll.maxNits);
+            Assert::AreEqual(cll.medNits, decoded.cll.medNits);
+
+            WICPixelFormatGUID format = {}, mappedFormat = {};
+            TESTHR(pixels->GetPixelFormat(&format));
+            TESTHR(decoded.pixels->GetPixelFormat(&mappedFormat));
+            Assert::IsTrue(format == mappedFormat);
+
+            ComPtr<IWICComponentInfo> componentInfo;
+            ComPtr<IWICPixelFormatInfo> formatInfo;
+            UINT bitsPerPixel = 0;
+            TESTHR(wicFactory->CreateComponentInfo(format, &componentInfo));
+            TESTHR(componentInfo.As(&formatInfo));
+            TESTHR(formatInfo->GetBitsPerPixel(&bitsPerPixel));
+
+            UINT stride = width * bitsPerPixel / 8;
+            std::vector<BYTE> expected(static_cast<size_t>(stride) * height);
+            std::vector<BYTE> actual(expected.size());
+            TESTHR(pixels->CopyPixels(nullptr, stride, static_cast<UINT>(expected.size()), expected.data()));
+            TESTHR(decoded.pixels->CopyPixels(nullptr, stride, static_cast<UINT>(actual.size()), actual.data()));
+            Assert::IsTrue(expected == actual, L"Mapped pixels differ from the stored pixels");
+
+            // A different version of the file misses.
+            DecodedImage other;
+            Assert::AreEqual(S_FALSE, cache.Lookup(DecodedImageCache::MakeKey(sourcePath, fileData.size(), 2), other));
+
+            // A truncated entry misses. The mapping must be released before the file can be truncated.
+            warmLoader = nullptr;
+            decoded = {};
+
+            auto entries = findEntries();
+            Assert::AreEqual(size_t(1), entries.size());
+            {
+                Wrappers::FileHandle file(CreateFile2(entries[0].c_str(), GENERIC_WRITE, 0, OPEN_EXISTING, nullptr));
+                Assert::IsTrue(file.IsValid());
+
+                LARGE_INTEGER end = {};
+                end.QuadPart = static_cast<LONGLONG>(expected.size() / 2);
+                Assert::IsTrue(SetFilePointerEx(file.Get(), end, nullptr, FILE_BEGIN) != FALSE);
+                Assert::IsTrue(SetEndOfFile(file.Get()) != FALSE);
+            }
+
+            Assert::AreEqual(S_FALSE, cache.Lookup(key, decoded));
+            DeleteFileW(entries[0].c_str());
+
+            // With room for two entries, looking up a leaves b least recently used.
+            DecodedImageCache smallCache(folder, wicFactory, 1ull << 30, 2);
+            ComPtr<IWICBitmap> small;
+            TESTHR(wicFactory->CreateBitmap(16, 16, GUID_WICPixelFormat64bppPRGBAHalf, WICBitmapCacheOnLoad, &small));
+
+            ImageInfo smallInfo = {};
+            smallInfo.size = Size(16.0f, 16.0f);
+
+            // File times are only as precise as the system clock.
+            TESTHR(smallCache.Store(L"a", smallInfo, cll, small.Get()));
+            Sleep(50);
+            TESTHR(smallCache.Store(L"b", smallInfo, cll, small.Get()));
+            Sleep(50);
+            Assert::AreEqual(S_OK, smallCache.Lookup(L"a", decoded));
+            decoded = {};
+            Sleep(50);
+            TESTHR(smallCache.Store(L"c", smallInfo, cll, small.Get()));
+
+            Assert::AreEqual(size_t(2), findEntries().size());
+            Assert::AreEqual(S_FALSE, smallCache.Lookup(L"b", decoded), L"b should be evicted");
+            Assert::AreEqual(S_OK, smallCache.Lookup(L"a", decoded));
+            Assert::AreEqual(S_OK, smallCache.Lookup(L"c", decoded));
+            decoded = {};
+
+            for (auto& entry : findEntries())
+            {
+                DeleteFileW(entry.c_str());
+            }
+
+            DeleteFileW(sourcePath->Data());
+        }
+
+        // Loads one ICC tagged image as a 500 image folder sharing a profile would be loaded: only the
+        // first load should parse the profile and create its color context. Logs the time per load with
+        // the shared cache and with the cache cleared before every load.
+        TEST_METHOD(ColorProfileCacheSharesProfiles)
+        {
+            const int numLoads = 500;
+
+            m_devRes = std::make_shared<DX::DeviceResources>();
+
+            auto uri = ref new Windows::Foundation::Uri(L"ms-appx:///TestInputs/Jpg_ProPhotoIcc.jpg");
+
+            create_task(StorageFile::GetFileFromApplicationUriAsync(uri)).then([=](StorageFile^ imageFile) {
+
+                return create_task(imageFile->OpenAsync(FileAccessMode::Read));
+
+            }).then([=](IRandomAccessStream^ stream) {
+
+                ComPtr<IStream> iStream;
+                TESTHR(CreateStreamOverRandomAccessStream(stream, IID_PPV_ARGS(&iStream)));
+
+                auto timedLoads = [&](bool clearCache)
+                {
+                    ColorProfileCache::Clear();
+
+                    auto begin = std::chrono::steady_clock::now();
+                    for (int i = 0; i < numLoads; i++)
+                    {
+                        if (clearCache)
+                        {
+                            ColorProfileCache::Clear();
+                        }
+
+                        LARGE_INTEGER start = {};
+                        TESTHR(iStream->Seek(start, STREAM_SEEK_SET, nullptr));
+
+                        ImageLoader loader(m_devRes);
+                        loader.LoadImageFromWic(iStream.Get());
+                        Assert::IsTrue(loader.GetState() == ImageLoaderState::LoadingSucceeded);
+                    }
+
+                    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / numLoads;
+                };
+
+                double uncachedMs = timedLoads(true);
+                double cachedMs = timedLoads(false);
+
+                auto stats = ColorProfileCache::GetStats();
+
+                std::wstringstream log;
+                log << L"Per load: " << cachedMs << L" ms shared, " << uncachedMs << L" ms unshared; "
+                    << L"profile hits: " << stats.hits << L", misses: " << stats.misses << L", "
+                    << L"color context hits: " << stats.colorContextHits << L", misses: " << stats.colorContextMisses;
+                Logger::WriteMessage(log.str().c_str());
+
+                Assert::AreEqual(static_cast<uint64_t>(1), stats.misses);
+                Assert::AreEqual(static_cast<uint64_t>(numLoads - 1), stats.hits);
+                Assert::AreEqual(static_cast<uint64_t>(1), stats.colorContextMisses);
+                Assert::AreEqual(static_cast<uint64_t>(numLoads - 1), stats.colorContextHits);
+            }).then([=](task<void> previousTask) {
+                try
+                {
+                    previousTask.get();
+                }
+                catch (Platform::COMException^ e)
+                {
+                    Assert::AreEqual(static_cast<int>(S_OK), e->HResult);
+                }
+            }).get();
+        }
+
+        // Benchmarks the fused render pipeline against the chained effect graph it replaces, for each
+        // fusable RenderEffectKind and display mode: per frame (a 1920x1080 view drawn repeatedly) and per
+        // export (a 12 MP image rendered in strips and read back) on the GPU, and per export on the CPU.
+        // Results must agree to within FP16 rounding of the chained graph's intermediates.
+        TEST_METHOD(FusedRenderPipelineMatchesChained)
+        {
+            const UINT frameWidth = 1920;
+            const UINT frameHeight = 1080;
+            const UINT frameCount = 60;
+            const UINT width = 4000;
+            const UINT height = 3000;
+            const UINT stripRows = 1024;
+            const UINT stride = width * 8;
+
+            m_devRes = std::make_shared<DX::DeviceResources>();
+            auto factory = m_devRes->GetD2DFactory();
+            auto context = m_devRes->GetD2DDeviceContext();
+
+            TESTHR(SimpleTonemapEffect::Register(factory));
+            TESTHR(SdrOverlayEffect::Register(factory));
+            TESTHR(LuminanceHeatmapEffect::Register(factory));
+            TESTHR(FusedRenderEffect::Register(factory));
+
+            // scRGB up to 1600 nits; a third of the pixels are SDR grays.
+            std::vector<uint8_t> source(static_cast<size_t>(stride) * height);
+            std::mt19937 random(25);
+            std::uniform_real_distribution<float> value(0.0f, 20.0f);
+            auto sourcePixels = reinterpret_cast<DirectX::PackedVector::XMHALF4*>(source.data());
+            for (size_t i = 0; i < static_cast<size_t>(width) * height; i++)
+            {
+                float r = value(random);
+                float g = value(random);
+                float b = value(random);
+                if (i % 3 == 0)
+                {
+                    r = g = b = r / 20.0f;
+                }
+
+                sourcePixels[i] = DirectX::PackedVector::XMHALF4(r, g, b, 1.0f);
+            }
+
+            auto fp16 = D2D1::PixelFormat(DXGI_FORMAT_R16G16B16A16_FLOAT, D2D1_ALPHA_MODE_PREMULTIPLIED);
+            auto targetProps = D2D1::BitmapProperties1(D2D1_BITMAP_OPTIONS_TARGET, fp16);
+            auto readbackProps = D2D1::BitmapProperties1(D2D1_BITMAP_OPTIONS_CPU_READ | D2D1_BITMAP_OPTIONS_CANNOT_DRAW, fp16);
+
+            ComPtr<ID2D1Bitmap1> bitmap;
+            ComPtr<ID2D1Bitmap1> frameTarget;
+            ComPtr<ID2D1Bitmap1> frameReadback;
+            ComPtr<ID2D1Bitmap1> stripTarget;
+            ComPtr<ID2D1Bitmap1> stripReadback;
+            TESTHR(context->CreateBitmap(D2D1::SizeU(width, height), source.data(), stride, D2D1::BitmapProperties1(D2D1_BITMAP_OPTIONS_NONE, fp16), &bitmap));
+            TESTHR(context->CreateBitmap(D2D1::SizeU(frameWidth, frameHeight), nullptr, 0, &targetProps, &frameTarget));
+            TESTHR(context->CreateBitmap(D2D1::SizeU(1, 1), nullptr, 0, &readbackProps, &frameReadback));
+            TESTHR(context->CreateBitmap(D2D1::SizeU(width, stripRows), nullptr, 0, &targetProps, &stripTarget));
+            TESTHR(context->CreateBitmap(D2D1::SizeU(width, stripRows), nullptr, 0, &readbackProps, &stripReadback));
+
+            RenderPipelineConstants constants = { 2.5f, 1000.0f, 270.0f, D2D1_SCENE_REFERRED_SDR_WHITE_LEVEL / 270.0f };
+
+            auto createScale = [&](float scale)
+            {
+                ComPtr<ID2D1Effect> effect;
+                TESTHR(context->CreateEffect(CLSID_D2D1ColorMatrix, &effect));
+                TESTHR(effect->SetValue(D2D1_COLORMATRIX_PROP_COLOR_MATRIX, D2D1::Matrix5x4F(
+                    scale, 0, 0, 0,
+                    0, scale, 0, 0,
+                    0, 0, scale, 0,
+                    0, 0, 0, 1,
+                    0, 0, 0, 0)));
+                return effect;
+            };
+
+            auto createEffect = [&](REFCLSID clsid)
+            {
+                ComPtr<ID2D1Effect> effect;
+                TESTHR(context->CreateEffect(clsid, &effect));
+                return effect;
+            };
+
+            // Average time to draw the top left of the image to a frame sized target; reading back a
+            // pixel waits for the GPU.
+            auto timeFrames = [&](ID2D1Effect* effect)
+            {
+                context->SetTarget(frameTarget.Get());
+
+                auto begin = std::chrono::steady_clock::now();
+                for (UINT i = 0; i < frameCount; i++)
+                {
+                    context->BeginDraw();
+                    context->DrawImage(effect, D2D1_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+                    TESTHR(context->EndDraw());
+                }
+
+                D2D1_RECT_U pixel = { 0, 0, 1, 1 };
+                TESTHR(frameReadback->CopyFromBitmap(nullptr, frameTarget.Get(), &pixel));
+
+                D2D1_MAPPED_RECT mapped = {};
+                TESTHR(frameReadback->Map(D2D1_MAP_OPTIONS_READ, &mapped));
+                TESTHR(frameReadback->Unmap());
+
+                context->SetTarget(nullptr);
+
+                return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / frameCount;
+            };
+
+            // Renders the whole image in strips and reads it back, as ImageExporter does.
+            auto timeExport = [&](ID2D1Effect* effect, std::vector<uint8_t>& output)
+            {
+                output.resize(source.size());
+                context->SetTarget(stripTarget.Get());
+
+                auto begin = std::chrono::steady_clock::now();
+                for (UINT y = 0; y < height; y += stripRows)
+                {
+                    UINT rows = min(stripRows, height - y);
+
+                    context->BeginDraw();
+                    context->Clear(D2D1::ColorF(0, 0, 0, 0));
+                    context->SetTransform(D2D1::Matrix3x2F::Translation(0.0f, -static_cast<float>(y)));
+                    context->DrawImage(effect, D2D1_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+                    context->SetTransform(D2D1::Matrix3x2F::Identity());
+                    TESTHR(context->EndDraw());
+
+                    D2D1_POINT_2U origin = { 0, 0 };
+                    D2D1_RECT_U strip = { 0, 0, width, rows };
+                    TESTHR(stripReadback->CopyFromBitmap(&origin, stripTarget.Get(), &strip));
+
+                    D2D1_MAPPED_RECT mapped = {};
+                    TESTHR(stripReadback->Map(D2D1_MAP_OPTIONS_READ, &mapped));
+                    for (UINT row = 0; row < rows; row++)
+                    {
+                        memcpy(output.data() + static_cast<size_t>(y + row) * stride, mapped.bits + static_cast<size_t>(row) * mapped.pitch, stride);
+                    }
+                    TESTHR(stripReadback->Unmap());
+                }
+
+                context->SetTarget(nullptr);
+
+                return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            };
+
+            auto maxDifference = [&](const std::vector<uint8_t>& actual, const std::vector<uint8_t>& expected)
+            {
+                auto a = reinterpret_cast<const DirectX::PackedVector::HALF*>(actual.data());
+                auto e = reinterpret_cast<const DirectX::PackedVector::HALF*>(expected.data());
+
+                float maxError = 0.0f;
+                for (size_t i = 0; i < actual.size() / sizeof(DirectX::PackedVector::HALF); i++)
+                {
+                    float af = DirectX::PackedVector::XMConvertHalfToFloat(a[i]);
+                    float ef = DirectX::PackedVector::XMConvertHalfToFloat(e[i]);
+                    maxError = max(maxError, fabsf(af - ef) / max(1.0f, fabsf(ef)));
+                }
+
+                return maxError;
+            };
+
+            struct Case
+            {
+                const wchar_t*      name;
+                RenderEffectKind    kind;
+                bool                isHdrDisplay;
+                FUSEDRENDER_KIND    fusedKind;
+            };
+
+            const Case cases[] =
+            {
+                { L"None",                      RenderEffectKind::None,             true,  FUSEDRENDER_KIND_NONE },
+                { L"HdrTonemap, HDR display",   RenderEffectKind::HdrTonemap,       true,  FUSEDRENDER_KIND_HDR_TONEMAP },
+                { L"HdrTonemap, SDR display",   RenderEffectKind::HdrTonemap,       false, FUSEDRENDER_KIND_HDR_TONEMAP },
+                { L"SdrOverlay",                RenderEffectKind::SdrOverlay,       true,  FUSEDRENDER_KIND_SDR_OVERLAY },
+                { L"LuminanceHeatmap",          RenderEffectKind::LuminanceHeatmap, true,  FUSEDRENDER_KIND_LUMINANCE_HEATMAP },
+            };
+
+            std::wstringstream log;
+            log << L"Per frame (" << frameWidth << L"x" << frameHeight << L") and per export (" << width << L"x" << height
+                << L") milliseconds, chained / fused, and largest difference of fused from chained:\n";
+
+            for (const auto& c : cases)
+            {
+                // The graphs HDRImageViewerRenderer::SetRenderOptions builds for the kind.
+                std::vector<ComPtr<ID2D1Effect>> chain;
+                switch (c.kind)
+                {
+                case RenderEffectKind::None:
+                    chain.push_back(createScale(constants.whiteScale));
+                    break;
+
+                case RenderEffectKind::HdrTonemap:
+                {
+                    chain.push_back(createScale(constants.whiteScale));
+
+                    auto tonemap = createEffect(CLSID_CustomSimpleTonemapEffect);
+                    TESTHR(tonemap->SetValue(D2D1_HDRTONEMAP_PROP_INPUT_MAX_LUMINANCE, constants.tonemapInputMax));
+                    TESTHR(tonemap->SetValue(D2D1_HDRTONEMAP_PROP_OUTPUT_MAX_LUMINANCE, constants.tonemapOutputMax));
+                    chain.push_back(tonemap);
+
+                    if (!c.isHdrDisplay)
+                    {
+                        chain.push_back(createScale(constants.outputScale));
+                    }
+                    break;
+                }
+
+                case RenderEffectKind::SdrOverlay:
+                    chain.push_back(createEffect(CLSID_CustomSdrOverlayEffect));
+                    chain.push_back(createScale(constants.whiteScale));
+                    break;
+
+                case RenderEffectKind::LuminanceHeatmap:
+                    chain.push_back(createEffect(CLSID_CustomLuminanceHeatmapEffect));
+                    chain.push_back(createScale(constants.whiteScale));
+                    break;
+                }
+
+                chain.front()->SetInput(0, bitmap.Get());
+                for (size_t i = 1; i < chain.size(); i++)
+                {
+                    chain[i]->SetInputEffect(0, chain[i - 1].Get());
+                }
+
+                auto fused = createEffect(CLSID_CustomFusedRenderEffect);
+                fused->SetInput(0, bitmap.Get());
+                TESTHR(fused->SetValue(FUSEDRENDER_PROP_KIND, c.fusedKind));
+                TESTHR(fused->SetValue(
+                    FUSEDRENDER_PROP_DISPLAY_MODE,
+                    c.isHdrDisplay ? D2D1_HDRTONEMAP_DISPLAY_MODE_HDR : D2D1_HDRTONEMAP_DISPLAY_MODE_SDR));
+                TESTHR(fused->SetValue(FUSEDRENDER_PROP_WHITE_SCALE, constants.whiteScale));
+                TESTHR(fused->SetValue(FUSEDRENDER_PROP_TONEMAP_INPUT_MAX_LUMINANCE, constants.tonemapInputMax));
+                TESTHR(fused->SetValue(FUSEDRENDER_PROP_TONEMAP_OUTPUT_MAX_LUMINANCE, constants.tonemapOutputMax));
+                TESTHR(fused->SetValue(FUSEDRENDER_PROP_OUTPUT_SCALE, constants.outputScale));
+
+                // The first draw of each graph compiles its shaders, so warm both up before timing.
+                timeFrames(chain.back().Get());
+                timeFrames(fused.Get());
+
+                double chainedFrameMs = timeFrames(chain.back().Get());
+                double fusedFrameMs = timeFrames(fused.Get());
+
+                std::vector<uint8_t> gpuChained;
+                std::vector<uint8_t> gpuFused;
+                double chainedExportMs = timeExport(chain.back().Get(), gpuChained);
+                double fusedExportMs = timeExport(fused.Get(), gpuFused);
+
+                std::vector<uint8_t> cpuChained(source.size());
+                std::vector<uint8_t> cpuFused(source.size());
+
+                auto begin = std::chrono::steady_clock::now();
+                TESTHR(RenderPipeline::ProcessChained(c.kind, c.isHdrDisplay, constants, source.data(), stride, cpuChained.data(), stride, width, height));
+                double cpuChainedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+                begin = std::chrono::steady_clock::now();
+                TESTHR(RenderPipeline::Process(c.kind, c.isHdrDisplay, constants, source.data(), stride, cpuFused.data(), stride, width, height));
+                double cpuFusedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+                float gpuError = maxDifference(gpuFused, gpuChained);
+                float cpuError = maxDifference(cpuFused, cpuChained);
+                float cpuGpuError = maxDifference(cpuFused, gpuFused);
+
+                log << c.name
+                    << L": GPU frame " << chainedFrameMs << L" / " << fusedFrameMs
+                    << L", GPU export " << chainedExportMs << L" / " << fusedExportMs
+                    << L", CPU export " << cpuChainedMs << L" / " << cpuFusedMs
+                    << L"; difference GPU " << gpuError << L", CPU " << cpuError << L", CPU from GPU " << cpuGpuError << L"\n";
+
+                // FP16 intermediates round each stage's output by up to half an ULP, 2^-11 relative.
+                if (gpuError > 2.0f / 1024 || cpuError > 2.0f / 1024 || cpuGpuError > 2.0f / 1024)
+                {
+                    Logger::WriteMessage(log.str().c_str());
+                    Assert::Fail(c.name);
+                }
+            }
+
+            Logger::WriteMessage(log.str().c_str());
+        }
     };
 }
\ No newline at end of file
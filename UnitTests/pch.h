@@ -12,6 +12,7 @@
 #include <dxgi1_6.h>
 #include <d3d11_3.h>
 #include <d2d1_3.h>
+#include <d2d1effectauthor_1.h>
 #include <dwrite_3.h>
 #include <wincodec.h>
 #include <DirectXMath.h>